@@ -0,0 +1,2607 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/*
+ * OpenGL compositing backend
+ *
+ * Window contents are bound as textures with GLX_EXT_texture_from_pixmap
+ * and drawn with fixed function GL, so this works on any GL 1.x driver
+ * that can texture from pixmaps, including Mesa's software rasterizers
+ * (LIBGL_ALWAYS_SOFTWARE=1).  Window tracking follows compositor-xrender.c.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#if defined(HAVE_COMPOSITE_EXTENSIONS) && defined(HAVE_GL_COMPOSITOR)
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gdk/gdk.h>
+#include <cairo/cairo-xlib.h>
+
+#include "display.h"
+#include "screen.h"
+#include "frame.h"
+#include "errors.h"
+#include "window.h"
+#include "compositor-private.h"
+#include "compositor-gl.h"
+#include "xprops.h"
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/shape.h>
+#include <X11/extensions/Xcomposite.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/xfixes.h>
+#include <GL/gl.h>
+#include <GL/glx.h>
+
+#include "deepin-message-hub.h"
+#include "frame-clock.h"
+#include "frame-stats.h"
+
+typedef enum _MetaCompWindowType
+{
+  META_COMP_WINDOW_NORMAL,
+  META_COMP_WINDOW_DND,
+  META_COMP_WINDOW_DESKTOP,
+  META_COMP_WINDOW_DOCK,
+  META_COMP_WINDOW_MENU,
+  META_COMP_WINDOW_DROP_DOWN_MENU,
+  META_COMP_WINDOW_TOOLTIP,
+} MetaCompWindowType;
+
+typedef enum _MetaShadowType
+{
+  META_SHADOW_SMALL,
+  META_SHADOW_MEDIUM,
+  META_SHADOW_LARGE,
+  LAST_SHADOW_TYPE
+} MetaShadowType;
+
+/* How pixmaps of a given depth are turned into textures */
+typedef struct _MetaGLFBConfig
+{
+  GLXFBConfig fbconfig;
+  int texture_format;        /* GLX_TEXTURE_FORMAT_*_EXT, 0 if unusable */
+  gboolean y_inverted;
+  gboolean initialized;
+} MetaGLFBConfig;
+
+typedef struct _MetaCompositorGL
+{
+  MetaCompositor compositor;
+
+  MetaDisplay *display;
+
+  Atom atom_x_root_pixmap;
+  Atom atom_x_set_root;
+  Atom atom_net_wm_window_opacity;
+  Atom atom_net_wm_window_type_dnd;
+
+  Atom atom_net_wm_window_type;
+  Atom atom_net_wm_window_type_desktop;
+  Atom atom_net_wm_window_type_dock;
+  Atom atom_net_wm_window_type_menu;
+  Atom atom_net_wm_window_type_dialog;
+  Atom atom_net_wm_window_type_normal;
+  Atom atom_net_wm_window_type_utility;
+  Atom atom_net_wm_window_type_splash;
+  Atom atom_net_wm_window_type_toolbar;
+  Atom atom_net_wm_window_type_dropdown_menu;
+  Atom atom_net_wm_window_type_tooltip;
+
+  PFNGLXBINDTEXIMAGEEXTPROC bind_tex_image;
+  PFNGLXRELEASETEXIMAGEEXTPROC release_tex_image;
+  PFNGLXSWAPINTERVALMESAPROC swap_interval_mesa;
+  PFNGLXSWAPINTERVALEXTPROC swap_interval_ext;
+  PFNGLXCOPYSUBBUFFERMESAPROC copy_sub_buffer;
+
+  /* Indexed by pixmap depth */
+  MetaGLFBConfig fbconfigs[33];
+
+  MetaFrameClock *frame_clock;
+  guint fixed_rate : 1;
+
+  MetaFrameStats *frame_stats;
+  MetaFrameRecord *frame_record; /* only set while painting a frame */
+
+  guint debug_id;
+  guint show_redraw : 1;
+  guint debug : 1;
+} MetaCompositorGL;
+
+/* A pixmap bound to a texture */
+typedef struct _MetaGLPixmap
+{
+  GLXPixmap glx_pixmap;
+  GLuint texture;
+  int width;
+  int height;
+  gboolean y_inverted;
+} MetaGLPixmap;
+
+/* A shadow is drawn as nine slices of a (2 * size + 1) square alpha
+ * texture: the corners map 1:1 and the middle row and column are
+ * stretched along the edges.
+ */
+typedef struct _MetaGLShadow
+{
+  GLuint texture;
+  int size;
+} MetaGLShadow;
+
+typedef struct _MetaGLScreen
+{
+  MetaScreen *screen;
+  GList *windows;
+  GHashTable *windows_by_xid;
+
+  MetaWindow *focus_window;
+
+  Window output;
+  GLXContext context;
+
+  gboolean have_shadows;
+  MetaGLShadow shadows[LAST_SHADOW_TYPE];
+
+  MetaGLPixmap root_tile;
+  gboolean root_tile_valid;
+
+  gboolean damaged;             /* a frame is needed */
+  gboolean damaged_all;         /* ... and everything must be repainted */
+  cairo_region_t *damage;       /* what must be, when not everything */
+
+  GSList *damaged_windows;      /* their damage is taken once per frame */
+
+  GSList *dock_windows;
+} MetaGLScreen;
+
+typedef struct _MetaGLWindow
+{
+  MetaScreen *screen;
+  MetaWindow *window; /* May be NULL if this window isn't managed by Metacity */
+  Window id;
+  XWindowAttributes attrs;
+
+  Pixmap back_pixmap;
+
+  /* Copy of the unshaded pixmap while the window is shaded, see
+     compositor-xrender.c */
+  Pixmap shaded_back_pixmap;
+
+  MetaGLPixmap texture;
+  gboolean texture_stale; /* contents changed since the last bind */
+
+  gboolean argb;
+  gboolean damaged;
+  gboolean repair_queued;
+  gboolean shaped;
+
+  /* Bounding shape relative to the window, only set while shaped */
+  XRectangle *shape_rects;
+  int n_shape_rects;
+
+  MetaCompWindowType type;
+
+  Damage damage;
+
+  gboolean needs_shadow;
+  MetaShadowType shadow_type;
+
+  /* Shadow rectangle and the visible frame it surrounds, in root
+     coordinates */
+  gboolean shadow_valid;
+  XRectangle shadow_rect;
+  XRectangle visible_rect;
+
+  guint opacity;
+} MetaGLWindow;
+
+#define OPAQUE 0xffffffff
+
+#define SHADOW_SMALL_RADIUS 3.0
+#define SHADOW_MEDIUM_RADIUS 6.0
+#define SHADOW_LARGE_RADIUS 12.0
+
+#define SHADOW_SMALL_OFFSET_X (SHADOW_SMALL_RADIUS * -3 / 2)
+#define SHADOW_SMALL_OFFSET_Y (SHADOW_SMALL_RADIUS * -3 / 2)
+#define SHADOW_MEDIUM_OFFSET_X (SHADOW_MEDIUM_RADIUS * -3 / 2)
+#define SHADOW_MEDIUM_OFFSET_Y (SHADOW_MEDIUM_RADIUS * -5 / 4)
+#define SHADOW_LARGE_OFFSET_X -15
+#define SHADOW_LARGE_OFFSET_Y -15
+
+#define SHADOW_OPACITY 0.66
+
+#define DISPLAY_COMPOSITOR(display) ((MetaCompositorGL *) meta_display_get_compositor (display))
+
+static const double shadow_radii[LAST_SHADOW_TYPE] = {SHADOW_SMALL_RADIUS,
+                                                      SHADOW_MEDIUM_RADIUS,
+                                                      SHADOW_LARGE_RADIUS};
+static const int shadow_offsets_x[LAST_SHADOW_TYPE] = {SHADOW_SMALL_OFFSET_X,
+                                                       SHADOW_MEDIUM_OFFSET_X,
+                                                       SHADOW_LARGE_OFFSET_X};
+static const int shadow_offsets_y[LAST_SHADOW_TYPE] = {SHADOW_SMALL_OFFSET_Y,
+                                                       SHADOW_MEDIUM_OFFSET_Y,
+                                                       SHADOW_LARGE_OFFSET_Y};
+
+static gboolean
+has_extension (const char *extensions,
+               const char *name)
+{
+  size_t len = strlen (name);
+  const char *p = extensions;
+
+  while (p != NULL && (p = strstr (p, name)) != NULL)
+    {
+      if ((p == extensions || p[-1] == ' ') &&
+          (p[len] == ' ' || p[len] == '\0'))
+        return TRUE;
+
+      p += len;
+    }
+
+  return FALSE;
+}
+
+/* Gaussian stuff for creating the shadows, as in compositor-xrender.c */
+static double *
+make_gaussian_map (double r,
+                   int   *size_ret)
+{
+  double *map;
+  int size, centre;
+  int x, y;
+  double t;
+
+  size = ((int) ceil ((r * 3)) + 1) & ~1;
+  centre = size / 2;
+  map = g_new (double, size * size);
+  t = 0.0;
+
+  for (y = 0; y < size; y++)
+    {
+      for (x = 0; x < size; x++)
+        {
+          double g;
+
+          g = (1 / (sqrt (2 * G_PI * r))) *
+              exp ((- ((x - centre) * (x - centre) + (y - centre) * (y - centre))) /
+                   (2 * r * r));
+          t += g;
+          map[y * size + x] = g;
+        }
+    }
+
+  for (x = 0; x < size * size; x++)
+    map[x] /= t;
+
+  *size_ret = size;
+
+  return map;
+}
+
+/* Coverage of a 2 * size square window by the gaussian centred on x, y */
+static guchar
+sum_gaussian (const double *map,
+              int           size,
+              int           x,
+              int           y)
+{
+  int centre = size / 2;
+  int fx, fy;
+  int fx_start, fx_end;
+  int fy_start, fy_end;
+  double v = 0.0;
+
+  fx_start = MAX (centre - x, 0);
+  fx_end = MIN (size * 2 + centre - x, size);
+  fy_start = MAX (centre - y, 0);
+  fy_end = MIN (size * 2 + centre - y, size);
+
+  for (fy = fy_start; fy < fy_end; fy++)
+    for (fx = fx_start; fx < fx_end; fx++)
+      v += map[fy * size + fx];
+
+  if (v > 1.0)
+    v = 1.0;
+
+  return (guchar) (v * 255.0);
+}
+
+static void
+generate_shadows (MetaGLScreen *info)
+{
+  int i;
+
+  for (i = 0; i < LAST_SHADOW_TYPE; i++)
+    {
+      MetaGLShadow *shadow = &info->shadows[i];
+      double *map;
+      guchar *quadrant, *data;
+      int size, n, x, y;
+
+      map = make_gaussian_map (shadow_radii[i], &size);
+      n = size * 2 + 1;
+
+      /* The shadow is symmetric, so only one quadrant is computed */
+      quadrant = g_malloc ((size + 1) * (size + 1));
+      for (y = 0; y <= size; y++)
+        for (x = 0; x <= size; x++)
+          quadrant[y * (size + 1) + x] =
+            sum_gaussian (map, size, x - size / 2, y - size / 2);
+
+      data = g_malloc (n * n);
+      for (y = 0; y < n; y++)
+        for (x = 0; x < n; x++)
+          data[y * n + x] = quadrant[MIN (y, n - 1 - y) * (size + 1) +
+                                     MIN (x, n - 1 - x)];
+
+      glGenTextures (1, &shadow->texture);
+      glBindTexture (GL_TEXTURE_2D, shadow->texture);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+      glTexImage2D (GL_TEXTURE_2D, 0, GL_ALPHA, n, n, 0,
+                    GL_ALPHA, GL_UNSIGNED_BYTE, data);
+
+      shadow->size = size;
+
+      g_free (data);
+      g_free (quadrant);
+      g_free (map);
+    }
+}
+
+static void
+make_current (MetaGLScreen *info)
+{
+  MetaDisplay *display = meta_screen_get_display (info->screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+  if (glXGetCurrentContext () != info->context)
+    glXMakeCurrent (xdisplay, info->output, info->context);
+}
+
+static MetaGLFBConfig *
+get_fbconfig (MetaCompositorGL *compositor,
+              int               screen_number,
+              int               depth)
+{
+  Display *xdisplay = meta_display_get_xdisplay (compositor->display);
+  MetaGLFBConfig *config;
+  GLXFBConfig *fbconfigs;
+  int n_fbconfigs, i;
+
+  if (depth <= 0 || depth > 32)
+    return NULL;
+
+  config = &compositor->fbconfigs[depth];
+  if (config->initialized)
+    return config->texture_format != 0 ? config : NULL;
+
+  config->initialized = TRUE;
+  config->texture_format = 0;
+
+  fbconfigs = glXGetFBConfigs (xdisplay, screen_number, &n_fbconfigs);
+
+  for (i = 0; i < n_fbconfigs; i++)
+    {
+      XVisualInfo *visual_info;
+      int visual_depth, value;
+
+      visual_info = glXGetVisualFromFBConfig (xdisplay, fbconfigs[i]);
+      if (visual_info == NULL)
+        continue;
+
+      visual_depth = visual_info->depth;
+      XFree (visual_info);
+
+      if (visual_depth != depth)
+        continue;
+
+      glXGetFBConfigAttrib (xdisplay, fbconfigs[i], GLX_DRAWABLE_TYPE, &value);
+      if (!(value & GLX_PIXMAP_BIT))
+        continue;
+
+      glXGetFBConfigAttrib (xdisplay, fbconfigs[i],
+                            GLX_BIND_TO_TEXTURE_TARGETS_EXT, &value);
+      if (!(value & GLX_TEXTURE_2D_BIT_EXT))
+        continue;
+
+      if (depth == 32)
+        {
+          glXGetFBConfigAttrib (xdisplay, fbconfigs[i],
+                                GLX_BIND_TO_TEXTURE_RGBA_EXT, &value);
+          if (!value)
+            continue;
+
+          config->texture_format = GLX_TEXTURE_FORMAT_RGBA_EXT;
+        }
+      else
+        {
+          glXGetFBConfigAttrib (xdisplay, fbconfigs[i],
+                                GLX_BIND_TO_TEXTURE_RGB_EXT, &value);
+          if (!value)
+            continue;
+
+          config->texture_format = GLX_TEXTURE_FORMAT_RGB_EXT;
+        }
+
+      value = FALSE;
+      glXGetFBConfigAttrib (xdisplay, fbconfigs[i], GLX_Y_INVERTED_EXT, &value);
+      config->y_inverted = (value == True);
+      config->fbconfig = fbconfigs[i];
+      break;
+    }
+
+  if (fbconfigs)
+    XFree (fbconfigs);
+
+  if (config->texture_format == 0)
+    {
+      meta_verbose ("No GLX FBConfig can texture from depth %d pixmaps\n", depth);
+      return NULL;
+    }
+
+  return config;
+}
+
+/* Must be called with the context of the screen current */
+static gboolean
+gl_pixmap_bind (MetaCompositorGL *compositor,
+                MetaScreen       *screen,
+                MetaGLPixmap     *glp,
+                Pixmap            pixmap,
+                int               depth,
+                int               width,
+                int               height)
+{
+  MetaDisplay *display = compositor->display;
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaGLFBConfig *config;
+  int attribs[] = {
+    GLX_TEXTURE_TARGET_EXT, GLX_TEXTURE_2D_EXT,
+    GLX_TEXTURE_FORMAT_EXT, 0,
+    None
+  };
+
+  config = get_fbconfig (compositor, meta_screen_get_screen_number (screen),
+                         depth);
+  if (config == NULL)
+    return FALSE;
+
+  attribs[3] = config->texture_format;
+
+  meta_error_trap_push (display);
+  glp->glx_pixmap = glXCreatePixmap (xdisplay, config->fbconfig, pixmap,
+                                     attribs);
+  if (meta_error_trap_pop_with_return (display, FALSE) != 0)
+    glp->glx_pixmap = None;
+
+  if (glp->glx_pixmap == None)
+    return FALSE;
+
+  glGenTextures (1, &glp->texture);
+  glBindTexture (GL_TEXTURE_2D, glp->texture);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  meta_error_trap_push (display);
+  compositor->bind_tex_image (xdisplay, glp->glx_pixmap,
+                              GLX_FRONT_LEFT_EXT, NULL);
+  meta_error_trap_pop (display, FALSE);
+
+  glp->width = width;
+  glp->height = height;
+  glp->y_inverted = config->y_inverted;
+
+  return TRUE;
+}
+
+/* Picks up new contents of the pixmap; without this the texture
+   contents are undefined after the pixmap was drawn to */
+static void
+gl_pixmap_rebind (MetaCompositorGL *compositor,
+                  MetaGLPixmap     *glp)
+{
+  MetaDisplay *display = compositor->display;
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+  glBindTexture (GL_TEXTURE_2D, glp->texture);
+
+  meta_error_trap_push (display);
+  compositor->release_tex_image (xdisplay, glp->glx_pixmap, GLX_FRONT_LEFT_EXT);
+  compositor->bind_tex_image (xdisplay, glp->glx_pixmap,
+                              GLX_FRONT_LEFT_EXT, NULL);
+  meta_error_trap_pop (display, FALSE);
+}
+
+static void
+gl_pixmap_unbind (MetaCompositorGL *compositor,
+                  MetaGLScreen     *info,
+                  MetaGLPixmap     *glp)
+{
+  MetaDisplay *display = compositor->display;
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+  if (glp->glx_pixmap == None)
+    return;
+
+  make_current (info);
+
+  meta_error_trap_push (display);
+  glBindTexture (GL_TEXTURE_2D, glp->texture);
+  compositor->release_tex_image (xdisplay, glp->glx_pixmap, GLX_FRONT_LEFT_EXT);
+  glXDestroyPixmap (xdisplay, glp->glx_pixmap);
+  meta_error_trap_pop (display, FALSE);
+
+  glDeleteTextures (1, &glp->texture);
+
+  glp->glx_pixmap = None;
+  glp->texture = 0;
+}
+
+/* Emits a quad inside glBegin (GL_QUADS) showing the part of @glp at
+   src_x, src_y on screen at dst_x, dst_y */
+static void
+emit_pixmap_quad (MetaGLPixmap *glp,
+                  int           src_x,
+                  int           src_y,
+                  int           dst_x,
+                  int           dst_y,
+                  int           width,
+                  int           height)
+{
+  GLfloat s0, s1, t0, t1;
+
+  s0 = (GLfloat) src_x / glp->width;
+  s1 = (GLfloat) (src_x + width) / glp->width;
+  t0 = (GLfloat) src_y / glp->height;
+  t1 = (GLfloat) (src_y + height) / glp->height;
+
+  if (!glp->y_inverted)
+    {
+      t0 = 1.0 - t0;
+      t1 = 1.0 - t1;
+    }
+
+  glTexCoord2f (s0, t0);
+  glVertex2i (dst_x, dst_y);
+  glTexCoord2f (s1, t0);
+  glVertex2i (dst_x + width, dst_y);
+  glTexCoord2f (s1, t1);
+  glVertex2i (dst_x + width, dst_y + height);
+  glTexCoord2f (s0, t1);
+  glVertex2i (dst_x, dst_y + height);
+}
+
+static MetaGLWindow *
+find_window_for_screen (MetaScreen *screen,
+                        Window      xwindow)
+{
+  MetaGLScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (info == NULL)
+    return NULL;
+
+  return g_hash_table_lookup (info->windows_by_xid, (gpointer) xwindow);
+}
+
+static MetaGLWindow *
+find_window_in_display (MetaDisplay *display,
+                        Window       xwindow)
+{
+  GSList *index;
+
+  for (index = meta_display_get_screens (display); index; index = index->next)
+    {
+      MetaGLWindow *cw = find_window_for_screen (index->data, xwindow);
+
+      if (cw != NULL)
+        return cw;
+    }
+
+  return NULL;
+}
+
+static MetaGLWindow *
+find_window_for_child_window_in_display (MetaDisplay *display,
+                                         Window       xwindow)
+{
+  Window ignored1, *ignored2;
+  Window parent;
+  guint ignored_children;
+
+  XQueryTree (meta_display_get_xdisplay (display), xwindow, &ignored1,
+              &parent, &ignored2, &ignored_children);
+
+  if (parent != None)
+    return find_window_in_display (display, parent);
+
+  return NULL;
+}
+
+static MetaGLWindow *
+find_window_for_meta_window (MetaScreen *screen,
+                             MetaWindow *window)
+{
+  MetaFrame *frame = meta_window_get_frame (window);
+
+  return find_window_for_screen (screen,
+                                 frame ? meta_frame_get_xwindow (frame) :
+                                 meta_window_get_xwindow (window));
+}
+
+static void
+damage_screen (MetaScreen *screen)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaGLScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (info == NULL)
+    return;
+
+  info->damaged = TRUE;
+  info->damaged_all = TRUE;
+  meta_frame_clock_schedule_frame (DISPLAY_COMPOSITOR (display)->frame_clock);
+}
+
+/* Only rect needs repainting, if it is all that changed this frame */
+static void
+add_damage (MetaScreen       *screen,
+            const XRectangle *rect)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaGLScreen *info = meta_screen_get_compositor_data (screen);
+  cairo_rectangle_int_t r = { rect->x, rect->y, rect->width, rect->height };
+
+  if (info == NULL)
+    return;
+
+  cairo_region_union_rectangle (info->damage, &r);
+  info->damaged = TRUE;
+  meta_frame_clock_schedule_frame (DISPLAY_COMPOSITOR (display)->frame_clock);
+}
+
+static gboolean
+window_has_shadow (MetaGLWindow *cw)
+{
+  MetaGLScreen *info = meta_screen_get_compositor_data (cw->screen);
+
+  if (info == NULL || info->have_shadows == FALSE)
+    return FALSE;
+
+  /* Same rules as compositor-xrender.c */
+  if (cw->attrs.map_state != IsUnmapped && cw->window)
+    {
+      if (meta_window_is_maximized (cw->window))
+        return FALSE;
+
+      if (meta_window_get_frame (cw->window))
+        return TRUE;
+    }
+
+  if (cw->argb)
+    return FALSE;
+
+  if (cw->shaped)
+    return FALSE;
+
+  if (cw->type == META_COMP_WINDOW_DND ||
+      cw->type == META_COMP_WINDOW_DESKTOP)
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+determine_mode (MetaGLWindow *cw)
+{
+  cw->argb = (cw->attrs.class != InputOnly && cw->attrs.depth == 32) ||
+             cw->opacity != (guint) OPAQUE;
+}
+
+static void
+update_shadow_geometry (MetaGLWindow *cw)
+{
+  MetaGLScreen *info = meta_screen_get_compositor_data (cw->screen);
+  MetaFrameBorders borders;
+  int size = info->shadows[cw->shadow_type].size;
+
+  meta_frame_borders_clear (&borders);
+
+  if (cw->attrs.map_state != IsUnmapped && cw->window)
+    {
+      MetaFrame *frame = meta_window_get_frame (cw->window);
+
+      if (frame)
+        meta_frame_calc_borders (frame, &borders);
+    }
+
+  cw->visible_rect.x = cw->attrs.x + borders.invisible.left;
+  cw->visible_rect.y = cw->attrs.y + borders.invisible.top;
+  cw->visible_rect.width = cw->attrs.width + cw->attrs.border_width * 2 -
+                           borders.invisible.left - borders.invisible.right;
+  cw->visible_rect.height = cw->attrs.height + cw->attrs.border_width * 2 -
+                            borders.invisible.top - borders.invisible.bottom;
+
+  cw->shadow_rect.x = cw->attrs.x + shadow_offsets_x[cw->shadow_type] +
+                      borders.invisible.left;
+  cw->shadow_rect.y = cw->attrs.y + shadow_offsets_y[cw->shadow_type] +
+                      borders.invisible.top;
+  cw->shadow_rect.width = cw->visible_rect.width + size;
+  cw->shadow_rect.height = cw->visible_rect.height + size;
+
+  cw->shadow_valid = TRUE;
+}
+
+/* Maps an offset into the shadow rectangle to a texel position */
+static GLfloat
+shadow_texel (int pos,
+              int length,
+              int size)
+{
+  int corner = MIN (size, length / 2);
+
+  if (pos <= corner)
+    return pos * (GLfloat) size / MAX (corner, 1);
+
+  if (pos >= length - corner)
+    return 2 * size + 1 - (length - pos) * (GLfloat) size / MAX (corner, 1);
+
+  return size + 0.5;
+}
+
+static int
+compare_int (gconstpointer a,
+             gconstpointer b)
+{
+  return *(const int *) a - *(const int *) b;
+}
+
+/* Collects the sorted slice boundaries of the shadow along one axis */
+static int
+shadow_breaks (int  start,
+               int  length,
+               int  size,
+               int  visible_start,
+               int  visible_length,
+               int *breaks)
+{
+  int corner = MIN (size, length / 2);
+  int candidates[6];
+  int i, n = 0;
+
+  candidates[0] = start;
+  candidates[1] = start + corner;
+  candidates[2] = start + length - corner;
+  candidates[3] = start + length;
+  candidates[4] = visible_start;
+  candidates[5] = visible_start + visible_length;
+
+  qsort (candidates, 6, sizeof (int), compare_int);
+
+  for (i = 0; i < 6; i++)
+    {
+      if (candidates[i] < start || candidates[i] > start + length)
+        continue;
+
+      if (n > 0 && breaks[n - 1] == candidates[i])
+        continue;
+
+      breaks[n++] = candidates[i];
+    }
+
+  return n;
+}
+
+/* Draws the shadow around the visible part of the window but not below
+   it, so it doesn't show through translucent windows */
+static void
+paint_shadow (MetaGLScreen *info,
+              MetaGLWindow *cw)
+{
+  MetaGLShadow *shadow = &info->shadows[cw->shadow_type];
+  XRectangle *s = &cw->shadow_rect;
+  XRectangle *v = &cw->visible_rect;
+  int xs[6], ys[6];
+  int n_xs, n_ys, i, j;
+  GLfloat n, opacity;
+
+  if (!cw->shadow_valid)
+    update_shadow_geometry (cw);
+
+  opacity = SHADOW_OPACITY;
+  if (cw->opacity != (guint) OPAQUE)
+    opacity = opacity * ((double) cw->opacity) / ((double) OPAQUE);
+
+  n_xs = shadow_breaks (s->x, s->width, shadow->size, v->x, v->width, xs);
+  n_ys = shadow_breaks (s->y, s->height, shadow->size, v->y, v->height, ys);
+  n = shadow->size * 2 + 1;
+
+  glBindTexture (GL_TEXTURE_2D, shadow->texture);
+  glEnable (GL_BLEND);
+  glColor4f (0.0, 0.0, 0.0, opacity);
+
+  glBegin (GL_QUADS);
+  for (j = 0; j + 1 < n_ys; j++)
+    {
+      GLfloat t0, t1;
+
+      t0 = shadow_texel (ys[j] - s->y, s->height, shadow->size) / n;
+      t1 = shadow_texel (ys[j + 1] - s->y, s->height, shadow->size) / n;
+
+      for (i = 0; i + 1 < n_xs; i++)
+        {
+          GLfloat s0, s1;
+
+          if (xs[i] >= v->x && xs[i + 1] <= v->x + v->width &&
+              ys[j] >= v->y && ys[j + 1] <= v->y + v->height)
+            continue;
+
+          s0 = shadow_texel (xs[i] - s->x, s->width, shadow->size) / n;
+          s1 = shadow_texel (xs[i + 1] - s->x, s->width, shadow->size) / n;
+
+          glTexCoord2f (s0, t0);
+          glVertex2i (xs[i], ys[j]);
+          glTexCoord2f (s1, t0);
+          glVertex2i (xs[i + 1], ys[j]);
+          glTexCoord2f (s1, t1);
+          glVertex2i (xs[i + 1], ys[j + 1]);
+          glTexCoord2f (s0, t1);
+          glVertex2i (xs[i], ys[j + 1]);
+        }
+    }
+  glEnd ();
+}
+
+static void
+update_root_tile (MetaScreen   *screen,
+                  MetaGLScreen *info)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaCompositorGL *compositor = DISPLAY_COMPOSITOR (display);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  Window xroot = meta_screen_get_xroot (screen);
+  Atom background_atoms[2];
+  Pixmap pixmap = None;
+  int p;
+
+  gl_pixmap_unbind (compositor, info, &info->root_tile);
+  info->root_tile_valid = TRUE;
+
+  background_atoms[0] = compositor->atom_x_root_pixmap;
+  background_atoms[1] = compositor->atom_x_set_root;
+
+  for (p = 0; p < 2 && pixmap == None; p++)
+    {
+      Atom actual_type;
+      int actual_format;
+      gulong nitems, bytes_after;
+      guchar *prop;
+
+      if (XGetWindowProperty (xdisplay, xroot, background_atoms[p],
+                              0, 4, FALSE, XA_PIXMAP,
+                              &actual_type, &actual_format,
+                              &nitems, &bytes_after, &prop) != Success)
+        continue;
+
+      if (actual_type == XA_PIXMAP && actual_format == 32 && nitems == 1)
+        pixmap = *(Pixmap *) prop;
+
+      XFree (prop);
+    }
+
+  if (pixmap != None)
+    {
+      Window ignored_root;
+      int ignored_x, ignored_y;
+      guint width, height, border_width, depth;
+      Status status;
+
+      meta_error_trap_push (display);
+      status = XGetGeometry (xdisplay, pixmap, &ignored_root,
+                             &ignored_x, &ignored_y,
+                             &width, &height, &border_width, &depth);
+      meta_error_trap_pop (display, FALSE);
+
+      if (status &&
+          gl_pixmap_bind (compositor, screen, &info->root_tile, pixmap,
+                          depth, width, height))
+        {
+          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+          glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        }
+    }
+}
+
+static void
+paint_root (MetaScreen   *screen,
+            MetaGLScreen *info,
+            int           width,
+            int           height)
+{
+  MetaGLPixmap *tile = &info->root_tile;
+
+  if (!info->root_tile_valid)
+    update_root_tile (screen, info);
+
+  if (tile->glx_pixmap == None)
+    {
+      /* Background default to just plain ugly grey */
+      glClearColor (0.5, 0.5, 0.5, 1.0);
+      glClear (GL_COLOR_BUFFER_BIT);
+      return;
+    }
+
+  glDisable (GL_BLEND);
+  glColor4f (1.0, 1.0, 1.0, 1.0);
+  glBindTexture (GL_TEXTURE_2D, tile->texture);
+
+  glBegin (GL_QUADS);
+  emit_pixmap_quad (tile, 0, 0, 0, 0, width, height);
+  glEnd ();
+}
+
+static void
+paint_dock_shadows (MetaGLScreen *info)
+{
+  GSList *d;
+
+  for (d = info->dock_windows; d; d = d->next)
+    {
+      MetaGLWindow *cw = d->data;
+
+      if (cw->needs_shadow && cw->attrs.map_state == IsViewable)
+        paint_shadow (info, cw);
+    }
+}
+
+/* Must be called with the context of the screen current */
+static gboolean
+bind_window_texture (MetaCompositorGL *compositor,
+                     MetaGLWindow     *cw)
+{
+  MetaDisplay *display = compositor->display;
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+  if (cw->back_pixmap == None)
+    {
+      meta_error_trap_push (display);
+      cw->back_pixmap = XCompositeNameWindowPixmap (xdisplay, cw->id);
+      if (meta_error_trap_pop_with_return (display, FALSE) != 0)
+        cw->back_pixmap = None;
+
+      if (cw->back_pixmap == None)
+        return FALSE;
+    }
+
+  if (cw->texture.glx_pixmap == None)
+    {
+      cw->texture_stale = FALSE;
+
+      return gl_pixmap_bind (compositor, cw->screen, &cw->texture,
+                             cw->back_pixmap, cw->attrs.depth,
+                             cw->attrs.width + cw->attrs.border_width * 2,
+                             cw->attrs.height + cw->attrs.border_width * 2);
+    }
+
+  if (cw->texture_stale)
+    {
+      gl_pixmap_rebind (compositor, &cw->texture);
+      cw->texture_stale = FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+paint_window (MetaCompositorGL *compositor,
+              MetaGLScreen     *info,
+              MetaGLWindow     *cw)
+{
+  GLfloat opacity;
+
+  if (!bind_window_texture (compositor, cw))
+    return;
+
+  if (cw->needs_shadow && cw->type != META_COMP_WINDOW_DOCK)
+    paint_shadow (info, cw);
+
+  opacity = (GLfloat) ((double) cw->opacity / OPAQUE);
+
+  /* Window pixmaps are premultiplied */
+  if (cw->argb)
+    glEnable (GL_BLEND);
+  else
+    glDisable (GL_BLEND);
+
+  glColor4f (opacity, opacity, opacity, opacity);
+  glBindTexture (GL_TEXTURE_2D, cw->texture.texture);
+
+  glBegin (GL_QUADS);
+  if (cw->shaped && cw->shape_rects != NULL)
+    {
+      int i;
+
+      for (i = 0; i < cw->n_shape_rects; i++)
+        {
+          XRectangle *r = &cw->shape_rects[i];
+          int bw = cw->attrs.border_width;
+
+          emit_pixmap_quad (&cw->texture, r->x + bw, r->y + bw,
+                            cw->attrs.x + r->x + bw, cw->attrs.y + r->y + bw,
+                            r->width, r->height);
+        }
+    }
+  else
+    {
+      emit_pixmap_quad (&cw->texture, 0, 0, cw->attrs.x, cw->attrs.y,
+                        cw->texture.width, cw->texture.height);
+    }
+  glEnd ();
+}
+
+/* Whether anything of cw, shadow included, is inside clip */
+static gboolean
+window_in_clip (MetaGLWindow                *cw,
+                const cairo_rectangle_int_t *clip)
+{
+  int x1 = cw->attrs.x, y1 = cw->attrs.y;
+  int x2 = x1 + cw->attrs.width + cw->attrs.border_width * 2;
+  int y2 = y1 + cw->attrs.height + cw->attrs.border_width * 2;
+
+  if (cw->needs_shadow)
+    {
+      MetaGLScreen *info = meta_screen_get_compositor_data (cw->screen);
+      int size = info->shadows[cw->shadow_type].size;
+
+      x1 += shadow_offsets_x[cw->shadow_type] - size;
+      y1 += shadow_offsets_y[cw->shadow_type] - size;
+      x2 += shadow_offsets_x[cw->shadow_type] + size;
+      y2 += shadow_offsets_y[cw->shadow_type] + size;
+    }
+
+  return x1 < clip->x + clip->width && x2 > clip->x &&
+         y1 < clip->y + clip->height && y2 > clip->y;
+}
+
+static void repair_damaged_windows (MetaScreen *screen);
+
+static void
+paint_screen (MetaScreen *screen)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaCompositorGL *compositor = DISPLAY_COMPOSITOR (display);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaGLScreen *info = meta_screen_get_compositor_data (screen);
+  gboolean docks_painted = FALSE;
+  cairo_rectangle_int_t clip;
+  gboolean partial;
+  int width, height;
+  GList *index;
+
+  meta_screen_get_size (screen, &width, &height);
+
+  clip.x = 0;
+  clip.y = 0;
+  clip.width = width;
+  clip.height = height;
+
+  /* Without a way to show just part of the back buffer everything is
+     painted and swapped */
+  partial = !info->damaged_all && compositor->copy_sub_buffer != NULL &&
+    !compositor->show_redraw;
+  if (partial)
+    {
+      cairo_region_t *damage = cairo_region_create_rectangle (&clip);
+
+      cairo_region_intersect (damage, info->damage);
+      cairo_region_get_extents (damage, &clip);
+      cairo_region_destroy (damage);
+    }
+
+  make_current (info);
+
+  glViewport (0, 0, width, height);
+  glMatrixMode (GL_PROJECTION);
+  glLoadIdentity ();
+  glOrtho (0, width, height, 0, -1, 1);
+  glMatrixMode (GL_MODELVIEW);
+  glLoadIdentity ();
+
+  glEnable (GL_TEXTURE_2D);
+  glTexEnvi (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  glBlendFunc (GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+  /* GL counts rows from the bottom */
+  if (partial)
+    {
+      glEnable (GL_SCISSOR_TEST);
+      glScissor (clip.x, height - clip.y - clip.height,
+                 clip.width, clip.height);
+    }
+
+  paint_root (screen, info, width, height);
+
+  /* Painting from bottom to top; dock shadows go right above the
+     desktop like in compositor-xrender.c */
+  for (index = g_list_last (info->windows); index; index = index->prev)
+    {
+      MetaGLWindow *cw = (MetaGLWindow *) index->data;
+
+      if (!cw->damaged || cw->attrs.map_state != IsViewable ||
+          cw->attrs.class == InputOnly)
+        continue;
+
+      if (cw->window && (cw->window->minimized || cw->window->hidden))
+        continue;
+
+      if (partial && !window_in_clip (cw, &clip))
+        continue;
+
+      if (!docks_painted && cw->type != META_COMP_WINDOW_DESKTOP)
+        {
+          paint_dock_shadows (info);
+          docks_painted = TRUE;
+        }
+
+      paint_window (compositor, info, cw);
+      if (compositor->frame_record)
+        compositor->frame_record->windows_painted++;
+    }
+
+  if (!docks_painted)
+    paint_dock_shadows (info);
+
+  if (compositor->show_redraw)
+    {
+      /* Random colour overlay */
+      glDisable (GL_TEXTURE_2D);
+      glEnable (GL_BLEND);
+      glColor4f (((double) (rand () % 100)) / 300.0,
+                 ((double) (rand () % 100)) / 300.0,
+                 ((double) (rand () % 100)) / 300.0,
+                 0.3);
+      glRecti (0, 0, width, height);
+    }
+
+  if (partial)
+    {
+      glDisable (GL_SCISSOR_TEST);
+      compositor->copy_sub_buffer (xdisplay, info->output,
+                                   clip.x, height - clip.y - clip.height,
+                                   clip.width, clip.height);
+      glFlush ();
+    }
+  else
+    glXSwapBuffers (xdisplay, info->output);
+
+  if (compositor->frame_record)
+    compositor->frame_record->damage_area += (guint64) clip.width * clip.height;
+
+  cairo_region_destroy (info->damage);
+  info->damage = cairo_region_create ();
+  info->damaged = FALSE;
+  info->damaged_all = FALSE;
+}
+
+static void
+compositor_paint_frame (gpointer data)
+{
+  MetaCompositorGL *compositor = (MetaCompositorGL *) data;
+  MetaDisplay *display = compositor->display;
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaFrameRecord *record;
+  unsigned long first_request;
+  GSList *screens;
+
+  record = meta_frame_stats_begin_frame (compositor->frame_stats);
+  compositor->frame_record = record;
+  first_request = NextRequest (xdisplay);
+
+  meta_error_trap_push (display);
+
+  for (screens = meta_display_get_screens (display); screens;
+       screens = screens->next)
+    {
+      MetaGLScreen *info = meta_screen_get_compositor_data (screens->data);
+
+      if (info == NULL)
+        continue;
+
+      repair_damaged_windows (screens->data);
+      if (info->damaged)
+        paint_screen (screens->data);
+    }
+
+  meta_error_trap_pop (display, FALSE);
+
+  record->x_requests = NextRequest (xdisplay) - first_request;
+  compositor->frame_record = NULL;
+  meta_frame_stats_end_frame (compositor->frame_stats,
+                              record->damage_area > 0);
+}
+
+/* A window's damage being taken, see compositor-xrender.c */
+typedef struct
+{
+  MetaGLWindow                    *cw;
+  XserverRegion                    parts;
+  xcb_xfixes_fetch_region_cookie_t cookie;  /* sequence 0 if not fetched */
+} WindowRepair;
+
+static void
+start_repair_win (MetaGLWindow *cw,
+                  WindowRepair *repair)
+{
+  MetaDisplay *display = meta_screen_get_display (cw->screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+  repair->cw = cw;
+  repair->parts = None;
+  repair->cookie.sequence = 0;
+
+  meta_error_trap_push (display);
+
+  /* Painting only needs the window, the parts are only worth a fetch to
+     someone keeping a copy of its contents */
+  if (cw->damaged && deepin_message_hub_wants_window_damage (cw->window))
+    {
+      repair->parts = XFixesCreateRegion (xdisplay, NULL, 0);
+      XDamageSubtract (xdisplay, cw->damage, None, repair->parts);
+      XFixesTranslateRegion (xdisplay, repair->parts,
+                             cw->attrs.x + cw->attrs.border_width,
+                             cw->attrs.y + cw->attrs.border_width);
+      repair->cookie =
+        xcb_xfixes_fetch_region (XGetXCBConnection (xdisplay), repair->parts);
+    }
+  else
+    XDamageSubtract (xdisplay, cw->damage, None, None);
+
+  meta_error_trap_pop (display, FALSE);
+}
+
+static void
+finish_repair_win (WindowRepair *repair)
+{
+  MetaGLWindow *cw = repair->cw;
+  MetaDisplay *display = meta_screen_get_display (cw->screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  xcb_xfixes_fetch_region_reply_t *reply = NULL;
+  XRectangle bounds;
+  XRectangle *rects = &bounds;
+  int nrects = 1;
+
+  bounds.x = cw->attrs.x;
+  bounds.y = cw->attrs.y;
+  bounds.width = cw->attrs.width + cw->attrs.border_width * 2;
+  bounds.height = cw->attrs.height + cw->attrs.border_width * 2;
+
+  if (repair->cookie.sequence != 0)
+    {
+      xcb_generic_error_t *error = NULL;
+
+      reply = xcb_xfixes_fetch_region_reply (XGetXCBConnection (xdisplay),
+                                             repair->cookie, &error);
+      free (error);
+    }
+
+  if (repair->parts != None)
+    {
+      meta_error_trap_push (display);
+      XFixesDestroyRegion (xdisplay, repair->parts);
+      meta_error_trap_pop (display, FALSE);
+    }
+
+  if (reply != NULL)
+    {
+      /* xcb_rectangle_t is laid out like XRectangle */
+      rects = (XRectangle *) xcb_xfixes_fetch_region_rectangles (reply);
+      nrects = xcb_xfixes_fetch_region_rectangles_length (reply);
+    }
+
+  /* The first damage shows the window, shadow and all */
+  if (!cw->damaged)
+    damage_screen (cw->screen);
+  else
+    add_damage (cw->screen, &bounds);
+
+  cw->damaged = TRUE;
+  cw->texture_stale = TRUE;
+
+  if (nrects > 0)
+    deepin_message_hub_window_damaged (cw->window, rects, nrects);
+
+  free (reply);
+}
+
+/* Damage events only queue the window, the damage is taken once per
+   frame, with all the subtracts and fetches sent before any reply is
+   waited for */
+static void
+queue_repair_win (MetaGLWindow *cw)
+{
+  MetaDisplay *display = meta_screen_get_display (cw->screen);
+  MetaGLScreen *info = meta_screen_get_compositor_data (cw->screen);
+
+  if (info == NULL || cw->repair_queued)
+    return;
+
+  cw->repair_queued = TRUE;
+  info->damaged_windows = g_slist_prepend (info->damaged_windows, cw);
+  meta_frame_clock_schedule_frame (DISPLAY_COMPOSITOR (display)->frame_clock);
+}
+
+static void
+repair_damaged_windows (MetaScreen *screen)
+{
+  MetaGLScreen *info = meta_screen_get_compositor_data (screen);
+  WindowRepair *repairs;
+  GSList *l;
+  int n_repairs, i;
+
+  if (info->damaged_windows == NULL)
+    return;
+
+  repairs = g_new (WindowRepair, g_slist_length (info->damaged_windows));
+  n_repairs = 0;
+
+  for (l = info->damaged_windows; l; l = l->next)
+    {
+      MetaGLWindow *cw = l->data;
+
+      cw->repair_queued = FALSE;
+      start_repair_win (cw, &repairs[n_repairs++]);
+    }
+
+  g_slist_free (info->damaged_windows);
+  info->damaged_windows = NULL;
+
+  for (i = 0; i < n_repairs; i++)
+    finish_repair_win (&repairs[i]);
+
+  g_free (repairs);
+}
+
+static void
+free_shape (MetaGLWindow *cw)
+{
+  if (cw->shape_rects)
+    {
+      XFree (cw->shape_rects);
+      cw->shape_rects = NULL;
+    }
+
+  cw->n_shape_rects = 0;
+}
+
+static void
+update_shape (MetaDisplay  *display,
+              MetaGLWindow *cw)
+{
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  int ordering;
+
+  free_shape (cw);
+
+  if (!cw->shaped)
+    return;
+
+  meta_error_trap_push (display);
+  cw->shape_rects = XShapeGetRectangles (xdisplay, cw->id, ShapeBounding,
+                                         &cw->n_shape_rects, &ordering);
+  meta_error_trap_pop (display, FALSE);
+
+  if (cw->shape_rects == NULL)
+    cw->n_shape_rects = 0;
+}
+
+static void
+free_win (MetaGLWindow *cw,
+          gboolean      destroy)
+{
+  MetaDisplay *display = meta_screen_get_display (cw->screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaGLScreen *info = meta_screen_get_compositor_data (cw->screen);
+
+  if (info != NULL)
+    gl_pixmap_unbind (DISPLAY_COMPOSITOR (display), info, &cw->texture);
+
+  /* See comment in map_win */
+  if (cw->back_pixmap && destroy)
+    {
+      XFreePixmap (xdisplay, cw->back_pixmap);
+      cw->back_pixmap = None;
+    }
+
+  if (cw->shaded_back_pixmap && destroy)
+    {
+      XFreePixmap (xdisplay, cw->shaded_back_pixmap);
+      cw->shaded_back_pixmap = None;
+    }
+
+  if (destroy)
+    {
+      if (cw->damage != None)
+        {
+          meta_error_trap_push (display);
+          XDamageDestroy (xdisplay, cw->damage);
+          meta_error_trap_pop (display, FALSE);
+
+          cw->damage = None;
+        }
+
+      free_shape (cw);
+
+      if (info != NULL && cw->type == META_COMP_WINDOW_DOCK)
+        info->dock_windows = g_slist_remove (info->dock_windows, cw);
+
+      if (info != NULL && cw->repair_queued)
+        info->damaged_windows = g_slist_remove (info->damaged_windows, cw);
+
+      g_free (cw);
+    }
+}
+
+static void
+map_win (MetaDisplay *display,
+         MetaScreen  *screen,
+         Window       id)
+{
+  MetaGLWindow *cw = find_window_for_screen (screen, id);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaGLScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (cw == NULL || info == NULL)
+    return;
+
+  /* The pixmaps are kept while the window is unmapped so that
+     get_window_surface still works */
+  gl_pixmap_unbind (DISPLAY_COMPOSITOR (display), info, &cw->texture);
+
+  if (cw->back_pixmap)
+    {
+      XFreePixmap (xdisplay, cw->back_pixmap);
+      cw->back_pixmap = None;
+    }
+
+  if (cw->shaded_back_pixmap)
+    {
+      XFreePixmap (xdisplay, cw->shaded_back_pixmap);
+      cw->shaded_back_pixmap = None;
+    }
+
+  cw->attrs.map_state = IsViewable;
+  cw->damaged = FALSE;
+  cw->shadow_valid = FALSE;
+}
+
+static void
+unmap_win (MetaDisplay *display,
+           MetaScreen  *screen,
+           Window       id)
+{
+  MetaGLWindow *cw = find_window_for_screen (screen, id);
+  MetaGLScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (cw == NULL || info == NULL)
+    return;
+
+  if (cw->window && cw->window == info->focus_window)
+    info->focus_window = NULL;
+
+  cw->attrs.map_state = IsUnmapped;
+  cw->damaged = FALSE;
+
+  free_win (cw, FALSE);
+  damage_screen (screen);
+}
+
+static gboolean
+is_shaped (MetaDisplay *display,
+           Window       xwindow)
+{
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  int xws, yws, xbs, ybs;
+  unsigned wws, hws, wbs, hbs;
+  int bounding_shaped, clip_shaped;
+
+  if (meta_display_has_shape (display))
+    {
+      XShapeQueryExtents (xdisplay, xwindow, &bounding_shaped,
+                          &xws, &yws, &wws, &hws, &clip_shaped,
+                          &xbs, &ybs, &wbs, &hbs);
+      return (bounding_shaped != 0);
+    }
+
+  return FALSE;
+}
+
+static void
+get_window_type (MetaDisplay  *display,
+                 MetaGLWindow *cw)
+{
+  MetaCompositorGL *compositor = DISPLAY_COMPOSITOR (display);
+  int n_atoms;
+  Atom *atoms, type_atom;
+  int i;
+
+  type_atom = None;
+  n_atoms = 0;
+  atoms = NULL;
+
+  meta_prop_get_atom_list (display, cw->id,
+                           compositor->atom_net_wm_window_type,
+                           &atoms, &n_atoms);
+
+  for (i = 0; i < n_atoms; i++)
+    {
+      if (atoms[i] == compositor->atom_net_wm_window_type_dnd ||
+          atoms[i] == compositor->atom_net_wm_window_type_desktop ||
+          atoms[i] == compositor->atom_net_wm_window_type_dock ||
+          atoms[i] == compositor->atom_net_wm_window_type_toolbar ||
+          atoms[i] == compositor->atom_net_wm_window_type_menu ||
+          atoms[i] == compositor->atom_net_wm_window_type_dialog ||
+          atoms[i] == compositor->atom_net_wm_window_type_normal ||
+          atoms[i] == compositor->atom_net_wm_window_type_utility ||
+          atoms[i] == compositor->atom_net_wm_window_type_splash ||
+          atoms[i] == compositor->atom_net_wm_window_type_dropdown_menu ||
+          atoms[i] == compositor->atom_net_wm_window_type_tooltip)
+        {
+          type_atom = atoms[i];
+          break;
+        }
+    }
+
+  meta_XFree (atoms);
+
+  if (type_atom == compositor->atom_net_wm_window_type_dnd)
+    cw->type = META_COMP_WINDOW_DND;
+  else if (type_atom == compositor->atom_net_wm_window_type_desktop)
+    cw->type = META_COMP_WINDOW_DESKTOP;
+  else if (type_atom == compositor->atom_net_wm_window_type_dock)
+    cw->type = META_COMP_WINDOW_DOCK;
+  else if (type_atom == compositor->atom_net_wm_window_type_menu)
+    cw->type = META_COMP_WINDOW_MENU;
+  else if (type_atom == compositor->atom_net_wm_window_type_dropdown_menu)
+    cw->type = META_COMP_WINDOW_DROP_DOWN_MENU;
+  else if (type_atom == compositor->atom_net_wm_window_type_tooltip)
+    cw->type = META_COMP_WINDOW_TOOLTIP;
+  else
+    cw->type = META_COMP_WINDOW_NORMAL;
+}
+
+/* Must be called with an error trap in place */
+static void
+add_win (MetaScreen *screen,
+         MetaWindow *window,
+         Window      xwindow)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaGLScreen *info = meta_screen_get_compositor_data (screen);
+  MetaGLWindow *cw;
+  gulong value;
+
+  if (info == NULL)
+    return;
+
+  if (xwindow == info->output)
+    return;
+
+  /* If already added, only bind the MetaWindow */
+  if ((cw = find_window_for_screen (screen, xwindow)) != NULL)
+    {
+      if (window && window->xwindow == cw->id)
+        {
+          cw->window = window;
+          cw->shadow_valid = FALSE;
+        }
+      return;
+    }
+
+  cw = g_new0 (MetaGLWindow, 1);
+  cw->screen = screen;
+  cw->window = window;
+  cw->id = xwindow;
+
+  if (!XGetWindowAttributes (xdisplay, xwindow, &cw->attrs))
+    {
+      g_free (cw);
+      return;
+    }
+  get_window_type (display, cw);
+
+  /* If Metacity has decided not to manage this window then the input events
+     won't have been set on the window */
+  XSelectInput (xdisplay, xwindow,
+                cw->attrs.your_event_mask | PropertyChangeMask);
+
+  cw->shaped = is_shaped (display, xwindow);
+  update_shape (display, cw);
+
+  if (cw->attrs.class == InputOnly)
+    cw->damage = None;
+  else
+    cw->damage = XDamageCreate (xdisplay, xwindow, XDamageReportNonEmpty);
+
+  if (window && meta_window_has_focus (window))
+    cw->shadow_type = META_SHADOW_LARGE;
+  else
+    cw->shadow_type = META_SHADOW_MEDIUM;
+
+  if (meta_prop_get_cardinal (display, xwindow,
+                              DISPLAY_COMPOSITOR (display)->atom_net_wm_window_opacity,
+                              &value) == FALSE)
+    value = OPAQUE;
+
+  cw->opacity = (guint) value;
+
+  determine_mode (cw);
+  cw->needs_shadow = window_has_shadow (cw);
+
+  if (cw->type == META_COMP_WINDOW_DOCK && cw->needs_shadow)
+    info->dock_windows = g_slist_append (info->dock_windows, cw);
+
+  /* Add this to the list at the top of the stack
+     before it is mapped so that map_win can find it again */
+  info->windows = g_list_prepend (info->windows, cw);
+  g_hash_table_insert (info->windows_by_xid, (gpointer) xwindow, cw);
+
+  if (cw->attrs.map_state == IsViewable)
+    map_win (display, screen, xwindow);
+}
+
+static void
+destroy_win (MetaDisplay *display,
+             Window       xwindow)
+{
+  MetaGLScreen *info;
+  MetaGLWindow *cw;
+
+  cw = find_window_in_display (display, xwindow);
+  if (cw == NULL)
+    return;
+
+  info = meta_screen_get_compositor_data (cw->screen);
+  if (info != NULL)
+    {
+      info->windows = g_list_remove (info->windows, (gconstpointer) cw);
+      g_hash_table_remove (info->windows_by_xid, (gpointer) xwindow);
+
+      if (cw->attrs.map_state == IsViewable)
+        damage_screen (cw->screen);
+    }
+
+  free_win (cw, TRUE);
+}
+
+static void
+restack_win (MetaGLWindow *cw,
+             Window        above)
+{
+  MetaGLScreen *info = meta_screen_get_compositor_data (cw->screen);
+  Window previous_above;
+  GList *sibling, *next;
+
+  if (info == NULL)
+    return;
+
+  sibling = g_list_find (info->windows, (gconstpointer) cw);
+  next = g_list_next (sibling);
+  previous_above = None;
+
+  if (next)
+    previous_above = ((MetaGLWindow *) next->data)->id;
+
+  /* If above is set to None, the window whose state was changed is on
+   * the bottom of the stack with respect to sibling.
+   */
+  if (above == None)
+    {
+      info->windows = g_list_delete_link (info->windows, sibling);
+      info->windows = g_list_append (info->windows, cw);
+    }
+  else if (previous_above != above)
+    {
+      GList *index;
+
+      for (index = info->windows; index; index = index->next)
+        if (((MetaGLWindow *) index->data)->id == above)
+          break;
+
+      if (index != NULL)
+        {
+          info->windows = g_list_delete_link (info->windows, sibling);
+          info->windows = g_list_insert_before (info->windows, index, cw);
+        }
+    }
+}
+
+static void
+resize_win (MetaGLWindow *cw,
+            int           x,
+            int           y,
+            int           width,
+            int           height,
+            int           border_width,
+            gboolean      override_redirect)
+{
+  MetaScreen *screen = cw->screen;
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaGLScreen *info = meta_screen_get_compositor_data (screen);
+
+  cw->attrs.x = x;
+  cw->attrs.y = y;
+
+  if (cw->attrs.width != width || cw->attrs.height != height ||
+      cw->attrs.border_width != border_width)
+    {
+      if (info != NULL)
+        gl_pixmap_unbind (DISPLAY_COMPOSITOR (display), info, &cw->texture);
+
+      if (cw->shaded_back_pixmap)
+        {
+          XFreePixmap (xdisplay, cw->shaded_back_pixmap);
+          cw->shaded_back_pixmap = None;
+        }
+
+      if (cw->back_pixmap)
+        {
+          /* If the window is shaded, we store the old backing pixmap
+             so we can return a proper image of the window */
+          if (cw->attrs.map_state != IsUnmapped && cw->window &&
+              meta_window_is_shaded (cw->window))
+            cw->shaded_back_pixmap = cw->back_pixmap;
+          else
+            XFreePixmap (xdisplay, cw->back_pixmap);
+
+          cw->back_pixmap = None;
+        }
+    }
+
+  cw->attrs.width = width;
+  cw->attrs.height = height;
+  cw->attrs.border_width = border_width;
+  cw->attrs.override_redirect = override_redirect;
+  cw->shadow_valid = FALSE;
+
+  if (cw->attrs.map_state == IsViewable)
+    damage_screen (screen);
+}
+
+/* event processors must all be called with an error trap in place */
+static void
+process_circulate_notify (MetaCompositorGL *compositor,
+                          XCirculateEvent  *event)
+{
+  MetaGLWindow *cw = find_window_in_display (compositor->display,
+                                             event->window);
+  MetaGLScreen *info;
+  Window above = None;
+
+  if (!cw)
+    return;
+
+  info = meta_screen_get_compositor_data (cw->screen);
+
+  if (event->place == PlaceOnTop && info->windows)
+    above = ((MetaGLWindow *) info->windows->data)->id;
+
+  restack_win (cw, above);
+  damage_screen (cw->screen);
+}
+
+static void
+process_configure_notify (MetaCompositorGL *compositor,
+                          XConfigureEvent  *event)
+{
+  MetaDisplay *display = compositor->display;
+  MetaGLWindow *cw = find_window_in_display (display, event->window);
+
+  if (cw)
+    {
+      restack_win (cw, event->above);
+      resize_win (cw, event->x, event->y, event->width, event->height,
+                  event->border_width, event->override_redirect);
+    }
+  else
+    {
+      MetaScreen *screen;
+      MetaGLScreen *info;
+
+      /* Might be the root window? */
+      screen = meta_display_screen_for_root (display, event->window);
+      if (screen == NULL)
+        return;
+
+      info = meta_screen_get_compositor_data (screen);
+      if (info != NULL)
+        info->root_tile_valid = FALSE;
+
+      damage_screen (screen);
+    }
+}
+
+static void
+process_property_notify (MetaCompositorGL *compositor,
+                         XPropertyEvent   *event)
+{
+  MetaDisplay *display = compositor->display;
+  MetaGLWindow *cw;
+
+  /* Check for the background property changing */
+  if (event->atom == compositor->atom_x_root_pixmap ||
+      event->atom == compositor->atom_x_set_root)
+    {
+      MetaScreen *screen = meta_display_screen_for_root (display,
+                                                         event->window);
+
+      if (screen)
+        {
+          MetaGLScreen *info = meta_screen_get_compositor_data (screen);
+
+          if (info != NULL)
+            {
+              info->root_tile_valid = FALSE;
+              damage_screen (screen);
+            }
+        }
+
+      return;
+    }
+
+  /* Check for the opacity changing */
+  if (event->atom == compositor->atom_net_wm_window_opacity)
+    {
+      gulong value;
+
+      cw = find_window_in_display (display, event->window);
+
+      /* Applications can set this for their toplevel windows, so
+       * this must be propagated to the window managed by the compositor
+       */
+      if (!cw)
+        cw = find_window_for_child_window_in_display (display, event->window);
+
+      if (!cw)
+        return;
+
+      if (meta_prop_get_cardinal (display, event->window,
+                                  compositor->atom_net_wm_window_opacity,
+                                  &value) == FALSE)
+        value = OPAQUE;
+
+      cw->opacity = (guint) value;
+      determine_mode (cw);
+      cw->needs_shadow = window_has_shadow (cw);
+
+      damage_screen (cw->screen);
+      return;
+    }
+
+  if (event->atom == compositor->atom_net_wm_window_type)
+    {
+      cw = find_window_in_display (display, event->window);
+      if (!cw)
+        return;
+
+      get_window_type (display, cw);
+      cw->needs_shadow = window_has_shadow (cw);
+      return;
+    }
+}
+
+static void
+process_expose (MetaCompositorGL *compositor,
+                XExposeEvent     *event)
+{
+  MetaGLWindow *cw = find_window_in_display (compositor->display,
+                                             event->window);
+  MetaScreen *screen;
+
+  if (cw != NULL)
+    screen = cw->screen;
+  else
+    screen = meta_display_screen_for_root (compositor->display,
+                                           event->window);
+
+  /* The output window is not tracked, so any expose repaints the
+     whole screen */
+  if (screen == NULL)
+    {
+      GSList *screens;
+
+      for (screens = meta_display_get_screens (compositor->display); screens;
+           screens = screens->next)
+        {
+          MetaGLScreen *info = meta_screen_get_compositor_data (screens->data);
+
+          if (info != NULL && info->output == event->window)
+            damage_screen (screens->data);
+        }
+
+      return;
+    }
+
+  damage_screen (screen);
+}
+
+static void
+process_unmap (MetaCompositorGL *compositor,
+               XUnmapEvent      *event)
+{
+  MetaGLWindow *cw;
+
+  if (event->from_configure)
+    {
+      /* Ignore unmap caused by parent's resize */
+      return;
+    }
+
+  cw = find_window_in_display (compositor->display, event->window);
+  if (cw && cw->attrs.map_state == IsViewable)
+    unmap_win (compositor->display, cw->screen, event->window);
+}
+
+static void
+process_map (MetaCompositorGL *compositor,
+             XMapEvent        *event)
+{
+  MetaGLWindow *cw = find_window_in_display (compositor->display,
+                                             event->window);
+
+  if (cw)
+    map_win (compositor->display, cw->screen, event->window);
+}
+
+static void
+process_reparent (MetaCompositorGL *compositor,
+                  XReparentEvent   *event,
+                  MetaWindow       *window)
+{
+  MetaScreen *screen;
+
+  screen = meta_display_screen_for_root (compositor->display, event->parent);
+  if (screen != NULL)
+    add_win (screen, window, event->window);
+  else
+    destroy_win (compositor->display, event->window);
+}
+
+static void
+process_create (MetaCompositorGL   *compositor,
+                XCreateWindowEvent *event,
+                MetaWindow         *window)
+{
+  MetaScreen *screen;
+
+  /* We are only interested in top level windows, others will
+     be caught by normal metacity functions */
+  screen = meta_display_screen_for_root (compositor->display, event->parent);
+  if (screen == NULL)
+    return;
+
+  if (!find_window_in_display (compositor->display, event->window))
+    add_win (screen, window, event->window);
+}
+
+static void
+process_destroy (MetaCompositorGL    *compositor,
+                 XDestroyWindowEvent *event)
+{
+  destroy_win (compositor->display, event->window);
+}
+
+static void
+process_damage (MetaCompositorGL   *compositor,
+                XDamageNotifyEvent *event)
+{
+  MetaGLWindow *cw = find_window_in_display (compositor->display,
+                                             event->drawable);
+  if (cw == NULL)
+    return;
+
+  queue_repair_win (cw);
+}
+
+static void
+process_shape (MetaCompositorGL *compositor,
+               XShapeEvent      *event)
+{
+  MetaGLWindow *cw = find_window_in_display (compositor->display,
+                                             event->window);
+
+  if (cw == NULL || event->kind != ShapeBounding)
+    return;
+
+  cw->shaped = event->shaped;
+  update_shape (compositor->display, cw);
+  cw->needs_shadow = window_has_shadow (cw);
+
+  if (cw->attrs.map_state == IsViewable)
+    damage_screen (cw->screen);
+}
+
+static int
+timeout_debug (MetaCompositorGL *compositor)
+{
+  compositor->show_redraw = (g_getenv ("METACITY_DEBUG_REDRAWS") != NULL);
+  compositor->debug = (g_getenv ("METACITY_DEBUG_COMPOSITOR") != NULL);
+
+  if (compositor->debug)
+    {
+      const MetaFrameClockStats *stats;
+
+      stats = meta_frame_clock_get_stats (compositor->frame_clock);
+      fprintf (stderr, "gl frames: %" G_GUINT64_FORMAT " painted, %"
+               G_GUINT64_FORMAT " dropped, refresh %" G_GINT64_FORMAT
+               "us, paint last %" G_GINT64_FORMAT "us avg %" G_GINT64_FORMAT
+               "us max %" G_GINT64_FORMAT "us\n",
+               stats->frames, stats->frames_dropped, stats->refresh_interval,
+               stats->last_paint_time, stats->avg_paint_time,
+               stats->max_paint_time);
+    }
+
+  /* only keep waking up while someone reads the numbers */
+  if (!compositor->debug)
+    compositor->debug_id = 0;
+
+  return compositor->debug;
+}
+
+static void
+gl_add_window (MetaCompositor    *compositor,
+               MetaWindow        *window,
+               Window             xwindow,
+               XWindowAttributes *attrs)
+{
+  MetaCompositorGL *glc = (MetaCompositorGL *) compositor;
+  MetaScreen *screen = meta_screen_for_x_screen (attrs->screen);
+
+  meta_error_trap_push (glc->display);
+  add_win (screen, window, xwindow);
+  meta_error_trap_pop (glc->display, FALSE);
+}
+
+static void
+gl_remove_window (MetaCompositor *compositor,
+                  Window          xwindow)
+{
+}
+
+static gboolean
+create_context (MetaGLScreen *info)
+{
+  MetaDisplay *display = meta_screen_get_display (info->screen);
+  MetaCompositorGL *compositor = DISPLAY_COMPOSITOR (display);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  XWindowAttributes attrs;
+  XVisualInfo template, *visual_info;
+  int n_visuals, value;
+
+  if (!XGetWindowAttributes (xdisplay, info->output, &attrs))
+    return FALSE;
+
+  template.visualid = XVisualIDFromVisual (attrs.visual);
+  visual_info = XGetVisualInfo (xdisplay, VisualIDMask, &template, &n_visuals);
+  if (visual_info == NULL)
+    return FALSE;
+
+  if (glXGetConfig (xdisplay, visual_info, GLX_USE_GL, &value) != 0 || !value ||
+      glXGetConfig (xdisplay, visual_info, GLX_DOUBLEBUFFER, &value) != 0 || !value)
+    {
+      XFree (visual_info);
+      return FALSE;
+    }
+
+  info->context = glXCreateContext (xdisplay, visual_info, NULL, True);
+  XFree (visual_info);
+
+  if (info->context == NULL)
+    return FALSE;
+
+  if (!glXMakeCurrent (xdisplay, info->output, info->context))
+    {
+      glXDestroyContext (xdisplay, info->context);
+      info->context = NULL;
+      return FALSE;
+    }
+
+  /* The frame clock paces repaints, the swap interval avoids tearing */
+  if (compositor->swap_interval_ext)
+    compositor->swap_interval_ext (xdisplay, info->output, 1);
+  else if (compositor->swap_interval_mesa)
+    compositor->swap_interval_mesa (1);
+
+  glDisable (GL_DEPTH_TEST);
+  glDisable (GL_DITHER);
+
+  return TRUE;
+}
+
+static void
+gl_manage_screen (MetaCompositor *compositor,
+                  MetaScreen     *screen)
+{
+  MetaCompositorGL *glc = (MetaCompositorGL *) compositor;
+  MetaGLScreen *info;
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  int screen_number = meta_screen_get_screen_number (screen);
+  Window xroot = meta_screen_get_xroot (screen);
+  XserverRegion region;
+
+  /* Check if the screen is already managed */
+  if (meta_screen_get_compositor_data (screen))
+    return;
+
+  meta_screen_set_cm_selection (screen);
+
+  info = g_new0 (MetaGLScreen, 1);
+  info->screen = screen;
+
+  info->output = XCompositeGetOverlayWindow (xdisplay, xroot);
+  XSelectInput (xdisplay, info->output, ExposureMask);
+
+  /* Made before the windows are redirected, nothing would show them if
+     it failed afterwards */
+  if (!create_context (info))
+    {
+      g_warning ("Cannot create GL context on screen %i", screen_number);
+
+      XCompositeReleaseOverlayWindow (xdisplay, info->output);
+      meta_screen_unset_cm_selection (screen);
+      g_free (info);
+      return;
+    }
+
+  gdk_error_trap_push ();
+  XCompositeRedirectSubwindows (xdisplay, xroot, CompositeRedirectManual);
+  XSync (xdisplay, FALSE);
+
+  if (gdk_error_trap_pop ())
+    {
+      meta_bug ("Another compositing manager is running on screen %i",
+                 screen_number);
+
+      glXMakeCurrent (xdisplay, None, NULL);
+      glXDestroyContext (xdisplay, info->context);
+      XCompositeReleaseOverlayWindow (xdisplay, info->output);
+      g_free (info);
+      return;
+    }
+
+  meta_screen_set_compositor_data (screen, info);
+
+  info->windows = NULL;
+  info->windows_by_xid = g_hash_table_new (g_direct_hash, g_direct_equal);
+  info->damage = cairo_region_create ();
+
+  info->focus_window = meta_display_get_focus_window (display);
+
+  if (!glc->fixed_rate)
+    meta_frame_clock_set_refresh_interval (glc->frame_clock,
+                                           meta_compositor_get_refresh_interval (screen));
+
+  info->have_shadows = (g_getenv ("META_DEBUG_NO_SHADOW") == NULL);
+  if (info->have_shadows)
+    {
+      meta_verbose ("Enabling shadows\n");
+      generate_shadows (info);
+    }
+  else
+    meta_verbose ("Disabling shadows\n");
+
+  /* Now we're up and running we can show the output */
+  region = XFixesCreateRegion (xdisplay, NULL, 0);
+  XFixesSetWindowShapeRegion (xdisplay, info->output, ShapeBounding, 0, 0, 0);
+  XFixesSetWindowShapeRegion (xdisplay, info->output, ShapeInput, 0, 0, region);
+  XFixesDestroyRegion (xdisplay, region);
+
+  damage_screen (screen);
+}
+
+static void
+gl_unmanage_screen (MetaCompositor *compositor,
+                    MetaScreen     *screen)
+{
+  MetaCompositorGL *glc = (MetaCompositorGL *) compositor;
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaGLScreen *info;
+  Window xroot = meta_screen_get_xroot (screen);
+  XserverRegion region;
+  GList *index;
+  int i;
+
+  info = meta_screen_get_compositor_data (screen);
+
+  /* This screen isn't managed */
+  if (info == NULL)
+    return;
+
+  region = XFixesCreateRegion (xdisplay, NULL, 0);
+  XFixesSetWindowShapeRegion (xdisplay, info->output, ShapeBounding, 0, 0, region);
+  XFixesDestroyRegion (xdisplay, region);
+
+  /* Destroy the windows */
+  for (index = info->windows; index; index = index->next)
+    free_win ((MetaGLWindow *) index->data, TRUE);
+  g_list_free (info->windows);
+  g_hash_table_destroy (info->windows_by_xid);
+  g_slist_free (info->damaged_windows);
+  cairo_region_destroy (info->damage);
+
+  gl_pixmap_unbind (glc, info, &info->root_tile);
+
+  make_current (info);
+  for (i = 0; i < LAST_SHADOW_TYPE; i++)
+    if (info->shadows[i].texture)
+      glDeleteTextures (1, &info->shadows[i].texture);
+
+  glXMakeCurrent (xdisplay, None, NULL);
+  glXDestroyContext (xdisplay, info->context);
+
+  XCompositeReleaseOverlayWindow (xdisplay, info->output);
+  XCompositeUnredirectSubwindows (xdisplay, xroot,
+                                  CompositeRedirectManual);
+
+  meta_screen_unset_cm_selection (screen);
+
+  g_free (info);
+
+  meta_screen_set_compositor_data (screen, NULL);
+}
+
+static void
+gl_set_updates (MetaCompositor *compositor,
+                MetaWindow     *window,
+                gboolean        updates)
+{
+}
+
+static void
+gl_destroy (MetaCompositor *compositor)
+{
+  MetaCompositorGL *glc = (MetaCompositorGL *) compositor;
+
+  if (glc->debug_id != 0)
+    g_source_remove (glc->debug_id);
+
+  meta_frame_clock_free (glc->frame_clock);
+  meta_frame_stats_free (glc->frame_stats);
+
+  g_free (compositor);
+}
+
+static void
+gl_free_window (MetaCompositor *compositor,
+                MetaWindow     *window)
+{
+  MetaCompositorGL *glc = (MetaCompositorGL *) compositor;
+  MetaFrame *frame = meta_window_get_frame (window);
+
+  /* Undecorated windows are destroyed on DestroyNotify, see
+     compositor-xrender.c */
+  if (frame)
+    destroy_win (glc->display, meta_frame_get_xwindow (frame));
+}
+
+static void
+gl_process_event (MetaCompositor *compositor,
+                  XEvent         *event,
+                  MetaWindow     *window)
+{
+  MetaCompositorGL *glc = (MetaCompositorGL *) compositor;
+
+  meta_error_trap_push (glc->display);
+  switch (event->type)
+    {
+    case CirculateNotify:
+      process_circulate_notify (glc, (XCirculateEvent *) event);
+      break;
+
+    case ConfigureNotify:
+      process_configure_notify (glc, (XConfigureEvent *) event);
+      break;
+
+    case PropertyNotify:
+      process_property_notify (glc, (XPropertyEvent *) event);
+      break;
+
+    case Expose:
+      process_expose (glc, (XExposeEvent *) event);
+      break;
+
+    case UnmapNotify:
+      process_unmap (glc, (XUnmapEvent *) event);
+      break;
+
+    case MapNotify:
+      process_map (glc, (XMapEvent *) event);
+      break;
+
+    case ReparentNotify:
+      process_reparent (glc, (XReparentEvent *) event, window);
+      break;
+
+    case CreateNotify:
+      process_create (glc, (XCreateWindowEvent *) event, window);
+      break;
+
+    case DestroyNotify:
+      process_destroy (glc, (XDestroyWindowEvent *) event);
+      break;
+
+    default:
+      if (event->type == meta_display_get_damage_event_base (glc->display) + XDamageNotify)
+        process_damage (glc, (XDamageNotifyEvent *) event);
+      else if (event->type == meta_display_get_shape_event_base (glc->display) + ShapeNotify)
+        process_shape (glc, (XShapeEvent *) event);
+      break;
+    }
+
+  meta_error_trap_pop (glc->display, FALSE);
+}
+
+static cairo_surface_t *
+gl_get_window_surface (MetaCompositor *compositor,
+                       MetaWindow     *window)
+{
+  MetaCompositorGL *glc = (MetaCompositorGL *) compositor;
+  MetaGLWindow *cw;
+  Pixmap pixmap;
+
+  cw = find_window_for_meta_window (meta_window_get_screen (window), window);
+  if (cw == NULL)
+    return NULL;
+
+  if (meta_window_is_shaded (window))
+    pixmap = cw->shaded_back_pixmap;
+  else
+    {
+      /* The pixmap is named lazily when painting */
+      if (cw->back_pixmap == None)
+        {
+          meta_error_trap_push (glc->display);
+          cw->back_pixmap =
+            XCompositeNameWindowPixmap (meta_display_get_xdisplay (glc->display),
+                                        cw->id);
+          if (meta_error_trap_pop_with_return (glc->display, FALSE) != 0)
+            cw->back_pixmap = None;
+        }
+
+      pixmap = cw->back_pixmap;
+    }
+
+  if (pixmap == None)
+    return NULL;
+
+  return cairo_xlib_surface_create (meta_display_get_xdisplay (glc->display),
+                                    pixmap, cw->attrs.visual,
+                                    cw->attrs.width, cw->attrs.height);
+}
+
+static void
+update_focus_shadow (MetaGLWindow   *cw,
+                     MetaShadowType  shadow_type)
+{
+  cw->shadow_type = shadow_type;
+  cw->needs_shadow = window_has_shadow (cw);
+  cw->shadow_valid = FALSE;
+}
+
+static void
+gl_set_active_window (MetaCompositor *compositor,
+                      MetaScreen     *screen,
+                      MetaWindow     *window)
+{
+  MetaGLScreen *info = meta_screen_get_compositor_data (screen);
+  MetaGLWindow *old_focus = NULL, *new_focus = NULL;
+
+  if (info == NULL)
+    return;
+
+  if (info->focus_window)
+    old_focus = find_window_for_meta_window (screen, info->focus_window);
+
+  if (window)
+    new_focus = find_window_for_meta_window (screen, window);
+
+  info->focus_window = window;
+
+  if (old_focus)
+    update_focus_shadow (old_focus, META_SHADOW_MEDIUM);
+
+  if (new_focus)
+    update_focus_shadow (new_focus, META_SHADOW_LARGE);
+
+  damage_screen (screen);
+}
+
+static void
+gl_update_shadow (MetaCompositor *compositor,
+                  MetaWindow     *window)
+{
+  MetaScreen *screen = meta_window_get_screen (window);
+  MetaGLWindow *cw = find_window_for_meta_window (screen, window);
+
+  if (!cw)
+    return;
+
+  cw->needs_shadow = window_has_shadow (cw);
+  cw->shadow_valid = FALSE;
+  damage_screen (screen);
+}
+
+static MetaFrameStats *
+gl_get_frame_stats (MetaCompositor *compositor)
+{
+  return ((MetaCompositorGL *) compositor)->frame_stats;
+}
+
+static MetaCompositor comp_info = {
+  gl_destroy,
+  gl_manage_screen,
+  gl_unmanage_screen,
+  gl_add_window,
+  gl_remove_window,
+  gl_set_updates,
+  gl_process_event,
+  gl_get_window_surface,
+  gl_set_active_window,
+  gl_free_window,
+  gl_update_shadow,
+  gl_update_shadow,
+  gl_get_frame_stats,
+};
+
+/* Checks that the default screen can texture from pixmaps; the screens
+   are only managed later, and we must not fail once they are redirected */
+static gboolean
+check_glx (MetaCompositorGL *glc)
+{
+  Display *xdisplay = meta_display_get_xdisplay (glc->display);
+  int screen_number = DefaultScreen (xdisplay);
+  const char *extensions;
+  int error_base, event_base;
+
+  if (!glXQueryExtension (xdisplay, &error_base, &event_base))
+    {
+      meta_verbose ("No GLX on the display\n");
+      return FALSE;
+    }
+
+  extensions = glXQueryExtensionsString (xdisplay, screen_number);
+  if (!has_extension (extensions, "GLX_EXT_texture_from_pixmap"))
+    {
+      meta_verbose ("GLX_EXT_texture_from_pixmap is not supported\n");
+      return FALSE;
+    }
+
+  glc->bind_tex_image = (PFNGLXBINDTEXIMAGEEXTPROC)
+    glXGetProcAddressARB ((const GLubyte *) "glXBindTexImageEXT");
+  glc->release_tex_image = (PFNGLXRELEASETEXIMAGEEXTPROC)
+    glXGetProcAddressARB ((const GLubyte *) "glXReleaseTexImageEXT");
+
+  if (glc->bind_tex_image == NULL || glc->release_tex_image == NULL)
+    return FALSE;
+
+  if (has_extension (extensions, "GLX_EXT_swap_control"))
+    glc->swap_interval_ext = (PFNGLXSWAPINTERVALEXTPROC)
+      glXGetProcAddressARB ((const GLubyte *) "glXSwapIntervalEXT");
+  else if (has_extension (extensions, "GLX_MESA_swap_control"))
+    glc->swap_interval_mesa = (PFNGLXSWAPINTERVALMESAPROC)
+      glXGetProcAddressARB ((const GLubyte *) "glXSwapIntervalMESA");
+
+  /* Lets a frame show just what was repainted */
+  if (has_extension (extensions, "GLX_MESA_copy_sub_buffer"))
+    glc->copy_sub_buffer = (PFNGLXCOPYSUBBUFFERMESAPROC)
+      glXGetProcAddressARB ((const GLubyte *) "glXCopySubBufferMESA");
+
+  /* Windows are at least 24 bits deep, and menus and frames are
+     often 32 bits deep */
+  if (get_fbconfig (glc, screen_number, DefaultDepth (xdisplay, screen_number)) == NULL ||
+      get_fbconfig (glc, screen_number, 32) == NULL)
+    return FALSE;
+
+  return TRUE;
+}
+
+MetaCompositor *
+meta_compositor_gl_new (MetaDisplay *display)
+{
+  const gchar *atom_names[] = {
+    "_XROOTPMAP_ID",
+    "_XSETROOT_ID",
+    "_NET_WM_WINDOW_OPACITY",
+    "_NET_WM_WINDOW_TYPE_DND",
+    "_NET_WM_WINDOW_TYPE",
+    "_NET_WM_WINDOW_TYPE_DESKTOP",
+    "_NET_WM_WINDOW_TYPE_DOCK",
+    "_NET_WM_WINDOW_TYPE_MENU",
+    "_NET_WM_WINDOW_TYPE_DIALOG",
+    "_NET_WM_WINDOW_TYPE_NORMAL",
+    "_NET_WM_WINDOW_TYPE_UTILITY",
+    "_NET_WM_WINDOW_TYPE_SPLASH",
+    "_NET_WM_WINDOW_TYPE_TOOLBAR",
+    "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU",
+    "_NET_WM_WINDOW_TYPE_TOOLTIP"
+  };
+  Atom atoms[G_N_ELEMENTS(atom_names)];
+  MetaCompositorGL *glc;
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  gint64 interval;
+
+  glc = g_new0 (MetaCompositorGL, 1);
+  glc->compositor = comp_info;
+  glc->display = display;
+
+  if (!check_glx (glc))
+    {
+      g_free (glc);
+      return NULL;
+    }
+
+  XInternAtoms (xdisplay, (gchar **) atom_names, G_N_ELEMENTS (atom_names),
+                False, atoms);
+
+  glc->atom_x_root_pixmap = atoms[0];
+  glc->atom_x_set_root = atoms[1];
+  glc->atom_net_wm_window_opacity = atoms[2];
+  glc->atom_net_wm_window_type_dnd = atoms[3];
+  glc->atom_net_wm_window_type = atoms[4];
+  glc->atom_net_wm_window_type_desktop = atoms[5];
+  glc->atom_net_wm_window_type_dock = atoms[6];
+  glc->atom_net_wm_window_type_menu = atoms[7];
+  glc->atom_net_wm_window_type_dialog = atoms[8];
+  glc->atom_net_wm_window_type_normal = atoms[9];
+  glc->atom_net_wm_window_type_utility = atoms[10];
+  glc->atom_net_wm_window_type_splash = atoms[11];
+  glc->atom_net_wm_window_type_toolbar = atoms[12];
+  glc->atom_net_wm_window_type_dropdown_menu = atoms[13];
+  glc->atom_net_wm_window_type_tooltip = atoms[14];
+
+  glc->frame_clock = meta_frame_clock_new (compositor_paint_frame, glc);
+  glc->frame_stats = meta_frame_stats_new ();
+
+  interval = meta_compositor_get_fixed_refresh_interval ();
+  if (interval > 0)
+    {
+      meta_frame_clock_set_refresh_interval (glc->frame_clock, interval);
+      glc->fixed_rate = TRUE;
+    }
+
+  meta_verbose ("Using the OpenGL compositor\n");
+  glc->debug_id = g_timeout_add (2000, (GSourceFunc) timeout_debug, glc);
+
+  return (MetaCompositor *) glc;
+}
+
+#endif /* HAVE_COMPOSITE_EXTENSIONS && HAVE_GL_COMPOSITOR */
@@ -21,6 +21,7 @@
 #define META_COMPOSITOR_PRIVATE_H
 
 #include "compositor.h"
+#include "frame-stats.h"
 
 struct _MetaCompositor
 {
@@ -57,6 +58,11 @@ struct _MetaCompositor
                              MetaWindow     *window);
   void (*unmaximize_window) (MetaCompositor *compositor,
                              MetaWindow     *window);
+
+  MetaFrameStats *(* get_frame_stats) (MetaCompositor *compositor);
 };
 
+gint64 meta_compositor_get_refresh_interval (MetaScreen *screen);
+gint64 meta_compositor_get_fixed_refresh_interval (void);
+
 #endif
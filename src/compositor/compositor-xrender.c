@@ -33,6 +33,7 @@
 #include <assert.h>
 
 #include <gdk/gdk.h>
+#include <gdk/gdkx.h>
 #include <cairo/cairo-xlib.h>
 
 #include "display.h"
@@ -49,8 +50,16 @@
 #include <X11/extensions/Xdamage.h>
 #include <X11/extensions/Xfixes.h>
 #include <X11/extensions/Xrender.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/shape.h>
+#include <xcb/xfixes.h>
+#ifdef HAVE_PRESENT
+#include <X11/extensions/Xpresent.h>
+#endif
 
 #include "deepin-message-hub.h"
+#include "frame-clock.h"
+#include "frame-stats.h"
 
 #define USE_IDLE_REPAINT 1
 
@@ -95,13 +104,30 @@ typedef struct _MetaCompositorXRender
   Atom atom_net_wm_window_type_toolbar;
   Atom atom_net_wm_window_type_dropdown_menu;
   Atom atom_net_wm_window_type_tooltip;
+  Atom atom_net_wm_bypass_compositor;
 
 #ifdef USE_IDLE_REPAINT
-  guint repaint_id;
-  guint fps;
-  guint use_idle_paint: 1;
+  MetaFrameClock *frame_clock;
+  guint fixed_rate : 1;
+#endif
+
+  MetaFrameStats *frame_stats;
+  MetaFrameRecord *frame_record; /* only set while painting a frame */
+
+#ifdef HAVE_PRESENT
+  int present_opcode;
+  guint32 present_serial;
+  guint have_present : 1;
+  guint present_pixmaps : 1;
+  guint presented_pixmap : 1; /* a frame went out through XPresentPixmap */
 #endif
+
+  guint shadow_cache_hits;
+  guint shadow_cache_misses;
+
+  guint debug_id;
   guint enabled : 1;
+  guint unredirect : 1;
   guint show_redraw : 1;
   guint debug : 1;
 } MetaCompositorXRender;
@@ -119,6 +145,33 @@ typedef struct _shadow
   guchar *shadow_top;
 } shadow;
 
+/* Opacity is quantised to this many levels, like the presummed tables */
+#define SHADOW_OPACITY_LEVELS 26
+
+typedef struct _MetaShadowPieces
+{
+  int size;
+  Picture corners;
+  Picture top;
+  Picture bottom;
+  Picture left;
+  Picture right;
+} MetaShadowPieces;
+
+#ifdef HAVE_PRESENT
+/* Output buffers handed to the server with XPresentPixmap, which may
+   flip them instead of copying */
+#define N_BACK_BUFFERS 3
+
+typedef struct _MetaBackBuffer
+{
+  Pixmap pixmap;
+  Picture picture;
+  guint64 frame; /* last frame painted into it, 0 if the contents are undefined */
+  gboolean busy; /* owned by the server until PresentIdleNotify */
+} MetaBackBuffer;
+#endif
+
 typedef struct _MetaCompScreen
 {
   MetaScreen *screen;
@@ -128,9 +181,21 @@ typedef struct _MetaCompScreen
   MetaWindow *focus_window;
 
   Window output;
+#ifdef HAVE_PRESENT
+  XID present_event_id;
+
+  MetaBackBuffer back_buffers[N_BACK_BUFFERS];
+  /* Damage of the last frames, newest first; NULL local regions mean
+     the whole screen */
+  XserverRegion damage_history[N_BACK_BUFFERS];
+  cairo_region_t *damage_history_local[N_BACK_BUFFERS];
+  guint64 frame_counter;
+  gboolean waiting_for_buffer;
+#endif
 
   gboolean have_shadows;
   shadow *shadows[LAST_SHADOW_TYPE];
+  MetaShadowPieces *shadow_cache[LAST_SHADOW_TYPE][SHADOW_OPACITY_LEVELS];
 
   Picture root_picture;
   Picture root_buffer;
@@ -138,12 +203,19 @@ typedef struct _MetaCompScreen
   Picture trans_black_picture;
   Picture root_tile;
   XserverRegion all_damage;
+  /* Client side mirror of all_damage, used to cull windows without
+     talking to the server. May be larger than all_damage, never smaller */
+  cairo_region_t *all_damage_local;
 
   guint overlays;
   gboolean compositor_active;
   gboolean clip_changed;
 
   GSList *dock_windows;
+  GSList *damaged_windows; /* waiting for repair_win at the next frame */
+
+  /* Fullscreen window painting directly to the screen, if any */
+  struct _MetaCompWindow *unredirected_window;
 } MetaCompScreen;
 
 typedef struct _MetaCompWindow
@@ -181,19 +253,32 @@ typedef struct _MetaCompWindow
   XserverRegion border_size;
   XserverRegion window_size;
   XserverRegion extents;
+  XRectangle extents_rect; /* local copy of extents, valid while it is set */
 
-  Picture shadow;
+  MetaShadowPieces *shadow; /* owned by the screen's shadow cache */
   int shadow_dx;
   int shadow_dy;
   int shadow_width;
   int shadow_height;
 
   guint opacity;
+  guint bypass_compositor;
 
   XserverRegion border_clip;
 
   gboolean updates_frozen;
   gboolean update_pending;
+  gboolean repair_queued;
+
+  /* Only the geometry from CreateNotify is known, the attributes
+     asked for then are taken when the window is first mapped */
+  gboolean deferred;
+  xcb_get_window_attributes_cookie_t attrs_cookie;
+
+  /* Mapped, but the type, opacity and shape are still on their way so
+     the window isn't repaired yet */
+  gboolean props_pending;
+  xcb_shape_query_extents_cookie_t shape_cookie;
 } MetaCompWindow;
 
 #define OPAQUE 0xffffffff
@@ -201,6 +286,11 @@ typedef struct _MetaCompWindow
 #define WINDOW_SOLID 0
 #define WINDOW_ARGB 1
 
+/* Values of _NET_WM_BYPASS_COMPOSITOR */
+#define BYPASS_COMPOSITOR_NONE 0
+#define BYPASS_COMPOSITOR_ON 1
+#define BYPASS_COMPOSITOR_OFF 2
+
 #define SHADOW_SMALL_RADIUS 3.0
 #define SHADOW_MEDIUM_RADIUS 6.0
 #define SHADOW_LARGE_RADIUS 12.0
@@ -442,130 +532,226 @@ generate_shadows (MetaCompScreen *info)
   }
 }
 
-static XImage *
-make_shadow (MetaDisplay   *display,
-             MetaScreen    *screen,
-             MetaShadowType shadow_type,
-             double         opacity,
-             int            width,
-             int            height)
+/*
+ * Shadows are drawn from nine-slice pieces that only depend on the
+ * shadow type and opacity, so resizing a window never rasterises or
+ * uploads anything.  The four corners live in one picture of 2 * msize
+ * square, the edges are one pixel long repeating strips that get
+ * stretched along the window sides.  The centre always lies under the
+ * visible part of the window and is never drawn.
+ */
+static Picture
+shadow_piece_picture (MetaDisplay *display,
+                      MetaScreen  *screen,
+                      guchar      *data,
+                      int          width,
+                      int          height,
+                      gboolean     repeat)
 {
-  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
-  XImage *ximage;
-  guchar *data;
-  shadow *shad;
-  int msize;
-  int ylimit, xlimit;
-  int swidth, sheight;
-  int centre;
-  int x, y;
-  guchar d;
-  int x_diff;
-  int opacity_int = (int)(opacity * 25);
+  Window xroot = meta_screen_get_xroot (screen);
   int screen_number = meta_screen_get_screen_number (screen);
+  XRenderPictureAttributes pa;
+  XImage *image;
+  Pixmap pixmap;
+  Picture picture;
+  GC gc;
 
-  if (info==NULL)
+  image = XCreateImage (xdisplay, DefaultVisual (xdisplay, screen_number),
+                        8, ZPixmap, 0, (char *) data,
+                        width, height, 8, width * sizeof (guchar));
+  if (!image)
     {
-      return NULL;
+      g_free (data);
+      return None;
     }
 
-  shad = info->shadows[shadow_type];
-  msize = shad->gaussian_map->size;
-  swidth = width + msize;
-  sheight = height + msize;
-  centre = msize / 2;
-
-  data = g_malloc (swidth * sheight * sizeof (guchar));
-
-  ximage = XCreateImage (xdisplay, DefaultVisual (xdisplay, screen_number),
-                         8, ZPixmap, 0, (char *) data,
-                         swidth, sheight, 8, swidth * sizeof (guchar));
-  if (!ximage)
+  pixmap = XCreatePixmap (xdisplay, xroot, width, height, 8);
+  if (!pixmap)
     {
-      g_free (data);
-      return NULL;
+      XDestroyImage (image);
+      return None;
     }
 
-  /*
-   * Build the gaussian in sections
-   */
+  pa.repeat = repeat;
+  picture = XRenderCreatePicture (xdisplay, pixmap,
+                                  XRenderFindStandardFormat (xdisplay, PictStandardA8),
+                                  CPRepeat, &pa);
 
-  /*
-   * centre (fill the complete data array
-   */
-  if (msize > 0)
-    d = shad->shadow_top[opacity_int * (msize + 1) + msize];
-  else
-    d = sum_gaussian (shad->gaussian_map, opacity, centre,
-                      centre, width, height);
-  memset (data, d, sheight * swidth);
+  gc = XCreateGC (xdisplay, pixmap, 0, 0);
+  XPutImage (xdisplay, pixmap, gc, image, 0, 0, 0, 0, width, height);
+  XFreeGC (xdisplay, gc);
 
-  /*
-   * corners
-   */
-  ylimit = msize;
-  if (ylimit > sheight / 2)
-    ylimit = (sheight + 1) / 2;
+  XDestroyImage (image);
+  XFreePixmap (xdisplay, pixmap);
+
+  return picture;
+}
+
+static MetaShadowPieces *
+make_shadow_pieces (MetaDisplay   *display,
+                    MetaScreen    *screen,
+                    shadow        *shad,
+                    int            opacity_int)
+{
+  MetaShadowPieces *pieces;
+  guchar *corner, *top, *bottom, *left, *right;
+  int msize, ssize;
+  int x, y;
 
-  xlimit = msize;
-  if (xlimit > swidth / 2)
-    xlimit = (swidth + 1) / 2;
+  msize = shad->gaussian_map->size;
+  ssize = msize * 2;
 
-  for (y = 0; y < ylimit; y++)
+  corner = g_malloc (ssize * ssize * sizeof (guchar));
+  for (y = 0; y < msize; y++)
     {
-      for (x = 0; x < xlimit; x++)
+      for (x = 0; x < msize; x++)
         {
+          guchar d;
 
-          if (xlimit == msize && ylimit == msize)
-            d = shad->shadow_corner[opacity_int * (msize + 1) * (msize + 1) + y * (msize + 1) + x];
-          else
-            d = sum_gaussian (shad->gaussian_map, opacity, x - centre,
-                              y - centre, width, height);
+          d = shad->shadow_corner[opacity_int * (msize + 1) * (msize + 1) + y * (msize + 1) + x];
 
-          data[y * swidth + x] = d;
-          data[(sheight - y - 1) * swidth + x] = d;
-          data[(sheight - y - 1) * swidth + (swidth - x - 1)] = d;
-          data[y * swidth + (swidth - x - 1)] = d;
+          corner[y * ssize + x] = d;
+          corner[(ssize - y - 1) * ssize + x] = d;
+          corner[(ssize - y - 1) * ssize + (ssize - x - 1)] = d;
+          corner[y * ssize + (ssize - x - 1)] = d;
         }
     }
 
-  /* top/bottom */
-  x_diff = swidth - (msize * 2);
-  if (x_diff > 0 && ylimit > 0)
+  top = g_malloc (msize * sizeof (guchar));
+  bottom = g_malloc (msize * sizeof (guchar));
+  left = g_malloc (msize * sizeof (guchar));
+  right = g_malloc (msize * sizeof (guchar));
+  for (x = 0; x < msize; x++)
     {
-      for (y = 0; y < ylimit; y++)
-        {
-          if (ylimit == msize)
-            d = shad->shadow_top[opacity_int * (msize + 1) + y];
-          else
-            d = sum_gaussian (shad->gaussian_map, opacity, centre,
-                              y - centre, width, height);
+      guchar d = shad->shadow_top[opacity_int * (msize + 1) + x];
 
-          memset (&data[y * swidth + msize], d, x_diff);
-          memset (&data[(sheight - y - 1) * swidth + msize], d, x_diff);
-        }
+      top[x] = left[x] = d;
+      bottom[msize - x - 1] = right[msize - x - 1] = d;
     }
 
-  /*
-   * sides
-   */
-  for (x = 0; x < xlimit; x++)
+  pieces = g_new0 (MetaShadowPieces, 1);
+  pieces->size = msize;
+  pieces->corners = shadow_piece_picture (display, screen, corner,
+                                          ssize, ssize, FALSE);
+  pieces->top = shadow_piece_picture (display, screen, top, 1, msize, TRUE);
+  pieces->bottom = shadow_piece_picture (display, screen, bottom,
+                                         1, msize, TRUE);
+  pieces->left = shadow_piece_picture (display, screen, left, msize, 1, TRUE);
+  pieces->right = shadow_piece_picture (display, screen, right,
+                                        msize, 1, TRUE);
+
+  return pieces;
+}
+
+static void
+free_shadow_pieces (Display          *xdisplay,
+                    MetaShadowPieces *pieces)
+{
+  if (pieces->corners)
+    XRenderFreePicture (xdisplay, pieces->corners);
+  if (pieces->top)
+    XRenderFreePicture (xdisplay, pieces->top);
+  if (pieces->bottom)
+    XRenderFreePicture (xdisplay, pieces->bottom);
+  if (pieces->left)
+    XRenderFreePicture (xdisplay, pieces->left);
+  if (pieces->right)
+    XRenderFreePicture (xdisplay, pieces->right);
+
+  g_free (pieces);
+}
+
+static MetaShadowPieces *
+get_shadow_pieces (MetaScreen     *screen,
+                   MetaShadowType  shadow_type,
+                   double          opacity)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  int opacity_int = (int) (opacity * 25);
+
+  if (info == NULL)
+    return NULL;
+
+  opacity_int = CLAMP (opacity_int, 0, SHADOW_OPACITY_LEVELS - 1);
+
+  if (info->shadow_cache[shadow_type][opacity_int])
     {
-      if (xlimit == msize)
-        d = shad->shadow_top[opacity_int * (msize + 1) + x];
-      else
-        d = sum_gaussian (shad->gaussian_map, opacity, x - centre,
-                          centre, width, height);
+      compositor->shadow_cache_hits++;
+      return info->shadow_cache[shadow_type][opacity_int];
+    }
 
-      for (y = msize; y < sheight - msize; y++)
-        {
-          data[y * swidth + x] = d;
-          data[y * swidth + (swidth - x - 1)] = d;
-        }
+  compositor->shadow_cache_misses++;
+  info->shadow_cache[shadow_type][opacity_int] =
+    make_shadow_pieces (display, screen, info->shadows[shadow_type],
+                        opacity_int);
+
+  return info->shadow_cache[shadow_type][opacity_int];
+}
+
+static void
+paint_shadow (MetaScreen     *screen,
+              MetaCompWindow *cw,
+              Picture         root_buffer)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaShadowPieces *pieces = cw->shadow;
+  int x, y, width, height;
+  int msize, cx, cy;
+
+  x = cw->attrs.x + cw->shadow_dx;
+  y = cw->attrs.y + cw->shadow_dy;
+  width = cw->shadow_width;
+  height = cw->shadow_height;
+  msize = pieces->size;
+
+  /* Windows smaller than the blur get cropped corners */
+  cx = MIN (msize, width / 2);
+  cy = MIN (msize, height / 2);
+
+  XRenderComposite (xdisplay, PictOpOver, info->black_picture,
+                    pieces->corners, root_buffer,
+                    0, 0, 0, 0, x, y, cx, cy);
+  XRenderComposite (xdisplay, PictOpOver, info->black_picture,
+                    pieces->corners, root_buffer,
+                    0, 0, msize * 2 - cx, 0,
+                    x + width - cx, y, cx, cy);
+  XRenderComposite (xdisplay, PictOpOver, info->black_picture,
+                    pieces->corners, root_buffer,
+                    0, 0, 0, msize * 2 - cy,
+                    x, y + height - cy, cx, cy);
+  XRenderComposite (xdisplay, PictOpOver, info->black_picture,
+                    pieces->corners, root_buffer,
+                    0, 0, msize * 2 - cx, msize * 2 - cy,
+                    x + width - cx, y + height - cy, cx, cy);
+
+  if (width > cx * 2)
+    {
+      XRenderComposite (xdisplay, PictOpOver, info->black_picture,
+                        pieces->top, root_buffer,
+                        0, 0, 0, 0,
+                        x + cx, y, width - cx * 2, cy);
+      XRenderComposite (xdisplay, PictOpOver, info->black_picture,
+                        pieces->bottom, root_buffer,
+                        0, 0, 0, msize - cy,
+                        x + cx, y + height - cy, width - cx * 2, cy);
     }
 
-  return ximage;
+  if (height > cy * 2)
+    {
+      XRenderComposite (xdisplay, PictOpOver, info->black_picture,
+                        pieces->left, root_buffer,
+                        0, 0, 0, 0,
+                        x, y + cy, cx, height - cy * 2);
+      XRenderComposite (xdisplay, PictOpOver, info->black_picture,
+                        pieces->right, root_buffer,
+                        0, 0, msize - cx, 0,
+                        x + width - cx, y + cy, cx, height - cy * 2);
+    }
 }
 
 double shadow_offsets_x[LAST_SHADOW_TYPE] = {SHADOW_SMALL_OFFSET_X,
@@ -604,115 +790,6 @@ cairo_region_to_xserver_region (Display        *xdisplay,
   return xregion;
 }
 
-static void
-shadow_picture_clip (Display          *xdisplay,
-                     Picture           shadow_picture,
-                     MetaCompWindow   *cw,
-                     MetaFrameBorders  borders,
-                     int               width,
-                     int               height)
-{
-  int shadow_dx;
-  int shadow_dy;
-  cairo_region_t *visible_region;
-  XRectangle rect;
-  XserverRegion region1;
-  XserverRegion region2;
-
-  if (cw->attrs.map_state == IsUnmapped || !cw->window)
-    return;
-
-  visible_region = meta_window_get_frame_bounds (cw->window);
-
-  if (!visible_region)
-    return;
-
-  shadow_dx = -1 * (int) shadow_offsets_x [cw->shadow_type] - borders.invisible.left;
-  shadow_dy = -1 * (int) shadow_offsets_y [cw->shadow_type] - borders.invisible.top;
-
-  rect.x = 0;
-  rect.y = 0;
-  rect.width = width;
-  rect.height = height;
-
-  region1 = XFixesCreateRegion (xdisplay, &rect, 1);
-  region2 = cairo_region_to_xserver_region (xdisplay, visible_region);
-
-  XFixesTranslateRegion (xdisplay, region2,
-                         shadow_dx, shadow_dy);
-
-  XFixesSubtractRegion (xdisplay, region1, region1, region2);
-  XFixesSetPictureClipRegion (xdisplay, shadow_picture, 0, 0, region1);
-
-  XFixesDestroyRegion (xdisplay, region1);
-  XFixesDestroyRegion (xdisplay, region2);
-}
-
-static Picture
-shadow_picture (MetaDisplay      *display,
-                MetaScreen       *screen,
-                MetaCompWindow   *cw,
-                double            opacity,
-                MetaFrameBorders  borders,
-                int               width,
-                int               height,
-                int              *wp,
-                int              *hp)
-{
-  Display *xdisplay = meta_display_get_xdisplay (display);
-  XImage *shadow_image;
-  Pixmap shadow_pixmap;
-  Picture shadow_picture;
-  Window xroot = meta_screen_get_xroot (screen);
-  GC gc;
-
-  shadow_image = make_shadow (display, screen, cw->shadow_type,
-                              opacity, width, height);
-  if (!shadow_image)
-    return None;
-
-  shadow_pixmap = XCreatePixmap (xdisplay, xroot,
-                                 shadow_image->width, shadow_image->height, 8);
-  if (!shadow_pixmap)
-    {
-      XDestroyImage (shadow_image);
-      return None;
-    }
-
-  shadow_picture = XRenderCreatePicture (xdisplay, shadow_pixmap,
-                                         XRenderFindStandardFormat (xdisplay, PictStandardA8),
-                                         0, 0);
-  if (!shadow_picture)
-    {
-      XDestroyImage (shadow_image);
-      XFreePixmap (xdisplay, shadow_pixmap);
-      return None;
-    }
-
-  shadow_picture_clip (xdisplay, shadow_picture, cw, borders,
-                       shadow_image->width, shadow_image->height);
-
-  gc = XCreateGC (xdisplay, shadow_pixmap, 0, 0);
-  if (!gc)
-    {
-      XDestroyImage (shadow_image);
-      XFreePixmap (xdisplay, shadow_pixmap);
-      XRenderFreePicture (xdisplay, shadow_picture);
-      return None;
-    }
-
-  XPutImage (xdisplay, shadow_pixmap, gc, shadow_image, 0, 0, 0, 0,
-             shadow_image->width, shadow_image->height);
-  *wp = shadow_image->width;
-  *hp = shadow_image->height;
-
-  XFreeGC (xdisplay, gc);
-  XDestroyImage (shadow_image);
-  XFreePixmap (xdisplay, shadow_pixmap);
-
-  return shadow_picture;
-}
-
 static MetaCompWindow *
 find_window_for_screen (MetaScreen *screen,
                         Window      xwindow)
@@ -919,7 +996,8 @@ root_tile (MetaScreen *screen)
 }
 
 static Picture
-create_root_buffer (MetaScreen *screen)
+create_root_buffer (MetaScreen *screen,
+                    Pixmap     *pixmap)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
@@ -948,7 +1026,11 @@ create_root_buffer (MetaScreen *screen)
   g_return_val_if_fail (root_pixmap != None, None);
 
   pict = XRenderCreatePicture (xdisplay, root_pixmap, format, 0, NULL);
-  XFreePixmap (xdisplay, root_pixmap);
+
+  if (pixmap)
+    *pixmap = root_pixmap;
+  else
+    XFreePixmap (xdisplay, root_pixmap);
 
   return pict;
 }
@@ -1048,7 +1130,8 @@ window_has_shadow (MetaCompWindow *cw)
 
 
 static XserverRegion
-win_extents (MetaCompWindow *cw)
+win_extents (MetaCompWindow *cw,
+             XRectangle     *rect)
 {
   MetaScreen *screen = cw->screen;
   MetaDisplay *display = meta_screen_get_display (screen);
@@ -1081,16 +1164,22 @@ win_extents (MetaCompWindow *cw)
       if (!cw->shadow)
         {
           double opacity = SHADOW_OPACITY;
-          int invisible_width = borders.invisible.left + borders.invisible.right;
-          int invisible_height = borders.invisible.top + borders.invisible.bottom;
 
           if (cw->opacity != (guint) OPAQUE)
             opacity = opacity * ((double) cw->opacity) / ((double) OPAQUE);
 
-          cw->shadow = shadow_picture (display, screen, cw, opacity, borders,
-                                       cw->attrs.width - invisible_width + cw->attrs.border_width * 2,
-                                       cw->attrs.height - invisible_height + cw->attrs.border_width * 2,
-                                       &cw->shadow_width, &cw->shadow_height);
+          cw->shadow = get_shadow_pieces (screen, cw->shadow_type, opacity);
+        }
+
+      if (cw->shadow)
+        {
+          int invisible_width = borders.invisible.left + borders.invisible.right;
+          int invisible_height = borders.invisible.top + borders.invisible.bottom;
+
+          cw->shadow_width = cw->attrs.width - invisible_width
+                             + cw->attrs.border_width * 2 + cw->shadow->size;
+          cw->shadow_height = cw->attrs.height - invisible_height
+                              + cw->attrs.border_width * 2 + cw->shadow->size;
         }
 
       sr.x = cw->attrs.x + cw->shadow_dx;
@@ -1117,6 +1206,9 @@ win_extents (MetaCompWindow *cw)
         r.height = sr.y + sr.height - r.y;
     }
 
+  if (rect)
+    *rect = r;
+
   return XFixesCreateRegion (xdisplay, &r, 1);
 }
 
@@ -1260,33 +1352,62 @@ paint_dock_shadows (MetaScreen   *screen,
           shadow_clip = XFixesCreateRegion (xdisplay, NULL, 0);
           XFixesIntersectRegion (xdisplay, shadow_clip,
                                  cw->border_clip, region);
+          if (cw->window_size)
+            XFixesSubtractRegion (xdisplay, shadow_clip, shadow_clip,
+                                  cw->window_size);
 
           XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0, shadow_clip);
 
-          XRenderComposite (xdisplay, PictOpOver, info->black_picture,
-                            cw->shadow, root_buffer,
-                            0, 0, 0, 0,
-                            cw->attrs.x + cw->shadow_dx,
-                            cw->attrs.y + cw->shadow_dy,
-                            cw->shadow_width, cw->shadow_height);
+          paint_shadow (screen, cw, root_buffer);
           XFixesDestroyRegion (xdisplay, shadow_clip);
         }
     }
 }
 
+static gboolean
+local_region_overlaps (cairo_region_t   *region,
+                       const XRectangle *rect)
+{
+  cairo_rectangle_int_t r;
+
+  r.x = rect->x;
+  r.y = rect->y;
+  r.width = rect->width;
+  r.height = rect->height;
+
+  return cairo_region_contains_rectangle (region, &r) != CAIRO_REGION_OVERLAP_OUT;
+}
+
+static void
+local_region_subtract (cairo_region_t   *region,
+                       const XRectangle *rect)
+{
+  cairo_rectangle_int_t r;
+
+  r.x = rect->x;
+  r.y = rect->y;
+  r.width = rect->width;
+  r.height = rect->height;
+
+  cairo_region_subtract_rectangle (region, &r);
+}
+
 static void
-paint_windows (MetaScreen   *screen,
-               GList        *windows,
-               Picture       root_buffer,
-               XserverRegion region)
+paint_windows (MetaScreen     *screen,
+               GList          *windows,
+               Picture         root_buffer,
+               XserverRegion   region,
+               cairo_region_t *region_local)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
+  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
   GList *index, *last;
   int screen_width, screen_height;
   MetaCompWindow *cw;
   XserverRegion paint_region, desktop_region;
+  cairo_region_t *visible;
 
   if (info == NULL)
     {
@@ -1310,6 +1431,21 @@ paint_windows (MetaScreen   *screen,
       XFixesCopyRegion (xdisplay, paint_region, region);
     }
 
+  /* visible tracks paint_region on the client side. It only ever
+     covers more than paint_region, so windows outside of it can be
+     skipped before any request is made for them */
+  if (region == None || region_local == NULL)
+    {
+      cairo_rectangle_int_t r;
+      r.x = 0;
+      r.y = 0;
+      r.width = screen_width;
+      r.height = screen_height;
+      visible = cairo_region_create_rectangle (&r);
+    }
+  else
+    visible = cairo_region_copy (region_local);
+
   desktop_region = None;
 
   /*
@@ -1339,9 +1475,6 @@ paint_windows (MetaScreen   *screen,
         }
 #endif
 
-      if (cw->picture == None)
-        cw->picture = get_window_picture (cw);
-
       /* If the clip region of the screen has been changed
          then we need to recreate the extents of the window */
       if (info->clip_changed)
@@ -1367,15 +1500,30 @@ paint_windows (MetaScreen   *screen,
 #endif
         }
 
+      if (cw->extents == None)
+        cw->extents = win_extents (cw, &cw->extents_rect);
+
+      /* Everything we paint for a window, shadow included, lies within
+         its extents, so there is nothing to do if they are not visible */
+      if (!local_region_overlaps (visible, &cw->extents_rect))
+        {
+          if (compositor->frame_record)
+            compositor->frame_record->windows_culled++;
+          continue;
+        }
+
+      if (compositor->frame_record)
+        compositor->frame_record->windows_painted++;
+
+      if (cw->picture == None)
+        cw->picture = get_window_picture (cw);
+
       if (cw->border_size == None)
         cw->border_size = border_size (cw);
 
       if (cw->window_size == None)
         cw->window_size = window_size (cw);
 
-      if (cw->extents == None)
-        cw->extents = win_extents (cw);
-
       if (cw->mode == WINDOW_SOLID)
         {
           if (cw->window && (cw->window->minimized || cw->window->hidden))
@@ -1403,6 +1551,18 @@ paint_windows (MetaScreen   *screen,
 
           XFixesSubtractRegion (xdisplay, paint_region,
                                 paint_region, cw->border_size);
+
+          /* border_size of an unshaped window is just its rectangle */
+          if (!cw->shaped)
+            {
+              XRectangle r;
+
+              r.x = x;
+              r.y = y;
+              r.width = wid;
+              r.height = hei;
+              local_region_subtract (visible, &r);
+            }
         }
 
       if (!cw->border_clip)
@@ -1437,6 +1597,10 @@ paint_windows (MetaScreen   *screen,
           continue;
         }
 
+      /* Culled on the way down */
+      if (cw->border_clip == None)
+        continue;
+
       if (cw->picture)
         {
           if (cw->shadow && cw->type != META_COMP_WINDOW_DOCK)
@@ -1449,12 +1613,7 @@ paint_windows (MetaScreen   *screen,
               XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0,
                                           shadow_clip);
 
-              XRenderComposite (xdisplay, PictOpOver, info->black_picture,
-                                cw->shadow, root_buffer,
-                                0, 0, 0, 0,
-                                cw->attrs.x + cw->shadow_dx,
-                                cw->attrs.y + cw->shadow_dy,
-                                cw->shadow_width, cw->shadow_height);
+              paint_shadow (screen, cw, root_buffer);
               if (shadow_clip)
                 XFixesDestroyRegion (xdisplay, shadow_clip);
             }
@@ -1494,101 +1653,359 @@ paint_windows (MetaScreen   *screen,
 
   XFlush(xdisplay);
   XFixesDestroyRegion (xdisplay, paint_region);
+  cairo_region_destroy (visible);
 }
 
+#ifdef HAVE_PRESENT
 static void
-paint_all (MetaScreen   *screen,
-           XserverRegion region)
+free_back_buffers (MetaScreen *screen)
 {
-  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
-  int screen_width, screen_height;
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  int i;
 
-  /* Set clipping to the given region */
-  XFixesSetPictureClipRegion (xdisplay, info->root_picture, 0, 0, region);
+  for (i = 0; i < N_BACK_BUFFERS; i++)
+    {
+      MetaBackBuffer *buffer = &info->back_buffers[i];
+
+      if (buffer->picture)
+        XRenderFreePicture (xdisplay, buffer->picture);
+      if (buffer->pixmap)
+        XFreePixmap (xdisplay, buffer->pixmap);
+
+      buffer->picture = None;
+      buffer->pixmap = None;
+      buffer->frame = 0;
+      buffer->busy = FALSE;
+
+      if (info->damage_history[i])
+        XFixesDestroyRegion (xdisplay, info->damage_history[i]);
+      info->damage_history[i] = None;
+      g_clear_pointer (&info->damage_history_local[i], cairo_region_destroy);
+    }
 
-  meta_screen_get_size (screen, &screen_width, &screen_height);
+  info->waiting_for_buffer = FALSE;
+}
 
-  if (DISPLAY_COMPOSITOR (display)->show_redraw)
-    {
-      Picture overlay;
+/* The idle buffer that is the fewest frames behind */
+static MetaBackBuffer *
+get_back_buffer (MetaScreen *screen)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaBackBuffer *best = NULL;
+  int i;
 
-      dump_xserver_region ("paint_all", display, region);
+  for (i = 0; i < N_BACK_BUFFERS; i++)
+    {
+      MetaBackBuffer *buffer = &info->back_buffers[i];
 
-      /* Make a random colour overlay */
-      overlay = solid_picture (display, screen, TRUE, 1, /* 0.3, alpha */
-                               ((double) (rand () % 100)) / 100.0,
-                               ((double) (rand () % 100)) / 100.0,
-                               ((double) (rand () % 100)) / 100.0);
+      if (buffer->busy)
+        continue;
 
-      XRenderComposite (xdisplay, PictOpOver, overlay, None, info->root_picture,
-                        0, 0, 0, 0, 0, 0, screen_width, screen_height);
-      XRenderFreePicture (xdisplay, overlay);
-      XFlush (xdisplay);
-      usleep (100 * 1000);
+      if (best == NULL || buffer->frame > best->frame)
+        best = buffer;
     }
 
-  if (info->root_buffer == None)
-    info->root_buffer = create_root_buffer (screen);
-
-  paint_windows (screen, info->windows, info->root_buffer, region);
+  if (best && best->pixmap == None)
+    {
+      best->picture = create_root_buffer (screen, &best->pixmap);
+      best->frame = 0;
+    }
 
-  XFixesSetPictureClipRegion (xdisplay, info->root_buffer, 0, 0, region);
-  XRenderComposite (xdisplay, PictOpSrc, info->root_buffer, None,
-                    info->root_picture, 0, 0, 0, 0, 0, 0,
-                    screen_width, screen_height);
+  return best;
 }
 
 static void
-repair_screen (MetaScreen *screen)
+push_damage_history (MetaScreen     *screen,
+                     XserverRegion   region,
+                     cairo_region_t *region_local)
 {
-  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
-
-  if (info!=NULL && info->all_damage != None)
-    {
-      meta_error_trap_push (display);
-      paint_all (screen, info->all_damage);
-      XFixesDestroyRegion (xdisplay, info->all_damage);
-      info->all_damage = None;
-      info->clip_changed = FALSE;
-      meta_error_trap_pop (display, FALSE);
-    }
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  int last = N_BACK_BUFFERS - 1;
+
+  if (info->damage_history[last])
+    XFixesDestroyRegion (xdisplay, info->damage_history[last]);
+  if (info->damage_history_local[last])
+    cairo_region_destroy (info->damage_history_local[last]);
+
+  memmove (&info->damage_history[1], &info->damage_history[0],
+           last * sizeof (XserverRegion));
+  memmove (&info->damage_history_local[1], &info->damage_history_local[0],
+           last * sizeof (cairo_region_t *));
+
+  info->damage_history[0] = XFixesCreateRegion (xdisplay, NULL, 0);
+  XFixesCopyRegion (xdisplay, info->damage_history[0], region);
+  info->damage_history_local[0] = region_local ?
+    cairo_region_copy (region_local) : NULL;
 }
 
-static void
-repair_display (MetaDisplay *display)
+/*
+ * Paints into an idle back buffer and hands it to the server. The
+ * buffer still shows the frame it was last painted with, so on top of
+ * the new damage it needs whatever changed in the frames it missed.
+ * Returns FALSE if all buffers are still owned by the server.
+ */
+static gboolean
+present_all (MetaScreen     *screen,
+             XserverRegion   region,
+             cairo_region_t *region_local)
 {
-  GSList *screens = meta_display_get_screens (display);
+  MetaDisplay *display = meta_screen_get_display (screen);
   MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaBackBuffer *buffer;
+  XserverRegion repair;
+  cairo_region_t *repair_local;
+  guint64 missed;
 
-#ifdef USE_IDLE_REPAINT
-  if (compositor->use_idle_paint && compositor->repaint_id > 0)
+  buffer = get_back_buffer (screen);
+  if (buffer == NULL || buffer->picture == None)
     {
-      g_source_remove (compositor->repaint_id);
-      compositor->repaint_id = 0;
+      info->waiting_for_buffer = TRUE;
+      return FALSE;
     }
-#endif
 
-  for (; screens; screens = screens->next)
-    repair_screen ((MetaScreen *) screens->data);
-}
+  missed = info->frame_counter - buffer->frame;
 
-#ifdef USE_IDLE_REPAINT
-static gboolean
-compositor_idle_cb (gpointer data)
+  if (buffer->frame == 0 || missed > N_BACK_BUFFERS)
+    {
+      /* Contents unknown or too old, repaint everything */
+      repair = None;
+      repair_local = NULL;
+    }
+  else
+    {
+      guint64 i;
+
+      repair = XFixesCreateRegion (xdisplay, NULL, 0);
+      XFixesCopyRegion (xdisplay, repair, region);
+      repair_local = region_local ? cairo_region_copy (region_local) : NULL;
+
+      for (i = 0; i < missed; i++)
+        {
+          XFixesUnionRegion (xdisplay, repair, repair,
+                             info->damage_history[i]);
+
+          if (repair_local && info->damage_history_local[i])
+            cairo_region_union (repair_local, info->damage_history_local[i]);
+          else
+            g_clear_pointer (&repair_local, cairo_region_destroy);
+        }
+    }
+
+  push_damage_history (screen, region, region_local);
+
+  paint_windows (screen, info->windows, buffer->picture, repair, repair_local);
+
+  /* If the server copies rather than flips, the window already holds
+     the previous frame */
+  XPresentPixmap (xdisplay, info->output, buffer->pixmap,
+                  ++compositor->present_serial, None, region, 0, 0,
+                  None, None, None, PresentOptionNone, 0, 0, 0, NULL, 0);
+
+  buffer->busy = TRUE;
+  buffer->frame = ++info->frame_counter;
+  compositor->presented_pixmap = TRUE;
+
+  if (repair)
+    XFixesDestroyRegion (xdisplay, repair);
+  if (repair_local)
+    cairo_region_destroy (repair_local);
+
+  return TRUE;
+}
+#endif
+
+/* Returns FALSE if the damage has to wait for a later frame */
+static gboolean
+paint_all (MetaScreen     *screen,
+           XserverRegion   region,
+           cairo_region_t *region_local)
 {
-  MetaCompositorXRender *compositor = (MetaCompositorXRender *) data;
-  if (compositor->use_idle_paint) 
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  int screen_width, screen_height;
+
+  /* Set clipping to the given region */
+  XFixesSetPictureClipRegion (xdisplay, info->root_picture, 0, 0, region);
+
+  meta_screen_get_size (screen, &screen_width, &screen_height);
+
+  if (DISPLAY_COMPOSITOR (display)->show_redraw)
     {
-      compositor->repaint_id = 0;
+      Picture overlay;
+
+      dump_xserver_region ("paint_all", display, region);
+
+      /* Make a random colour overlay */
+      overlay = solid_picture (display, screen, TRUE, 1, /* 0.3, alpha */
+                               ((double) (rand () % 100)) / 100.0,
+                               ((double) (rand () % 100)) / 100.0,
+                               ((double) (rand () % 100)) / 100.0);
+
+      XRenderComposite (xdisplay, PictOpOver, overlay, None, info->root_picture,
+                        0, 0, 0, 0, 0, 0, screen_width, screen_height);
+      XRenderFreePicture (xdisplay, overlay);
+      XFlush (xdisplay);
+      usleep (100 * 1000);
     }
 
+#ifdef HAVE_PRESENT
+  if (DISPLAY_COMPOSITOR (display)->present_pixmaps)
+    return present_all (screen, region, region_local);
+#endif
+
+  if (info->root_buffer == None)
+    info->root_buffer = create_root_buffer (screen, NULL);
+
+  paint_windows (screen, info->windows, info->root_buffer,
+                 region, region_local);
+
+  XFixesSetPictureClipRegion (xdisplay, info->root_buffer, 0, 0, region);
+  XRenderComposite (xdisplay, PictOpSrc, info->root_buffer, None,
+                    info->root_picture, 0, 0, 0, 0, 0, 0,
+                    screen_width, screen_height);
+
+  return TRUE;
+}
+
+static void update_unredirect (MetaScreen *screen);
+static void repair_damaged_windows (MetaScreen *screen);
+
+static void
+record_damage_area (MetaScreen     *screen,
+                    MetaCompScreen *info)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaFrameRecord *record = DISPLAY_COMPOSITOR (display)->frame_record;
+  int i, n_rects;
+
+  if (record == NULL)
+    return;
+
+  if (info->all_damage_local == NULL)
+    {
+      int width, height;
+
+      meta_screen_get_size (screen, &width, &height);
+      record->damage_area += (guint64) width * height;
+      return;
+    }
+
+  n_rects = cairo_region_num_rectangles (info->all_damage_local);
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (info->all_damage_local, i, &rect);
+      record->damage_area += (guint64) rect.width * rect.height;
+    }
+}
+
+static void
+repair_screen (MetaScreen *screen)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+  if (info != NULL)
+    repair_damaged_windows (screen);
+
+  update_unredirect (screen);
+
+  if (info!=NULL && info->all_damage != None)
+    {
+      meta_error_trap_push (display);
+      /* Nothing we paint would be visible */
+      if (info->unredirected_window == NULL)
+        {
+          if (!paint_all (screen, info->all_damage, info->all_damage_local))
+            {
+              meta_error_trap_pop (display, FALSE);
+              return;
+            }
+
+          record_damage_area (screen, info);
+        }
+      XFixesDestroyRegion (xdisplay, info->all_damage);
+      info->all_damage = None;
+      g_clear_pointer (&info->all_damage_local, cairo_region_destroy);
+      info->clip_changed = FALSE;
+      meta_error_trap_pop (display, FALSE);
+    }
+}
+
+static void
+repair_display (MetaDisplay *display)
+{
+  GSList *screens = meta_display_get_screens (display);
+
+  for (; screens; screens = screens->next)
+    repair_screen ((MetaScreen *) screens->data);
+}
+
+#ifdef HAVE_PRESENT
+/* Ask to be told when the frame we just painted hits the screen; the
+ * frame clock holds back the next frame until then.  One output is
+ * enough to pace on.
+ */
+static void
+request_present_notify (MetaCompositorXRender *compositor)
+{
+  Display *xdisplay = meta_display_get_xdisplay (compositor->display);
+  GSList *screens = meta_display_get_screens (compositor->display);
+
+  for (; screens; screens = screens->next)
+    {
+      MetaCompScreen *info = meta_screen_get_compositor_data (screens->data);
+
+      if (info == NULL || info->present_event_id == None)
+        continue;
+
+      XPresentNotifyMSC (xdisplay, info->output,
+                         ++compositor->present_serial, 0, 1, 0);
+      XFlush (xdisplay);
+      return;
+    }
+}
+#endif
+
+#ifdef USE_IDLE_REPAINT
+static void
+compositor_paint_frame (gpointer data)
+{
+  MetaCompositorXRender *compositor = (MetaCompositorXRender *) data;
+  Display *xdisplay = meta_display_get_xdisplay (compositor->display);
+  MetaFrameRecord *record;
+  unsigned long first_request;
+
+  record = meta_frame_stats_begin_frame (compositor->frame_stats);
+  compositor->frame_record = record;
+  first_request = NextRequest (xdisplay);
+
+#ifdef HAVE_PRESENT
+  compositor->presented_pixmap = FALSE;
+#endif
+
   repair_display (compositor->display);
 
-  return compositor->use_idle_paint ? FALSE : G_SOURCE_CONTINUE;
+  /* Nearly everything sent while painting is XFixes or XRender */
+  record->x_requests = NextRequest (xdisplay) - first_request;
+  compositor->frame_record = NULL;
+  meta_frame_stats_end_frame (compositor->frame_stats,
+                              record->damage_area > 0);
+
+#ifdef HAVE_PRESENT
+  /* A presented pixmap brings its own CompleteNotify */
+  if (compositor->have_present && !compositor->presented_pixmap)
+    request_present_notify (compositor);
+#endif
 }
 
 static void
@@ -1596,33 +2013,48 @@ add_repair (MetaDisplay *display)
 {
   MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
 
-  if (compositor->repaint_id > 0)
-    return;
+  meta_frame_clock_schedule_frame (compositor->frame_clock);
+}
+#endif
+
+static void
+add_local_damage (MetaScreen       *screen,
+                  MetaCompScreen   *info,
+                  const XRectangle *rects,
+                  int               n_rects)
+{
+  cairo_rectangle_int_t r;
+  int i;
 
-  const char* mode = g_getenv("META_IDLE_PAINT_MODE");
-  compositor->use_idle_paint = (mode == NULL || !g_str_equal(mode, "fixed"));
+  if (info->all_damage_local == NULL)
+    info->all_damage_local = cairo_region_create ();
 
-  if (compositor->use_idle_paint) 
+  if (rects == NULL)
     {
-      compositor->repaint_id = g_timeout_add_full (G_PRIORITY_HIGH, 5,
-                                                compositor_idle_cb, compositor,
-                                                NULL);
+      r.x = 0;
+      r.y = 0;
+      meta_screen_get_size (screen, &r.width, &r.height);
+      cairo_region_union_rectangle (info->all_damage_local, &r);
+      return;
     }
-  else
+
+  for (i = 0; i < n_rects; i++)
     {
-      const char* fps_str = g_getenv("META_IDLE_PAINT_FPS");
-      compositor->fps = fps_str == NULL ? 30 : (guint)atoi(fps_str);
-      guint interval = 1000 / compositor->fps;
-      compositor->repaint_id = g_timeout_add_full (G_PRIORITY_HIGH, interval,
-                                                   compositor_idle_cb, compositor,
-                                                   NULL);
+      r.x = rects[i].x;
+      r.y = rects[i].y;
+      r.width = rects[i].width;
+      r.height = rects[i].height;
+      cairo_region_union_rectangle (info->all_damage_local, &r);
     }
 }
-#endif
 
+/* rects must cover damage; if they are not known pass NULL and the
+   whole screen is considered damaged when culling windows */
 static void
-add_damage (MetaScreen     *screen,
-            XserverRegion   damage)
+add_damage (MetaScreen       *screen,
+            XserverRegion     damage,
+            const XRectangle *rects,
+            int               n_rects)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
@@ -1630,6 +2062,9 @@ add_damage (MetaScreen     *screen,
 
   /*  dump_xserver_region ("add_damage", display, damage); */
 
+  if (info != NULL)
+    add_local_damage (screen, info, rects, n_rects);
+
   if (info != NULL && info->all_damage)
     {
       XFixesUnionRegion (xdisplay, info->all_damage, info->all_damage, damage);
@@ -1660,56 +2095,359 @@ damage_screen (MetaScreen *screen)
 
   region = XFixesCreateRegion (xdisplay, &r, 1);
   dump_xserver_region ("damage_screen", display, region);
-  add_damage (screen, region);
+  add_damage (screen, region, &r, 1);
+}
+
+static void
+show_overlay_window (MetaScreen *screen,
+                     Window      cow)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  XserverRegion region;
+
+  region = XFixesCreateRegion (xdisplay, NULL, 0);
+
+  XFixesSetWindowShapeRegion (xdisplay, cow, ShapeBounding, 0, 0, 0);
+  XFixesSetWindowShapeRegion (xdisplay, cow, ShapeInput, 0, 0, region);
+
+  XFixesDestroyRegion (xdisplay, region);
+
+  damage_screen (screen);
+}
+
+static void
+hide_overlay_window (MetaScreen *screen,
+                     Window      cow)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  XserverRegion region;
+
+  region = XFixesCreateRegion (xdisplay, NULL, 0);
+  XFixesSetWindowShapeRegion (xdisplay, cow, ShapeBounding, 0, 0, region);
+  XFixesDestroyRegion (xdisplay, region);
 }
 
+/*
+ * A fullscreen opaque window at the top of the stack hides everything
+ * else, so compositing it only costs a full screen copy per frame.
+ * Such a window is unredirected and painting is suspended until it
+ * stops covering the screen or something is mapped above it.
+ */
 static void
-repair_win (MetaCompWindow *cw)
+get_bypass_compositor (MetaDisplay    *display,
+                       MetaCompWindow *cw)
+{
+  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+  Window xwindow;
+  gulong value;
+
+  /* The hint lives on the client window, not on its frame */
+  xwindow = cw->window ? cw->window->xwindow : cw->id;
+
+  if (meta_prop_get_cardinal (display, xwindow,
+                              compositor->atom_net_wm_bypass_compositor,
+                              &value) == FALSE)
+    value = BYPASS_COMPOSITOR_NONE;
+
+  cw->bypass_compositor = (guint) value;
+}
+
+static gboolean
+window_covers_screen (MetaCompWindow *cw,
+                      int             screen_width,
+                      int             screen_height)
+{
+  return (cw->attrs.x <= 0 && cw->attrs.y <= 0 &&
+          cw->attrs.x + cw->attrs.width + cw->attrs.border_width * 2 >= screen_width &&
+          cw->attrs.y + cw->attrs.height + cw->attrs.border_width * 2 >= screen_height);
+}
+
+static gboolean
+window_should_unredirect (MetaCompWindow *cw,
+                          int             screen_width,
+                          int             screen_height)
+{
+  if (cw->bypass_compositor == BYPASS_COMPOSITOR_OFF)
+    return FALSE;
+
+  if (cw->opacity != (guint) OPAQUE || cw->shaped)
+    return FALSE;
+
+  if (!window_covers_screen (cw, screen_width, screen_height))
+    return FALSE;
+
+  /* Clients asking for it know their alpha channel doesn't matter */
+  if (cw->bypass_compositor == BYPASS_COMPOSITOR_ON)
+    return TRUE;
+
+  if (cw->mode != WINDOW_SOLID)
+    return FALSE;
+
+  /* Don't flip back and forth when the last window on the desktop
+     comes and goes */
+  return cw->type != META_COMP_WINDOW_DESKTOP;
+}
+
+static MetaCompWindow *
+find_unredirect_window (MetaScreen *screen)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  int screen_width, screen_height;
+  GList *index;
+
+  meta_screen_get_size (screen, &screen_width, &screen_height);
+
+  /* Only the topmost window that shows up on screen can qualify;
+     anything else overlaps it */
+  for (index = info->windows; index; index = index->next)
+    {
+      MetaCompWindow *cw = (MetaCompWindow *) index->data;
+
+      if (cw->attrs.map_state != IsViewable || cw->attrs.class == InputOnly)
+        continue;
+
+      if (cw->window && (cw->window->minimized || cw->window->hidden))
+        continue;
+
+      if (cw->attrs.x >= screen_width || cw->attrs.y >= screen_height ||
+          cw->attrs.x + cw->attrs.width + cw->attrs.border_width * 2 <= 0 ||
+          cw->attrs.y + cw->attrs.height + cw->attrs.border_width * 2 <= 0)
+        continue;
+
+      if (window_should_unredirect (cw, screen_width, screen_height))
+        return cw;
+
+      return NULL;
+    }
+
+  return NULL;
+}
+
+static void
+set_unredirected_window (MetaScreen     *screen,
+                         MetaCompWindow *cw)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaCompWindow *old = info->unredirected_window;
+
+  if (old == cw)
+    return;
+
+  if (old)
+    {
+      meta_verbose ("Redirecting window 0x%lx\n", old->id);
+
+      meta_error_trap_push (display);
+      XCompositeRedirectWindow (xdisplay, old->id, CompositeRedirectManual);
+      meta_error_trap_pop (display, FALSE);
+
+      info->unredirected_window = NULL;
+    }
+
+  if (cw)
+    {
+      meta_verbose ("Unredirecting window 0x%lx\n", cw->id);
+
+      meta_error_trap_push (display);
+      XCompositeUnredirectWindow (xdisplay, cw->id, CompositeRedirectManual);
+      meta_error_trap_pop (display, FALSE);
+
+      /* The named pixmap stops following the window, get a new one
+         when it is redirected again */
+      if (cw->picture)
+        {
+          XRenderFreePicture (xdisplay, cw->picture);
+          cw->picture = None;
+        }
+
+      if (cw->back_pixmap)
+        {
+          XFreePixmap (xdisplay, cw->back_pixmap);
+          cw->back_pixmap = None;
+        }
+
+      info->unredirected_window = cw;
+
+      if (old == NULL)
+        hide_overlay_window (screen, info->output);
+    }
+  else
+    {
+      show_overlay_window (screen, info->output);
+    }
+}
+
+static void
+update_unredirect (MetaScreen *screen)
+{
+  MetaCompositorXRender *compositor;
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (info == NULL)
+    return;
+
+  compositor = DISPLAY_COMPOSITOR (meta_screen_get_display (screen));
+
+  if (!compositor->unredirect)
+    return;
+
+  set_unredirected_window (screen, find_unredirect_window (screen));
+}
+
+/* A window's damage being taken, from the subtract to the fetch of what
+   was damaged */
+typedef struct
+{
+  MetaCompWindow                  *cw;
+  XserverRegion                    parts;
+  XRectangle                       bounds;
+  xcb_xfixes_fetch_region_cookie_t cookie;  /* sequence 0 if not fetched */
+} WindowRepair;
+
+/* Takes the damage of the window without waiting on the server; the
+   parts are only asked for when somebody wants to know them, and
+   collected by finish_repair_win */
+static void
+start_repair_win (MetaCompWindow *cw,
+                  WindowRepair   *repair)
 {
   MetaScreen *screen = cw->screen;
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
-  XserverRegion parts;
+
+  repair->cw = cw;
+  repair->cookie.sequence = 0;
 
   meta_error_trap_push (display);
 
 #if defined(__alpha__) || defined(__mips__) || defined(__arm__) || defined(__sw_64__)
-  parts = win_extents (cw);
+  repair->parts = win_extents (cw, &repair->bounds);
   XDamageSubtract (xdisplay, cw->damage, None, None);
 #else
   if (!cw->damaged)
     {
-      parts = win_extents (cw);
+      repair->parts = win_extents (cw, &repair->bounds);
       XDamageSubtract (xdisplay, cw->damage, None, None);
     }
   else
     {
-      parts = XFixesCreateRegion (xdisplay, 0, 0);
-      XDamageSubtract (xdisplay, cw->damage, None, parts);
-      XFixesTranslateRegion (xdisplay, parts,
+      repair->parts = XFixesCreateRegion (xdisplay, 0, 0);
+      XDamageSubtract (xdisplay, cw->damage, None, repair->parts);
+      XFixesTranslateRegion (xdisplay, repair->parts,
                              cw->attrs.x + cw->attrs.border_width,
                              cw->attrs.y + cw->attrs.border_width);
+
+      /* The window is good enough for culling, the parts are only
+         worth a fetch to someone keeping a copy of its contents */
+      if (deepin_message_hub_wants_window_damage (cw->window))
+        repair->cookie =
+          xcb_xfixes_fetch_region (XGetXCBConnection (xdisplay),
+                                   repair->parts);
+
+      repair->bounds.x = cw->attrs.x;
+      repair->bounds.y = cw->attrs.y;
+      repair->bounds.width = cw->attrs.width + cw->attrs.border_width * 2;
+      repair->bounds.height = cw->attrs.height + cw->attrs.border_width * 2;
     }
 #endif
 
   meta_error_trap_pop (display, FALSE);
-  
-  dump_xserver_region ("repair_win", display, parts);
-  add_damage (screen, parts);
-  cw->damaged = TRUE;
+}
+
+static void
+finish_repair_win (WindowRepair *repair)
+{
+  MetaCompWindow *cw = repair->cw;
+  MetaScreen *screen = cw->screen;
+  MetaDisplay *display = meta_screen_get_display (screen);
+  xcb_xfixes_fetch_region_reply_t *reply = NULL;
+  XRectangle *rects = &repair->bounds;
+  int nrects = 1;
 
-  if (parts) {
+  if (repair->cookie.sequence != 0)
+    {
       Display *xdisplay = meta_display_get_xdisplay (display);
-      int nrects;
-      XRectangle *rects;
-      XRectangle bounds;
+      xcb_generic_error_t *error = NULL;
 
-      rects = XFixesFetchRegionAndBounds (xdisplay, parts, &nrects, &bounds);
-      if (nrects > 0) {
-          deepin_message_hub_window_damaged(cw->window, rects, nrects);
-      }
-      XFree (rects);
-  }
+      reply = xcb_xfixes_fetch_region_reply (XGetXCBConnection (xdisplay),
+                                             repair->cookie, &error);
+      free (error);
+    }
+
+  if (reply != NULL)
+    {
+      /* xcb_rectangle_t is laid out like XRectangle */
+      rects = (XRectangle *) xcb_xfixes_fetch_region_rectangles (reply);
+      nrects = xcb_xfixes_fetch_region_rectangles_length (reply);
+    }
+
+  dump_xserver_region ("repair_win", display, repair->parts);
+
+  add_damage (screen, repair->parts, rects, nrects);
+  cw->damaged = TRUE;
+
+  if (nrects > 0)
+    deepin_message_hub_window_damaged (cw->window, rects, nrects);
+
+  free (reply);
+}
+
+/* Damage events only queue the window, the damage itself is taken
+   once per frame so a client drawing a lot costs one subtract and one
+   notification per frame */
+static void
+queue_repair_win (MetaCompWindow *cw)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (cw->screen);
+
+  if (info == NULL || cw->repair_queued)
+    return;
+
+  cw->repair_queued = TRUE;
+  info->damaged_windows = g_slist_prepend (info->damaged_windows, cw);
+}
+
+static void
+repair_damaged_windows (MetaScreen *screen)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  GSList *damaged, *l;
+  WindowRepair *repairs;
+  int n_repairs, i;
+
+  damaged = info->damaged_windows;
+  info->damaged_windows = NULL;
+
+  repairs = g_new (WindowRepair, g_slist_length (damaged));
+  n_repairs = 0;
+
+  /* All the subtracts and fetches go out before any reply is waited
+     for, so a frame costs at most one round trip however many windows
+     were damaged */
+  for (l = damaged; l; l = l->next)
+    {
+      MetaCompWindow *cw = l->data;
+
+      /* Left queued so it isn't painted before it is known how */
+      if (cw->props_pending)
+        {
+          info->damaged_windows = g_slist_prepend (info->damaged_windows, cw);
+          continue;
+        }
+
+      cw->repair_queued = FALSE;
+      start_repair_win (cw, &repairs[n_repairs++]);
+    }
+
+  for (i = 0; i < n_repairs; i++)
+    finish_repair_win (&repairs[i]);
+
+  g_free (repairs);
+  g_slist_free (damaged);
 }
 
 static void
@@ -1739,11 +2477,7 @@ free_win (MetaCompWindow *cw,
       cw->picture = None;
     }
 
-  if (cw->shadow)
-    {
-      XRenderFreePicture (xdisplay, cw->shadow);
-      cw->shadow = None;
-    }
+  cw->shadow = NULL;
 
   if (cw->alpha_pict)
     {
@@ -1804,10 +2538,27 @@ free_win (MetaCompWindow *cw,
       if (info!=NULL && cw->type == META_COMP_WINDOW_DOCK)
         info->dock_windows = g_slist_remove (info->dock_windows, cw);
 
+      if (info != NULL && cw->repair_queued)
+        info->damaged_windows = g_slist_remove (info->damaged_windows, cw);
+
+      if (cw->attrs_cookie.sequence != 0)
+        xcb_discard_reply (XGetXCBConnection (xdisplay),
+                           cw->attrs_cookie.sequence);
+      if (cw->shape_cookie.sequence != 0)
+        xcb_discard_reply (XGetXCBConnection (xdisplay),
+                           cw->shape_cookie.sequence);
+      if (cw->props_pending)
+        meta_prop_cancel_values_async (cw);
+
       g_free (cw);
     }
 }
 
+static gboolean
+init_win (MetaDisplay    *display,
+          MetaScreen     *screen,
+          MetaCompWindow *cw);
+
 static void
 map_win (MetaDisplay *display,
          MetaScreen  *screen,
@@ -1819,6 +2570,19 @@ map_win (MetaDisplay *display,
   if (cw == NULL)
     return;
 
+  if (cw->deferred)
+    {
+      gboolean ok;
+
+      meta_error_trap_push (display);
+      ok = init_win (display, screen, cw);
+      meta_error_trap_pop (display, FALSE);
+
+      /* Already gone, the DestroyNotify will clean up */
+      if (!ok)
+        return;
+    }
+
   meta_verbose ("%s window %p\n", __func__, id);
   /* The reason we deallocate this here and not in unmap
      is so that we will still have a valid pixmap for
@@ -1855,13 +2619,16 @@ unmap_win (MetaDisplay *display,
   if (cw->window && cw->window == info->focus_window)
     info->focus_window = NULL;
 
+  if (cw == info->unredirected_window)
+    set_unredirected_window (screen, NULL);
+
   cw->attrs.map_state = IsUnmapped;
   cw->damaged = FALSE;
 
   if (cw->extents != None)
     {
       dump_xserver_region ("unmap_win", display, cw->extents);
-      add_damage (screen, cw->extents);
+      add_damage (screen, cw->extents, &cw->extents_rect, 1);
       cw->extents = None;
     }
 
@@ -1907,7 +2674,7 @@ determine_mode (MetaDisplay    *display,
       XFixesCopyRegion (xdisplay, damage, cw->extents);
 
       dump_xserver_region ("determine_mode", display, damage);
-      add_damage (screen, damage);
+      add_damage (screen, damage, &cw->extents_rect, 1);
     }
 }
 
@@ -1931,22 +2698,15 @@ is_shaped (MetaDisplay *display,
   return FALSE;
 }
 
-static void
-get_window_type (MetaDisplay    *display,
-                 MetaCompWindow *cw)
+static MetaCompWindowType
+window_type_from_atoms (MetaCompositorXRender *compositor,
+                        Atom                  *atoms,
+                        int                    n_atoms)
 {
-  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
-  int n_atoms;
-  Atom *atoms, type_atom;
+  Atom type_atom;
   int i;
 
   type_atom = None;
-  n_atoms = 0;
-  atoms = NULL;
-
-  meta_prop_get_atom_list (display, cw->id,
-                           compositor->atom_net_wm_window_type,
-                           &atoms, &n_atoms);
 
   for (i = 0; i < n_atoms; i++)
     {
@@ -1967,30 +2727,354 @@ get_window_type (MetaDisplay    *display,
         }
     }
 
-  meta_XFree (atoms);
+  if (type_atom == compositor->atom_net_wm_window_type_dnd)
+    return META_COMP_WINDOW_DND;
+  else if (type_atom == compositor->atom_net_wm_window_type_desktop)
+    return META_COMP_WINDOW_DESKTOP;
+  else if (type_atom == compositor->atom_net_wm_window_type_dock)
+    return META_COMP_WINDOW_DOCK;
+  else if (type_atom == compositor->atom_net_wm_window_type_menu)
+    return META_COMP_WINDOW_MENU;
+  else if (type_atom == compositor->atom_net_wm_window_type_dropdown_menu)
+    return META_COMP_WINDOW_DROP_DOWN_MENU;
+  else if (type_atom == compositor->atom_net_wm_window_type_tooltip)
+    return META_COMP_WINDOW_TOOLTIP;
+  else
+    return META_COMP_WINDOW_NORMAL;
+}
+
+static void
+get_window_type (MetaDisplay    *display,
+                 MetaCompWindow *cw)
+{
+  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+  int n_atoms;
+  Atom *atoms;
+
+  n_atoms = 0;
+  atoms = NULL;
+
+  meta_prop_get_atom_list (display, cw->id,
+                           compositor->atom_net_wm_window_type,
+                           &atoms, &n_atoms);
+
+  cw->type = window_type_from_atoms (compositor, atoms, n_atoms);
+
+  meta_XFree (atoms);
+
+/*   meta_verbose ("Window is %d\n", cw->type); */
+}
+
+/* The window type, the opacity and, when it is set on the same window,
+ * the bypass hint.  They are fetched together so this is one round trip
+ * instead of three.  Returns how many of values are used.
+ */
+static int
+init_window_prop_values (MetaDisplay    *display,
+                         MetaCompWindow *cw,
+                         MetaPropValue  *values)
+{
+  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+
+  values[0].type = META_PROP_VALUE_ATOM_LIST;
+  values[0].atom = compositor->atom_net_wm_window_type;
+  values[0].required_type = None;
+
+  values[1].type = META_PROP_VALUE_CARDINAL;
+  values[1].atom = compositor->atom_net_wm_window_opacity;
+  values[1].required_type = None;
+
+  if (cw->window != NULL && cw->window->xwindow != cw->id)
+    return 2;
+
+  values[2].type = META_PROP_VALUE_CARDINAL;
+  values[2].atom = compositor->atom_net_wm_bypass_compositor;
+  values[2].required_type = None;
+
+  return 3;
+}
+
+static void
+set_window_props (MetaDisplay    *display,
+                  MetaCompWindow *cw,
+                  MetaPropValue  *values,
+                  int             n_values)
+{
+  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+
+  if (values[0].type != META_PROP_VALUE_INVALID)
+    cw->type = window_type_from_atoms (compositor,
+                                       values[0].v.atom_list.atoms,
+                                       values[0].v.atom_list.n_atoms);
+  else
+    cw->type = META_COMP_WINDOW_NORMAL;
+
+  if (values[1].type != META_PROP_VALUE_INVALID)
+    cw->opacity = (guint) values[1].v.cardinal;
+  else
+    cw->opacity = OPAQUE;
+
+  if (n_values < 3)
+    get_bypass_compositor (display, cw);
+  else if (values[2].type != META_PROP_VALUE_INVALID)
+    cw->bypass_compositor = (guint) values[2].v.cardinal;
+  else
+    cw->bypass_compositor = BYPASS_COMPOSITOR_NONE;
+}
+
+static void
+get_window_props (MetaDisplay    *display,
+                  MetaCompWindow *cw)
+{
+  MetaPropValue values[3];
+  int n_values;
+
+  n_values = init_window_prop_values (display, cw, values);
+  meta_prop_get_values (display, cw->id, values, n_values);
+  set_window_props (display, cw, values, n_values);
+  meta_prop_free_values (values, n_values);
+}
+
+/* Redoes what depends on the type and opacity once the window is set up */
+static void
+window_props_changed (MetaDisplay    *display,
+                      MetaCompWindow *cw)
+{
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+  determine_mode (display, cw->screen, cw);
+  cw->needs_shadow = window_has_shadow (cw);
+
+  /* The shadow pieces are cached per opacity */
+  cw->shadow = NULL;
+
+  if (cw->extents)
+    XFixesDestroyRegion (xdisplay, cw->extents);
+  cw->extents = win_extents (cw, &cw->extents_rect);
+
+  cw->damaged = TRUE;
+#ifdef USE_IDLE_REPAINT
+  add_repair (display);
+#endif
+}
+
+static void
+take_window_shape (MetaDisplay    *display,
+                   MetaCompWindow *cw)
+{
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  xcb_shape_query_extents_reply_t *reply;
+  xcb_generic_error_t *error = NULL;
+
+  reply = xcb_shape_query_extents_reply (XGetXCBConnection (xdisplay),
+                                         cw->shape_cookie, &error);
+  cw->shape_cookie.sequence = 0;
+
+  cw->shaped = reply != NULL && reply->bounding_shaped;
+
+  free (reply);
+  free (error);
+}
+
+static void
+window_props_received (MetaDisplay   *display,
+                       Window         xwindow,
+                       MetaPropValue *values,
+                       int            n_values,
+                       gpointer       user_data)
+{
+  MetaCompWindow *cw = user_data;
+  MetaCompScreen *info = meta_screen_get_compositor_data (cw->screen);
+
+  cw->props_pending = FALSE;
+
+  meta_error_trap_push (display);
+
+  set_window_props (display, cw, values, n_values);
+
+  /* Asked for first, so its reply is in already */
+  if (cw->shape_cookie.sequence != 0)
+    take_window_shape (display, cw);
+
+  meta_error_trap_pop (display, FALSE);
+
+  window_props_changed (display, cw);
+
+  /* Only add the window to the list of docks if it needs a shadow */
+  if (info != NULL && cw->type == META_COMP_WINDOW_DOCK && cw->needs_shadow)
+    {
+      meta_verbose ("Appending %p to dock windows\n", cw);
+      info->dock_windows = g_slist_append (info->dock_windows, cw);
+    }
+}
+
+/* Asks for the properties and the shape of a window being mapped without
+ * waiting for them; window_props_received() fills them in.
+ */
+static void
+request_window_props (MetaDisplay    *display,
+                      MetaCompWindow *cw)
+{
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaPropValue values[3];
+  int n_values;
+
+  if (meta_display_has_shape (display))
+    cw->shape_cookie = xcb_shape_query_extents (XGetXCBConnection (xdisplay),
+                                                cw->id);
+
+  n_values = init_window_prop_values (display, cw, values);
+  meta_prop_get_values_async (display, cw->id, values, n_values,
+                              window_props_received, cw);
+  cw->props_pending = TRUE;
+}
+
+/* A property changed before the ones asked for at map came in, which
+ * may be older now, so read them all again.
+ */
+static void
+take_pending_props (MetaDisplay    *display,
+                    MetaCompWindow *cw)
+{
+  MetaPropValue values[3];
+  int n_values;
+
+  if (!cw->props_pending)
+    return;
+
+  meta_prop_cancel_values_async (cw);
+
+  n_values = init_window_prop_values (display, cw, values);
+  meta_prop_get_values (display, cw->id, values, n_values);
+  window_props_received (display, cw->id, values, n_values, cw);
+  meta_prop_free_values (values, n_values);
+}
+
+static void
+destroy_win (MetaDisplay *display,
+             Window       xwindow,
+             gboolean     gone);
+
+/* Fills in the attributes asked for when the window was created, keeping
+ * the geometry the events have tracked since.
+ */
+static gboolean
+take_created_attributes (MetaDisplay    *display,
+                         MetaCompWindow *cw)
+{
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  xcb_get_window_attributes_reply_t *reply;
+  xcb_generic_error_t *error = NULL;
+
+  reply = xcb_get_window_attributes_reply (XGetXCBConnection (xdisplay),
+                                           cw->attrs_cookie, &error);
+  cw->attrs_cookie.sequence = 0;
+  free (error);
+
+  if (reply == NULL)
+    return FALSE;
+
+  cw->attrs.class = reply->_class;
+  if (cw->attrs.class == InputOnly)
+    {
+      cw->attrs.visual = meta_screen_lookup_visual (cw->screen,
+                                                    reply->visual, NULL);
+      cw->attrs.depth = 0;
+    }
+  else
+    cw->attrs.visual = meta_screen_lookup_visual (cw->screen, reply->visual,
+                                                  &cw->attrs.depth);
+
+  cw->attrs.root = meta_screen_get_xroot (cw->screen);
+  cw->attrs.screen = ScreenOfDisplay (xdisplay,
+                                      meta_screen_get_screen_number (cw->screen));
+  cw->attrs.bit_gravity = reply->bit_gravity;
+  cw->attrs.win_gravity = reply->win_gravity;
+  cw->attrs.backing_store = reply->backing_store;
+  cw->attrs.backing_planes = reply->backing_planes;
+  cw->attrs.backing_pixel = reply->backing_pixel;
+  cw->attrs.save_under = reply->save_under;
+  cw->attrs.colormap = reply->colormap;
+  cw->attrs.map_installed = reply->map_is_installed;
+  cw->attrs.all_event_masks = reply->all_event_masks;
+  cw->attrs.your_event_mask = reply->your_event_mask;
+  cw->attrs.do_not_propagate_mask = reply->do_not_propagate_mask;
+
+  free (reply);
+
+  return TRUE;
+}
+
+/* Fetches what add_win needs to know about a window beyond its
+ * geometry.  For a window added on CreateNotify nothing is waited for
+ * here: its attributes were asked for then and its properties and shape
+ * are only asked for now.  Must be called with an error trap in place.
+ */
+static gboolean
+init_win (MetaDisplay    *display,
+          MetaScreen     *screen,
+          MetaCompWindow *cw)
+{
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  gulong event_mask;
+
+  if (cw->deferred)
+    {
+      /* PropertyChangeMask was selected by add_created_win, and the
+       * mask in the reply may be stale by now */
+      if (!take_created_attributes (display, cw))
+        return FALSE;
+    }
+  else
+    {
+      if (!XGetWindowAttributes (xdisplay, cw->id, &cw->attrs))
+        return FALSE;
+
+      /* If Metacity has decided not to manage this window then the input
+         events won't have been set on the window */
+      event_mask = cw->attrs.your_event_mask | PropertyChangeMask;
+      XSelectInput (xdisplay, cw->id, event_mask);
+    }
 
-  if (type_atom == compositor->atom_net_wm_window_type_dnd)
-    cw->type = META_COMP_WINDOW_DND;
-  else if (type_atom == compositor->atom_net_wm_window_type_desktop)
-    cw->type = META_COMP_WINDOW_DESKTOP;
-  else if (type_atom == compositor->atom_net_wm_window_type_dock)
-    cw->type = META_COMP_WINDOW_DOCK;
-  else if (type_atom == compositor->atom_net_wm_window_type_menu)
-    cw->type = META_COMP_WINDOW_MENU;
-  else if (type_atom == compositor->atom_net_wm_window_type_dropdown_menu)
-    cw->type = META_COMP_WINDOW_DROP_DOWN_MENU;
-  else if (type_atom == compositor->atom_net_wm_window_type_tooltip)
-    cw->type = META_COMP_WINDOW_TOOLTIP;
+  /* Selected first so nothing set meanwhile is missed */
+  if (cw->deferred)
+    request_window_props (display, cw);
   else
-    cw->type = META_COMP_WINDOW_NORMAL;
+    {
+      get_window_props (display, cw);
+      cw->shaped = is_shaped (display, cw->id);
+    }
 
-/*   meta_verbose ("Window is %d\n", cw->type); */
-}
+  cw->deferred = FALSE;
 
-static void
-destroy_win (MetaDisplay *display,
-             Window       xwindow,
-             gboolean     gone);
+  cw->shape_bounds.x = cw->attrs.x;
+  cw->shape_bounds.y = cw->attrs.y;
+  cw->shape_bounds.width = cw->attrs.width;
+  cw->shape_bounds.height = cw->attrs.height;
+
+  if (cw->attrs.class == InputOnly)
+    cw->damage = None;
+  else
+    cw->damage = XDamageCreate (xdisplay, cw->id, XDamageReportNonEmpty);
+
+  if (cw->window && meta_window_has_focus (cw->window))
+    cw->shadow_type = META_SHADOW_LARGE;
+  else
+    cw->shadow_type = META_SHADOW_MEDIUM;
+
+  determine_mode (display, screen, cw);
+  cw->needs_shadow = window_has_shadow (cw);
+
+  /* Only add the window to the list of docks if it needs a shadow */
+  if (cw->type == META_COMP_WINDOW_DOCK && cw->needs_shadow)
+    {
+      meta_verbose ("Appending %p to dock windows\n", cw);
+      info->dock_windows = g_slist_append (info->dock_windows, cw);
+    }
+
+  return TRUE;
+}
 
 /* Must be called with an error trap in place */
 static void
@@ -2002,7 +3086,6 @@ add_win (MetaScreen *screen,
   Display *xdisplay = meta_display_get_xdisplay (display);
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   MetaCompWindow *cw;
-  gulong event_mask;
 
   if (info == NULL)
     return;
@@ -2017,6 +3100,7 @@ add_win (MetaScreen *screen,
         {
           meta_verbose ("rebind MetaWindow %p with MetaCompWindow\n", window);
           cw->window = window;
+          get_bypass_compositor (display, cw);
           if (!XGetWindowAttributes (xdisplay, xwindow, &cw->attrs))
             {
               cw->shape_bounds.x = cw->attrs.x;
@@ -2035,83 +3119,79 @@ add_win (MetaScreen *screen,
   cw->window = window;
   cw->id = xwindow;
 
-  if (!XGetWindowAttributes (xdisplay, xwindow, &cw->attrs))
+  if (!init_win (display, screen, cw))
     {
       g_free (cw);
       return;
     }
-  get_window_type (display, cw);
 
+  /* Add this to the list at the top of the stack
+     before it is mapped so that map_win can find it again */
+  info->windows = g_list_prepend (info->windows, cw);
+  g_hash_table_insert (info->windows_by_xid, (gpointer) xwindow, cw);
+
+  if (cw->attrs.map_state == IsViewable)
+    map_win (display, screen, xwindow);
+}
 
-  /* If Metacity has decided not to manage this window then the input events
-     won't have been set on the window */
-  event_mask = cw->attrs.your_event_mask | PropertyChangeMask;
-  XSelectInput (xdisplay, xwindow, event_mask);
+/* Adds a window that was just created.  It can't be mapped yet and
+ * lots of them (menus, tooltips, DND icons, windows toolkits keep
+ * around hidden) are destroyed before they ever are, so everything
+ * the CreateNotify doesn't tell us is left for map_win, with only the
+ * attributes asked for here.
+ */
+static void
+add_created_win (MetaScreen         *screen,
+                 MetaWindow         *window,
+                 XCreateWindowEvent *event)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaCompWindow *cw;
 
-  cw->back_pixmap = None;
-  cw->shaded_back_pixmap = None;
+  if (info == NULL)
+    return;
 
-  cw->damaged = FALSE;
-  cw->shaped = is_shaped (display, xwindow);
+  if (event->window == info->output)
+    return;
+
+  cw = g_new0 (MetaCompWindow, 1);
+  cw->screen = screen;
+  cw->window = window;
+  cw->id = event->window;
+  cw->deferred = TRUE;
+
+  cw->attrs.x = event->x;
+  cw->attrs.y = event->y;
+  cw->attrs.width = event->width;
+  cw->attrs.height = event->height;
+  cw->attrs.border_width = event->border_width;
+  cw->attrs.override_redirect = event->override_redirect;
+  cw->attrs.map_state = IsUnmapped;
 
   cw->shape_bounds.x = cw->attrs.x;
   cw->shape_bounds.y = cw->attrs.y;
   cw->shape_bounds.width = cw->attrs.width;
   cw->shape_bounds.height = cw->attrs.height;
 
-  if (cw->attrs.class == InputOnly)
-    cw->damage = None;
-  else
-    cw->damage = XDamageCreate (xdisplay, xwindow, XDamageReportNonEmpty);
-
-  cw->alpha_pict = None;
-  cw->shadow_pict = None;
-  cw->border_size = None;
-  cw->window_size = None;
-  cw->extents = None;
-  cw->shadow = None;
-  cw->shadow_dx = 0;
-  cw->shadow_dy = 0;
-  cw->shadow_width = 0;
-  cw->shadow_height = 0;
-
-  if (window && meta_window_has_focus (window))
-    cw->shadow_type = META_SHADOW_LARGE;
-  else
-    cw->shadow_type = META_SHADOW_MEDIUM;
-
-  {
-    gulong value;
-
-    MetaCompositorXRender* compositor = DISPLAY_COMPOSITOR(display);
-
-    if (meta_prop_get_cardinal (display, xwindow,
-                                compositor->atom_net_wm_window_opacity,
-                                &value) == FALSE)
-      value = OPAQUE;
-
-    cw->opacity = (guint)value;
-  }
-
-  cw->border_clip = None;
+  cw->type = META_COMP_WINDOW_NORMAL;
+  cw->opacity = OPAQUE;
+  cw->mode = WINDOW_SOLID;
 
-  determine_mode (display, screen, cw);
-  cw->needs_shadow = window_has_shadow (cw);
+  /* Nobody but its creator can have selected anything on a window this
+   * new, so this needn't know the current mask.  Our own windows are
+   * left to GDK, which selected what they need when creating them. */
+  if (gdk_x11_window_lookup_for_display (gdk_display_get_default (),
+                                         cw->id) == NULL)
+    XSelectInput (xdisplay, cw->id, PropertyChangeMask);
 
-  /* Only add the window to the list of docks if it needs a shadow */
-  if (cw->type == META_COMP_WINDOW_DOCK && cw->needs_shadow)
-    {
-      meta_verbose ("Appending %p to dock windows\n", cw);
-      info->dock_windows = g_slist_append (info->dock_windows, cw);
-    }
+  /* Taken by map_win, so mapping doesn't wait on the server */
+  cw->attrs_cookie =
+    xcb_get_window_attributes (XGetXCBConnection (xdisplay), cw->id);
 
-  /* Add this to the list at the top of the stack
-     before it is mapped so that map_win can find it again */
   info->windows = g_list_prepend (info->windows, cw);
-  g_hash_table_insert (info->windows_by_xid, (gpointer) xwindow, cw);
-
-  if (cw->attrs.map_state == IsViewable)
-    map_win (display, screen, xwindow);
+  g_hash_table_insert (info->windows_by_xid, (gpointer) cw->id, cw);
 }
 
 static void
@@ -2133,13 +3213,16 @@ destroy_win (MetaDisplay *display,
   if (cw->extents != None)
     {
       dump_xserver_region ("destroy_win", display, cw->extents);
-      add_damage (screen, cw->extents);
+      add_damage (screen, cw->extents, &cw->extents_rect, 1);
       cw->extents = None;
     }
 
   info = meta_screen_get_compositor_data (screen);
   if (info != NULL)
     {
+      if (cw == info->unredirected_window)
+        set_unredirected_window (screen, NULL);
+
       info->windows = g_list_remove (info->windows, (gconstpointer) cw);
       g_hash_table_remove (info->windows_by_xid, (gpointer) xwindow);
     }
@@ -2230,6 +3313,8 @@ resize_win (MetaCompWindow *cw,
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   XserverRegion damage;
   XserverRegion shape;
+  XRectangle damage_rects[3];
+  int n_damage_rects = 0;
   gboolean debug;
 
   debug = DISPLAY_COMPOSITOR (display)->debug;
@@ -2238,6 +3323,7 @@ resize_win (MetaCompWindow *cw,
     {
       damage = XFixesCreateRegion (xdisplay, NULL, 0);
       XFixesCopyRegion (xdisplay, damage, cw->extents);
+      damage_rects[n_damage_rects++] = cw->extents_rect;
     }
   else
     {
@@ -2290,12 +3376,6 @@ resize_win (MetaCompWindow *cw,
           XRenderFreePicture (xdisplay, cw->picture);
           cw->picture = None;
         }
-
-      if (cw->shadow)
-        {
-          XRenderFreePicture (xdisplay, cw->shadow);
-          cw->shadow = None;
-        }
     }
 
   cw->attrs.width = width;
@@ -2306,7 +3386,8 @@ resize_win (MetaCompWindow *cw,
   if (cw->extents)
     XFixesDestroyRegion (xdisplay, cw->extents);
 
-  cw->extents = win_extents (cw);
+  cw->extents = win_extents (cw, &cw->extents_rect);
+  damage_rects[n_damage_rects++] = cw->extents_rect;
 
   if (damage)
     {
@@ -2324,9 +3405,10 @@ resize_win (MetaCompWindow *cw,
   shape = XFixesCreateRegion (xdisplay, &cw->shape_bounds, 1);
   XFixesUnionRegion (xdisplay, damage, damage, shape);
   XFixesDestroyRegion (xdisplay, shape);
+  damage_rects[n_damage_rects++] = cw->shape_bounds;
 
   dump_xserver_region ("resize_win", display, damage);
-  add_damage (screen, damage);
+  add_damage (screen, damage, damage_rects, n_damage_rects);
 
   XFixesDestroyRegion (xdisplay, cw->extents);
   cw->extents = None;
@@ -2431,6 +3513,12 @@ process_configure_notify (MetaCompositorXRender  *compositor,
           info->root_buffer = None;
         }
 
+#ifdef HAVE_PRESENT
+      /* The screen size changed */
+      if (info != NULL)
+        free_back_buffers (screen);
+#endif
+
       damage_screen (screen);
     }
 }
@@ -2495,26 +3583,36 @@ process_property_notify (MetaCompositorXRender *compositor,
       if (!cw)
         return;
 
+      take_pending_props (display, cw);
+
       if (meta_prop_get_cardinal (display, event->window,
                                   compositor->atom_net_wm_window_opacity,
                                   &value) == FALSE)
         value = OPAQUE;
 
       cw->opacity = (guint)value;
-      determine_mode (display, cw->screen, cw);
-      cw->needs_shadow = window_has_shadow (cw);
 
-      if (cw->shadow)
-        {
-          XRenderFreePicture (xdisplay, cw->shadow);
-          cw->shadow = None;
-        }
+      /* Nothing has been set up to redo yet */
+      if (cw->deferred)
+        return;
+
+      window_props_changed (display, cw);
+
+      return;
+    }
+
+  if (event->atom == compositor->atom_net_wm_bypass_compositor)
+    {
+      MetaCompWindow *cw = find_window_in_display (display, event->window);
 
-      if (cw->extents)
-        XFixesDestroyRegion (xdisplay, cw->extents);
-      cw->extents = win_extents (cw);
+      if (!cw)
+        cw = find_window_for_child_window_in_display (display, event->window);
+
+      if (!cw)
+        return;
 
-      cw->damaged = TRUE;
+      take_pending_props (display, cw);
+      get_bypass_compositor (display, cw);
 #ifdef USE_IDLE_REPAINT
       add_repair (display);
 #endif
@@ -2528,6 +3626,7 @@ process_property_notify (MetaCompositorXRender *compositor,
     if (!cw)
       return;
 
+    take_pending_props (display, cw);
     get_window_type (display, cw);
     cw->needs_shadow = window_has_shadow (cw);
     return;
@@ -2546,7 +3645,7 @@ expose_area (MetaScreen *screen,
   region = XFixesCreateRegion (xdisplay, rects, nrects);
 
   dump_xserver_region ("expose_area", display, region);
-  add_damage (screen, region);
+  add_damage (screen, region, rects, nrects);
 }
 
 static void
@@ -2639,7 +3738,7 @@ process_create (MetaCompositorXRender *compositor,
     return;
 
   if (!find_window_in_display (compositor->display, event->window))
-    add_win (screen, window, event->window);
+    add_created_win (screen, window, event);
 }
 
 static void
@@ -2658,7 +3757,10 @@ process_damage (MetaCompositorXRender *compositor,
   if (cw == NULL)
     return;
 
-  repair_win (cw);
+  queue_repair_win (cw);
+#ifdef USE_IDLE_REPAINT
+  add_repair (compositor->display);
+#endif
 }
 
 static void
@@ -2701,13 +3803,106 @@ process_shape (MetaCompositorXRender *compositor,
     }
 }
 
+#ifdef HAVE_PRESENT
+static void
+process_present_idle (MetaCompositorXRender   *compositor,
+                      XPresentIdleNotifyEvent *event)
+{
+  GSList *screens = meta_display_get_screens (compositor->display);
+
+  for (; screens; screens = screens->next)
+    {
+      MetaCompScreen *info = meta_screen_get_compositor_data (screens->data);
+      int i;
+
+      if (info == NULL || info->output != event->window)
+        continue;
+
+      for (i = 0; i < N_BACK_BUFFERS; i++)
+        {
+          if (info->back_buffers[i].pixmap == event->pixmap)
+            info->back_buffers[i].busy = FALSE;
+        }
+
+      if (info->waiting_for_buffer)
+        {
+          info->waiting_for_buffer = FALSE;
+#ifdef USE_IDLE_REPAINT
+          add_repair (compositor->display);
+#endif
+        }
+
+      return;
+    }
+}
+
+static void
+process_present (MetaCompositorXRender *compositor,
+                 XGenericEventCookie   *cookie)
+{
+  XPresentCompleteNotifyEvent *event;
+
+  /* GDK has already fetched the cookie data for us */
+  if (cookie->data == NULL)
+    return;
+
+  if (cookie->evtype == PresentIdleNotify)
+    {
+      process_present_idle (compositor, cookie->data);
+      return;
+    }
+
+  if (cookie->evtype != PresentCompleteNotify)
+    return;
+
+  event = (XPresentCompleteNotifyEvent *) cookie->data;
+
+  /* Completions of frames we have stopped waiting for are stale */
+  if (event->serial_number != compositor->present_serial)
+    return;
+
+  meta_frame_clock_notify_presented (compositor->frame_clock,
+                                     (gint64) event->ust, event->msc);
+}
+#endif
+
 static int
 timeout_debug (MetaCompositorXRender *compositor)
 {
   compositor->show_redraw = (g_getenv ("METACITY_DEBUG_REDRAWS") != NULL);
   compositor->debug = (g_getenv ("METACITY_DEBUG_COMPOSITOR") != NULL);
 
-  return FALSE;
+  if (compositor->debug)
+    {
+      fprintf (stderr, "shadow cache: %u hits, %u misses\n",
+               compositor->shadow_cache_hits, compositor->shadow_cache_misses);
+      fprintf (stderr, "paint time: p50 %" G_GINT64_FORMAT "us p99 %"
+               G_GINT64_FORMAT "us\n",
+               meta_frame_stats_get_paint_time_percentile (compositor->frame_stats, 50),
+               meta_frame_stats_get_paint_time_percentile (compositor->frame_stats, 99));
+    }
+
+#ifdef USE_IDLE_REPAINT
+  if (compositor->debug)
+    {
+      const MetaFrameClockStats *stats;
+
+      stats = meta_frame_clock_get_stats (compositor->frame_clock);
+      fprintf (stderr, "frames: %" G_GUINT64_FORMAT " painted, %"
+               G_GUINT64_FORMAT " dropped, refresh %" G_GINT64_FORMAT
+               "us, paint last %" G_GINT64_FORMAT "us avg %" G_GINT64_FORMAT
+               "us max %" G_GINT64_FORMAT "us\n",
+               stats->frames, stats->frames_dropped, stats->refresh_interval,
+               stats->last_paint_time, stats->avg_paint_time,
+               stats->max_paint_time);
+    }
+#endif
+
+  /* only keep waking up while someone reads the numbers */
+  if (!compositor->debug)
+    compositor->debug_id = 0;
+
+  return compositor->debug;
 }
 
 static void
@@ -2734,37 +3929,6 @@ xrender_remove_window (MetaCompositor *compositor,
 #endif
 }
 
-static void
-show_overlay_window (MetaScreen *screen,
-                     Window      cow)
-{
-  MetaDisplay *display = meta_screen_get_display (screen);
-  Display *xdisplay = meta_display_get_xdisplay (display);
-  XserverRegion region;
-
-  region = XFixesCreateRegion (xdisplay, NULL, 0);
-
-  XFixesSetWindowShapeRegion (xdisplay, cow, ShapeBounding, 0, 0, 0);
-  XFixesSetWindowShapeRegion (xdisplay, cow, ShapeInput, 0, 0, region);
-
-  XFixesDestroyRegion (xdisplay, region);
-
-  damage_screen (screen);
-}
-
-static void
-hide_overlay_window (MetaScreen *screen,
-                     Window      cow)
-{
-  MetaDisplay *display = meta_screen_get_display (screen);
-  Display *xdisplay = meta_display_get_xdisplay (display);
-  XserverRegion region;
-
-  region = XFixesCreateRegion (xdisplay, NULL, 0);
-  XFixesSetWindowShapeRegion (xdisplay, cow, ShapeBounding, 0, 0, region);
-  XFixesDestroyRegion (xdisplay, region);
-}
-
 static Window
 get_output_window (MetaScreen *screen)
 {
@@ -2846,6 +4010,23 @@ xrender_manage_screen (MetaCompositor *compositor,
 
   info->focus_window = meta_display_get_focus_window (display);
 
+#ifdef USE_IDLE_REPAINT
+  if (!DISPLAY_COMPOSITOR (display)->fixed_rate)
+    meta_frame_clock_set_refresh_interval (DISPLAY_COMPOSITOR (display)->frame_clock,
+                                           meta_compositor_get_refresh_interval (screen));
+
+#ifdef HAVE_PRESENT
+  if (DISPLAY_COMPOSITOR (display)->have_present)
+    {
+      info->present_event_id = XPresentSelectInput (xdisplay, info->output,
+                                                    PresentCompleteNotifyMask |
+                                                    PresentIdleNotifyMask);
+      meta_frame_clock_set_wait_for_presentation (DISPLAY_COMPOSITOR (display)->frame_clock,
+                                                  TRUE);
+    }
+#endif
+#endif
+
   info->compositor_active = TRUE;
   info->overlays = 0;
   info->clip_changed = TRUE;
@@ -2890,6 +4071,16 @@ xrender_unmanage_screen (MetaCompositor *compositor,
 
   hide_overlay_window (screen, info->output);
 
+  /* Unredirecting the subwindows below takes care of it */
+  info->unredirected_window = NULL;
+
+#ifdef HAVE_PRESENT
+  if (info->present_event_id != None)
+    XPresentFreeInput (xdisplay, info->output, info->present_event_id);
+
+  free_back_buffers (screen);
+#endif
+
   /* Destroy the windows */
   for (index = info->windows; index; index = index->next)
     {
@@ -2905,12 +4096,25 @@ xrender_unmanage_screen (MetaCompositor *compositor,
   if (info->black_picture)
     XRenderFreePicture (xdisplay, info->black_picture);
 
+  if (info->all_damage_local)
+    cairo_region_destroy (info->all_damage_local);
+
   if (info->have_shadows)
     {
       int i;
 
       for (i = 0; i < LAST_SHADOW_TYPE; i++)
-        g_free (info->shadows[i]->gaussian_map);
+        {
+          int j;
+
+          for (j = 0; j < SHADOW_OPACITY_LEVELS; j++)
+            {
+              if (info->shadow_cache[i][j])
+                free_shadow_pieces (xdisplay, info->shadow_cache[i][j]);
+            }
+
+          g_free (info->shadows[i]->gaussian_map);
+        }
     }
 
   XCompositeReleaseOverlayWindow (xdisplay, info->output);
@@ -2939,10 +4143,31 @@ static void
 xrender_destroy (MetaCompositor *compositor)
 {
 #ifdef HAVE_COMPOSITE_EXTENSIONS
+  MetaCompositorXRender *xrc = (MetaCompositorXRender *) compositor;
+
+  if (xrc->debug_id != 0)
+    g_source_remove (xrc->debug_id);
+
+#ifdef USE_IDLE_REPAINT
+  meta_frame_clock_free (xrc->frame_clock);
+#endif
+
+  meta_frame_stats_free (xrc->frame_stats);
+
   g_free (compositor);
 #endif
 }
 
+static MetaFrameStats *
+xrender_get_frame_stats (MetaCompositor *compositor)
+{
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+  return ((MetaCompositorXRender *) compositor)->frame_stats;
+#else
+  return NULL;
+#endif
+}
+
 #if 0
 /* Taking these out because they're empty and never called, and the
  * compiler complains -- tthurman
@@ -3074,6 +4299,11 @@ xrender_process_event (MetaCompositor *compositor,
         process_damage (xrc, (XDamageNotifyEvent *) event);
       else if (event->type == meta_display_get_shape_event_base (xrc->display) + ShapeNotify)
         process_shape (xrc, (XShapeEvent *) event);
+#ifdef HAVE_PRESENT
+      else if (event->type == GenericEvent && xrc->have_present &&
+               event->xcookie.extension == xrc->present_opcode)
+        process_present (xrc, &event->xcookie);
+#endif
       else
         {
           meta_error_trap_pop (xrc->display, FALSE);
@@ -3180,6 +4410,8 @@ xrender_set_active_window (MetaCompositor *compositor,
   if (old_focus)
     {
       XserverRegion damage;
+      XRectangle damage_rects[2];
+      int n_damage_rects = 0;
 
       /* Tear down old shadows */
       old_focus->shadow_type = META_SHADOW_MEDIUM;
@@ -3188,23 +4420,21 @@ xrender_set_active_window (MetaCompositor *compositor,
 
       if (old_focus->attrs.map_state == IsViewable)
         {
-          if (old_focus->shadow)
-            {
-              XRenderFreePicture (xdisplay, old_focus->shadow);
-              old_focus->shadow = None;
-            }
+          old_focus->shadow = NULL;
 
           if (old_focus->extents)
             {
               damage = XFixesCreateRegion (xdisplay, NULL, 0);
               XFixesCopyRegion (xdisplay, damage, old_focus->extents);
               XFixesDestroyRegion (xdisplay, old_focus->extents);
+              damage_rects[n_damage_rects++] = old_focus->extents_rect;
             }
           else
             damage = None;
 
           /* Build new extents */
-          old_focus->extents = win_extents (old_focus);
+          old_focus->extents = win_extents (old_focus, &old_focus->extents_rect);
+          damage_rects[n_damage_rects++] = old_focus->extents_rect;
 
           if (damage)
             XFixesUnionRegion (xdisplay, damage, damage, old_focus->extents);
@@ -3215,7 +4445,7 @@ xrender_set_active_window (MetaCompositor *compositor,
             }
 
           dump_xserver_region ("resize_win", display, damage);
-          add_damage (screen, damage);
+          add_damage (screen, damage, damage_rects, n_damage_rects);
 
           if (info != NULL)
             {
@@ -3227,28 +4457,28 @@ xrender_set_active_window (MetaCompositor *compositor,
   if (new_focus)
     {
       XserverRegion damage;
+      XRectangle damage_rects[2];
+      int n_damage_rects = 0;
 
       new_focus->shadow_type = META_SHADOW_LARGE;
       determine_mode (display, screen, new_focus);
       new_focus->needs_shadow = window_has_shadow (new_focus);
 
-      if (new_focus->shadow)
-        {
-          XRenderFreePicture (xdisplay, new_focus->shadow);
-          new_focus->shadow = None;
-        }
+      new_focus->shadow = NULL;
 
       if (new_focus->extents)
         {
           damage = XFixesCreateRegion (xdisplay, NULL, 0);
           XFixesCopyRegion (xdisplay, damage, new_focus->extents);
           XFixesDestroyRegion (xdisplay, new_focus->extents);
+          damage_rects[n_damage_rects++] = new_focus->extents_rect;
         }
       else
         damage = None;
 
       /* Build new extents */
-      new_focus->extents = win_extents (new_focus);
+      new_focus->extents = win_extents (new_focus, &new_focus->extents_rect);
+      damage_rects[n_damage_rects++] = new_focus->extents_rect;
 
       if (damage)
         XFixesUnionRegion (xdisplay, damage, damage, new_focus->extents);
@@ -3259,7 +4489,7 @@ xrender_set_active_window (MetaCompositor *compositor,
         }
 
       dump_xserver_region ("resize_win", display, damage);
-      add_damage (screen, damage);
+      add_damage (screen, damage, damage_rects, n_damage_rects);
 
       if (info != NULL)
         {
@@ -3317,6 +4547,7 @@ static MetaCompositor comp_info = {
   xrender_free_window,
   xrender_maximize_window,
   xrender_unmaximize_window,
+  xrender_get_frame_stats,
 };
 
 MetaCompositor *
@@ -3338,7 +4569,8 @@ meta_compositor_xrender_new (MetaDisplay *display)
     "_NET_WM_WINDOW_TYPE_SPLASH",
     "_NET_WM_WINDOW_TYPE_TOOLBAR",
     "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU",
-    "_NET_WM_WINDOW_TYPE_TOOLTIP"
+    "_NET_WM_WINDOW_TYPE_TOOLTIP",
+    "_NET_WM_BYPASS_COMPOSITOR"
   };
   Atom atoms[G_N_ELEMENTS(atom_names)];
   MetaCompositorXRender *xrc;
@@ -3371,16 +4603,54 @@ meta_compositor_xrender_new (MetaDisplay *display)
   xrc->atom_net_wm_window_type_toolbar = atoms[12];
   xrc->atom_net_wm_window_type_dropdown_menu = atoms[13];
   xrc->atom_net_wm_window_type_tooltip = atoms[14];
+  xrc->atom_net_wm_bypass_compositor = atoms[15];
   xrc->show_redraw = FALSE;
   xrc->debug = FALSE;
+  xrc->unredirect = (g_getenv ("META_DEBUG_NO_UNREDIRECT") == NULL);
+  xrc->frame_stats = meta_frame_stats_new ();
+  xrc->frame_record = NULL;
+  xrc->shadow_cache_hits = 0;
+  xrc->shadow_cache_misses = 0;
+
+#ifdef USE_IDLE_REPAINT
+  meta_verbose ("Using frame clock for repaints\n");
+  xrc->frame_clock = meta_frame_clock_new (compositor_paint_frame, xrc);
+  xrc->fixed_rate = FALSE;
+
+  {
+    gint64 interval = meta_compositor_get_fixed_refresh_interval ();
+
+    if (interval > 0)
+      {
+        meta_frame_clock_set_refresh_interval (xrc->frame_clock, interval);
+        xrc->fixed_rate = TRUE;
+      }
+  }
+#endif
+
+#ifdef HAVE_PRESENT
+  xrc->present_serial = 0;
+  xrc->have_present = FALSE;
+  xrc->present_pixmaps = FALSE;
 
 #ifdef USE_IDLE_REPAINT
-  meta_verbose ("Using idle repaint\n");
-  xrc->repaint_id = 0;
+  if (!xrc->fixed_rate)
+    {
+      int event_base, error_base;
+
+      xrc->have_present = XPresentQueryExtension (xdisplay,
+                                                  &xrc->present_opcode,
+                                                  &event_base, &error_base);
+      xrc->present_pixmaps = xrc->have_present &&
+        g_getenv ("META_DEBUG_NO_PRESENT_PIXMAP") == NULL;
+      meta_verbose ("Present extension %s\n",
+                    xrc->have_present ? "available" : "not available");
+    }
+#endif
 #endif
 
   xrc->enabled = TRUE;
-  g_timeout_add (2000, (GSourceFunc) timeout_debug, xrc);
+  xrc->debug_id = g_timeout_add (2000, (GSourceFunc) timeout_debug, xrc);
 
   return compositor;
 #else
@@ -18,20 +18,176 @@
  */
 
 #include <config.h>
+#include <stdlib.h>
 #include "compositor-private.h"
 #include "compositor-xrender.h"
+#include "compositor-gl.h"
+#include "display.h"
+#include "screen.h"
+#include "util.h"
+#ifdef HAVE_RANDR
+#include <X11/extensions/Xrandr.h>
+#endif
 
 MetaCompositor *
 meta_compositor_new (MetaDisplay *display)
 {
 #ifdef HAVE_COMPOSITE_EXTENSIONS
-  /* At some point we would have a way to select between backends */
-  return meta_compositor_xrender_new (display);
+  MetaCompositor *compositor = NULL;
+
+#ifdef HAVE_GL_COMPOSITOR
+  if (g_strcmp0 (g_getenv ("META_COMPOSITOR_BACKEND"), "gl") == 0)
+    {
+      compositor = meta_compositor_gl_new (display);
+      if (compositor == NULL)
+        meta_warning ("OpenGL compositing is not available, using XRender\n");
+    }
+#endif
+
+  if (compositor == NULL)
+    compositor = meta_compositor_xrender_new (display);
+
+  return compositor;
 #else
   return NULL;
 #endif
 }
 
+#ifdef HAVE_RANDR
+static gint64
+mode_refresh_interval (XRRScreenResources *resources,
+                       RRMode              mode)
+{
+  int i;
+
+  for (i = 0; i < resources->nmode; i++)
+    {
+      XRRModeInfo *info = &resources->modes[i];
+      gint64 vtotal;
+
+      if (info->id != mode)
+        continue;
+
+      if (info->dotClock == 0 || info->hTotal == 0 || info->vTotal == 0)
+        return 0;
+
+      vtotal = info->vTotal;
+      if (info->modeFlags & RR_DoubleScan)
+        vtotal *= 2;
+      if (info->modeFlags & RR_Interlace)
+        vtotal /= 2;
+
+      return (gint64) G_USEC_PER_SEC * info->hTotal * vtotal / info->dotClock;
+    }
+
+  return 0;
+}
+
+static gint64
+crtc_refresh_interval (Display            *xdisplay,
+                       XRRScreenResources *resources,
+                       RRCrtc              crtc)
+{
+  XRRCrtcInfo *crtc_info;
+  gint64 interval = 0;
+
+  crtc_info = XRRGetCrtcInfo (xdisplay, resources, crtc);
+  if (crtc_info == NULL)
+    return 0;
+
+  if (crtc_info->mode != None)
+    interval = mode_refresh_interval (resources, crtc_info->mode);
+
+  XRRFreeCrtcInfo (crtc_info);
+
+  return interval;
+}
+#endif
+
+/**
+ * meta_compositor_get_refresh_interval:
+ * @screen: a #MetaScreen
+ *
+ * Returns: the refresh interval of the primary output of @screen in
+ * microseconds, or of the fastest active CRTC if there is no primary
+ * output.  0 if unknown.
+ */
+gint64
+meta_compositor_get_refresh_interval (MetaScreen *screen)
+{
+#ifdef HAVE_RANDR
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  Window xroot = meta_screen_get_xroot (screen);
+  XRRScreenResources *resources;
+  RROutput primary;
+  gint64 interval = 0;
+  int i;
+
+  resources = XRRGetScreenResourcesCurrent (xdisplay, xroot);
+  if (resources == NULL)
+    return 0;
+
+  primary = XRRGetOutputPrimary (xdisplay, xroot);
+  if (primary != None)
+    {
+      XRROutputInfo *output = XRRGetOutputInfo (xdisplay, resources, primary);
+
+      if (output != NULL)
+        {
+          if (output->crtc != None)
+            interval = crtc_refresh_interval (xdisplay, resources, output->crtc);
+
+          XRRFreeOutputInfo (output);
+        }
+    }
+
+  if (interval == 0)
+    {
+      for (i = 0; i < resources->ncrtc; i++)
+        {
+          gint64 crtc_interval;
+
+          crtc_interval = crtc_refresh_interval (xdisplay, resources,
+                                                 resources->crtcs[i]);
+          if (crtc_interval != 0 &&
+              (interval == 0 || crtc_interval < interval))
+            interval = crtc_interval;
+        }
+    }
+
+  XRRFreeScreenResources (resources);
+
+  return interval;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * meta_compositor_get_fixed_refresh_interval:
+ *
+ * Returns: the refresh interval in microseconds forced with
+ * META_IDLE_PAINT_MODE=fixed, at META_IDLE_PAINT_FPS frames per second
+ * or 30 if that isn't set, which overrides whatever the outputs say.
+ * 0 if repaints follow the outputs.
+ */
+gint64
+meta_compositor_get_fixed_refresh_interval (void)
+{
+  const char *mode = g_getenv ("META_IDLE_PAINT_MODE");
+  const char *fps_str;
+  int fps;
+
+  if (mode == NULL || !g_str_equal (mode, "fixed"))
+    return 0;
+
+  fps_str = g_getenv ("META_IDLE_PAINT_FPS");
+  fps = fps_str == NULL ? 30 : atoi (fps_str);
+
+  return fps > 0 ? G_USEC_PER_SEC / fps : 0;
+}
+
 void
 meta_compositor_destroy (MetaCompositor *compositor)
 {
@@ -179,3 +335,29 @@ meta_compositor_unmaximize_window (MetaCompositor *compositor,
     compositor->unmaximize_window (compositor, window);
 #endif
 }
+
+/**
+ * meta_compositor_get_stats:
+ * @compositor: (allow-none): a #MetaCompositor
+ *
+ * Collects the frame timing statistics of the compositing backend, see
+ * meta_frame_stats_to_variant() for the layout.  The dictionary is
+ * empty when compositing is off or the backend keeps no statistics.
+ *
+ * Return value: (transfer floating): an a{sv} #GVariant
+ */
+GVariant *
+meta_compositor_get_stats (MetaCompositor *compositor)
+{
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+  if (compositor && compositor->get_frame_stats)
+    {
+      MetaFrameStats *stats = compositor->get_frame_stats (compositor);
+
+      if (stats)
+        return meta_frame_stats_to_variant (stats);
+    }
+#endif
+
+  return g_variant_new ("a{sv}", NULL);
+}
@@ -0,0 +1,322 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/*
+ * Frame scheduling for the compositor
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The frame clock coalesces damage into at most one repaint per
+ * refresh cycle.  Frames are aimed at a refresh (the "target vblank")
+ * and painting starts early enough before it to cover the recent paint
+ * cost.
+ *
+ * If the backend can tell us when a frame actually reached the screen
+ * (Present CompleteNotify), the clock follows the real refresh phase and
+ * keeps a single frame in flight.  Otherwise it runs on a virtual grid
+ * spaced by the refresh interval reported by the backend.
+ */
+
+#include <config.h>
+
+#include "frame-clock.h"
+
+#define DEFAULT_REFRESH_INTERVAL (G_USEC_PER_SEC / 60)
+
+/* Minimum time we reserve for painting before the target refresh */
+#define MIN_PAINT_BUDGET 1000
+
+/* Stop waiting for a presentation event after this many refresh cycles,
+ * so a lost event (DPMS, VT switch, output removed) can't stall us.
+ */
+#define PRESENTATION_TIMEOUT_CYCLES 4
+
+struct _MetaFrameClock
+{
+  MetaFrameClockPaintFunc paint_func;
+  gpointer user_data;
+
+  MetaFrameClockStats stats;
+
+  gint64  last_vblank;    /* monotonic time of the last known refresh */
+  gint64  target_vblank;  /* refresh the scheduled frame is aimed at */
+  gint64  last_ust;
+  guint64 last_msc;
+
+  guint source_id;
+
+  guint frame_pending : 1;
+  guint in_paint : 1;
+  guint wait_for_presentation : 1;
+  guint awaiting_presentation : 1;
+};
+
+static gint64
+frame_clock_paint_budget (MetaFrameClock *clock)
+{
+  gint64 budget;
+
+  budget = clock->stats.avg_paint_time + MIN_PAINT_BUDGET;
+
+  return CLAMP (budget, MIN_PAINT_BUDGET, clock->stats.refresh_interval / 2);
+}
+
+static gint64
+frame_clock_compute_target (MetaFrameClock *clock,
+                            gint64          now)
+{
+  gint64 interval = clock->stats.refresh_interval;
+  gint64 earliest = now + frame_clock_paint_budget (clock);
+  gint64 cycles;
+
+  if (clock->last_vblank == 0)
+    return earliest;
+
+  /* Without presentation feedback the grid is only virtual, so there is
+   * no point in delaying the first frame after an idle period.
+   */
+  if (!clock->wait_for_presentation &&
+      now - clock->last_vblank >= interval)
+    return earliest;
+
+  cycles = (earliest - clock->last_vblank + interval - 1) / interval;
+  if (cycles < 1)
+    cycles = 1;
+
+  return clock->last_vblank + cycles * interval;
+}
+
+static void
+frame_clock_update_stats (MetaFrameClock *clock,
+                          gint64          paint_time,
+                          gint64          end)
+{
+  MetaFrameClockStats *stats = &clock->stats;
+
+  stats->frames++;
+  stats->last_paint_time = paint_time;
+
+  if (stats->frames == 1)
+    stats->avg_paint_time = paint_time;
+  else
+    stats->avg_paint_time = (stats->avg_paint_time * 15 + paint_time) / 16;
+
+  if (paint_time > stats->max_paint_time)
+    stats->max_paint_time = paint_time;
+
+  if (end > clock->target_vblank)
+    stats->frames_dropped +=
+      (end - clock->target_vblank) / stats->refresh_interval + 1;
+}
+
+static gboolean
+frame_clock_presentation_timeout (gpointer data)
+{
+  MetaFrameClock *clock = data;
+
+  clock->source_id = 0;
+  clock->awaiting_presentation = FALSE;
+  clock->last_vblank = 0;
+
+  if (clock->frame_pending)
+    meta_frame_clock_schedule_frame (clock);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+frame_clock_paint (gpointer data)
+{
+  MetaFrameClock *clock = data;
+  gint64 start, end;
+
+  clock->source_id = 0;
+
+  if (!clock->frame_pending)
+    return G_SOURCE_REMOVE;
+
+  /* Damage added while painting belongs to the next frame */
+  clock->frame_pending = FALSE;
+  clock->in_paint = TRUE;
+
+  start = g_get_monotonic_time ();
+  clock->paint_func (clock->user_data);
+  end = g_get_monotonic_time ();
+
+  clock->in_paint = FALSE;
+
+  frame_clock_update_stats (clock, end - start, end);
+
+  if (clock->wait_for_presentation)
+    {
+      guint timeout;
+
+      timeout = PRESENTATION_TIMEOUT_CYCLES * clock->stats.refresh_interval / 1000;
+
+      clock->awaiting_presentation = TRUE;
+      clock->source_id = g_timeout_add_full (G_PRIORITY_HIGH, timeout,
+                                             frame_clock_presentation_timeout,
+                                             clock, NULL);
+    }
+  else
+    {
+      clock->last_vblank = clock->target_vblank;
+    }
+
+  if (clock->frame_pending)
+    meta_frame_clock_schedule_frame (clock);
+
+  return G_SOURCE_REMOVE;
+}
+
+MetaFrameClock *
+meta_frame_clock_new (MetaFrameClockPaintFunc paint_func,
+                      gpointer                user_data)
+{
+  MetaFrameClock *clock;
+
+  clock = g_new0 (MetaFrameClock, 1);
+  clock->paint_func = paint_func;
+  clock->user_data = user_data;
+  clock->stats.refresh_interval = DEFAULT_REFRESH_INTERVAL;
+
+  return clock;
+}
+
+void
+meta_frame_clock_free (MetaFrameClock *clock)
+{
+  if (clock->source_id != 0)
+    g_source_remove (clock->source_id);
+
+  g_free (clock);
+}
+
+void
+meta_frame_clock_set_refresh_interval (MetaFrameClock *clock,
+                                       gint64          interval)
+{
+  if (interval <= 0)
+    interval = DEFAULT_REFRESH_INTERVAL;
+
+  clock->stats.refresh_interval = interval;
+}
+
+void
+meta_frame_clock_set_wait_for_presentation (MetaFrameClock *clock,
+                                            gboolean        wait)
+{
+  clock->wait_for_presentation = wait != FALSE;
+
+  if (!wait && clock->awaiting_presentation)
+    {
+      g_source_remove (clock->source_id);
+      frame_clock_presentation_timeout (clock);
+    }
+}
+
+/**
+ * meta_frame_clock_schedule_frame:
+ * @clock: a #MetaFrameClock
+ *
+ * Requests a repaint.  Any number of requests made before the frame
+ * is painted result in a single call to the paint function.
+ */
+void
+meta_frame_clock_schedule_frame (MetaFrameClock *clock)
+{
+  gint64 now, delay;
+
+  clock->frame_pending = TRUE;
+
+  if (clock->in_paint ||
+      clock->awaiting_presentation ||
+      clock->source_id != 0)
+    return;
+
+  now = g_get_monotonic_time ();
+  clock->target_vblank = frame_clock_compute_target (clock, now);
+  delay = clock->target_vblank - frame_clock_paint_budget (clock) - now;
+
+  if (delay < 0)
+    delay = 0;
+
+  clock->source_id = g_timeout_add_full (G_PRIORITY_HIGH,
+                                         (delay + 999) / 1000,
+                                         frame_clock_paint,
+                                         clock, NULL);
+}
+
+/**
+ * meta_frame_clock_notify_presented:
+ * @clock: a #MetaFrameClock
+ * @ust: time of the refresh in microseconds
+ * @msc: media stream counter of the refresh
+ *
+ * Tells the clock that the last painted frame reached the screen.
+ * Only meaningful when the clock waits for presentation.
+ */
+void
+meta_frame_clock_notify_presented (MetaFrameClock *clock,
+                                   gint64          ust,
+                                   guint64         msc)
+{
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+
+  if (clock->last_msc != 0 && msc > clock->last_msc && ust > clock->last_ust)
+    {
+      gint64 measured;
+
+      measured = (ust - clock->last_ust) / (gint64) (msc - clock->last_msc);
+
+      /* Ignore nonsense from suspended or reconfigured outputs */
+      if (measured >= G_USEC_PER_SEC / 300 && measured <= G_USEC_PER_SEC / 20)
+        clock->stats.refresh_interval =
+          (clock->stats.refresh_interval * 7 + measured) / 8;
+    }
+
+  clock->last_ust = ust;
+  clock->last_msc = msc;
+
+  /* UST is CLOCK_MONOTONIC on Linux, like g_get_monotonic_time(); if it
+   * obviously isn't, the arrival time is the best guess we have.
+   */
+  if (ust > now || now - ust > G_USEC_PER_SEC)
+    clock->last_vblank = now;
+  else
+    clock->last_vblank = ust;
+
+  if (!clock->awaiting_presentation)
+    return;
+
+  clock->awaiting_presentation = FALSE;
+
+  if (clock->source_id != 0)
+    {
+      g_source_remove (clock->source_id);
+      clock->source_id = 0;
+    }
+
+  if (clock->frame_pending)
+    meta_frame_clock_schedule_frame (clock);
+}
+
+const MetaFrameClockStats *
+meta_frame_clock_get_stats (MetaFrameClock *clock)
+{
+  return &clock->stats;
+}
@@ -0,0 +1,55 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/*
+ * Frame scheduling for the compositor
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef META_FRAME_CLOCK_H
+#define META_FRAME_CLOCK_H
+
+#include <glib.h>
+
+typedef struct _MetaFrameClock MetaFrameClock;
+
+typedef struct _MetaFrameClockStats
+{
+  guint64 frames;            /* number of frames painted */
+  guint64 frames_dropped;    /* refresh cycles missed by a due frame */
+  gint64  refresh_interval;  /* microseconds */
+  gint64  last_paint_time;   /* microseconds spent in the last paint */
+  gint64  avg_paint_time;    /* moving average, microseconds */
+  gint64  max_paint_time;    /* microseconds */
+} MetaFrameClockStats;
+
+typedef void (* MetaFrameClockPaintFunc) (gpointer user_data);
+
+MetaFrameClock *meta_frame_clock_new   (MetaFrameClockPaintFunc paint_func,
+                                        gpointer                user_data);
+void            meta_frame_clock_free  (MetaFrameClock         *clock);
+
+void meta_frame_clock_set_refresh_interval     (MetaFrameClock *clock,
+                                                gint64          interval);
+void meta_frame_clock_set_wait_for_presentation (MetaFrameClock *clock,
+                                                 gboolean        wait);
+
+void meta_frame_clock_schedule_frame   (MetaFrameClock *clock);
+void meta_frame_clock_notify_presented (MetaFrameClock *clock,
+                                        gint64          ust,
+                                        guint64         msc);
+
+const MetaFrameClockStats *meta_frame_clock_get_stats (MetaFrameClock *clock);
+
+#endif
@@ -0,0 +1,228 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/*
+ * Per-frame compositor statistics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The backends fill in one record per painted frame and the last
+ * FRAME_STATS_HISTORY of them are kept in a ring.  Recording is a few
+ * integer stores per frame; sorting for percentiles only happens when
+ * somebody asks for them.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame-stats.h"
+
+#define FRAME_STATS_HISTORY 512
+
+struct _MetaFrameStats
+{
+  MetaFrameRecord records[FRAME_STATS_HISTORY];
+  guint next;        /* slot the next frame goes to */
+  guint n_records;   /* valid records, at most FRAME_STATS_HISTORY */
+  guint64 frames;    /* frames recorded since startup */
+
+  MetaFrameRecord current;
+  gint64 frame_start;
+};
+
+static int
+compare_int64 (const void *a,
+               const void *b)
+{
+  gint64 va = *(const gint64 *) a;
+  gint64 vb = *(const gint64 *) b;
+
+  return va < vb ? -1 : (va > vb ? 1 : 0);
+}
+
+/* Nearest rank percentile of values, which gets sorted */
+static gint64
+percentile (gint64 *values,
+            guint   n_values,
+            guint   percent)
+{
+  guint rank;
+
+  if (n_values == 0)
+    return 0;
+
+  qsort (values, n_values, sizeof (gint64), compare_int64);
+
+  rank = (n_values * percent + 99) / 100;
+  if (rank < 1)
+    rank = 1;
+
+  return values[MIN (rank, n_values) - 1];
+}
+
+/* Walks the ring from the oldest record to the newest */
+static const MetaFrameRecord *
+get_record (MetaFrameStats *stats,
+            guint           i)
+{
+  guint oldest = (stats->next + FRAME_STATS_HISTORY - stats->n_records)
+                 % FRAME_STATS_HISTORY;
+
+  return &stats->records[(oldest + i) % FRAME_STATS_HISTORY];
+}
+
+MetaFrameStats *
+meta_frame_stats_new (void)
+{
+  return g_new0 (MetaFrameStats, 1);
+}
+
+void
+meta_frame_stats_free (MetaFrameStats *stats)
+{
+  g_free (stats);
+}
+
+/**
+ * meta_frame_stats_begin_frame:
+ * @stats: a #MetaFrameStats
+ *
+ * Starts timing a frame.
+ *
+ * Return value: the record for the frame, to be filled in by the
+ * caller until meta_frame_stats_end_frame() is called.
+ */
+MetaFrameRecord *
+meta_frame_stats_begin_frame (MetaFrameStats *stats)
+{
+  memset (&stats->current, 0, sizeof (MetaFrameRecord));
+  stats->frame_start = g_get_monotonic_time ();
+
+  return &stats->current;
+}
+
+/**
+ * meta_frame_stats_end_frame:
+ * @stats: a #MetaFrameStats
+ * @painted: whether anything was painted
+ *
+ * Finishes the current frame.  Frames where nothing was painted are
+ * not recorded, so idle wakeups don't water down the numbers.
+ */
+void
+meta_frame_stats_end_frame (MetaFrameStats *stats,
+                            gboolean        painted)
+{
+  if (!painted)
+    return;
+
+  stats->current.paint_time = g_get_monotonic_time () - stats->frame_start;
+
+  stats->records[stats->next] = stats->current;
+  stats->next = (stats->next + 1) % FRAME_STATS_HISTORY;
+  if (stats->n_records < FRAME_STATS_HISTORY)
+    stats->n_records++;
+  stats->frames++;
+}
+
+gint64
+meta_frame_stats_get_paint_time_percentile (MetaFrameStats *stats,
+                                            guint           percent)
+{
+  gint64 values[FRAME_STATS_HISTORY];
+  guint i;
+
+  for (i = 0; i < stats->n_records; i++)
+    values[i] = get_record (stats, i)->paint_time;
+
+  return percentile (values, stats->n_records, percent);
+}
+
+/**
+ * meta_frame_stats_to_variant:
+ * @stats: a #MetaFrameStats
+ *
+ * Summarises the recorded frames as an a{sv}.  Besides percentiles
+ * and averages it holds the raw records, oldest first, under "history"
+ * as a(xuutu): paint time, windows painted, windows culled, damaged
+ * area and X requests.
+ *
+ * Return value: (transfer floating): the summary
+ */
+GVariant *
+meta_frame_stats_to_variant (MetaFrameStats *stats)
+{
+  GVariantBuilder builder, history;
+  gint64 paint_times[FRAME_STATS_HISTORY];
+  gint64 requests[FRAME_STATS_HISTORY];
+  guint64 painted = 0, culled = 0, area = 0;
+  guint n = stats->n_records;
+  guint i;
+
+  g_variant_builder_init (&history, G_VARIANT_TYPE ("a(xuutu)"));
+
+  for (i = 0; i < n; i++)
+    {
+      const MetaFrameRecord *record = get_record (stats, i);
+
+      paint_times[i] = record->paint_time;
+      requests[i] = record->x_requests;
+      painted += record->windows_painted;
+      culled += record->windows_culled;
+      area += record->damage_area;
+
+      g_variant_builder_add (&history, "(xuutu)",
+                             record->paint_time,
+                             record->windows_painted,
+                             record->windows_culled,
+                             record->damage_area,
+                             record->x_requests);
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+  g_variant_builder_add (&builder, "{sv}", "frames",
+                         g_variant_new_uint64 (stats->frames));
+  g_variant_builder_add (&builder, "{sv}", "samples",
+                         g_variant_new_uint32 (n));
+
+  g_variant_builder_add (&builder, "{sv}", "paint_time_p50",
+                         g_variant_new_int64 (percentile (paint_times, n, 50)));
+  g_variant_builder_add (&builder, "{sv}", "paint_time_p90",
+                         g_variant_new_int64 (percentile (paint_times, n, 90)));
+  g_variant_builder_add (&builder, "{sv}", "paint_time_p99",
+                         g_variant_new_int64 (percentile (paint_times, n, 99)));
+  g_variant_builder_add (&builder, "{sv}", "paint_time_max",
+                         g_variant_new_int64 (percentile (paint_times, n, 100)));
+
+  g_variant_builder_add (&builder, "{sv}", "x_requests_p50",
+                         g_variant_new_int64 (percentile (requests, n, 50)));
+  g_variant_builder_add (&builder, "{sv}", "x_requests_p99",
+                         g_variant_new_int64 (percentile (requests, n, 99)));
+
+  g_variant_builder_add (&builder, "{sv}", "windows_painted_avg",
+                         g_variant_new_double (n ? (double) painted / n : 0.0));
+  g_variant_builder_add (&builder, "{sv}", "windows_culled_avg",
+                         g_variant_new_double (n ? (double) culled / n : 0.0));
+  g_variant_builder_add (&builder, "{sv}", "damage_area_avg",
+                         g_variant_new_double (n ? (double) area / n : 0.0));
+
+  g_variant_builder_add (&builder, "{sv}", "history",
+                         g_variant_builder_end (&history));
+
+  return g_variant_builder_end (&builder);
+}
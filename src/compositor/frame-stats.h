@@ -0,0 +1,48 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/*
+ * Per-frame compositor statistics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef META_FRAME_STATS_H
+#define META_FRAME_STATS_H
+
+#include <glib.h>
+
+typedef struct _MetaFrameStats MetaFrameStats;
+
+typedef struct _MetaFrameRecord
+{
+  gint64  paint_time;       /* microseconds */
+  guint   windows_painted;
+  guint   windows_culled;   /* skipped without talking to the server */
+  guint64 damage_area;      /* pixels, may overestimate */
+  guint   x_requests;       /* X requests issued while painting */
+} MetaFrameRecord;
+
+MetaFrameStats  *meta_frame_stats_new         (void);
+void             meta_frame_stats_free        (MetaFrameStats *stats);
+
+MetaFrameRecord *meta_frame_stats_begin_frame (MetaFrameStats *stats);
+void             meta_frame_stats_end_frame   (MetaFrameStats *stats,
+                                               gboolean        painted);
+
+gint64           meta_frame_stats_get_paint_time_percentile (MetaFrameStats *stats,
+                                                             guint           percentile);
+
+GVariant        *meta_frame_stats_to_variant  (MetaFrameStats *stats);
+
+#endif
@@ -19,6 +19,7 @@
 #include "deepin-message-hub.h"
 #include "deepin-dbus-wm.h"
 #include "deepin-keybindings.h"
+#include "compositor.h"
 
 static DeepinDBusWm* _the_service = NULL;
 
@@ -344,6 +345,31 @@ done:
     return TRUE;
 }
 
+static gboolean deepin_dbus_service_handle_get_compositor_stats (
+        DeepinDBusWm *object,
+        GDBusMethodInvocation *invocation,
+        gpointer data)
+{
+    meta_verbose("%s\n", __func__);
+
+    MetaDisplay* display = meta_get_display();
+    GVariant *stats = meta_compositor_get_stats (display->compositor);
+    deepin_dbus_wm_complete_get_compositor_stats (object, invocation, stats);
+    return TRUE;
+}
+
+static gboolean deepin_dbus_service_handle_get_background_stats (
+        DeepinDBusWm *object,
+        GDBusMethodInvocation *invocation,
+        gpointer data)
+{
+    meta_verbose("%s\n", __func__);
+
+    GVariant *stats = deepin_background_cache_get_stats ();
+    deepin_dbus_wm_complete_get_background_stats (object, invocation, stats);
+    return TRUE;
+}
+
 static gboolean on_idle_startup (gpointer data)
 {
     deepin_message_hub_startup_ready ();
@@ -407,6 +433,10 @@ DeepinDBusWm* deepin_dbus_service_get()
                 deepin_dbus_service_handle_tile_active_window, NULL,
                 "signal::handle_begin_to_move_active_window",
                 deepin_dbus_service_handle_begin_to_move_active_window, NULL,
+                "signal::handle_get_compositor_stats",
+                deepin_dbus_service_handle_get_compositor_stats, NULL,
+                "signal::handle_get_background_stats",
+                deepin_dbus_service_handle_get_background_stats, NULL,
                 NULL);
 
         g_object_connect (G_OBJECT(deepin_message_hub_get ()),
@@ -38,6 +38,7 @@ enum
     SIGNAL_WINDOW_REMOVED,
     SIGNAL_WINDOW_ADDED,
     SIGNAL_WINDOW_DAMAGED,
+    SIGNAL_WANTS_WINDOW_DAMAGE,
     SIGNAL_DESKTOP_CHANGED,
     SIGNAL_SCREEN_CHANGED,
     SIGNAL_ABOUT_TO_CHANGE_WORKSPACE,
@@ -103,7 +104,21 @@ void deepin_message_hub_window_damaged(MetaWindow* window, XRectangle* rects, in
         return;
 
     g_signal_emit(deepin_message_hub_get(),
-            signals[SIGNAL_WINDOW_DAMAGED], 0, window);
+            signals[SIGNAL_WINDOW_DAMAGED], 0, window, rects, n);
+}
+
+/* whether anybody keeps something the damaged parts of window matter to,
+ * so they are worth fetching */
+gboolean deepin_message_hub_wants_window_damage(MetaWindow* window)
+{
+    gboolean wanted = FALSE;
+
+    if (window == NULL || window->unmanaging || window->withdrawn)
+        return FALSE;
+
+    g_signal_emit(deepin_message_hub_get(),
+            signals[SIGNAL_WANTS_WINDOW_DAMAGE], 0, window, &wanted);
+    return wanted;
 }
 
 void deepin_message_hub_desktop_changed(void)
@@ -162,11 +177,19 @@ static void deepin_message_hub_class_init (DeepinMessageHubClass *klass)
             NULL, NULL, NULL,
             G_TYPE_NONE, 1, G_TYPE_POINTER);
 
+    /* rects are in root coordinates, none means the whole window */
     signals[SIGNAL_WINDOW_DAMAGED] = g_signal_new ("window-damaged",
             G_OBJECT_CLASS_TYPE (klass),
             G_SIGNAL_RUN_LAST, 0,
             NULL, NULL, NULL,
-            G_TYPE_NONE, 1, G_TYPE_POINTER);
+            G_TYPE_NONE, 3, G_TYPE_POINTER, G_TYPE_POINTER, G_TYPE_INT);
+
+    /* handlers return TRUE if they want the rects of window-damaged */
+    signals[SIGNAL_WANTS_WINDOW_DAMAGE] = g_signal_new ("wants-window-damage",
+            G_OBJECT_CLASS_TYPE (klass),
+            G_SIGNAL_RUN_LAST, 0,
+            g_signal_accumulator_true_handled, NULL, NULL,
+            G_TYPE_BOOLEAN, 1, G_TYPE_POINTER);
 
     signals[SIGNAL_DESKTOP_CHANGED] = g_signal_new ("desktop-changed",
             G_OBJECT_CLASS_TYPE (klass),
@@ -193,7 +193,6 @@ struct _MetaDisplay
   gboolean    grab_threshold_movement_reached; /* raise_on_click == FALSE.    */
   MetaResizePopup *grab_resize_popup;
   GTimeVal    grab_last_moveresize_time;
-  guint32     grab_motion_notify_time;
   int         grab_wireframe_last_display_width;
   int         grab_wireframe_last_display_height;
   GList*      grab_old_window_stacking;
@@ -253,6 +252,9 @@ struct _MetaDisplay
   /* Managed by group-props.c */
   MetaGroupPropHooks *group_prop_hooks;
 
+  /* Managed by xprops.c, only while windows are being managed at startup */
+  GHashTable *prefetched_props;
+
   /* Managed by compositor.c */
   MetaCompositor *compositor;
 
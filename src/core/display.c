@@ -38,6 +38,7 @@
 #include "window-private.h"
 #include "deepin-message-hub.h"
 #include "deepin-shadow-workspace.h"
+#include "deepin-clone-model.h"
 #include "window-props.h"
 #include "group-props.h"
 #include "frame-private.h"
@@ -411,6 +412,7 @@ meta_display_open (void)
   meta_display_init_window_prop_hooks (the_display);
   the_display->group_prop_hooks = NULL;
   meta_display_init_group_prop_hooks (the_display);
+  the_display->prefetched_props = NULL;
 
   /* Offscreen unmapped window used for _NET_SUPPORTING_WM_CHECK,
    * created in screen_new
@@ -772,6 +774,8 @@ meta_display_open (void)
 
   /* instance message hub before manage windows */
   deepin_message_hub_get();
+  /* so the clones of windows are ready before a view wants them */
+  deepin_clone_model_watch ();
 
   /* Now manage all existing windows */
   tmp = the_display->screens;
@@ -1966,6 +1970,472 @@ handle_input_xevent (MetaDisplay  *display, MetaWindow* window, Window modified,
     }
 }
 
+/* Event coalescing
+ *
+ * By the time an event reaches us Xlib has often read a whole burst
+ * behind it.  Some events only say that some state changed and are
+ * handled by reading that state again, so if a later event in the queue
+ * will do the same, the earlier one needn't be handled:
+ *
+ *  - pointer motion during a mouse grab, if more motion follows before
+ *    any other input event;
+ *  - PropertyNotify, if the same property of the same window changes
+ *    again before anything else happens to the window;
+ *  - ConfigureNotify, if the same window is configured again before any
+ *    other window changes structure (stacking is relative to siblings);
+ *  - DamageNotify, if the same damage object reports again.
+ *
+ * The queue is looked at in one pass per batch: coalesce_scan() files
+ * every such event under its key, in order, and marks it superseded when
+ * the next one with the same key turns up with nothing blocking in
+ * between.  As the events then come through event_callback(),
+ * coalesce_take() pops the verdict off the front of their key.
+ */
+typedef enum
+{
+  COALESCE_NONE = -1,
+  COALESCE_MOTION,
+  COALESCE_PROPERTY,
+  COALESCE_CONFIGURE,
+  COALESCE_DAMAGE,
+  N_COALESCE_KINDS
+} CoalesceKind;
+
+static const char *coalesce_names[N_COALESCE_KINDS] = {
+  "motion", "property", "configure", "damage"
+};
+
+static guint64 coalesce_elided[N_COALESCE_KINDS];
+
+typedef struct
+{
+  CoalesceKind kind;
+  Window       window;
+  XID          detail;          /* atom, event window or damage */
+} CoalesceKey;
+
+typedef struct
+{
+  XEvent   event;               /* to recognise it when it comes through */
+  gboolean superseded;
+  guint    window_generation;   /* what could block it when it was filed */
+  guint    structure_generation;
+  guint    input_generation;
+} CoalesceEntry;
+
+typedef struct
+{
+  GHashTable *entries;          /* CoalesceKey -> GQueue of CoalesceEntry */
+  GHashTable *windows;          /* Window -> generation */
+  guint       structure_generation;
+  guint       input_generation;
+  int         remaining;        /* scanned events not come through yet */
+
+  /* how batches get through, logged under the events topic */
+  guint64     batches;
+  guint       depth;            /* events queued when it was scanned */
+  guint       max_depth;
+  gint64      batch_start;      /* 0 when no batch is coming through */
+  gint64      max_batch_time;   /* microseconds */
+} Coalescer;
+
+static Coalescer coalescer;
+
+static guint
+coalesce_key_hash (gconstpointer v)
+{
+  const CoalesceKey *key = v;
+
+  return (key->window * 31 + key->detail) * 4 + key->kind;
+}
+
+static gboolean
+coalesce_key_equal (gconstpointer a,
+                    gconstpointer b)
+{
+  const CoalesceKey *key_a = a;
+  const CoalesceKey *key_b = b;
+
+  return key_a->kind == key_b->kind &&
+         key_a->window == key_b->window &&
+         key_a->detail == key_b->detail;
+}
+
+static void
+coalesce_entries_free (gpointer data)
+{
+  g_queue_free_full (data, g_free);
+}
+
+static gboolean
+is_structure_event (int type)
+{
+  switch (type)
+    {
+    case CreateNotify:
+    case DestroyNotify:
+    case MapNotify:
+    case UnmapNotify:
+    case ReparentNotify:
+    case ConfigureNotify:
+    case GravityNotify:
+    case CirculateNotify:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static gboolean
+is_core_input_event (int type)
+{
+  switch (type)
+    {
+    case KeyPress:
+    case KeyRelease:
+    case ButtonPress:
+    case ButtonRelease:
+    case MotionNotify:
+    case EnterNotify:
+    case LeaveNotify:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static gboolean
+is_damage_event (MetaDisplay  *display,
+                 const XEvent *event)
+{
+  return META_DISPLAY_HAS_DAMAGE (display) &&
+         event->type == display->damage_event_base + XDamageNotify;
+}
+
+/* Works on queued events too: only the evtype of an XI2 event is
+ * known before its data is fetched. */
+static CoalesceKind
+event_get_coalesce_key (MetaDisplay  *display,
+                        const XEvent *event,
+                        CoalesceKey  *key)
+{
+  key->window = None;
+  key->detail = None;
+
+  if (event->type == GenericEvent)
+    {
+      if (event->xcookie.extension == display->xi_opcode &&
+          event->xcookie.evtype == XI_Motion)
+        return key->kind = COALESCE_MOTION;
+      return key->kind = COALESCE_NONE;
+    }
+
+  switch (event->type)
+    {
+    case PropertyNotify:
+      /* the sentinel counts round trips, each one matters */
+      if (event->xproperty.atom == display->atom__METACITY_SENTINEL)
+        return key->kind = COALESCE_NONE;
+      key->window = event->xproperty.window;
+      key->detail = event->xproperty.atom;
+      return key->kind = COALESCE_PROPERTY;
+
+    case ConfigureNotify:
+      /* the same configure is reported to the window and its parent */
+      key->window = event->xconfigure.window;
+      key->detail = event->xconfigure.event;
+      return key->kind = COALESCE_CONFIGURE;
+
+    default:
+      if (is_damage_event (display, event))
+        {
+          key->window = ((XDamageNotifyEvent*) event)->drawable;
+          key->detail = ((XDamageNotifyEvent*) event)->damage;
+          return key->kind = COALESCE_DAMAGE;
+        }
+      return key->kind = COALESCE_NONE;
+    }
+}
+
+static guint
+window_generation (Window window)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (coalescer.windows,
+                                                GUINT_TO_POINTER (window)));
+}
+
+/* Whether anything that would block entry came after it was filed */
+static gboolean
+coalesce_entry_blocked (CoalesceEntry *entry,
+                        CoalesceKind   kind,
+                        Window         window)
+{
+  switch (kind)
+    {
+    case COALESCE_MOTION:
+      return entry->input_generation != coalescer.input_generation;
+    case COALESCE_CONFIGURE:
+      if (entry->structure_generation != coalescer.structure_generation)
+        return TRUE;
+      /* fall through */
+    case COALESCE_PROPERTY:
+    case COALESCE_DAMAGE:
+      return entry->window_generation != window_generation (window);
+    default:
+      return TRUE;
+    }
+}
+
+/* Moves the generations on for whatever next blocks */
+static void
+coalesce_block (MetaDisplay  *display,
+                const XEvent *next)
+{
+  if (next->type == GenericEvent)
+    {
+      if (next->xcookie.extension == display->xi_opcode &&
+          next->xcookie.evtype != XI_Motion)
+        coalescer.input_generation++;
+      return;
+    }
+
+  if (is_core_input_event (next->type))
+    coalescer.input_generation++;
+
+  if (is_structure_event (next->type))
+    coalescer.structure_generation++;
+
+  /* property changes and damage don't get in each other's way */
+  if (next->type != PropertyNotify && !is_damage_event (display, next))
+    {
+      Window window = next->xany.window;
+
+      /* ConfigureNotify is reported on the parent too */
+      if (next->type == ConfigureNotify)
+        window = next->xconfigure.window;
+
+      g_hash_table_insert (coalescer.windows,
+                           GUINT_TO_POINTER (window),
+                           GUINT_TO_POINTER (window_generation (window) + 1));
+    }
+}
+
+static Bool
+coalesce_scan_predicate (Display  *xdisplay,
+                         XEvent   *next,
+                         XPointer  arg)
+{
+  MetaDisplay *display = (MetaDisplay*) arg;
+  CoalesceKey key;
+  CoalesceEntry *entry;
+  GQueue *entries;
+
+  coalescer.remaining++;
+
+  event_get_coalesce_key (display, next, &key);
+
+  entries = NULL;
+  if (key.kind != COALESCE_NONE)
+    {
+      entries = g_hash_table_lookup (coalescer.entries, &key);
+      if (entries == NULL)
+        {
+          entries = g_queue_new ();
+          g_hash_table_insert (coalescer.entries,
+                               g_memdup (&key, sizeof (key)), entries);
+        }
+
+      entry = g_queue_peek_tail (entries);
+      if (entry != NULL && !coalesce_entry_blocked (entry, key.kind, key.window))
+        entry->superseded = TRUE;
+    }
+
+  coalesce_block (display, next);
+
+  if (entries != NULL)
+    {
+      entry = g_new0 (CoalesceEntry, 1);
+      entry->event = *next;
+      entry->window_generation = window_generation (key.window);
+      entry->structure_generation = coalescer.structure_generation;
+      entry->input_generation = coalescer.input_generation;
+      g_queue_push_tail (entries, entry);
+    }
+
+  return False;
+}
+
+/* Files the events Xlib has already read, in a single pass */
+static void
+coalesce_scan (MetaDisplay *display)
+{
+  XEvent useless;
+
+  if (coalescer.entries == NULL)
+    {
+      coalescer.entries = g_hash_table_new_full (coalesce_key_hash,
+                                                 coalesce_key_equal,
+                                                 g_free,
+                                                 coalesce_entries_free);
+      coalescer.windows = g_hash_table_new (NULL, NULL);
+    }
+
+  g_hash_table_remove_all (coalescer.entries);
+  g_hash_table_remove_all (coalescer.windows);
+  coalescer.remaining = 0;
+
+  /* "useless" isn't filled in because the predicate never returns True */
+  XCheckIfEvent (display->xdisplay,
+                 &useless,
+                 coalesce_scan_predicate,
+                 (XPointer) display);
+
+  /* only needed while scanning */
+  g_hash_table_remove_all (coalescer.windows);
+
+  if (coalescer.remaining > 0)
+    {
+      coalescer.batches++;
+      coalescer.depth = coalescer.remaining;
+      coalescer.max_depth = MAX (coalescer.max_depth, coalescer.depth);
+      coalescer.batch_start = g_get_monotonic_time ();
+    }
+}
+
+/* Times the batch from its scan to its last event coming through */
+static void
+coalesce_end_batch (void)
+{
+  gint64 elapsed;
+
+  if (coalescer.batch_start == 0)
+    return;
+
+  elapsed = g_get_monotonic_time () - coalescer.batch_start;
+  coalescer.max_batch_time = MAX (coalescer.max_batch_time, elapsed);
+  coalescer.batch_start = 0;
+
+  meta_topic (META_DEBUG_EVENTS,
+              "Batch %" G_GUINT64_FORMAT " of %u events took %"
+              G_GINT64_FORMAT "us, deepest %u events, longest %"
+              G_GINT64_FORMAT "us\n",
+              coalescer.batches, coalescer.depth, elapsed,
+              coalescer.max_depth, coalescer.max_batch_time);
+}
+
+/* Whether a later event Xlib already has makes this one redundant,
+ * to be called once for every event coming through */
+static gboolean
+coalesce_take (MetaDisplay *display,
+               XEvent      *event,
+               XIEvent     *input_event)
+{
+  CoalesceKey key;
+  CoalesceEntry *entry;
+  GQueue *entries;
+  gboolean superseded;
+
+  /* Rescan once the last batch came through, or if somebody else took
+   * events out of the queue meanwhile */
+  if (coalescer.remaining <= 0 ||
+      coalescer.remaining > XEventsQueued (display->xdisplay, QueuedAlready))
+    {
+      /* this event is out of the queue already, so it isn't filed */
+      coalesce_end_batch ();
+      coalesce_scan (display);
+      return FALSE;
+    }
+
+  coalescer.remaining--;
+  if (coalescer.remaining == 0)
+    coalesce_end_batch ();
+
+  if (event_get_coalesce_key (display, event, &key) == COALESCE_NONE)
+    return FALSE;
+
+  entries = g_hash_table_lookup (coalescer.entries, &key);
+  if (entries == NULL)
+    return FALSE;
+
+  entry = g_queue_pop_head (entries);
+  if (entry == NULL)
+    return FALSE;
+
+  /* XI2 data is fetched once the event is out of the queue */
+  if (event->type != GenericEvent &&
+      memcmp (&entry->event, event, sizeof (XEvent)) != 0)
+    {
+      /* out of step, don't trust the rest of them */
+      g_free (entry);
+      g_hash_table_remove (coalescer.entries, &key);
+      return FALSE;
+    }
+
+  superseded = entry->superseded;
+  g_free (entry);
+
+  /* motion is only worth dropping when a grab op handles each one */
+  if (key.kind == COALESCE_MOTION)
+    superseded = superseded && input_event != NULL &&
+                 grab_op_is_mouse (display->grab_op);
+
+  if (superseded)
+    {
+      coalesce_elided[key.kind]++;
+      meta_topic (META_DEBUG_EVENTS,
+                  "Elided %s event, %" G_GUINT64_FORMAT " %s events elided so far\n",
+                  coalesce_names[key.kind],
+                  coalesce_elided[key.kind],
+                  coalesce_names[key.kind]);
+    }
+
+  return superseded;
+}
+
+/* Lets the stack of the screen whose root window got a structure event
+ * about one of its children keep track of them */
+static void
+track_root_children (MetaDisplay *display,
+                     XEvent      *event)
+{
+  MetaScreen *screen;
+  Window parent;
+
+  switch (event->type)
+    {
+    case CreateNotify:
+      parent = event->xcreatewindow.parent;
+      break;
+    case DestroyNotify:
+      parent = event->xdestroywindow.event;
+      break;
+    case UnmapNotify:
+      parent = event->xunmap.event;
+      break;
+    case MapNotify:
+      parent = event->xmap.event;
+      break;
+    case ReparentNotify:
+      parent = event->xreparent.event;
+      break;
+    case ConfigureNotify:
+      /* the root window itself changing size */
+      if (event->xconfigure.window == event->xconfigure.event)
+        return;
+      parent = event->xconfigure.event;
+      break;
+    case CirculateNotify:
+      parent = event->xcirculate.event;
+      break;
+    default:
+      return;
+    }
+
+  screen = meta_display_screen_for_root (display, parent);
+  if (screen != NULL && screen->stack != NULL)
+    meta_stack_root_child_event (screen->stack, event);
+}
+
 /**
  * This is the most important function in the whole program. It is the heart,
  * it is the nexus, it is the Grand Central Station of Metacity's world.
@@ -1994,6 +2464,7 @@ event_callback (XEvent   *event,
   XIEvent* input_event;
   XIDeviceEvent* device_event;
   XIEnterEvent* enter_event;
+  gboolean superseded;
 
   display = data;
 
@@ -2006,6 +2477,11 @@ event_callback (XEvent   *event,
   device_event = (XIDeviceEvent*)input_event;
   enter_event = (XIEnterEvent*)input_event;
 
+  /* only the handling of what it says changed is skipped */
+  superseded = coalesce_take (display, event, input_event);
+
+  track_root_children (display, event);
+
 #ifdef HAVE_STARTUP_NOTIFICATION
   sn_display_process_event (display->sn_display, event);
 #endif
@@ -2197,7 +2673,7 @@ event_callback (XEvent   *event,
        }
     }
 
-  if (input_event) {
+  if (input_event && !superseded) {
       handle_input_xevent (display, window, modified, frame_was_receiver, event, input_event);
   }
 
@@ -2346,8 +2822,11 @@ event_callback (XEvent   *event,
       {
 	MetaScreen *screen;
 
-        screen = meta_display_screen_for_root (display,
-                                               event->xconfigure.window);
+        /* a later one has the final size */
+        screen = NULL;
+        if (!superseded)
+          screen = meta_display_screen_for_root (display,
+                                                 event->xconfigure.window);
 
 	if (screen != NULL)
           {
@@ -2410,6 +2889,9 @@ event_callback (XEvent   *event,
         MetaGroup *group;
         MetaScreen *screen;
 
+        if (superseded)
+          break;
+
         if (window && !frame_was_receiver)
           meta_window_property_notify (window, event);
         else if (property_for_window && !frame_was_receiver)
@@ -2668,7 +3150,7 @@ event_callback (XEvent   *event,
       break;
     }
 
-  if (display->compositor)
+  if (display->compositor && !superseded)
     {
       meta_compositor_process_event (display->compositor,
 				     event,
@@ -3775,7 +4257,6 @@ meta_display_begin_grab_op (MetaDisplay *display,
   display->grab_latest_motion_y = root_y;
   display->grab_last_moveresize_time.tv_sec = 0;
   display->grab_last_moveresize_time.tv_usec = 0;
-  display->grab_motion_notify_time = 0;
   display->grab_old_window_stacking = NULL;
   display->grab_sync_request_alarm = None;
   display->grab_last_user_action_was_snap = FALSE;
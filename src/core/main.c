@@ -631,6 +631,7 @@ prefs_changed_callback (MetaPreference pref,
     case META_PREF_FORCE_FULLSCREEN:
     case META_PREF_PLACEMENT_MODE:
     case META_PREF_ALT_TAB_THUMBNAILS:
+    case META_PREF_BACKGROUND_DISK_CACHE:
       break;
 
     default:
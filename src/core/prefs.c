@@ -91,6 +91,7 @@ static gboolean resize_with_right_button = FALSE;
 static gboolean edge_tiling = FALSE;
 static gboolean force_fullscreen = TRUE;
 static gboolean alt_tab_thumbnails = FALSE;
+static gboolean background_disk_cache = TRUE;
 
 static GDesktopVisualBellType visual_bell_type = G_DESKTOP_VISUAL_BELL_FULLSCREEN_FLASH;
 static MetaButtonLayout button_layout;
@@ -366,6 +367,14 @@ static MetaBoolPreference preferences_bool[] =
       &alt_tab_thumbnails,
       FALSE,
     },
+    {
+      { "background-disk-cache",
+        SCHEMA_METACITY,
+        META_PREF_BACKGROUND_DISK_CACHE,
+      },
+      &background_disk_cache,
+      FALSE,
+    },
     { { NULL, 0, 0 }, NULL, FALSE },
   };
 
@@ -1545,6 +1554,9 @@ meta_preference_to_string (MetaPreference pref)
     case META_PREF_ALT_TAB_THUMBNAILS:
       return "ALT_TAB_THUMBNAILS";
 
+    case META_PREF_BACKGROUND_DISK_CACHE:
+      return "BACKGROUND_DISK_CACHE";
+
     default:
       break;
     }
@@ -2032,6 +2044,12 @@ meta_prefs_get_alt_tab_thumbnails (void)
   return alt_tab_thumbnails;
 }
 
+gboolean
+meta_prefs_get_background_disk_cache (void)
+{
+  return background_disk_cache;
+}
+
 void
 meta_prefs_set_compositing_manager (gboolean whether)
 {
@@ -31,6 +31,7 @@
 #include "util.h"
 #include "errors.h"
 #include "window-private.h"
+#include "window-props.h"
 #include "frame-private.h"
 #include "prefs.h"
 #include "workspace.h"
@@ -54,6 +55,7 @@
 #include <X11/extensions/XInput2.h>
 
 #include <X11/Xatom.h>
+#include <X11/Xlib-xcb.h>
 #include <locale.h>
 #include <string.h>
 #include <stdio.h>
@@ -966,6 +968,63 @@ typedef struct
   XWindowAttributes	attrs;
 } WindowInfo;
 
+/* The Visual Xlib has for visual_id, as XGetWindowAttributes() would
+ * find it, for when window attributes come some other way */
+Visual *
+meta_screen_lookup_visual (MetaScreen *screen,
+                           VisualID    visual_id,
+                           int        *depth)
+{
+  Screen *xscreen = screen->xscreen;
+  int i, j;
+
+  for (i = 0; i < xscreen->ndepths; i++)
+    for (j = 0; j < xscreen->depths[i].nvisuals; j++)
+      if (xscreen->depths[i].visuals[j].visualid == visual_id)
+        {
+          if (depth)
+            *depth = xscreen->depths[i].depth;
+          return &xscreen->depths[i].visuals[j];
+        }
+
+  return NULL;
+}
+
+/* What XGetWindowAttributes() makes of the same two replies */
+static void
+fill_window_attributes (MetaScreen                        *screen,
+                        xcb_get_window_attributes_reply_t *attr,
+                        xcb_get_geometry_reply_t          *geom,
+                        XWindowAttributes                 *attrs)
+{
+  attrs->x = geom->x;
+  attrs->y = geom->y;
+  attrs->width = geom->width;
+  attrs->height = geom->height;
+  attrs->border_width = geom->border_width;
+  attrs->depth = geom->depth;
+  attrs->root = geom->root;
+  attrs->visual = meta_screen_lookup_visual (screen, attr->visual, NULL);
+  attrs->class = attr->_class;
+  attrs->bit_gravity = attr->bit_gravity;
+  attrs->win_gravity = attr->win_gravity;
+  attrs->backing_store = attr->backing_store;
+  attrs->backing_planes = attr->backing_planes;
+  attrs->backing_pixel = attr->backing_pixel;
+  attrs->save_under = attr->save_under;
+  attrs->colormap = attr->colormap;
+  attrs->map_installed = attr->map_is_installed;
+  attrs->map_state = attr->map_state;
+  attrs->all_event_masks = attr->all_event_masks;
+  attrs->your_event_mask = attr->your_event_mask;
+  attrs->do_not_propagate_mask = attr->do_not_propagate_mask;
+  attrs->override_redirect = attr->override_redirect;
+  attrs->screen = screen->xscreen;
+}
+
+/* Asks for the attributes of all the children at once and then reads
+ * the replies, rather than making a round trip per child.  The stack
+ * tracks the children from here on */
 static GList *
 list_windows (MetaScreen *screen)
 {
@@ -973,41 +1032,129 @@ list_windows (MetaScreen *screen)
   Window *children;
   guint n_children, i;
   GList *result;
+  xcb_connection_t *xcb;
+  xcb_get_window_attributes_cookie_t *attr_cookies;
+  xcb_get_geometry_cookie_t *geom_cookies;
+
+  meta_stack_reset_root_children (screen->stack,
+                                  NextRequest (screen->display->xdisplay));
 
   XQueryTree (screen->display->xdisplay,
               screen->xroot,
               &ignored1, &ignored2, &children, &n_children);
 
-  result = NULL;
+  xcb = XGetXCBConnection (screen->display->xdisplay);
+  attr_cookies = g_new (xcb_get_window_attributes_cookie_t, n_children);
+  geom_cookies = g_new (xcb_get_geometry_cookie_t, n_children);
+
   for (i = 0; i < n_children; ++i)
     {
-      WindowInfo *info = g_new0 (WindowInfo, 1);
+      attr_cookies[i] = xcb_get_window_attributes (xcb, children[i]);
+      geom_cookies[i] = xcb_get_geometry (xcb, children[i]);
+    }
 
-      meta_error_trap_push_with_return (screen->display);
+  result = NULL;
+  for (i = 0; i < n_children; ++i)
+    {
+      xcb_get_window_attributes_reply_t *attr;
+      xcb_get_geometry_reply_t *geom;
+      xcb_generic_error_t *error = NULL;
+      WindowInfo *info;
 
-      XGetWindowAttributes (screen->display->xdisplay,
-                            children[i], &info->attrs);
+      attr = xcb_get_window_attributes_reply (xcb, attr_cookies[i], &error);
+      free (error);
+      error = NULL;
+      geom = xcb_get_geometry_reply (xcb, geom_cookies[i], &error);
+      free (error);
 
-      if (meta_error_trap_pop_with_return (screen->display, TRUE))
-	{
+      if (attr == NULL || geom == NULL)
+        {
           meta_verbose ("Failed to get attributes for window 0x%lx\n",
                         children[i]);
-	  g_free (info);
         }
       else
         {
-	  info->xwindow = children[i];
-	}
+          info = g_new0 (WindowInfo, 1);
+          info->xwindow = children[i];
+          fill_window_attributes (screen, attr, geom, &info->attrs);
+
+          meta_stack_add_root_child (screen->stack, info->xwindow,
+                                     info->attrs.map_state != IsUnmapped);
+
+          result = g_list_prepend (result, info);
+        }
 
-      result = g_list_prepend (result, info);
+      free (attr);
+      free (geom);
     }
 
+  g_free (attr_cookies);
+  g_free (geom_cookies);
+
   if (children)
     XFree (children);
 
   return g_list_reverse (result);
 }
 
+/* Sends the property requests for every window that will get managed
+ * up front; managing the first one then waits for all the replies at
+ * once instead of each window waiting on its own.  Unmapped windows are
+ * only managed if they have WM_STATE, so that is asked of all of them
+ * at once first */
+static void
+prefetch_initial_properties (MetaScreen *screen,
+                             GList      *windows)
+{
+  MetaDisplay *display = screen->display;
+  xcb_connection_t *xcb;
+  xcb_get_property_cookie_t *cookies;
+  GList *list;
+  int i;
+
+  xcb = XGetXCBConnection (display->xdisplay);
+  cookies = g_new0 (xcb_get_property_cookie_t, g_list_length (windows));
+
+  for (list = windows, i = 0; list != NULL; list = list->next, i++)
+    {
+      WindowInfo *info = list->data;
+
+      if (!info->attrs.override_redirect &&
+          info->attrs.map_state != IsViewable)
+        cookies[i] = xcb_get_property (xcb, FALSE, info->xwindow,
+                                       display->atom_WM_STATE,
+                                       display->atom_WM_STATE, 0, 2);
+    }
+
+  for (list = windows, i = 0; list != NULL; list = list->next, i++)
+    {
+      WindowInfo *info = list->data;
+
+      if (info->attrs.override_redirect)
+        continue;
+
+      if (info->attrs.map_state != IsViewable)
+        {
+          xcb_get_property_reply_t *reply;
+          xcb_generic_error_t *error = NULL;
+          gboolean has_wm_state;
+
+          reply = xcb_get_property_reply (xcb, cookies[i], &error);
+          free (error);
+
+          has_wm_state = reply != NULL && reply->type != XCB_NONE;
+          free (reply);
+
+          if (!has_wm_state)
+            continue;
+        }
+
+      meta_window_prefetch_initial_properties (display, info->xwindow);
+    }
+
+  g_free (cookies);
+}
+
 static void meta_screen_rebuild_backgrounds (MetaScreen *screen)
 {
   if (screen->desktop_bgs) {
@@ -1050,6 +1197,8 @@ meta_screen_manage_all_windows (MetaScreen *screen)
 {
   GList *windows;
   GList *list;
+  gint64 start_time;
+  int n_managed;
 
   if (screen->guard_window == None)
     screen->guard_window = create_guard_window (screen->display->xdisplay,
@@ -1077,8 +1226,13 @@ meta_screen_manage_all_windows (MetaScreen *screen)
 
   meta_display_grab (screen->display);
 
+  start_time = g_get_monotonic_time ();
+  n_managed = 0;
+
   windows = list_windows (screen);
 
+  prefetch_initial_properties (screen, windows);
+
   meta_stack_freeze (screen->stack);
   for (list = windows; list != NULL; list = list->next)
     {
@@ -1087,6 +1241,8 @@ meta_screen_manage_all_windows (MetaScreen *screen)
 
       window = meta_window_new_with_attrs (screen->display, info->xwindow, TRUE,
                                            &info->attrs);
+      if (window)
+        n_managed++;
       if (info->xwindow == screen->no_focus_window ||
           info->xwindow == screen->flash_window ||
 #ifdef HAVE_COMPOSITE_EXTENSIONS
@@ -1114,6 +1270,13 @@ meta_screen_manage_all_windows (MetaScreen *screen)
     }
   meta_stack_thaw (screen->stack);
 
+  meta_prop_drop_prefetched_values (screen->display);
+
+  meta_topic (META_DEBUG_STARTUP,
+              "Managed %d of %d windows in %" G_GINT64_FORMAT " ms\n",
+              n_managed, g_list_length (windows),
+              (g_get_monotonic_time () - start_time) / 1000);
+
   g_list_foreach (windows, (GFunc)g_free, NULL);
   g_list_free (windows);
 
@@ -49,6 +49,13 @@
 
 #define WINDOW_IN_STACK(w) (w->stack_position >= 0)
 
+/* An element of MetaStack::root_children */
+typedef struct
+{
+  Window   xwindow;
+  gboolean mapped;
+} RootChild;
+
 static void stack_sync_to_server (MetaStack *stack);
 static void meta_window_set_stack_position_no_sync (MetaWindow *window,
                                                     int         position);
@@ -77,6 +84,9 @@ meta_stack_new (MetaScreen *screen)
   stack->freeze_count = 0;
   stack->last_root_children_stacked = NULL;
 
+  stack->root_children = g_array_new (FALSE, FALSE, sizeof (RootChild));
+  stack->root_children_serial = 0;
+
   stack->n_positions = 0;
 
   stack->need_resort = FALSE;
@@ -98,9 +108,150 @@ meta_stack_free (MetaStack *stack)
   if (stack->last_root_children_stacked)
     g_array_free (stack->last_root_children_stacked, TRUE);
 
+  g_array_free (stack->root_children, TRUE);
+
   g_free (stack);
 }
 
+static int
+find_root_child (GArray *children,
+                 Window  xwindow)
+{
+  int i;
+
+  for (i = 0; i < (int) children->len; i++)
+    if (g_array_index (children, RootChild, i).xwindow == xwindow)
+      return i;
+
+  return -1;
+}
+
+static void
+remove_root_child (GArray *children,
+                   Window  xwindow)
+{
+  int i;
+
+  i = find_root_child (children, xwindow);
+  if (i >= 0)
+    g_array_remove_index (children, i);
+}
+
+/* Moves xwindow right above sibling, or to the bottom if sibling is
+ * None.  Windows we somehow don't know about are put on top. */
+static void
+restack_root_child (GArray *children,
+                    Window  xwindow,
+                    Window  sibling)
+{
+  RootChild child;
+  int i;
+
+  i = find_root_child (children, xwindow);
+  if (i < 0)
+    return;
+
+  child = g_array_index (children, RootChild, i);
+  g_array_remove_index (children, i);
+
+  if (sibling == None)
+    i = 0;
+  else
+    {
+      i = find_root_child (children, sibling);
+      i = (i < 0) ? (int) children->len : i + 1;
+    }
+
+  g_array_insert_val (children, i, child);
+}
+
+void
+meta_stack_reset_root_children (MetaStack *stack,
+                                gulong     serial)
+{
+  g_array_set_size (stack->root_children, 0);
+  stack->root_children_serial = serial;
+}
+
+void
+meta_stack_add_root_child (MetaStack *stack,
+                           Window     xwindow,
+                           gboolean   mapped)
+{
+  RootChild child;
+
+  if (find_root_child (stack->root_children, xwindow) >= 0)
+    return;
+
+  child.xwindow = xwindow;
+  child.mapped = mapped;
+  g_array_append_val (stack->root_children, child);
+}
+
+void
+meta_stack_root_child_event (MetaStack *stack,
+                             XEvent    *event)
+{
+  GArray *children = stack->root_children;
+  int i;
+
+  /* already seen by the query we started from */
+  if (event->xany.serial < stack->root_children_serial)
+    return;
+
+  switch (event->type)
+    {
+    case CreateNotify:
+      meta_stack_add_root_child (stack, event->xcreatewindow.window, FALSE);
+      break;
+
+    case DestroyNotify:
+      remove_root_child (children, event->xdestroywindow.window);
+      break;
+
+    case ReparentNotify:
+      if (event->xreparent.parent == stack->screen->xroot)
+        meta_stack_add_root_child (stack, event->xreparent.window, FALSE);
+      else
+        remove_root_child (children, event->xreparent.window);
+      break;
+
+    case MapNotify:
+      i = find_root_child (children, event->xmap.window);
+      if (i >= 0)
+        g_array_index (children, RootChild, i).mapped = TRUE;
+      break;
+
+    case UnmapNotify:
+      i = find_root_child (children, event->xunmap.window);
+      if (i >= 0)
+        g_array_index (children, RootChild, i).mapped = FALSE;
+      break;
+
+    case ConfigureNotify:
+      restack_root_child (children, event->xconfigure.window,
+                          event->xconfigure.above);
+      break;
+
+    case CirculateNotify:
+      i = find_root_child (children, event->xcirculate.window);
+      if (i >= 0)
+        {
+          RootChild child = g_array_index (children, RootChild, i);
+
+          g_array_remove_index (children, i);
+          if (event->xcirculate.place == PlaceOnTop)
+            g_array_append_val (children, child);
+          else
+            g_array_prepend_val (children, child);
+        }
+      break;
+
+    default:
+      break;
+    }
+}
+
 void
 meta_stack_add (MetaStack  *stack,
                 MetaWindow *window)
@@ -1039,30 +1190,15 @@ static void
 restack_override_redirected_windows_relative_to_managed (MetaStack *stack)
 {
   MetaScreen* screen;
-  Window ignored1, ignored2;
-  Window *children;
-  unsigned int n_children;
+  GArray *children;
   int i;
 
   screen = stack->screen;
 
-  /* Normally XQueryTree() means "must grab server" but here
-   * we don't, since we know we won't manage any new windows
-   * or restack any windows before using the XQueryTree results.
+  /* The children of the root window and their map state are tracked
+   * from events, so working out what to move needs no round trips.
    */
-
-  meta_error_trap_push_with_return (screen->display);
-
-  XQueryTree (screen->display->xdisplay,
-              screen->xroot,
-              &ignored1, &ignored2, &children, &n_children);
-
-  if (meta_error_trap_pop_with_return (screen->display, TRUE) != Success)
-    {
-      meta_topic (META_DEBUG_STACK,
-                  "Error querying root children to raise or windows\n");
-      return;
-    }
+  children = stack->root_children;
 
   // sorted in top-to-bottom order for XRestackWindows
   GArray *or_windows = g_array_new (FALSE, FALSE, sizeof (Window));
@@ -1070,16 +1206,18 @@ restack_override_redirected_windows_relative_to_managed (MetaStack *stack)
   int guard_id = 0;
 
   /* First, find topmost managed and guard_window as boundary */
-  i = n_children - 1;
+  i = children->len - 1;
   while (i >= 0)
     {
+      Window xwindow = g_array_index (children, RootChild, i).xwindow;
+
       if (topmost_managed == None && 
-              meta_display_lookup_x_window (screen->display, children[i]) != NULL)
+              meta_display_lookup_x_window (screen->display, xwindow) != NULL)
         {
-            topmost_managed = children[i];
+            topmost_managed = xwindow;
         }
 
-      if (screen->guard_window == children[i])
+      if (screen->guard_window == xwindow)
         {
           guard_id = i;
           break;
@@ -1092,27 +1230,19 @@ restack_override_redirected_windows_relative_to_managed (MetaStack *stack)
 
   /* Collect all OR windows visible below the topmost managed, and restack them 
    * restack is heavy, we deliberately reduce the amount of windows need to be 
-   * restacked by checking map state. I assume XGetWindowAttributes is sort of 
-   * more light-weight than XConfigureWindow
+   * restacked by checking map state.
    **/
   i = guard_id+1;
-  while (i < n_children)
+  while (i < (int) children->len)
     {
-      if (topmost_managed == children[i]) break;
+      RootChild *child = &g_array_index (children, RootChild, i);
+
+      if (topmost_managed == child->xwindow) break;
 
-      if (meta_display_lookup_x_window (screen->display, children[i]) == NULL)
+      if (child->mapped &&
+          meta_display_lookup_x_window (screen->display, child->xwindow) == NULL)
         {
-          XWindowAttributes attrs;
-
-          meta_error_trap_push_with_return (screen->display);
-          if (XGetWindowAttributes (screen->display->xdisplay, children[i], &attrs))
-           {
-              if(meta_error_trap_pop_with_return (screen->display, TRUE) == Success &&
-                      attrs.map_state == IsViewable)
-               {
-                 g_array_prepend_val (or_windows, children[i]);
-               }
-           }
+          g_array_prepend_val (or_windows, child->xwindow);
         }
 
       ++i;
@@ -1121,7 +1251,7 @@ restack_override_redirected_windows_relative_to_managed (MetaStack *stack)
   i = 0;
   while (i < or_windows->len) {
       Window or_window = g_array_index (or_windows, Window, i);
-      meta_verbose (META_DEBUG_STACK, "Moving or 0x%lx above topmost managed window 0x%lx\n",
+      meta_topic (META_DEBUG_STACK, "Moving or 0x%lx above topmost managed window 0x%lx\n",
               or_window, topmost_managed);
 
       XWindowChanges changes;
@@ -1134,6 +1264,10 @@ restack_override_redirected_windows_relative_to_managed (MetaStack *stack)
                         CWSibling | CWStackMode,
                         &changes);
       meta_error_trap_pop (screen->display, FALSE);
+
+      /* so the next sync doesn't move it again before the
+       * ConfigureNotify comes back */
+      restack_root_child (children, or_window, topmost_managed);
       ++i;
   }
 
@@ -1142,10 +1276,6 @@ restack_override_redirected_windows_relative_to_managed (MetaStack *stack)
 
 out:
   g_array_free (or_windows, TRUE);
-
-  if (children)
-    XFree (children);
-
 }
 
 /**
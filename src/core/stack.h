@@ -114,6 +114,17 @@ struct _MetaStack
    */
   GArray *last_root_children_stacked;
 
+  /**
+   * All the children of the root window, bottom to top, and whether each
+   * is mapped, as last told by the events on the root window.  Lets us
+   * keep override redirect windows above the managed ones without asking
+   * the server.
+   */
+  GArray *root_children;
+
+  /** Events older than the query root_children started from are stale. */
+  gulong root_children_serial;
+
   /**
    * Number of stack positions; same as the length of added, but
    * kept for quick reference.
@@ -151,6 +162,37 @@ MetaStack *meta_stack_new       (MetaScreen     *screen);
  */
 void       meta_stack_free      (MetaStack      *stack);
 
+/**
+ * Starts tracking the children of the root window over from a query
+ * of them.  They are added bottom to top with meta_stack_add_root_child().
+ *
+ * \param stack  The stack.
+ * \param serial The serial of the XQueryTree() request.
+ */
+void       meta_stack_reset_root_children (MetaStack *stack,
+                                           gulong     serial);
+
+/**
+ * Adds a child of the root window on top of the ones already known.
+ *
+ * \param stack   The stack.
+ * \param xwindow The child.
+ * \param mapped  Whether it is mapped.
+ */
+void       meta_stack_add_root_child      (MetaStack *stack,
+                                           Window     xwindow,
+                                           gboolean   mapped);
+
+/**
+ * Updates the children of the root window from a structure event
+ * received on the root window.
+ *
+ * \param stack The stack.
+ * \param event The event.
+ */
+void       meta_stack_root_child_event    (MetaStack *stack,
+                                           XEvent    *event);
+
 /**
  * Adds a window to the local stack.  It is a fatal error to call this
  * function on a window which already exists on the stack of any screen.
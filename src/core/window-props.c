@@ -70,6 +70,9 @@ typedef enum {
   LOAD_INIT  = (1 << 0),
   INIT_ONLY  = (1 << 1),
   FORCE_INIT = (1 << 2),
+  /* on notify, don't wait for the new value; for properties clients
+   * change often and nothing depends on right away, like titles */
+  ASYNC      = (1 << 3),
 } MetaPropHookFlags;
 
 struct _MetaWindowPropHooks {
@@ -89,6 +92,19 @@ static void reload_prop_value          (MetaWindow          *window,
 static MetaWindowPropHooks* find_hooks (MetaDisplay *display,
                                         Atom         property);
 
+static void
+reload_property_async_done (MetaDisplay   *display,
+                            Window         xwindow,
+                            MetaPropValue *values,
+                            int            n_values,
+                            gpointer       user_data)
+{
+  MetaWindow *window = user_data;
+
+  reload_prop_value (window, find_hooks (display, values[0].atom),
+                     &values[0], FALSE);
+}
+
 void
 meta_window_reload_property_from_xwindow (MetaWindow *window,
                                           Window      xwindow,
@@ -104,6 +120,14 @@ meta_window_reload_property_from_xwindow (MetaWindow *window,
 
   init_prop_value (window, hooks, &value);
 
+  if (!initial && (hooks->flags & ASYNC) && value.atom != None)
+    {
+      meta_prop_get_values_async (window->display, xwindow,
+                                  &value, 1,
+                                  reload_property_async_done, window);
+      return;
+    }
+
   meta_prop_get_values (window->display, xwindow,
                         &value, 1);
 
@@ -124,26 +148,52 @@ meta_window_reload_property (MetaWindow *window,
                                             initial);
 }
 
-void
-meta_window_load_initial_properties (MetaWindow *window)
+/* The values of the properties loaded when a window is managed */
+static MetaPropValue*
+initial_prop_values (MetaDisplay *display,
+                     MetaWindow  *window,
+                     int         *n_values)
 {
   int i, j;
   MetaPropValue *values;
-  int n_properties = 0;
 
-  values = g_new0 (MetaPropValue, window->display->n_prop_hooks);
+  values = g_new0 (MetaPropValue, display->n_prop_hooks);
 
   j = 0;
-  for (i = 0; i < window->display->n_prop_hooks; i++)
+  for (i = 0; i < display->n_prop_hooks; i++)
     {
-      MetaWindowPropHooks *hooks = &window->display->prop_hooks_table[i];
+      MetaWindowPropHooks *hooks = &display->prop_hooks_table[i];
       if (hooks->flags & LOAD_INIT)
         {
           init_prop_value (window, hooks, &values[j]);
           ++j;
         }
     }
-  n_properties = j;
+  *n_values = j;
+
+  return values;
+}
+
+void
+meta_window_prefetch_initial_properties (MetaDisplay *display,
+                                         Window       xwindow)
+{
+  MetaPropValue *values;
+  int n_properties;
+
+  values = initial_prop_values (display, NULL, &n_properties);
+  meta_prop_prefetch_values (display, xwindow, values, n_properties);
+  g_free (values);
+}
+
+void
+meta_window_load_initial_properties (MetaWindow *window)
+{
+  int i, j;
+  MetaPropValue *values;
+  int n_properties = 0;
+
+  values = initial_prop_values (window->display, window, &n_properties);
 
   meta_prop_get_values (window->display, window->xwindow,
                         values, n_properties);
@@ -1776,7 +1826,7 @@ meta_display_init_window_prop_hooks (MetaDisplay *display)
       display->atom__NET_WM_NAME,
       META_PROP_VALUE_UTF8,
       reload_net_wm_name,
-      LOAD_INIT
+      LOAD_INIT | ASYNC
     },
     {
       XA_WM_CLASS,
@@ -1794,19 +1844,19 @@ meta_display_init_window_prop_hooks (MetaDisplay *display)
       XA_WM_NAME,
       META_PROP_VALUE_TEXT_PROPERTY,
       reload_wm_name,
-      LOAD_INIT
+      LOAD_INIT | ASYNC
     },
     {
       display->atom__NET_WM_ICON_NAME,
       META_PROP_VALUE_UTF8,
       reload_net_wm_icon_name,
-      LOAD_INIT
+      LOAD_INIT | ASYNC
     },
     {
       XA_WM_ICON_NAME,
       META_PROP_VALUE_TEXT_PROPERTY,
       reload_wm_icon_name,
-      LOAD_INIT
+      LOAD_INIT | ASYNC
     },
     {
       display->atom__NET_WM_DESKTOP,
@@ -68,6 +68,16 @@ void meta_window_reload_property_from_xwindow (MetaWindow *window,
  */
 void meta_window_load_initial_properties (MetaWindow *window);
 
+/**
+ * Sends the requests meta_window_load_initial_properties() makes for
+ * a window that is about to be managed, without waiting for replies.
+ *
+ * \param display The display.
+ * \param xwindow The X window.
+ */
+void meta_window_prefetch_initial_properties (MetaDisplay *display,
+                                              Window       xwindow);
+
 /**
  * Initialises the hooks used for the reload_propert* functions
  * on a particular display, and stores a pointer to them in the
@@ -1111,6 +1111,7 @@ meta_window_free (MetaWindow  *window,
   meta_window_unqueue (window, META_QUEUE_CALC_SHOWING |
                                META_QUEUE_MOVE_RESIZE |
                                META_QUEUE_UPDATE_ICON);
+  meta_prop_cancel_values_async (window);
   meta_window_free_delete_dialog (window);
 
   if (window->workspace)
@@ -7789,83 +7790,6 @@ update_resize (MetaWindow *window,
     g_get_current_time (&window->display->grab_last_moveresize_time);
 }
 
-typedef struct
-{
-  const XEvent *current_event;
-  int           count;
-  guint32       last_time;
-} EventScannerData;
-
-static Bool
-find_last_time_predicate (Display  *display,
-                          XEvent   *xevent,
-                          XPointer  arg)
-{
-  EventScannerData *esd = (void*) arg;
-
-  if (esd->current_event->type == xevent->type &&
-      esd->current_event->xany.window == xevent->xany.window)
-    {
-      esd->count += 1;
-      esd->last_time = xevent->xmotion.time;
-    }
-
-  return False;
-}
-
-static gboolean
-check_use_this_motion_notify (MetaWindow *window,
-                              XEvent     *event)
-{
-  EventScannerData esd;
-  XEvent useless;
-
-  /* This code is copied from Owen's GDK code. */
-
-  if (window->display->grab_motion_notify_time != 0)
-    {
-      /* == is really the right test, but I'm all for paranoia */
-      if (window->display->grab_motion_notify_time <=
-          event->xmotion.time)
-        {
-          meta_topic (META_DEBUG_RESIZING,
-                      "Arrived at event with time %u (waiting for %u), using it\n",
-                      (unsigned int)event->xmotion.time,
-                      window->display->grab_motion_notify_time);
-          window->display->grab_motion_notify_time = 0;
-          return TRUE;
-        }
-      else
-        return FALSE; /* haven't reached the saved timestamp yet */
-    }
-
-  esd.current_event = event;
-  esd.count = 0;
-  esd.last_time = 0;
-
-  /* "useless" isn't filled in because the predicate never returns True */
-  XCheckIfEvent (window->display->xdisplay,
-                 &useless,
-                 find_last_time_predicate,
-                 (XPointer) &esd);
-
-  if (esd.count > 0)
-    meta_topic (META_DEBUG_RESIZING,
-                "Will skip %d motion events and use the event with time %u\n",
-                esd.count, (unsigned int) esd.last_time);
-
-  if (esd.last_time == 0)
-    return TRUE;
-  else
-    {
-      /* Save this timestamp, and ignore all motion notify
-       * until we get to the one with this stamp.
-       */
-      window->display->grab_motion_notify_time = esd.last_time;
-      return FALSE;
-    }
-}
-
 static void
 update_tile_mode (MetaWindow *window)
 {
@@ -8025,25 +7949,23 @@ meta_window_handle_mouse_grab_op_event (MetaWindow *window,
         {
           if (dev->root == window->screen->xroot)
             {
-              if (check_use_this_motion_notify (window,
-                                                event))
-                update_move (window,
-                             dev->mods.effective & ShiftMask,
-                             dev->root_x,
-                             dev->root_y);
+              /* motion superseded by later motion was already
+               * dropped by the display */
+              update_move (window,
+                           dev->mods.effective & ShiftMask,
+                           dev->root_x,
+                           dev->root_y);
             }
         }
       else if (meta_grab_op_is_resizing (window->display->grab_op))
         {
           if (dev->root == window->screen->xroot)
             {
-              if (check_use_this_motion_notify (window,
-                                                event))
-                update_resize (window,
-                               dev->mods.effective & ShiftMask,
-                               dev->root_x,
-                               dev->root_y,
-                               FALSE);
+              update_resize (window,
+                             dev->mods.effective & ShiftMask,
+                             dev->root_x,
+                             dev->root_y,
+                             FALSE);
             }
         }
       break;
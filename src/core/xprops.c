@@ -965,21 +965,17 @@ latin1_to_utf8 (const char *text)
   return g_string_free (str, FALSE);
 }
 
-void
-meta_prop_get_values (MetaDisplay   *display,
-                      Window         xwindow,
-                      MetaPropValue *values,
-                      int            n_values)
+/* Sends the GetProperty requests for values, tasks[i] is NULL for
+ * values that aren't wanted */
+static AgGetPropertyTask**
+start_tasks (MetaDisplay   *display,
+             Window         xwindow,
+             MetaPropValue *values,
+             int            n_values)
 {
   int i;
   AgGetPropertyTask **tasks;
 
-  meta_verbose ("Requesting %d properties of 0x%lx at once\n",
-                n_values, xwindow);
-
-  if (n_values == 0)
-    return;
-
   tasks = g_new0 (AgGetPropertyTask*, n_values);
 
   /* Start up tasks. The "values" array can have values
@@ -1047,12 +1043,20 @@ meta_prop_get_values (MetaDisplay   *display,
       ++i;
     }
 
-  /* Get replies for all our tasks */
-  meta_topic (META_DEBUG_SYNC, "Syncing to get %d GetProperty replies in %s\n",
-              n_values, G_STRFUNC);
-  XSync (display->xdisplay, False);
+  return tasks;
+}
+
+/* Fills in values from the replies to tasks, which must all have
+ * arrived, and frees tasks */
+static void
+collect_results (MetaDisplay        *display,
+                 Window              xwindow,
+                 MetaPropValue      *values,
+                 int                 n_values,
+                 AgGetPropertyTask **tasks)
+{
+  int i;
 
-  /* Collect results, should arrive in order requested */
   i = 0;
   while (i < n_values)
     {
@@ -1068,8 +1072,9 @@ meta_prop_get_values (MetaDisplay   *display,
           goto next;
         }
 
-      task = ag_get_next_completed_task (display->xdisplay);
-      g_assert (task != NULL);
+      /* Take our own task rather than the next completed one, replies
+       * to meta_prop_get_values_async() may be completed too */
+      task = tasks[i];
       g_assert (ag_task_have_reply (task));
 
       results.display = display;
@@ -1201,6 +1206,309 @@ meta_prop_get_values (MetaDisplay   *display,
   g_free (tasks);
 }
 
+static gboolean
+tasks_completed (AgGetPropertyTask **tasks,
+                 int                 n_tasks)
+{
+  int i;
+
+  for (i = 0; i < n_tasks; i++)
+    if (tasks[i] != NULL && !ag_task_have_reply (tasks[i]))
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Requests of meta_prop_prefetch_values() not yet taken by
+ * meta_prop_get_values(), in display->prefetched_props by window */
+typedef struct
+{
+  MetaPropValue      *values;
+  int                 n_values;
+  AgGetPropertyTask **tasks;
+} PrefetchedValues;
+
+/**
+ * meta_prop_prefetch_values:
+ *
+ * Sends the requests for @values of @xwindow without waiting for the
+ * replies. The next meta_prop_get_values() for the same window and
+ * properties takes them instead of asking again, so prefetching many
+ * windows at once costs a single round trip.
+ */
+void
+meta_prop_prefetch_values (MetaDisplay         *display,
+                           Window               xwindow,
+                           const MetaPropValue *values,
+                           int                  n_values)
+{
+  PrefetchedValues *fetch;
+
+  if (n_values == 0)
+    return;
+
+  if (display->prefetched_props == NULL)
+    display->prefetched_props = g_hash_table_new_full (meta_unsigned_long_hash,
+                                                       meta_unsigned_long_equal,
+                                                       g_free, g_free);
+
+  if (g_hash_table_lookup (display->prefetched_props, &xwindow))
+    return;
+
+  fetch = g_new0 (PrefetchedValues, 1);
+  fetch->values = g_memdup (values, n_values * sizeof (MetaPropValue));
+  fetch->n_values = n_values;
+  fetch->tasks = start_tasks (display, xwindow, fetch->values, n_values);
+
+  g_hash_table_insert (display->prefetched_props,
+                       g_memdup (&xwindow, sizeof (Window)), fetch);
+}
+
+/* The tasks prefetched for exactly these values of xwindow, if any */
+static AgGetPropertyTask**
+take_prefetched (MetaDisplay   *display,
+                 Window         xwindow,
+                 MetaPropValue *values,
+                 int            n_values)
+{
+  PrefetchedValues *fetch;
+  AgGetPropertyTask **tasks;
+  int i;
+
+  if (display->prefetched_props == NULL)
+    return NULL;
+
+  fetch = g_hash_table_lookup (display->prefetched_props, &xwindow);
+  if (fetch == NULL || fetch->n_values != n_values)
+    return NULL;
+
+  for (i = 0; i < n_values; i++)
+    if (fetch->values[i].atom != values[i].atom ||
+        fetch->values[i].type != values[i].type)
+      return NULL;
+
+  for (i = 0; i < n_values; i++)
+    values[i].required_type = fetch->values[i].required_type;
+
+  tasks = fetch->tasks;
+  g_free (fetch->values);
+  g_hash_table_remove (display->prefetched_props, &xwindow);
+
+  return tasks;
+}
+
+/**
+ * meta_prop_drop_prefetched_values:
+ *
+ * Frees whatever meta_prop_prefetch_values() fetched that nobody
+ * asked for, e.g. for windows that ended up not being managed.
+ */
+void
+meta_prop_drop_prefetched_values (MetaDisplay *display)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (display->prefetched_props == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, display->prefetched_props);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      PrefetchedValues *fetch = value;
+
+      if (!tasks_completed (fetch->tasks, fetch->n_values))
+        {
+          meta_topic (META_DEBUG_SYNC,
+                      "Syncing to drop prefetched properties in %s\n",
+                      G_STRFUNC);
+          XSync (display->xdisplay, False);
+        }
+
+      collect_results (display, *(Window *) key,
+                       fetch->values, fetch->n_values, fetch->tasks);
+      meta_prop_free_values (fetch->values, fetch->n_values);
+      g_free (fetch->values);
+      g_hash_table_iter_remove (&iter);
+    }
+
+  g_clear_pointer (&display->prefetched_props, g_hash_table_destroy);
+}
+
+void
+meta_prop_get_values (MetaDisplay   *display,
+                      Window         xwindow,
+                      MetaPropValue *values,
+                      int            n_values)
+{
+  AgGetPropertyTask **tasks;
+
+  meta_verbose ("Requesting %d properties of 0x%lx at once\n",
+                n_values, xwindow);
+
+  if (n_values == 0)
+    return;
+
+  tasks = take_prefetched (display, xwindow, values, n_values);
+  if (tasks == NULL)
+    tasks = start_tasks (display, xwindow, values, n_values);
+
+  /* Get replies for all our tasks */
+  if (!tasks_completed (tasks, n_values))
+    {
+      meta_topic (META_DEBUG_SYNC, "Syncing to get %d GetProperty replies in %s\n",
+                  n_values, G_STRFUNC);
+      XSync (display->xdisplay, False);
+    }
+
+  collect_results (display, xwindow, values, n_values, tasks);
+}
+
+/* Requests of meta_prop_get_values_async() in the order they were sent.
+ * The server replies in that order too, so only the oldest request needs
+ * checking, and nothing waits on the connection: the replies are read
+ * whenever GDK reads events.
+ */
+typedef struct
+{
+  MetaDisplay        *display;
+  Window              xwindow;
+  MetaPropValue      *values;
+  int                 n_values;
+  AgGetPropertyTask **tasks;
+  MetaPropValuesFunc  callback;   /* NULL once cancelled */
+  gpointer            user_data;
+} PropRequest;
+
+static GQueue pending_requests = G_QUEUE_INIT;
+static GSource *replies_source = NULL;
+
+static gboolean
+request_completed (PropRequest *request)
+{
+  int i;
+
+  /* the last reply in means all of them are */
+  for (i = request->n_values - 1; i >= 0; i--)
+    if (request->tasks[i] != NULL)
+      return ag_task_have_reply (request->tasks[i]);
+
+  return TRUE;
+}
+
+static gboolean
+replies_ready (void)
+{
+  PropRequest *request = g_queue_peek_head (&pending_requests);
+
+  return request != NULL && request_completed (request);
+}
+
+static gboolean
+replies_prepare (GSource *source, gint *timeout)
+{
+  *timeout = -1;
+  return replies_ready ();
+}
+
+static gboolean
+replies_check (GSource *source)
+{
+  return replies_ready ();
+}
+
+static gboolean
+replies_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
+{
+  while (replies_ready ())
+    {
+      PropRequest *request = g_queue_pop_head (&pending_requests);
+
+      collect_results (request->display, request->xwindow,
+                       request->values, request->n_values,
+                       request->tasks);
+
+      if (request->callback)
+        (* request->callback) (request->display, request->xwindow,
+                               request->values, request->n_values,
+                               request->user_data);
+
+      meta_prop_free_values (request->values, request->n_values);
+      g_free (request->values);
+      g_free (request);
+    }
+
+  return TRUE;
+}
+
+static GSourceFuncs replies_funcs = {
+  replies_prepare,
+  replies_check,
+  replies_dispatch,
+  NULL
+};
+
+/**
+ * meta_prop_get_values_async:
+ *
+ * Like meta_prop_get_values(), but doesn't wait for the replies.
+ * @callback gets a filled in copy of @values from the main loop once
+ * they are in, which is freed after it returns.
+ */
+void
+meta_prop_get_values_async (MetaDisplay         *display,
+                            Window               xwindow,
+                            const MetaPropValue *values,
+                            int                  n_values,
+                            MetaPropValuesFunc   callback,
+                            gpointer             user_data)
+{
+  PropRequest *request;
+
+  meta_verbose ("Requesting %d properties of 0x%lx asynchronously\n",
+                n_values, xwindow);
+
+  if (replies_source == NULL)
+    {
+      replies_source = g_source_new (&replies_funcs, sizeof (GSource));
+      g_source_set_priority (replies_source, G_PRIORITY_DEFAULT);
+      g_source_attach (replies_source, NULL);
+    }
+
+  request = g_new0 (PropRequest, 1);
+  request->display = display;
+  request->xwindow = xwindow;
+  request->values = g_memdup (values, n_values * sizeof (MetaPropValue));
+  request->n_values = n_values;
+  request->tasks = start_tasks (display, xwindow, request->values, n_values);
+  request->callback = callback;
+  request->user_data = user_data;
+
+  g_queue_push_tail (&pending_requests, request);
+
+  XFlush (display->xdisplay);
+}
+
+/**
+ * meta_prop_cancel_values_async:
+ *
+ * Stops calling back with @user_data for requests still waiting on
+ * their replies, e.g. because it is going away.
+ */
+void
+meta_prop_cancel_values_async (gpointer user_data)
+{
+  GList *l;
+
+  for (l = pending_requests.head; l != NULL; l = l->next)
+    {
+      PropRequest *request = l->data;
+
+      if (request->user_data == user_data)
+        request->callback = NULL;
+    }
+}
+
 static void
 free_value (MetaPropValue *value)
 {
@@ -73,4 +73,6 @@ void meta_compositor_maximize_window   (MetaCompositor *compositor,
 void meta_compositor_unmaximize_window (MetaCompositor *compositor,
                                         MetaWindow     *window);
 
+GVariant *meta_compositor_get_stats (MetaCompositor *compositor);
+
 #endif
@@ -53,6 +53,9 @@ char* deepin_get_background_uri (int index);
 void deepin_change_background_transient (int index, const char* uri);
 void deepin_background_cache_request_new_default_uri();
 
+gsize deepin_background_cache_get_resident_bytes(void);
+GVariant* deepin_background_cache_get_stats(void);
+
 G_END_DECLS
 
 #endif /* _DEEPIN_BACKGROUND_CACHE_H_ */
@@ -0,0 +1,40 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*-  */
+
+/**
+ * Copyright (C) 2015 Deepin Technology Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ **/
+
+#ifndef _DEEPIN_CLONE_MODEL_H_
+#define _DEEPIN_CLONE_MODEL_H_
+
+#include <gtk/gtk.h>
+#include "types.h"
+#include "deepin-cloned-widget.h"
+
+G_BEGIN_DECLS
+
+/* clones of windows, kept between views so that showing the overview or
+ * the multitasking view again doesn't build them again. clones are kept
+ * for as long as their window lives, with an icon and without */
+
+/* builds the clones of windows as they are added from now on */
+void deepin_clone_model_watch(void);
+
+/* a clone of window, with a new reference. one kept that no view is
+ * using, else a new one that is kept as well */
+MetaDeepinClonedWidget* deepin_clone_model_acquire(MetaWindow* window,
+        gboolean show_icon);
+
+/* view is done with clone: disconnects the handlers view connected,
+ * takes clone out of its parent and keeps it for the next view.
+ * drops the reference got from acquire */
+void deepin_clone_model_release(MetaDeepinClonedWidget* clone, gpointer view);
+
+G_END_DECLS
+
+#endif /* _DEEPIN_CLONE_MODEL_H_ */
@@ -52,6 +52,8 @@ void meta_deepin_cloned_widget_set_scale_x(MetaDeepinClonedWidget*, gdouble);
 void meta_deepin_cloned_widget_set_scale_y(MetaDeepinClonedWidget*, gdouble);
 
 void meta_deepin_cloned_widget_set_blur_radius(MetaDeepinClonedWidget*, gdouble);
+/* drops the blurred copies, leaving the clone the snapshot alone */
+void meta_deepin_cloned_widget_release_blur(MetaDeepinClonedWidget*);
 
 void meta_deepin_cloned_widget_set_alpha(MetaDeepinClonedWidget*, gdouble);
 gdouble meta_deepin_cloned_widget_get_alpha(MetaDeepinClonedWidget*);
@@ -65,6 +67,9 @@ void meta_deepin_cloned_widget_translate_x(MetaDeepinClonedWidget*, gdouble);
 void meta_deepin_cloned_widget_translate_y(MetaDeepinClonedWidget*, gdouble);
 
 void meta_deepin_cloned_widget_set_size(MetaDeepinClonedWidget*, gdouble, gdouble);
+/* same, for before the clone is placed: the snapshot is left for the
+ * set_size() that places it, at the scale it is shown at */
+void meta_deepin_cloned_widget_set_initial_size(MetaDeepinClonedWidget*, gdouble, gdouble);
 void meta_deepin_cloned_widget_get_size(MetaDeepinClonedWidget*, gdouble*, gdouble*);
 
 void meta_deepin_cloned_widget_set_render_frame(MetaDeepinClonedWidget*, gboolean);
@@ -52,6 +52,7 @@ DeepinMessageHub* deepin_message_hub_get();
 void deepin_message_hub_window_removed(MetaWindow*);
 void deepin_message_hub_window_added(MetaWindow*);
 void deepin_message_hub_window_damaged(MetaWindow*, XRectangle*, int);
+gboolean deepin_message_hub_wants_window_damage(MetaWindow*);
 void deepin_message_hub_desktop_changed(void);
 void deepin_message_hub_window_about_to_change_workspace(MetaWindow*, MetaWorkspace*);
 void deepin_message_hub_window_above_state_changed(MetaWindow*, gboolean above);
@@ -16,4 +16,10 @@
 #include <cairo.h>
 void stack_blur_surface(cairo_surface_t* surface, int radius);
 
+/* returns a blurred copy of surface, which will be shown at scale.
+ * large radii are blurred at a lower resolution, less so when scale enlarges.
+ */
+cairo_surface_t* stack_blur_surface_scaled(cairo_surface_t* surface,
+        int radius, double scale);
+
 #endif 
@@ -0,0 +1,31 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*-  */
+
+/**
+ * Copyright (C) 2015 Deepin Technology Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ **/
+
+#ifndef _DEEPIN_SURFACE_DAMAGE_H_
+#define _DEEPIN_SURFACE_DAMAGE_H_
+
+#include <cairo.h>
+#include <X11/Xlib.h>
+
+/* what parts of a window surface damage makes stale.  only arithmetic,
+ * kept apart from the surface manager so it can be tested */
+
+/* rects are in root coordinates, the surface is width x height with its
+ * origin at (x, y) on the root.  returns the part of the surface they hit */
+cairo_region_t* deepin_surface_damage_region(const XRectangle* rects, int n,
+        int x, int y, int width, int height);
+
+/* the part of a copy scaled by scale, width x height big, that has to be
+ * fetched again for dirty (unscaled).  extents is what bounds it */
+cairo_region_t* deepin_surface_damage_scale(const cairo_region_t* dirty,
+        double scale, int width, int height, cairo_rectangle_int_t* extents);
+
+#endif /* _DEEPIN_SURFACE_DAMAGE_H_ */
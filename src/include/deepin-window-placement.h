@@ -0,0 +1,46 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*-  */
+
+/**
+ * Copyright (C) 2015 Deepin Technology Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ **/
+
+#ifndef _DEEPIN_WINDOW_PLACEMENT_H_
+#define _DEEPIN_WINDOW_PLACEMENT_H_
+
+#include <gio/gio.h>
+#include "boxes.h"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+    DEEPIN_PLACEMENT_GRID, // a grid, in the order given
+    DEEPIN_PLACEMENT_GRID_CLOSEST, // a grid, each window in the slot nearest to it
+    DEEPIN_PLACEMENT_NATURAL, // push windows apart from where they are
+} DeepinPlacementMode;
+
+/* lays out windows inside area, writing where window i goes to targets[i].
+ * this only does arithmetic, so it can be called from any thread */
+void deepin_window_placement_compute(DeepinPlacementMode mode,
+        const MetaRectangle* windows, int n, MetaRectangle area,
+        MetaRectangle* targets);
+
+void deepin_window_placement_compute_async(DeepinPlacementMode mode,
+        const MetaRectangle* windows, int n, MetaRectangle area,
+        GCancellable* cancellable, GAsyncReadyCallback callback,
+        gpointer user_data);
+/* returns the targets, free with g_free */
+MetaRectangle* deepin_window_placement_compute_finish(GAsyncResult* result,
+        GError** error);
+
+/* drops the layouts cached by the async version */
+void deepin_window_placement_invalidate(void);
+
+G_END_DECLS
+
+#endif /* _DEEPIN_WINDOW_PLACEMENT_H_ */
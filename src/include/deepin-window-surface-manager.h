@@ -50,6 +50,14 @@ DeepinWindowSurfaceManager* deepin_window_surface_manager_get(void);
 /* get surface from window at scale */
 cairo_surface_t* deepin_window_surface_manager_get_surface(MetaWindow*, double);
 
+/* same as above, but a scale not cached yet is made on a worker thread.
+ * finish returns a new reference.
+ */
+void deepin_window_surface_manager_get_surface_async(MetaWindow*, double,
+        GCancellable*, GAsyncReadyCallback, gpointer);
+cairo_surface_t* deepin_window_surface_manager_get_surface_finish(
+        GAsyncResult*, GError**);
+
 /* get combined surface of two windows, second is over first
  * the returned surafce inherit properties (format and size) of first parameter
  */
@@ -62,6 +70,9 @@ cairo_surface_t* deepin_window_surface_manager_get_combined3(
         cairo_surface_t*, int, int, 
         double);
 
+/* changes whenever the surfaces of window would, 0 if none is cached */
+guint deepin_window_surface_manager_get_serial(MetaWindow*);
+
 /* clear surface for window */
 void deepin_window_surface_manager_remove_window(MetaWindow*);
 
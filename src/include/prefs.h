@@ -62,7 +62,8 @@ typedef enum
   META_PREF_EDGE_TILING,
   META_PREF_FORCE_FULLSCREEN,
   META_PREF_PLACEMENT_MODE,
-  META_PREF_ALT_TAB_THUMBNAILS
+  META_PREF_ALT_TAB_THUMBNAILS,
+  META_PREF_BACKGROUND_DISK_CACHE
 } MetaPreference;
 
 typedef enum
@@ -131,6 +132,7 @@ gboolean    meta_prefs_get_force_fullscreen  (void);
 MetaPlacementMode meta_prefs_get_placement_mode (void);
 
 gboolean    meta_prefs_get_alt_tab_thumbnails (void);
+gboolean    meta_prefs_get_background_disk_cache (void);
 
 /**
  * Sets whether the compositor is turned on.
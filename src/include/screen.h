@@ -38,6 +38,10 @@ void meta_screen_set_compositor_data (MetaScreen *screen,
 
 MetaScreen *meta_screen_for_x_screen (Screen *xscreen);
 
+Visual *meta_screen_lookup_visual (MetaScreen *screen,
+                                   VisualID    visual_id,
+                                   int        *depth);
+
 #ifdef HAVE_COMPOSITE_EXTENSIONS
 void meta_screen_set_cm_selection (MetaScreen *screen);
 void meta_screen_unset_cm_selection (MetaScreen *screen);
@@ -211,6 +211,32 @@ void meta_prop_get_values (MetaDisplay   *display,
                            MetaPropValue *values,
                            int            n_values);
 
+typedef void (* MetaPropValuesFunc) (MetaDisplay   *display,
+                                     Window         xwindow,
+                                     MetaPropValue *values,
+                                     int            n_values,
+                                     gpointer       user_data);
+
+/* Same, but doesn't wait: callback gets a filled in copy of values from
+ * the main loop once the replies arrive, and it is freed afterwards */
+void meta_prop_get_values_async (MetaDisplay         *display,
+                                 Window               xwindow,
+                                 const MetaPropValue *values,
+                                 int                  n_values,
+                                 MetaPropValuesFunc   callback,
+                                 gpointer             user_data);
+
+void meta_prop_cancel_values_async (gpointer user_data);
+
+/* Sends the requests of meta_prop_get_values() ahead of time; the next
+ * call for the same window and values uses their replies */
+void meta_prop_prefetch_values (MetaDisplay         *display,
+                                Window               xwindow,
+                                const MetaPropValue *values,
+                                int                  n_values);
+
+void meta_prop_drop_prefetched_values (MetaDisplay *display);
+
 void meta_prop_free_values (MetaPropValue *values,
                             int            n_values);
 
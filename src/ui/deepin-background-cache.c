@@ -12,14 +12,18 @@
 #include <config.h>
 #include <math.h>
 #include <util.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
 #include <cairo.h>
+#include <glib/gstdio.h>
 #include <json-glib/json-glib.h>
 #include "deepin-background-cache.h"
 #include "deepin-message-hub.h"
+#include "prefs.h"
 
 #define BACKGROUND_SCHEMA "com.deepin.wrap.gnome.desktop.background"
 #define EXTRA_BACKGROUND_SCHEMA "com.deepin.dde.appearance"
@@ -29,19 +33,82 @@
 
 static const char* fallback_background_name = "/usr/share/backgrounds/default_background.jpg";
 
-typedef struct _ScaledCacheInfo
+/* surfaces are kept in an LRU by content: the hash of the picture file,
+ * the size of the monitor and the scale. this bounds how many bytes it
+ * holds beyond what is on screen */
+#define SURFACE_CACHE_MAX_BYTES (256 * 1024 * 1024)
+
+/* pictures decoded and scaled to a monitor are also kept on disk, so a
+ * restart can map them instead of decoding again */
+#define DISK_CACHE_MAX_FILES 16
+#define DISK_CACHE_MAGIC 0x47425744 // "DWBG"
+
+#define SOLID_HASH_PREFIX "solid:"
+
+typedef struct _DiskCacheHeader
+{
+    guint32 magic;
+    guint32 format;
+    guint32 width;
+    guint32 height;
+    guint32 stride;
+    guint32 padding[3]; // keep pixels 16 bytes aligned
+} DiskCacheHeader;
+
+/* what to show for one monitor of a workspace */
+typedef struct _BackgroundSlot
 {
     gint monitor;
-    gint workspace;
-    double scale;
+    gint workspace; // -1 for the default background
+    char* path; // picture to show, NULL for solid color
+    char* hash; // content shown, the previous one while path is loading
+    gboolean pending; // path is loading
+    gboolean stale; // path needs to be looked up again
+} BackgroundSlot;
+
+/* every surface the cache made that is still alive, in the LRU or not */
+typedef struct _ResidentSurface
+{
+    DeepinBackgroundCache* owner; // NULL once the cache is gone
+    char* key;
+    gsize bytes;
+} ResidentSurface;
+
+typedef struct _CachedSurface
+{
+    char* key;
     cairo_surface_t* surface;
-} ScaledCacheInfo;
+    gsize bytes;
+    GList* link; // in lru
+} CachedSurface;
+
+/* one decode of a picture, scaled to the size of each monitor */
+typedef struct _BackgroundLoad
+{
+    char* path;
+    char* file_key; // set by the thread, see _make_file_key()
+    char* hash; // set by the thread
+    gint n_monitors;
+    GdkRectangle* geometries;
+    cairo_surface_t** surfaces;
+    char* disk_cache_dir; // NULL if the disk cache is off
+} BackgroundLoad;
 
 struct _DeepinBackgroundCachePrivate
 {
-    GList *caches;
+    GHashTable *slots; // BackgroundSlot, by workspace and monitor
 
-    GList *defaults; // caches for default, monitor&workspace is useless
+    GHashTable *surfaces; // key -> CachedSurface
+    GQueue lru; // CachedSurface, most recently used first
+    gsize cached_bytes;
+
+    // key -> cairo_surface_t, not referenced. surfaces evicted but still
+    // on screen are found here instead of being made again
+    GHashTable *resident;
+    gsize resident_bytes;
+
+    GHashTable *hashes; // file key -> content hash of pictures loaded
+    GHashTable *loads; // path -> GCancellable of decodes in flight
 
     GList *preinstalled_wallpapers;
     GDBusProxy *appearance_intf;
@@ -53,59 +120,188 @@ struct _DeepinBackgroundCachePrivate
 
 static DeepinBackgroundCache* _the_cache = NULL;
 
+static const cairo_user_data_key_t mapped_file_key;
+static const cairo_user_data_key_t resident_key;
+
 
 G_DEFINE_TYPE (DeepinBackgroundCache, deepin_background_cache, G_TYPE_OBJECT);
 
-static void _clear_cache_list(GList **caches) 
+static guint _slot_hash(gconstpointer key)
+{
+    const BackgroundSlot* slot = (const BackgroundSlot*)key;
+    return (guint)slot->workspace * 31 + slot->monitor;
+}
+
+static gboolean _slot_equal(gconstpointer a, gconstpointer b)
+{
+    const BackgroundSlot* sa = (const BackgroundSlot*)a;
+    const BackgroundSlot* sb = (const BackgroundSlot*)b;
+    return sa->workspace == sb->workspace && sa->monitor == sb->monitor;
+}
+
+static void _slot_free(BackgroundSlot* slot)
+{
+    g_free(slot->path);
+    g_free(slot->hash);
+    g_slice_free(BackgroundSlot, slot);
+}
+
+static void _cached_surface_free(CachedSurface* cs)
+{
+    cairo_surface_destroy(cs->surface);
+    g_free(cs->key);
+    g_slice_free(CachedSurface, cs);
+}
+
+static char* _make_key(const char* hash, int width, int height, double scale)
+{
+    return g_strdup_printf("%s/%dx%d/%g", hash, width, height, scale);
+}
+
+// what picture hashes are kept by: a file with the same path, mtime and
+// size is taken to be unchanged, so it is not read again to find out
+static char* _make_file_key(const char* path, const GStatBuf* st)
+{
+    return g_strdup_printf("%s:%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+            path, (gint64)st->st_mtime, (gint64)st->st_size);
+}
+
+static char* _lookup_file_key(const char* path)
+{
+    GStatBuf st;
+    if (g_stat(path, &st) < 0) return NULL;
+    return _make_file_key(path, &st);
+}
+
+static cairo_surface_t* _insert_surface(DeepinBackgroundCache* self, const char* hash,
+        int width, int height, double scale, cairo_surface_t* surface);
+
+static cairo_surface_t* _lookup_surface(DeepinBackgroundCache* self,
+        const char* hash, int width, int height, double scale)
+{
+    DeepinBackgroundCachePrivate* priv = self->priv;
+
+    char* key = _make_key(hash, width, height, scale);
+    CachedSurface* cs = (CachedSurface*)g_hash_table_lookup(priv->surfaces, key);
+    cairo_surface_t* shared = NULL;
+
+    if (cs) {
+        g_queue_unlink(&priv->lru, cs->link);
+        g_queue_push_head_link(&priv->lru, cs->link);
+        shared = cs->surface;
+    } else if ((shared = g_hash_table_lookup(priv->resident, key))) {
+        // evicted but still in use, cache it again
+        _insert_surface(self, hash, width, height, scale,
+                cairo_surface_reference(shared));
+    }
+
+    g_free(key);
+    return shared;
+}
+
+static void _untrack_surface(ResidentSurface* rs)
+{
+    if (rs->owner) {
+        DeepinBackgroundCachePrivate* priv = rs->owner->priv;
+        g_hash_table_remove(priv->resident, rs->key);
+        priv->resident_bytes -= rs->bytes;
+    }
+    g_free(rs->key);
+    g_slice_free(ResidentSurface, rs);
+}
+
+// takes over surface, evicting the least recently used ones beyond the limit.
+// returns what is cached under the key, which may be an equal surface
+// made earlier
+static cairo_surface_t* _insert_surface(DeepinBackgroundCache* self, const char* hash,
+        int width, int height, double scale, cairo_surface_t* surface)
 {
-    if (caches == NULL) return;
+    DeepinBackgroundCachePrivate* priv = self->priv;
 
-    GList* l = *caches;
-    while (l) {
-        ScaledCacheInfo* sci = (ScaledCacheInfo*)l->data;
-        cairo_surface_destroy(sci->surface);
-        g_slice_free(ScaledCacheInfo, sci);
-        l = l->next;
+    char* key = _make_key(hash, width, height, scale);
+    CachedSurface* cached = (CachedSurface*)g_hash_table_lookup(priv->surfaces, key);
+    if (cached) {
+        g_free(key);
+        cairo_surface_destroy(surface);
+        return cached->surface;
     }
-    g_list_free(*caches);
-    *caches = NULL;
+
+    cairo_surface_t* shared = (cairo_surface_t*)g_hash_table_lookup(priv->resident, key);
+    if (shared && shared != surface) {
+        cairo_surface_destroy(surface);
+        surface = cairo_surface_reference(shared);
+    } else if (!shared) {
+        ResidentSurface* rs = g_slice_new0(ResidentSurface);
+        rs->owner = self;
+        rs->key = g_strdup(key);
+        rs->bytes = (gsize)cairo_image_surface_get_stride(surface) *
+            cairo_image_surface_get_height(surface);
+        cairo_surface_set_user_data(surface, &resident_key, rs,
+                (cairo_destroy_func_t)_untrack_surface);
+        g_hash_table_insert(priv->resident, rs->key, surface);
+        priv->resident_bytes += rs->bytes;
+    }
+
+    CachedSurface* cs = g_slice_new0(CachedSurface);
+    cs->key = key;
+    cs->surface = surface;
+    cs->bytes = (gsize)cairo_image_surface_get_stride(surface) *
+        cairo_image_surface_get_height(surface);
+    g_queue_push_head(&priv->lru, cs);
+    cs->link = priv->lru.head;
+    g_hash_table_insert(priv->surfaces, cs->key, cs);
+    priv->cached_bytes += cs->bytes;
+
+    while (priv->cached_bytes > SURFACE_CACHE_MAX_BYTES && priv->lru.length > 1) {
+        CachedSurface* old = (CachedSurface*)g_queue_pop_tail(&priv->lru);
+        meta_verbose("%s: evict %s\n", __func__, old->key);
+        priv->cached_bytes -= old->bytes;
+        g_hash_table_remove(priv->surfaces, old->key);
+    }
+
+    return surface;
 }
 
+static void _cancel_load(gpointer key, gpointer value, gpointer user_data)
+{
+    g_cancellable_cancel(G_CANCELLABLE(value));
+}
+
+// forget which pictures are where. the surfaces stay cached by content
+// and the hashes by file, so pictures that didn't change aren't read again
 static void deepin_background_cache_flush(DeepinBackgroundCache* self)
 {
     DeepinBackgroundCachePrivate* priv = self->priv;
-    if (priv->caches) {
-        _clear_cache_list(&priv->caches);
-    }
 
-    if (priv->defaults) {
-        _clear_cache_list(&priv->defaults);
+    // whatever is still decoding may be outdated
+    g_hash_table_foreach(priv->loads, _cancel_load, NULL);
+    g_hash_table_remove_all(priv->loads);
+
+    GHashTableIter iter;
+    BackgroundSlot* slot;
+    g_hash_table_iter_init(&iter, priv->slots);
+    while (g_hash_table_iter_next(&iter, (gpointer*)&slot, NULL)) {
+        slot->stale = TRUE;
+        slot->pending = FALSE;
     }
 }
 
 static void deepin_background_cache_invalidate(DeepinBackgroundCache* self, int index)
 {
     DeepinBackgroundCachePrivate* priv = self->priv;
-    if (priv->caches) {
-        GList* l = priv->caches;
-        while (l) {
-            ScaledCacheInfo* sci = (ScaledCacheInfo*)l->data;
-            if (sci->workspace == index) {
-                cairo_surface_destroy(sci->surface);
-                g_slice_free(ScaledCacheInfo, sci);
-
-                GList *old = l;
-                l = l->next;
-                priv->caches = g_list_remove_link(priv->caches, old);
-                g_list_free(old);
-            } else {
-                l = l->next;
-            }
+
+    GHashTableIter iter;
+    BackgroundSlot* slot;
+    g_hash_table_iter_init(&iter, priv->slots);
+    while (g_hash_table_iter_next(&iter, (gpointer*)&slot, NULL)) {
+        if (slot->workspace == index) {
+            slot->stale = TRUE;
         }
     }
 }
 
-static GdkPixbuf* _do_scale(DeepinBackgroundCache* self, GdkPixbuf* pixbuf, gint width, gint height)
+// called from load threads, must not touch self
+static GdkPixbuf* _do_scale(GdkPixbuf* pixbuf, gint width, gint height)
 {
     GdkPixbuf* new_pixbuf;
 
@@ -140,14 +336,10 @@ static GdkPixbuf* _do_scale(DeepinBackgroundCache* self, GdkPixbuf* pixbuf, gint
     return new_pixbuf;
 }
 
-static cairo_surface_t* _create_solid_background(DeepinBackgroundCache* self, GdkRectangle r)
+static cairo_surface_t* _create_solid_background(const char* color_str, GdkRectangle r)
 {
-    DeepinBackgroundCachePrivate* priv = self->priv;
-
-    gchar* color_str = g_settings_get_string(priv->bg_settings, GSETTINGS_PRIM_CLR);
     GdkRGBA clr;
     gdk_rgba_parse(&clr, color_str);
-    g_free(color_str);
 
     cairo_surface_t* bg = cairo_image_surface_create(CAIRO_FORMAT_RGB24, r.width, r.height);
     cairo_t* cr = cairo_create(bg);
@@ -158,6 +350,420 @@ static cairo_surface_t* _create_solid_background(DeepinBackgroundCache* self, Gd
     return bg;
 }
 
+// solid backgrounds are addressed by their color
+static char* _solid_hash(DeepinBackgroundCache* self)
+{
+    gchar* color_str = g_settings_get_string(self->priv->bg_settings, GSETTINGS_PRIM_CLR);
+    char* hash = g_strconcat(SOLID_HASH_PREFIX, color_str, NULL);
+    g_free(color_str);
+    return hash;
+}
+
+static char* _disk_cache_filename(const char* dir, const char* hash,
+        int width, int height)
+{
+    char* name = g_strdup_printf("%s-%dx%d", hash, width, height);
+    char* filename = g_build_filename(dir, name, NULL);
+    g_free(name);
+    return filename;
+}
+
+// maps a surface saved by _save_to_disk_cache, pixels are only read
+// from disk as they are drawn
+static cairo_surface_t* _load_from_disk_cache(const char* dir, const char* hash,
+        int width, int height)
+{
+    char* filename = _disk_cache_filename(dir, hash, width, height);
+    // writable only makes the mapping private, the file is never changed
+    GMappedFile* mapped = g_mapped_file_new(filename, TRUE, NULL);
+    cairo_surface_t* surface = NULL;
+
+    if (!mapped) goto out;
+
+    gsize length = g_mapped_file_get_length(mapped);
+    DiskCacheHeader* header = (DiskCacheHeader*)g_mapped_file_get_contents(mapped);
+    if (length < sizeof(DiskCacheHeader) || header->magic != DISK_CACHE_MAGIC ||
+            header->width != width || header->height != height ||
+            (header->format != CAIRO_FORMAT_RGB24 && header->format != CAIRO_FORMAT_ARGB32) ||
+            header->stride != cairo_format_stride_for_width(header->format, width) ||
+            length < sizeof(DiskCacheHeader) + (gsize)header->stride * height) {
+        meta_verbose("%s: %s is corrupt\n", __func__, filename);
+        g_mapped_file_unref(mapped);
+        goto out;
+    }
+
+    surface = cairo_image_surface_create_for_data((unsigned char*)(header + 1),
+            header->format, width, height, header->stride);
+    cairo_surface_set_user_data(surface, &mapped_file_key, mapped,
+            (cairo_destroy_func_t)g_mapped_file_unref);
+
+    // mark it used, pruning goes by age
+    g_utime(filename, NULL);
+
+out:
+    g_free(filename);
+    return surface;
+}
+
+static gint _compare_mtime(gconstpointer a, gconstpointer b)
+{
+    GStatBuf* sa = (GStatBuf*)((gchar**)a)[1];
+    GStatBuf* sb = (GStatBuf*)((gchar**)b)[1];
+    return sa->st_mtime < sb->st_mtime ? 1 : (sa->st_mtime > sb->st_mtime ? -1 : 0);
+}
+
+// keep the DISK_CACHE_MAX_FILES most recently used files
+static void _prune_disk_cache(const char* dir)
+{
+    GDir* d = g_dir_open(dir, 0, NULL);
+    if (!d) return;
+
+    // pairs of filename and its stat
+    GArray* files = g_array_new(FALSE, FALSE, sizeof(gpointer) * 2);
+    const char* name;
+    while ((name = g_dir_read_name(d))) {
+        gpointer entry[2];
+        GStatBuf* st = g_new(GStatBuf, 1);
+        entry[0] = g_build_filename(dir, name, NULL);
+        entry[1] = st;
+        if (g_stat(entry[0], st) == 0) {
+            g_array_append_vals(files, entry, 1);
+        } else {
+            g_free(entry[0]);
+            g_free(st);
+        }
+    }
+    g_dir_close(d);
+
+    g_array_sort(files, _compare_mtime);
+    for (guint i = 0; i < files->len; i++) {
+        gpointer* entry = &g_array_index(files, gpointer, i * 2);
+        if (i >= DISK_CACHE_MAX_FILES) {
+            meta_verbose("%s: remove %s\n", __func__, (char*)entry[0]);
+            g_unlink(entry[0]);
+        }
+        g_free(entry[0]);
+        g_free(entry[1]);
+    }
+    g_array_free(files, TRUE);
+}
+
+static void _save_to_disk_cache(const char* dir, const char* hash,
+        cairo_surface_t* surface)
+{
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    DiskCacheHeader header = {
+        .magic = DISK_CACHE_MAGIC,
+        .format = cairo_image_surface_get_format(surface),
+        .width = width,
+        .height = height,
+        .stride = cairo_image_surface_get_stride(surface),
+    };
+
+    if (g_mkdir_with_parents(dir, 0700) < 0) return;
+
+    char* filename = _disk_cache_filename(dir, hash, width, height);
+    char* tmpname = g_strdup_printf("%s.%d.tmp", filename, getpid());
+
+    cairo_surface_flush(surface);
+
+    // written aside and renamed, so a reader never maps half a file
+    FILE* fp = fopen(tmpname, "wb");
+    gboolean ok = fp != NULL &&
+        fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(cairo_image_surface_get_data(surface), header.stride, height, fp) == height;
+    if (fp && fclose(fp) != 0) ok = FALSE;
+
+    if (!ok || g_rename(tmpname, filename) < 0) {
+        meta_verbose("%s: saving %s failed\n", __func__, filename);
+        g_unlink(tmpname);
+    } else {
+        _prune_disk_cache(dir);
+    }
+
+    g_free(tmpname);
+    g_free(filename);
+}
+
+static void _background_load_free(BackgroundLoad* load)
+{
+    if (load->surfaces) {
+        for (int i = 0; i < load->n_monitors; i++) {
+            if (load->surfaces[i]) cairo_surface_destroy(load->surfaces[i]);
+        }
+        g_free(load->surfaces);
+    }
+    g_free(load->geometries);
+    g_free(load->disk_cache_dir);
+    g_free(load->file_key);
+    g_free(load->hash);
+    g_free(load->path);
+    g_slice_free(BackgroundLoad, load);
+}
+
+// the size of an earlier monitor with the same size, or -1
+static int _same_size_as(BackgroundLoad* load, int i)
+{
+    for (int j = 0; j < i; j++) {
+        if (load->geometries[j].width == load->geometries[i].width &&
+                load->geometries[j].height == load->geometries[i].height) {
+            return j;
+        }
+    }
+    return -1;
+}
+
+static void load_in_thread(GTask* task, gpointer source, gpointer data,
+        GCancellable* cancellable)
+{
+    BackgroundLoad* load = (BackgroundLoad*)data;
+    GError* error = NULL;
+    gchar* contents = NULL;
+    gsize length = 0;
+
+    // taken before reading, so a change meanwhile only costs a reload
+    load->file_key = _lookup_file_key(load->path);
+
+    if (!g_file_get_contents(load->path, &contents, &length, &error)) {
+        g_task_return_error(task, error);
+        return;
+    }
+
+    load->hash = g_compute_checksum_for_data(G_CHECKSUM_SHA1,
+            (const guchar*)contents, length);
+    load->surfaces = g_new0(cairo_surface_t*, load->n_monitors);
+
+    gboolean need_decode = FALSE;
+    for (int i = 0; i < load->n_monitors; i++) {
+        GdkRectangle* r = &load->geometries[i];
+        if (load->disk_cache_dir && _same_size_as(load, i) < 0) {
+            load->surfaces[i] = _load_from_disk_cache(load->disk_cache_dir,
+                    load->hash, r->width, r->height);
+        }
+        if (!load->surfaces[i] && _same_size_as(load, i) < 0) need_decode = TRUE;
+    }
+
+    GdkPixbuf* pixbuf = NULL;
+    if (need_decode) {
+        GInputStream* stream = g_memory_input_stream_new_from_data(contents, length, NULL);
+        pixbuf = gdk_pixbuf_new_from_stream(stream, cancellable, &error);
+        g_object_unref(stream);
+
+        if (!pixbuf) {
+            g_free(contents);
+            g_task_return_error(task, error);
+            return;
+        }
+    }
+
+    for (int i = 0; i < load->n_monitors; i++) {
+        GdkRectangle* r = &load->geometries[i];
+        int j = _same_size_as(load, i);
+
+        if (g_cancellable_is_cancelled(cancellable)) break;
+
+        if (j >= 0) {
+            if (load->surfaces[j])
+                load->surfaces[i] = cairo_surface_reference(load->surfaces[j]);
+            continue;
+        }
+        if (load->surfaces[i]) continue;
+
+        GdkPixbuf* scaled_pixbuf = _do_scale(pixbuf, r->width, r->height);
+
+        // no window given, so this only allocates an image surface
+        cairo_surface_t* background = gdk_cairo_surface_create_from_pixbuf(
+                scaled_pixbuf, 1.0, NULL);
+        if (!background || cairo_surface_status(background) != CAIRO_STATUS_SUCCESS) {
+            meta_verbose("%s create surface failed", __func__);
+            if (background) g_clear_pointer(&background, cairo_surface_destroy);
+        } else if (load->disk_cache_dir) {
+            _save_to_disk_cache(load->disk_cache_dir, load->hash, background);
+        }
+        load->surfaces[i] = background;
+
+        g_object_unref(scaled_pixbuf);
+    }
+
+    if (pixbuf) g_object_unref(pixbuf);
+    g_free(contents);
+    g_task_return_boolean(task, TRUE);
+}
+
+static void on_load_done(GObject* source, GAsyncResult* res, gpointer data)
+{
+    DeepinBackgroundCache* self = DEEPIN_BACKGROUND_CACHE(source);
+    DeepinBackgroundCachePrivate* priv = self->priv;
+    GTask* task = G_TASK(res);
+    BackgroundLoad* load = (BackgroundLoad*)g_task_get_task_data(task);
+    GError* error = NULL;
+    char* hash = NULL;
+
+    // flushed meanwhile, nobody is waiting for it anymore
+    if (g_cancellable_is_cancelled(g_task_get_cancellable(task)))
+        return;
+
+    g_hash_table_remove(priv->loads, load->path);
+
+    if (g_task_propagate_boolean(task, &error)) {
+        // handed over, so the task never frees a tracked surface in
+        // the load thread
+        for (int i = 0; i < load->n_monitors; i++) {
+            if (!load->surfaces[i]) continue;
+            _insert_surface(self, load->hash, load->geometries[i].width,
+                    load->geometries[i].height, 1.0, load->surfaces[i]);
+            load->surfaces[i] = NULL;
+        }
+        if (load->file_key) {
+            g_hash_table_replace(priv->hashes, load->file_key, g_strdup(load->hash));
+            load->file_key = NULL;
+        }
+        hash = g_strdup(load->hash);
+    } else {
+        meta_verbose("%s\n", error->message);
+        g_error_free(error);
+        hash = _solid_hash(self);
+    }
+
+    GHashTableIter iter;
+    BackgroundSlot* slot;
+    g_hash_table_iter_init(&iter, priv->slots);
+    while (g_hash_table_iter_next(&iter, (gpointer*)&slot, NULL)) {
+        if (slot->pending && g_strcmp0(slot->path, load->path) == 0) {
+            g_free(slot->hash);
+            slot->hash = g_strdup(hash);
+            slot->pending = FALSE;
+
+            meta_verbose("%s: loaded %s for monitor #%d, workspace %d\n",
+                    __func__, load->path, slot->monitor, slot->workspace);
+        }
+    }
+
+    g_free(hash);
+    deepin_message_hub_desktop_changed();
+}
+
+// decode path in a thread, unless that is already under way
+static void _start_load(DeepinBackgroundCache* self, const char* path)
+{
+    DeepinBackgroundCachePrivate* priv = self->priv;
+
+    if (g_hash_table_contains(priv->loads, path)) return;
+
+    GdkScreen* gscreen = gdk_screen_get_default();
+    BackgroundLoad* load = g_slice_new0(BackgroundLoad);
+    load->path = g_strdup(path);
+    load->n_monitors = gdk_screen_get_n_monitors(gscreen);
+    load->geometries = g_new(GdkRectangle, load->n_monitors);
+    for (int i = 0; i < load->n_monitors; i++) {
+        gdk_screen_get_monitor_geometry(gscreen, i, &load->geometries[i]);
+    }
+    if (meta_prefs_get_background_disk_cache()) {
+        load->disk_cache_dir = g_build_filename(g_get_user_cache_dir(),
+                "deepin-wm", "backgrounds", NULL);
+    }
+
+    GCancellable* cancellable = g_cancellable_new();
+    g_hash_table_insert(priv->loads, g_strdup(path), cancellable);
+
+    GTask* task = g_task_new(self, cancellable, on_load_done, NULL);
+    g_task_set_task_data(task, load, (GDestroyNotify)_background_load_free);
+    g_task_run_in_thread(task, load_in_thread);
+    g_object_unref(task);
+}
+
+// point slot at path. until path is loaded the slot keeps showing what it
+// showed before, or a solid color
+static void _update_slot(DeepinBackgroundCache* self, BackgroundSlot* slot,
+        const char* path)
+{
+    DeepinBackgroundCachePrivate* priv = self->priv;
+    char* file_key = path ? _lookup_file_key(path) : NULL;
+    const char* hash = file_key ?
+        (const char*)g_hash_table_lookup(priv->hashes, file_key) : NULL;
+    g_free(file_key);
+
+    g_free(slot->path);
+    slot->path = g_strdup(path);
+    slot->stale = FALSE;
+    slot->pending = FALSE;
+
+    if (hash) {
+        g_free(slot->hash);
+        slot->hash = g_strdup(hash);
+    } else if (!path) {
+        g_free(slot->hash);
+        slot->hash = _solid_hash(self);
+    } else {
+        if (!slot->hash) slot->hash = _solid_hash(self);
+        slot->pending = TRUE;
+        _start_load(self, path);
+    }
+
+    meta_verbose("%s: %s for monitor #%d, workspace %d%s\n", __func__,
+            path, slot->monitor, slot->workspace, slot->pending ? " (pending)" : "");
+}
+
+static BackgroundSlot* _get_slot(DeepinBackgroundCache* self, int workspace, int monitor)
+{
+    DeepinBackgroundCachePrivate* priv = self->priv;
+    BackgroundSlot key = { .monitor = monitor, .workspace = workspace };
+
+    BackgroundSlot* slot = (BackgroundSlot*)g_hash_table_lookup(priv->slots, &key);
+    if (!slot) {
+        slot = g_slice_new0(BackgroundSlot);
+        slot->monitor = monitor;
+        slot->workspace = workspace;
+        slot->stale = TRUE;
+        g_hash_table_add(priv->slots, slot);
+    }
+    return slot;
+}
+
+static cairo_surface_t* _get_slot_surface(DeepinBackgroundCache* self,
+        BackgroundSlot* slot, double scale)
+{
+    GdkRectangle r;
+    gdk_screen_get_monitor_geometry(gdk_screen_get_default(), slot->monitor, &r);
+
+    cairo_surface_t* surface = _lookup_surface(self, slot->hash, r.width, r.height, scale);
+    if (surface) return surface;
+
+    cairo_surface_t* base = _lookup_surface(self, slot->hash, r.width, r.height, 1.0);
+    if (!base) {
+        if (g_str_has_prefix(slot->hash, SOLID_HASH_PREFIX)) {
+            base = _insert_surface(self, slot->hash, r.width, r.height, 1.0,
+                    _create_solid_background(slot->hash + strlen(SOLID_HASH_PREFIX), r));
+        } else {
+            // evicted, or for an old monitor size. load it again
+            if (!slot->pending && slot->path) {
+                slot->pending = TRUE;
+                _start_load(self, slot->path);
+            }
+            g_free(slot->hash);
+            slot->hash = _solid_hash(self);
+            return _get_slot_surface(self, slot, scale);
+        }
+    }
+
+    if (scale == 1.0) return base;
+    
+    gint w = scale * cairo_image_surface_get_width(base),
+         h = scale * cairo_image_surface_get_height(base);
+    cairo_surface_t* surf = cairo_image_surface_create(
+            cairo_image_surface_get_format(base), w, h);
+    cairo_t* cr = cairo_create(surf);
+    cairo_scale(cr, scale, scale);
+    cairo_set_source_surface(cr, base, 0, 0);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+
+    meta_verbose("%s: create scaled(%f) for monitor #%d, workspace #%d\n", __func__, 
+            scale, slot->monitor, slot->workspace);
+    return _insert_surface(self, slot->hash, r.width, r.height, scale, surf);
+}
+
 typedef char* (get_picture_filename_callback)(DeepinBackgroundCache *, int, int);
 
 static char* get_picture_filename_cb(DeepinBackgroundCache *self, int monitor_index, int workspace_index)
@@ -208,125 +814,26 @@ static void on_file_changed(GFileMonitor *monitor,
     _do_reload_background(DEEPIN_BACKGROUND_CACHE(user_data));
 }
 
-static void deepin_background_cache_load_default_background(DeepinBackgroundCache* self)
-{ 
-    DeepinBackgroundCachePrivate *priv = self->priv;
-
-    GdkPixbuf *pixbuf = NULL;
-    GError* error = NULL;
-
-    MetaScreen *screen = meta_get_display()->active_screen;
-    int nr_ws = meta_screen_get_n_workspaces (screen);
-    gchar* path = get_picture_filename_cb (self, 0, nr_ws);
-
-    pixbuf = gdk_pixbuf_new_from_file(path, &error);
-    if (!pixbuf) {
-        meta_verbose("%s\n", error->message);
-        g_free(path);
-        g_error_free(error);
-        return;
-    }
-
-    cairo_surface_t* background = gdk_cairo_surface_create_from_pixbuf(pixbuf, 1.0, NULL);
-    if (!background || cairo_surface_status(background) != CAIRO_STATUS_SUCCESS) {
-        meta_verbose("%s create surface failed", __func__);
-        if (background) g_clear_pointer(&background, cairo_surface_destroy);
-    }
-
-    ScaledCacheInfo* sci = g_slice_new(ScaledCacheInfo);
-    sci->scale = 1.0;
-    sci->surface = background;
-    priv->defaults = g_list_append(priv->defaults, sci);
-
-    g_free(path);
-    g_object_unref(pixbuf);
-}
-
 static void deepin_background_cache_load_background_for_workspace(DeepinBackgroundCache* self,
         int workspace_index, get_picture_filename_callback* get_picture_filename)
 { 
-    DeepinBackgroundCachePrivate *priv = self->priv;
-
     GdkScreen* gscreen = gdk_screen_get_default();
     gint n_monitors = gdk_screen_get_n_monitors(gscreen);
 
-    gboolean solid_mode = TRUE;
-    GdkPixbuf *pixbuf = NULL;
-    GError* error = NULL;
-
     gchar* path = get_picture_filename (self, 0, workspace_index);
     meta_verbose("uri for workspace %d: %s\n", workspace_index, path);
-    if (!path) {
-        goto _next;
-    }
-
-    pixbuf = gdk_pixbuf_new_from_file(path, &error);
-    if (!pixbuf) {
-        meta_verbose("%s\n", error->message);
-        g_free(path);
-        path = NULL;
-        g_error_free(error);
-        goto _next;
-    }
 
-    solid_mode = FALSE;
-
-_next:
     for (int monitor = 0; monitor < n_monitors; monitor++) {
-        GdkRectangle r;
-        cairo_surface_t* background;
-
-        gdk_screen_get_monitor_geometry(gscreen, monitor, &r);
-
-        if (!solid_mode) {
-            GdkPixbuf* scaled_pixbuf = _do_scale(self, pixbuf, r.width, r.height);
-
-            background = gdk_cairo_surface_create_from_pixbuf(scaled_pixbuf, 1.0, NULL);
-            if (!background || cairo_surface_status(background) != CAIRO_STATUS_SUCCESS) {
-                meta_verbose("%s create surface failed", __func__);
-                if (background) g_clear_pointer(&background, cairo_surface_destroy);
-            }
-
-            g_object_unref(scaled_pixbuf);
-
-        } else {
-            background = _create_solid_background(self, r);
-        }
-
-        ScaledCacheInfo* sci = g_slice_new(ScaledCacheInfo);
-        sci->scale = 1.0;
-        sci->monitor = monitor;
-        sci->workspace = workspace_index;
-        sci->surface = background;
-        priv->caches = g_list_append(priv->caches, sci);
-
-        meta_verbose("%s: create scaled(1.0) for monitor #%d, workspace %d\n", __func__,
-                monitor, workspace_index);
+        _update_slot(self, _get_slot(self, workspace_index, monitor), path);
     }
 
     if (path) g_free(path);
-    if (pixbuf) g_object_unref(pixbuf);
-}
-
-static void deepin_background_cache_load_background(DeepinBackgroundCache* self)
-{
-    DeepinBackgroundCachePrivate* priv = self->priv;
-    MetaScreen *screen = meta_get_display()->active_screen;
-    int nr_ws = meta_screen_get_n_workspaces (screen);
-
-    for (int workspace_index = 0; workspace_index < nr_ws; workspace_index++) {
-        deepin_background_cache_load_background_for_workspace(self, workspace_index,
-                get_picture_filename_cb);
-    }
 }
 
+// backgrounds get loaded when they are first asked for
 static void _do_reload_background(DeepinBackgroundCache* self)
 {
-    DeepinBackgroundCachePrivate* priv = self->priv;
-
     deepin_background_cache_flush(self);
-    deepin_background_cache_load_background(self);
-    deepin_background_cache_load_default_background(self);
     deepin_message_hub_desktop_changed();
 }
 
@@ -386,8 +893,6 @@ static void change_background (DeepinBackgroundCache *self, int index, const cha
     g_strfreev(extra_uris);
 
     deepin_background_cache_invalidate(self, index);
-    deepin_background_cache_load_background_for_workspace(self, index,
-            get_picture_filename_cb);
     deepin_message_hub_desktop_changed();
 }
 
@@ -491,7 +996,6 @@ static void on_workspace_removed(DeepinMessageHub* hub, gint index,
 
     for (int i = index; i < nr_ws; i++) {
         deepin_background_cache_invalidate(self, i);
-        deepin_background_cache_load_background_for_workspace(self, i, get_picture_filename_cb);
     }
 
     g_idle_add(on_idle_emit_change, NULL);
@@ -534,7 +1038,6 @@ static void reorder_workspace_background(DeepinBackgroundCache *self, int from,
 
     for (int k = from; d > 0 ? k <= to : k >= to; k += d) {
         deepin_background_cache_invalidate(self, k);
-        deepin_background_cache_load_background_for_workspace(self, k, get_picture_filename_cb);
     }
     deepin_message_hub_desktop_changed();
 }
@@ -549,7 +1052,18 @@ static void deepin_background_cache_init (DeepinBackgroundCache *self)
 {
 	self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, DEEPIN_TYPE_BACKGROUND_CACHE, DeepinBackgroundCachePrivate);
 
-    self->priv->caches = NULL;
+    self->priv->slots = g_hash_table_new_full(_slot_hash, _slot_equal,
+            (GDestroyNotify)_slot_free, NULL);
+    self->priv->surfaces = g_hash_table_new_full(g_str_hash, g_str_equal,
+            NULL, (GDestroyNotify)_cached_surface_free);
+    g_queue_init(&self->priv->lru);
+    self->priv->cached_bytes = 0;
+    self->priv->resident = g_hash_table_new(g_str_hash, g_str_equal);
+    self->priv->resident_bytes = 0;
+    self->priv->hashes = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, g_free);
+    self->priv->loads = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, g_object_unref);
     self->priv->preinstalled_wallpapers = NULL;
     self->priv->default_uri = g_strdup_printf("file://%s", fallback_background_name);
     self->priv->appearance_intf = NULL;
@@ -574,6 +1088,22 @@ static void deepin_background_cache_finalize (GObject *object)
     DeepinBackgroundCachePrivate* priv = DEEPIN_BACKGROUND_CACHE(object)->priv;
 
     deepin_background_cache_flush(DEEPIN_BACKGROUND_CACHE(object));
+    g_clear_pointer(&priv->loads, g_hash_table_destroy);
+    g_clear_pointer(&priv->hashes, g_hash_table_destroy);
+    g_clear_pointer(&priv->slots, g_hash_table_destroy);
+    g_queue_clear(&priv->lru);
+    g_clear_pointer(&priv->surfaces, g_hash_table_destroy);
+
+    // widgets may still hold some
+    GHashTableIter iter;
+    cairo_surface_t* surface;
+    g_hash_table_iter_init(&iter, priv->resident);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&surface)) {
+        ResidentSurface* rs = (ResidentSurface*)cairo_surface_get_user_data(
+                surface, &resident_key);
+        rs->owner = NULL;
+    }
+    g_clear_pointer(&priv->resident, g_hash_table_destroy);
 
     if (priv->extra_settings) {
         g_clear_pointer(&priv->extra_settings, g_object_unref);
@@ -599,65 +1129,80 @@ DeepinBackgroundCache* deepin_get_background()
 {
     if (!_the_cache) {
         _the_cache = (DeepinBackgroundCache*)g_object_new(DEEPIN_TYPE_BACKGROUND_CACHE, NULL);
-        deepin_background_cache_load_background(_the_cache);
-        deepin_background_cache_load_default_background(_the_cache);
     }
     return _the_cache;
 }
 
 cairo_surface_t* deepin_background_cache_get_surface(gint monitor, gint workspace, double scale)
 {
-    DeepinBackgroundCachePrivate* priv = deepin_get_background()->priv;
-    cairo_surface_t* base = NULL;
-
-    GList* l = priv->caches;
-    while (l) {
-        ScaledCacheInfo* sci = (ScaledCacheInfo*)l->data;
-        if (sci->monitor == monitor && sci->workspace == workspace) {
-            if (sci->scale == scale) {
-                meta_verbose("%s: reuse scaled(%f) for monitor #%d, workspace #%d\n", __func__,
-                        scale, monitor, workspace);
-                return sci->surface;
-            } else if (sci->scale == 1.0) 
-                base = sci->surface;
-        }
-        l = l->next;
-    }
-    
-    gint w = scale * cairo_image_surface_get_width(base),
-         h = scale * cairo_image_surface_get_height(base);
-    cairo_surface_t* surf = cairo_image_surface_create(
-            cairo_image_surface_get_format(base), w, h);
-    cairo_t* cr = cairo_create(surf);
-    cairo_scale(cr, scale, scale);
-    cairo_set_source_surface(cr, base, 0, 0);
-    cairo_paint(cr);
-    cairo_destroy(cr);
+    DeepinBackgroundCache* self = deepin_get_background();
 
-    ScaledCacheInfo* sci = g_slice_new(ScaledCacheInfo);
-    sci->scale = scale;
-    sci->monitor = monitor;
-    sci->workspace = workspace;
-    sci->surface = surf;
-    priv->caches = g_list_append(priv->caches, sci);
+    if (monitor >= gdk_screen_get_n_monitors(gdk_screen_get_default()))
+        return NULL;
 
-    meta_verbose("%s: create scaled(%f) for monitor #%d, workspace #%d\n", __func__, 
-            scale, monitor, workspace);
-    return sci->surface;
+    BackgroundSlot* slot = _get_slot(self, workspace, monitor);
+    if (slot->stale) {
+        deepin_background_cache_load_background_for_workspace(self, workspace,
+                get_picture_filename_cb);
+    }
+
+    return _get_slot_surface(self, slot, scale);
 }
 
 // right now, now need to cache scales at all
 cairo_surface_t* deepin_background_cache_get_default(double scale)
 {
     DeepinBackgroundCache* self = deepin_get_background();
-    DeepinBackgroundCachePrivate* priv = self->priv;
 
-    GList* l = priv->defaults;
-    if (l) {
-        ScaledCacheInfo* sci = (ScaledCacheInfo*)l->data;
-        return sci->surface;
+    // only shown as a thumbnail, the size of the primary monitor will do
+    BackgroundSlot* slot = _get_slot(self, -1,
+            gdk_screen_get_primary_monitor(gdk_screen_get_default()));
+    if (slot->stale) {
+        MetaScreen *screen = meta_get_display()->active_screen;
+        int nr_ws = meta_screen_get_n_workspaces (screen);
+        gchar* path = get_picture_filename_cb (self, 0, nr_ws);
+
+        _update_slot(self, slot, path);
+        g_free(path);
     }
-    return NULL;
+
+    return _get_slot_surface(self, slot, 1.0);
+}
+
+/**
+ * deepin_background_cache_get_resident_bytes:
+ *
+ * Background pixels kept alive by the cache or the widgets showing them.
+ * Workspaces and monitors showing the same picture at the same size share
+ * their surfaces, so each is only counted once.
+ */
+gsize deepin_background_cache_get_resident_bytes(void)
+{
+    return deepin_get_background()->priv->resident_bytes;
+}
+
+/**
+ * deepin_background_cache_get_stats:
+ *
+ * Return value: (transfer floating): an a{sv} with the resident and
+ * cached bytes and surface counts
+ */
+GVariant* deepin_background_cache_get_stats(void)
+{
+    DeepinBackgroundCachePrivate* priv = deepin_get_background()->priv;
+    GVariantBuilder builder;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&builder, "{sv}", "resident_bytes",
+            g_variant_new_uint64(priv->resident_bytes));
+    g_variant_builder_add(&builder, "{sv}", "resident_surfaces",
+            g_variant_new_uint32(g_hash_table_size(priv->resident)));
+    g_variant_builder_add(&builder, "{sv}", "cached_bytes",
+            g_variant_new_uint64(priv->cached_bytes));
+    g_variant_builder_add(&builder, "{sv}", "cached_surfaces",
+            g_variant_new_uint32(priv->lru.length));
+
+    return g_variant_builder_end(&builder);
 }
 
 void deepin_background_cache_request_new_default_uri ()
@@ -721,7 +1266,6 @@ done:
         int index = g_random_int_range (0, g_list_length(priv->preinstalled_wallpapers));
         priv->default_uri = (char*)g_list_nth_data(priv->preinstalled_wallpapers, index);
 
-        _clear_cache_list(&priv->defaults);
-        deepin_background_cache_load_default_background(self);
+        deepin_background_cache_invalidate(self, -1);
     }
 }
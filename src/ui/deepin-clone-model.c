@@ -0,0 +1,211 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*-  */
+
+/**
+ * Copyright (C) 2015 Deepin Technology Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ **/
+
+#include <config.h>
+#include <util.h>
+#include "../core/window-private.h"
+#include "deepin-clone-model.h"
+#include "deepin-message-hub.h"
+
+/*
+ * Building a clone looks up the application icon, which means reading
+ * /proc, desktop files and the icon theme, and its snapshot has to be
+ * grabbed and scaled.  Views come and go all the time while windows
+ * mostly stay, so the clones are kept per window instead and follow the
+ * windows: they are built in an idle once a window is added, so opening
+ * a view rarely builds any, and a window shown by several views at once
+ * (sticky, or the thumbnail and the full view of one workspace) keeps a
+ * clone per view until it moves to a single workspace.  A kept clone
+ * asks for a new snapshot only if the window got damaged meanwhile.
+ */
+typedef struct _KeptClones
+{
+    GPtrArray* clones[2]; /* without, with icon */
+    GPtrArray* in_use[2]; /* those a view has now */
+} KeptClones;
+
+static GHashTable* _kept = NULL; /* MetaWindow* -> KeptClones* */
+static GQueue _to_build = G_QUEUE_INIT; /* windows added since, oldest first */
+static guint _build_id = 0;
+
+static void kept_clones_free(KeptClones* kept)
+{
+    for (int i = 0; i < G_N_ELEMENTS(kept->clones); i++) {
+        g_ptr_array_free(kept->clones[i], TRUE);
+        g_ptr_array_free(kept->in_use[i], TRUE);
+    }
+    g_slice_free(KeptClones, kept);
+}
+
+static KeptClones* kept_clones_get(MetaWindow* window);
+
+static gboolean kept_clone_in_use(KeptClones* kept, int kind, gpointer clone)
+{
+    for (int i = 0; i < kept->in_use[kind]->len; i++) {
+        if (g_ptr_array_index(kept->in_use[kind], i) == clone) return TRUE;
+    }
+    return FALSE;
+}
+
+static MetaDeepinClonedWidget* kept_clones_add(KeptClones* kept,
+        MetaWindow* window, int kind)
+{
+    GtkWidget* widget = meta_deepin_cloned_widget_new(window, kind == 1);
+    g_ptr_array_add(kept->clones[kind], g_object_ref_sink(widget));
+    return META_DEEPIN_CLONED_WIDGET(widget);
+}
+
+static gboolean build_clones(gpointer data)
+{
+    /* one window per run, so a burst of new windows doesn't stall */
+    MetaWindow* window = g_queue_pop_head(&_to_build);
+    if (window) {
+        KeptClones* kept = kept_clones_get(window);
+        for (int kind = 0; kind < G_N_ELEMENTS(kept->clones); kind++) {
+            if (kept->clones[kind]->len == 0) kept_clones_add(kept, window, kind);
+        }
+    }
+
+    if (g_queue_is_empty(&_to_build)) {
+        _build_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void on_window_added(DeepinMessageHub* hub, MetaWindow* window,
+        gpointer data)
+{
+    if (window->type != META_WINDOW_NORMAL) return;
+
+    g_queue_push_tail(&_to_build, window);
+    if (!_build_id) {
+        _build_id = g_idle_add_full(G_PRIORITY_LOW, build_clones, NULL, NULL);
+    }
+}
+
+static void on_window_removed(DeepinMessageHub* hub, MetaWindow* window,
+        gpointer data)
+{
+    g_queue_remove(&_to_build, window);
+
+    /* views still showing the clones hold their own references */
+    g_hash_table_remove(_kept, window);
+}
+
+static void on_window_change_workspace(DeepinMessageHub* hub,
+        MetaWindow* window, MetaWorkspace* workspace, gpointer data)
+{
+    KeptClones* kept = g_hash_table_lookup(_kept, window);
+    if (!kept || !workspace) return;
+
+    /* on one workspace from now on, one idle clone of each kind will do */
+    for (int kind = 0; kind < G_N_ELEMENTS(kept->clones); kind++) {
+        gboolean have_idle = FALSE;
+        for (int i = kept->clones[kind]->len - 1; i >= 0; i--) {
+            gpointer clone = g_ptr_array_index(kept->clones[kind], i);
+            if (kept_clone_in_use(kept, kind, clone)) continue;
+
+            if (have_idle) g_ptr_array_remove_index_fast(kept->clones[kind], i);
+            have_idle = TRUE;
+        }
+    }
+}
+
+static GHashTable* get_kept(void)
+{
+    if (!_kept) {
+        _kept = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                NULL, (GDestroyNotify)kept_clones_free);
+
+        g_object_connect(G_OBJECT(deepin_message_hub_get()),
+                "signal::window-added", on_window_added, NULL,
+                "signal::window-removed", on_window_removed, NULL,
+                "signal::about-to-change-workspace", on_window_change_workspace, NULL,
+                NULL);
+    }
+    return _kept;
+}
+
+static KeptClones* kept_clones_get(MetaWindow* window)
+{
+    GHashTable* kept_clones = get_kept();
+
+    KeptClones* kept = (KeptClones*)g_hash_table_lookup(kept_clones, window);
+    if (!kept) {
+        kept = g_slice_new0(KeptClones);
+        for (int i = 0; i < G_N_ELEMENTS(kept->clones); i++) {
+            kept->clones[i] = g_ptr_array_new_with_free_func(g_object_unref);
+            kept->in_use[i] = g_ptr_array_new();
+        }
+        g_hash_table_insert(kept_clones, window, kept);
+    }
+    return kept;
+}
+
+/**
+ * deepin_clone_model_watch:
+ *
+ * Starts following windows, so the clones of windows added from now on
+ * are built before any view asks for them.
+ */
+void deepin_clone_model_watch(void)
+{
+    get_kept();
+}
+
+MetaDeepinClonedWidget* deepin_clone_model_acquire(MetaWindow* window,
+        gboolean show_icon)
+{
+    KeptClones* kept = kept_clones_get(window);
+    int kind = show_icon ? 1 : 0;
+    MetaDeepinClonedWidget* clone = NULL;
+
+    for (int i = 0; i < kept->clones[kind]->len && !clone; i++) {
+        MetaDeepinClonedWidget* c = g_ptr_array_index(kept->clones[kind], i);
+        if (!kept_clone_in_use(kept, kind, c)) clone = c;
+    }
+
+    if (clone) {
+        meta_verbose("%s: reuse clone of %s\n", __func__, window->desc);
+    } else {
+        clone = kept_clones_add(kept, window, kind);
+    }
+
+    g_ptr_array_add(kept->in_use[kind], clone);
+    return g_object_ref(clone);
+}
+
+void deepin_clone_model_release(MetaDeepinClonedWidget* clone, gpointer view)
+{
+    GtkWidget* widget = GTK_WIDGET(clone);
+    GtkWidget* parent = gtk_widget_get_parent(widget);
+
+    g_signal_handlers_disconnect_by_data(clone, view);
+    /* views hang their own bookkeeping off the clone */
+    g_object_set_data(G_OBJECT(clone), "cloned-widget-key", NULL);
+    meta_deepin_cloned_widget_unselect(clone);
+    meta_deepin_cloned_widget_release_blur(clone);
+
+    if (parent) {
+        gtk_container_remove(GTK_CONTAINER(parent), widget);
+    }
+
+    MetaWindow* window = meta_deepin_cloned_widget_get_window(clone);
+    KeptClones* kept = _kept ? g_hash_table_lookup(_kept, window) : NULL;
+    if (kept) {
+        for (int i = 0; i < G_N_ELEMENTS(kept->in_use); i++) {
+            g_ptr_array_remove(kept->in_use[i], clone);
+        }
+    }
+
+    g_object_unref(clone);
+}
@@ -13,6 +13,7 @@
 #include <config.h>
 #include <math.h>
 #include <util.h>
+#include <stdlib.h>
 #include <string.h>
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
@@ -27,6 +28,9 @@
 
 #define ICON_SIZE 64
 
+/* blurred snapshots are cached at radius 1, 2, 4 ... 128 */
+#define N_BLUR_LEVELS 8
+
 typedef struct _MetaDeepinClonedWidgetPrivate
 {
     gboolean selected;
@@ -50,6 +54,10 @@ typedef struct _MetaDeepinClonedWidgetPrivate
 
     MetaWindow* meta_window;
     cairo_surface_t* snapshot;
+    GCancellable* snapshot_cancellable;
+    gdouble snapshot_scale; /* of the last snapshot asked for */
+    guint snapshot_serial; /* of the window surfaces back then */
+    cairo_surface_t* blur_levels[N_BLUR_LEVELS]; /* of snapshot, made on demand */
     cairo_surface_t* icon;
 
     GtkRequisition real_size;
@@ -153,15 +161,48 @@ static void meta_deepin_cloned_widget_get_property(GObject *object, guint proper
     }
 }
 
+static void clear_blur_levels(MetaDeepinClonedWidgetPrivate* priv)
+{
+    for (int i = 0; i < N_BLUR_LEVELS; i++) {
+        g_clear_pointer(&priv->blur_levels[i], cairo_surface_destroy);
+    }
+}
+
+static cairo_surface_t* get_blur_level(MetaDeepinClonedWidgetPrivate* priv,
+        int level)
+{
+    if (!priv->blur_levels[level]) {
+        cairo_surface_t* dest = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                cairo_image_surface_get_width(priv->snapshot),
+                cairo_image_surface_get_height(priv->snapshot));
+
+        cairo_t* cr = cairo_create(dest);
+        cairo_set_source_surface(cr, priv->snapshot, 0, 0);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+
+        priv->blur_levels[level] = stack_blur_surface_scaled(dest, 1 << level, 1.0);
+        cairo_surface_destroy(dest);
+    }
+
+    return priv->blur_levels[level];
+}
+
 static void meta_deepin_cloned_widget_dispose(GObject *object)
 {
     MetaDeepinClonedWidget *self = META_DEEPIN_CLONED_WIDGET(object);
     MetaDeepinClonedWidgetPrivate* priv = self->priv;
 
     priv->meta_window = NULL;
+    if (priv->snapshot_cancellable) {
+        g_cancellable_cancel(priv->snapshot_cancellable);
+        g_clear_object(&priv->snapshot_cancellable);
+    }
+
     if (priv->snapshot) {
         g_clear_pointer(&priv->snapshot, cairo_surface_destroy);
     }
+    clear_blur_levels(priv);
 
     if (priv->icon) {
         g_clear_pointer(&priv->icon, cairo_surface_destroy);
@@ -248,25 +289,38 @@ static gboolean meta_deepin_cloned_widget_draw (GtkWidget *widget, cairo_t* cr)
 
     if (priv->meta_window->unmanaging || !priv->snapshot) return TRUE;
 
-    gdouble d = priv->blur_radius;
-    if (d > 0.0) {
+    /* the snapshot may still be of the previous size until the new one
+     * is ready */
+    gint sw = cairo_image_surface_get_width(priv->snapshot);
+    if (priv->real_size.width > 0 && abs(priv->real_size.width - sw) > 1) {
+        gdouble ss = priv->real_size.width / (gdouble)sw;
+        cairo_scale(cr, ss, ss);
+    }
+
+    gdouble d = MIN(priv->blur_radius, 1 << (N_BLUR_LEVELS - 1));
+    if (d >= 1.0) {
         x = cairo_image_surface_get_width(priv->snapshot) / 2.0,
           y = cairo_image_surface_get_height(priv->snapshot) / 2.0;
 
-        cairo_surface_t* dest = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
-                cairo_image_surface_get_width(priv->snapshot),
-                cairo_image_surface_get_height(priv->snapshot));
+        /* fade between the two cached levels around d, so animating
+         * the radius doesn't blur anything after the first pass */
+        int level = (int)floor(log2(d));
+        gdouble t = d / (1 << level) - 1.0;
 
-        cairo_t* cr2 = cairo_create(dest);
-        cairo_set_source_surface(cr2, priv->snapshot, 0, 0);
-        cairo_paint(cr2);
-        cairo_destroy(cr2);
+        if (alpha < 1.0) cairo_push_group(cr);
 
-        stack_blur_surface(dest, d);
+        cairo_set_source_surface(cr, get_blur_level(priv, level), -x, -y);
+        cairo_paint(cr);
 
-        cairo_set_source_surface(cr, dest, -x, -y);
-        cairo_paint_with_alpha(cr, alpha);
-        cairo_surface_destroy(dest);
+        if (t > 0.0 && level + 1 < N_BLUR_LEVELS) {
+            cairo_set_source_surface(cr, get_blur_level(priv, level + 1), -x, -y);
+            cairo_paint_with_alpha(cr, t);
+        }
+
+        if (alpha < 1.0) {
+            cairo_pop_group_to_source(cr);
+            cairo_paint_with_alpha(cr, alpha);
+        }
 
     } else {
         x = cairo_image_surface_get_width(priv->snapshot) / 2.0,
@@ -547,6 +601,8 @@ static void on_deepin_cloned_widget_drag_begin(GtkWidget* widget, GdkDragContext
     meta_verbose("%s\n", __func__);
     MetaDeepinClonedWidgetPrivate* priv = META_DEEPIN_CLONED_WIDGET(widget)->priv;
 
+    if (!priv->snapshot) return;
+
     gint w = cairo_image_surface_get_width(priv->snapshot); 
     gint h = cairo_image_surface_get_height(priv->snapshot); 
 
@@ -722,18 +778,35 @@ void meta_deepin_cloned_widget_set_blur_radius(MetaDeepinClonedWidget* self, gdo
     gtk_widget_queue_draw(GTK_WIDGET(self));
 }
 
-void meta_deepin_cloned_widget_set_size(MetaDeepinClonedWidget* self,
-        gdouble width, gdouble height)
+void meta_deepin_cloned_widget_release_blur(MetaDeepinClonedWidget* self)
 {
     MetaDeepinClonedWidgetPrivate* priv = self->priv;
+    priv->blur_radius = 0.0;
+    clear_blur_levels(priv);
+}
 
-    MetaRectangle r;
-    meta_window_get_outer_rect(priv->meta_window, &r);
+static void on_snapshot_ready(GObject* source, GAsyncResult* res,
+        gpointer data)
+{
+    cairo_surface_t* surface;
+
+    /* fails when cancelled too, self may be gone then */
+    surface = deepin_window_surface_manager_get_surface_finish(res, NULL);
+    if (!surface) return;
+
+    MetaDeepinClonedWidget* self = META_DEEPIN_CLONED_WIDGET(data);
+    MetaDeepinClonedWidgetPrivate* priv = self->priv;
 
     g_clear_pointer (&priv->snapshot, cairo_surface_destroy);
-    priv->snapshot = deepin_window_surface_manager_get_surface(
-            priv->meta_window, (double)width/r.width);
-    if (priv->snapshot) cairo_surface_reference(priv->snapshot);
+    priv->snapshot = surface;
+    clear_blur_levels(priv);
+    gtk_widget_queue_draw(GTK_WIDGET(self));
+}
+
+static void set_real_size(MetaDeepinClonedWidget* self,
+        gdouble width, gdouble height)
+{
+    MetaDeepinClonedWidgetPrivate* priv = self->priv;
 
     priv->real_size.width = width;
     priv->real_size.height = height;
@@ -750,6 +823,43 @@ void meta_deepin_cloned_widget_set_size(MetaDeepinClonedWidget* self,
     gtk_widget_queue_resize(GTK_WIDGET(self));
 }
 
+void meta_deepin_cloned_widget_set_initial_size(MetaDeepinClonedWidget* self,
+        gdouble width, gdouble height)
+{
+    set_real_size(self, width, height);
+}
+
+void meta_deepin_cloned_widget_set_size(MetaDeepinClonedWidget* self,
+        gdouble width, gdouble height)
+{
+    MetaDeepinClonedWidgetPrivate* priv = self->priv;
+
+    MetaRectangle r;
+    meta_window_get_outer_rect(priv->meta_window, &r);
+
+    /* a clone kept from an earlier view already has what it needs,
+     * unless the window was damaged since */
+    double scale = (double)width/r.width;
+    guint serial = deepin_window_surface_manager_get_serial(priv->meta_window);
+    if (!priv->snapshot_cancellable || scale != priv->snapshot_scale ||
+            serial == 0 || serial != priv->snapshot_serial) {
+        /* the old snapshot is drawn scaled until the new one arrives */
+        if (priv->snapshot_cancellable) {
+            g_cancellable_cancel(priv->snapshot_cancellable);
+            g_object_unref(priv->snapshot_cancellable);
+        }
+        priv->snapshot_cancellable = g_cancellable_new();
+
+        deepin_window_surface_manager_get_surface_async(priv->meta_window,
+                scale, priv->snapshot_cancellable, on_snapshot_ready, self);
+        priv->snapshot_scale = scale;
+        priv->snapshot_serial =
+            deepin_window_surface_manager_get_serial(priv->meta_window);
+    }
+
+    set_real_size(self, width, height);
+}
+
 void meta_deepin_cloned_widget_set_alpha(MetaDeepinClonedWidget* self, gdouble val)
 {
     MetaDeepinClonedWidgetPrivate* priv = self->priv;
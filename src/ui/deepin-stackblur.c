@@ -13,7 +13,13 @@
 #include <math.h>
 #include <cairo.h>
 #include <stdint.h>
+#include <string.h>
 #include <glib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include "deepin-stackblur.h"
 
 /*
@@ -58,7 +64,7 @@ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 OTHER DEALINGS IN THE SOFTWARE.
 */
 
-static unsigned mul_table[] = {
+static const unsigned mul_table[] = {
 512,512,456,512,328,456,335,512,405,328,271,456,388,335,292,512,
 454,405,364,328,298,271,496,456,420,388,360,335,312,292,273,512,
 482,454,428,405,383,364,345,328,312,298,284,271,259,496,475,456,
@@ -77,7 +83,7 @@ static unsigned mul_table[] = {
 289,287,285,282,280,278,275,273,271,269,267,265,263,261,259};
 
 
-static unsigned shg_table[] = {
+static const unsigned shg_table[] = {
 9, 11, 12, 13, 13, 14, 14, 15, 15, 15, 15, 16, 16, 16, 16, 17,
 17, 17, 17, 17, 17, 17, 18, 18, 18, 18, 18, 18, 18, 18, 18, 19,
 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 20, 20, 20,
@@ -96,261 +102,486 @@ static unsigned shg_table[] = {
 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24 };
 
 
-typedef struct BlurData_
-{
-    int r, g, b, a;
-} BlurData;
+/*
+ * The blur stack is a ring of 2 * radius + 1 pixels living on the C stack,
+ * with all four channels of a pixel held in one vector so they are summed
+ * together.  Rows of the horizontal pass and columns of the vertical pass
+ * are independent, so both passes are cut into bands and handed to a
+ * thread pool.
+ *
+ * The output is the same as that of the original port, byte for byte,
+ * teststackblur checks that.  That includes its oddities: alpha is never
+ * written, and the vertical pass multiplies colors by 255 / alpha.
+ */
+
+#define MAX_RADIUS 254
+#define STACK_SIZE (MAX_RADIUS * 2 + 1)
+
+/* below this many pixels threads cost more than they save */
+#define MIN_THREADED_PIXELS (256 * 256)
+#define MAX_BANDS 32
+
+#define COLUMN_BLOCK 8
+
+/* the smallest radius left after downscaling, anything smaller shows
+ * the blocks of the downscale through the blur */
+#define MIN_SCALED_RADIUS 4
+
+#if defined(__SSE2__)
 
-static GSList* blur_stack_new(GSList* l)
+typedef __m128i vec4;
+
+static inline vec4 vec4_zero(void)
 {
-    BlurData* d = g_slice_new0(BlurData);
-    return g_slist_append(l, d);
+    return _mm_setzero_si128();
 }
 
-static void blur_stack_free(BlurData* d)
+static inline vec4 vec4_load(const uint8_t* p)
 {
-    g_slice_free(BlurData, d);
+    int32_t v;
+    memcpy(&v, p, 4);
+    __m128i zero = _mm_setzero_si128();
+    __m128i r = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+    return _mm_unpacklo_epi16(r, zero);
 }
 
-void stack_blur_surface(cairo_surface_t* surface, int radius)
+static inline vec4 vec4_add(vec4 a, vec4 b) { return _mm_add_epi32(a, b); }
+static inline vec4 vec4_sub(vec4 a, vec4 b) { return _mm_sub_epi32(a, b); }
+
+/* no 32 bit multiply before SSE4.1 */
+static inline vec4 vec4_mul(vec4 a, unsigned k)
 {
-    if (radius < 1) return;
+    __m128i b = _mm_set1_epi32(k);
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), b);
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
 
-    uint8_t * pixels = (uint8_t *)cairo_image_surface_get_data(surface);
-    unsigned width = cairo_image_surface_get_width(surface),
-        height = cairo_image_surface_get_height(surface);
+static inline vec4 vec4_shr(vec4 a, unsigned n)
+{
+    return _mm_srl_epi32(a, _mm_cvtsi32_si128(n));
+}
 
-    int x, y, i, p, yp, yi, yw, r_sum, g_sum, b_sum, a_sum,
-            r_out_sum, g_out_sum, b_out_sum, a_out_sum,
-            r_in_sum, g_in_sum, b_in_sum, a_in_sum,
-            pr, pg, pb, pa, rbs;
+static inline unsigned vec4_alpha(vec4 a)
+{
+    return _mm_extract_epi16(a, 6);
+}
 
-    int div = radius + radius + 1;
-    int widthMinus1  = width - 1;
-    int heightMinus1 = height - 1;
-    int radiusPlus1  = radius + 1;
-    int sumFactor = radiusPlus1 * ( radiusPlus1 + 1 ) / 2;
-
-    GSList* stackStart = blur_stack_new(NULL);
-    GSList* stack = stackStart, *stackEnd = NULL;
-    for ( i = 1; i < div; i++ ) {
-        stack = blur_stack_new(stack);
-        if ( i == radiusPlus1 ) stackEnd = g_slist_last(stack);
-    }
-    g_assert(stack == stackStart);
-    stack = g_slist_last(stackStart);
-    g_assert(stack->next == NULL);
-    stack->next = stackStart; /* NOTE: make a circle */
-    GSList* stackIn = NULL;
-    GSList* stackOut = NULL;
+/* low byte of each channel, the way storing to uint8_t truncates */
+static inline void vec4_store_rgb(vec4 a, uint8_t* p)
+{
+    uint32_t v;
+    a = _mm_and_si128(a, _mm_set1_epi32(0xff));
+    a = _mm_packs_epi32(a, a);
+    v = _mm_cvtsi128_si32(_mm_packus_epi16(a, a));
+    memcpy(p, &v, 3);
+}
 
-    yw = yi = 0;
+#elif defined(__ARM_NEON)
 
-    unsigned mul_sum = mul_table[radius];
-    unsigned shg_sum = shg_table[radius];
+typedef uint32x4_t vec4;
 
-    for ( y = 0; y < height; y++ ) {
-        r_in_sum = g_in_sum = b_in_sum = a_in_sum = r_sum = g_sum = b_sum = a_sum = 0;
+static inline vec4 vec4_zero(void)
+{
+    return vdupq_n_u32(0);
+}
 
-        r_out_sum = radiusPlus1 * ( pr = pixels[yi] );
-        g_out_sum = radiusPlus1 * ( pg = pixels[yi+1] );
-        b_out_sum = radiusPlus1 * ( pb = pixels[yi+2] );
-        a_out_sum = radiusPlus1 * ( pa = pixels[yi+3] );
+static inline vec4 vec4_load(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    uint16x8_t r = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(v)));
+    return vmovl_u16(vget_low_u16(r));
+}
 
-        r_sum += sumFactor * pr;
-        g_sum += sumFactor * pg;
-        b_sum += sumFactor * pb;
-        a_sum += sumFactor * pa;
+static inline vec4 vec4_add(vec4 a, vec4 b) { return vaddq_u32(a, b); }
+static inline vec4 vec4_sub(vec4 a, vec4 b) { return vsubq_u32(a, b); }
+static inline vec4 vec4_mul(vec4 a, unsigned k) { return vmulq_n_u32(a, k); }
 
-        stack = stackStart;
+static inline vec4 vec4_shr(vec4 a, unsigned n)
+{
+    return vshlq_u32(a, vdupq_n_s32(-(int)n));
+}
 
-        for( i = 0; i < radiusPlus1; i++ ) {
-            BlurData* d = (BlurData*)stack->data;
-            d->r = pr;
-            d->g = pg;
-            d->b = pb;
-            d->a = pa;
-            stack = stack->next;
-        }
+static inline unsigned vec4_alpha(vec4 a)
+{
+    return vgetq_lane_u32(a, 3) & 0xff;
+}
 
-        for( i = 1; i < radiusPlus1; i++ ) {
-            p = yi + (( widthMinus1 < i ? widthMinus1 : i ) << 2 );
-            BlurData* d = (BlurData*)stack->data;
-            r_sum += ( d->r = ( pr = pixels[p])) * ( rbs = radiusPlus1 - i );
-            g_sum += ( d->g = ( pg = pixels[p+1])) * rbs;
-            b_sum += ( d->b = ( pb = pixels[p+2])) * rbs;
-            a_sum += ( d->a = ( pa = pixels[p+3])) * rbs;
+static inline void vec4_store_rgb(vec4 a, uint8_t* p)
+{
+    uint8x8_t b = vmovn_u16(vcombine_u16(vmovn_u32(a), vmovn_u32(a)));
+    uint32_t v = vget_lane_u32(vreinterpret_u32_u8(b), 0);
+    memcpy(p, &v, 3);
+}
 
-            r_in_sum += pr;
-            g_in_sum += pg;
-            b_in_sum += pb;
-            a_in_sum += pa;
+#else
 
-            stack = stack->next;
-        }
+typedef struct { uint32_t c[4]; } vec4;
 
+static inline vec4 vec4_zero(void)
+{
+    vec4 r = {{0, 0, 0, 0}};
+    return r;
+}
 
-        stackIn = stackStart;
-        stackOut = stackEnd;
-        for ( x = 0; x < width; x++ ) {
-            pixels[yi]   = (r_sum * mul_sum) >> shg_sum;
-            pixels[yi+1] = (g_sum * mul_sum) >> shg_sum;
-            pixels[yi+2] = (b_sum * mul_sum) >> shg_sum;
-            /*pixels[yi+3] = (a_sum * mul_sum) >> shg_sum;*/
+static inline vec4 vec4_load(const uint8_t* p)
+{
+    vec4 r = {{p[0], p[1], p[2], p[3]}};
+    return r;
+}
 
-            r_sum -= r_out_sum;
-            g_sum -= g_out_sum;
-            b_sum -= b_out_sum;
-            a_sum -= a_out_sum;
+static inline vec4 vec4_add(vec4 a, vec4 b)
+{
+    for (int i = 0; i < 4; i++) a.c[i] += b.c[i];
+    return a;
+}
 
-            BlurData* d = (BlurData*)stackIn->data;
-            r_out_sum -= d->r;
-            g_out_sum -= d->g;
-            b_out_sum -= d->b;
-            a_out_sum -= d->a;
+static inline vec4 vec4_sub(vec4 a, vec4 b)
+{
+    for (int i = 0; i < 4; i++) a.c[i] -= b.c[i];
+    return a;
+}
 
-            p =  ( yw + ( ( p = x + radius + 1 ) < widthMinus1 ? p : widthMinus1 ) ) << 2;
+static inline vec4 vec4_mul(vec4 a, unsigned k)
+{
+    for (int i = 0; i < 4; i++) a.c[i] *= k;
+    return a;
+}
 
-            r_in_sum += ( d->r = pixels[p]);
-            g_in_sum += ( d->g = pixels[p+1]);
-            b_in_sum += ( d->b = pixels[p+2]);
-            a_in_sum += ( d->a = pixels[p+3]);
+static inline vec4 vec4_shr(vec4 a, unsigned n)
+{
+    for (int i = 0; i < 4; i++) a.c[i] >>= n;
+    return a;
+}
 
-            r_sum += r_in_sum;
-            g_sum += g_in_sum;
-            b_sum += b_in_sum;
-            a_sum += a_in_sum;
+static inline unsigned vec4_alpha(vec4 a)
+{
+    return a.c[3] & 0xff;
+}
 
-            stackIn = stackIn->next;
+static inline void vec4_store_rgb(vec4 a, uint8_t* p)
+{
+    p[0] = a.c[0];
+    p[1] = a.c[1];
+    p[2] = a.c[2];
+}
 
-            d = (BlurData*)stackOut->data;
-            r_out_sum += ( pr = d->r );
-            g_out_sum += ( pg = d->g );
-            b_out_sum += ( pb = d->b );
-            a_out_sum += ( pa = d->a );
+#endif
 
-            r_in_sum -= pr;
-            g_in_sum -= pg;
-            b_in_sum -= pb;
-            a_in_sum -= pa;
+typedef struct _BlurPass
+{
+    uint8_t* pixels;
+    int width, height, stride;
+    int radius;
 
-            stackOut = stackOut->next;
+    GMutex mutex;
+    GCond cond;
+    int pending;
+} BlurPass;
 
-            yi += 4;
-        }
-        yw += width;
-    }
+typedef struct _BlurBand
+{
+    BlurPass* pass;
+    gboolean vertical;
+    int start, end; /* rows or columns */
+} BlurBand;
 
+/* horizontal pass over one row, alpha is left alone */
+static void blur_row(uint8_t* pixels, int width, int radius)
+{
+    vec4 stack[STACK_SIZE];
+    vec4 sum, in_sum, out_sum, p;
+    int div = radius + radius + 1;
+    int last = width - 1;
+    int radius_plus1 = radius + 1;
+    unsigned sum_factor = radius_plus1 * (radius_plus1 + 1) / 2;
+    unsigned mul_sum = mul_table[radius];
+    unsigned shg_sum = shg_table[radius];
+    int i, si, so;
 
-    for ( x = 0; x < width; x++ )
-    {
-        g_in_sum = b_in_sum = a_in_sum = r_in_sum = g_sum = b_sum = a_sum = r_sum = 0;
+    p = vec4_load(pixels);
+    sum = vec4_mul(p, sum_factor);
+    out_sum = vec4_mul(p, radius_plus1);
+    in_sum = vec4_zero();
 
-        yi = x << 2;
-        r_out_sum = radiusPlus1 * ( pr = pixels[yi]);
-        g_out_sum = radiusPlus1 * ( pg = pixels[yi+1]);
-        b_out_sum = radiusPlus1 * ( pb = pixels[yi+2]);
-        a_out_sum = radiusPlus1 * ( pa = pixels[yi+3]);
+    for (i = 0; i < radius_plus1; i++)
+        stack[i] = p;
 
-        r_sum += sumFactor * pr;
-        g_sum += sumFactor * pg;
-        b_sum += sumFactor * pb;
-        a_sum += sumFactor * pa;
+    for (i = 1; i <= radius; i++) {
+        p = vec4_load(pixels + MIN(i, last) * 4);
+        stack[radius + i] = p;
+        sum = vec4_add(sum, vec4_mul(p, radius_plus1 - i));
+        in_sum = vec4_add(in_sum, p);
+    }
 
-        stack = stackStart;
+    si = 0;
+    so = radius_plus1;
+    for (i = 0; i < width; i++) {
+        vec4_store_rgb(vec4_shr(vec4_mul(sum, mul_sum), shg_sum), pixels + i * 4);
 
-        for( i = 0; i < radiusPlus1; i++ ) {
-            BlurData* d = (BlurData*)stack->data;
-            d->r = pr;
-            d->g = pg;
-            d->b = pb;
-            d->a = pa;
-            stack = stack->next;
-        }
+        sum = vec4_sub(sum, out_sum);
+        out_sum = vec4_sub(out_sum, stack[si]);
 
-        yp = width;
+        p = vec4_load(pixels + MIN(i + radius_plus1, last) * 4);
+        stack[si] = p;
+        in_sum = vec4_add(in_sum, p);
+        sum = vec4_add(sum, in_sum);
+        if (++si == div) si = 0;
 
-        for( i = 1; i <= radius; i++ ) {
-            yi = ( yp + x ) << 2;
+        p = stack[so];
+        out_sum = vec4_add(out_sum, p);
+        in_sum = vec4_sub(in_sum, p);
+        if (++so == div) so = 0;
+    }
+}
 
-            BlurData* d = (BlurData*)stack->data;
-            r_sum += ( d->r = ( pr = pixels[yi])) * ( rbs = radiusPlus1 - i );
-            g_sum += ( d->g = ( pg = pixels[yi+1])) * rbs;
-            b_sum += ( d->b = ( pb = pixels[yi+2])) * rbs;
-            a_sum += ( d->a = ( pa = pixels[yi+3])) * rbs;
+/*
+ * Vertical pass over up to COLUMN_BLOCK neighbouring columns.  Walking
+ * them together reads each row once per block instead of once per column,
+ * which is what makes this pass cache friendly.
+ *
+ * Colors are scaled by 255 / alpha of the pixel, fully transparent pixels
+ * are left alone.
+ */
+static void blur_columns(uint8_t* pixels, int n_cols, int height, int stride,
+        int radius)
+{
+    vec4 stack[STACK_SIZE][COLUMN_BLOCK];
+    vec4 sum[COLUMN_BLOCK], in_sum[COLUMN_BLOCK], out_sum[COLUMN_BLOCK];
+    unsigned pa[COLUMN_BLOCK];
+    int div = radius + radius + 1;
+    int last = height - 1;
+    int radius_plus1 = radius + 1;
+    unsigned sum_factor = radius_plus1 * (radius_plus1 + 1) / 2;
+    unsigned mul_sum = mul_table[radius];
+    unsigned shg_sum = shg_table[radius];
+    int i, k, si, so;
 
-            r_in_sum += pr;
-            g_in_sum += pg;
-            b_in_sum += pb;
-            a_in_sum += pa;
+    for (k = 0; k < n_cols; k++) {
+        vec4 p = vec4_load(pixels + k * 4);
+        sum[k] = vec4_mul(p, sum_factor);
+        out_sum[k] = vec4_mul(p, radius_plus1);
+        in_sum[k] = vec4_zero();
+        pa[k] = vec4_alpha(p);
 
-            stack = stack->next;
+        for (i = 0; i < radius_plus1; i++)
+            stack[i][k] = p;
+    }
 
-            if( i < heightMinus1 ) {
-                yp += width;
-            }
+    /* like the original, the first row uses the alpha of the last pixel
+     * read here rather than its own */
+    for (i = 1; i <= radius; i++) {
+        uint8_t* row = pixels + MIN(i, last) * stride;
+
+        for (k = 0; k < n_cols; k++) {
+            vec4 p = vec4_load(row + k * 4);
+            stack[radius + i][k] = p;
+            sum[k] = vec4_add(sum[k], vec4_mul(p, radius_plus1 - i));
+            in_sum[k] = vec4_add(in_sum[k], p);
+            pa[k] = vec4_alpha(p);
         }
+    }
+
+    si = 0;
+    so = radius_plus1;
+    for (i = 0; i < height; i++) {
+        uint8_t* out = pixels + i * stride;
+        uint8_t* in = pixels + MIN(i + radius_plus1, last) * stride;
 
-        yi = x;
-        stackIn = stackStart;
-        stackOut = stackEnd;
-        for ( y = 0; y < height; y++ ) {
-            p = yi << 2;
-            /*pixels[p+3] = pa = (a_sum * mul_sum) >> shg_sum;*/
-            if ( pa > 0 ) {
-                pa = 255 / pa;
-                pixels[p]   = ((r_sum * mul_sum) >> shg_sum ) * pa;
-                pixels[p+1] = ((g_sum * mul_sum) >> shg_sum ) * pa;
-                pixels[p+2] = ((b_sum * mul_sum) >> shg_sum ) * pa;
-            } else {
-                /*pixels[p] = pixels[p+1] = pixels[p+2] = 0;*/
-                /*pixels[p+3] = 0;*/
+        for (k = 0; k < n_cols; k++) {
+            if (pa[k] > 0) {
+                vec4 value = vec4_shr(vec4_mul(sum[k], mul_sum), shg_sum);
+                vec4_store_rgb(vec4_mul(value, 255 / pa[k]), out + k * 4);
             }
 
-            r_sum -= r_out_sum;
-            g_sum -= g_out_sum;
-            b_sum -= b_out_sum;
-            a_sum -= a_out_sum;
+            sum[k] = vec4_sub(sum[k], out_sum[k]);
+            out_sum[k] = vec4_sub(out_sum[k], stack[si][k]);
 
-            BlurData* d = (BlurData*)stackIn->data;
-            r_out_sum -= d->r;
-            g_out_sum -= d->g;
-            b_out_sum -= d->b;
-            a_out_sum -= d->a;
+            vec4 p = vec4_load(in + k * 4);
+            stack[si][k] = p;
+            in_sum[k] = vec4_add(in_sum[k], p);
+            sum[k] = vec4_add(sum[k], in_sum[k]);
 
-            p = ( x + (( ( p = y + radiusPlus1) < heightMinus1 ? p : heightMinus1 ) * width )) << 2;
+            p = stack[so][k];
+            out_sum[k] = vec4_add(out_sum[k], p);
+            in_sum[k] = vec4_sub(in_sum[k], p);
+            pa[k] = vec4_alpha(p);
+        }
 
-            r_sum += ( r_in_sum += ( d->r = pixels[p]));
-            g_sum += ( g_in_sum += ( d->g = pixels[p+1]));
-            b_sum += ( b_in_sum += ( d->b = pixels[p+2]));
-            a_sum += ( a_in_sum += ( d->a = pixels[p+3]));
+        if (++si == div) si = 0;
+        if (++so == div) so = 0;
+    }
+}
 
-            stackIn = stackIn->next;
+static void blur_band(BlurBand* band)
+{
+    BlurPass* pass = band->pass;
+    int i;
+
+    if (band->vertical) {
+        for (i = band->start; i < band->end; i += COLUMN_BLOCK)
+            blur_columns(pass->pixels + i * 4, MIN(COLUMN_BLOCK, band->end - i),
+                    pass->height, pass->stride, pass->radius);
+    } else {
+        for (i = band->start; i < band->end; i++)
+            blur_row(pass->pixels + i * pass->stride, pass->width, pass->radius);
+    }
+}
 
-            d = (BlurData*)stackOut->data;
-            r_out_sum += ( pr = d->r );
-            g_out_sum += ( pg = d->g );
-            b_out_sum += ( pb = d->b );
-            a_out_sum += ( pa = d->a );
+static void blur_band_in_thread(gpointer data, gpointer user_data)
+{
+    BlurBand* band = (BlurBand*)data;
+    BlurPass* pass = band->pass;
 
-            r_in_sum -= pr;
-            g_in_sum -= pg;
-            b_in_sum -= pb;
-            a_in_sum -= pa;
+    blur_band(band);
 
-            stackOut = stackOut->next;
+    g_mutex_lock(&pass->mutex);
+    if (--pass->pending == 0)
+        g_cond_signal(&pass->cond);
+    g_mutex_unlock(&pass->mutex);
+}
 
-            yi += width;
-        }
+/* NULL on a single core machine */
+static GThreadPool* get_pool(void)
+{
+    static gsize once = 0;
+    static GThreadPool* pool = NULL;
+
+    if (g_once_init_enter(&once)) {
+        int n = MIN(g_get_num_processors(), MAX_BANDS) - 1;
+        if (n > 0)
+            pool = g_thread_pool_new(blur_band_in_thread, NULL, n, FALSE, NULL);
+        g_once_init_leave(&once, 1);
     }
+    return pool;
+}
 
-    /* free stack */
-    GSList* ls = stackEnd;
-    while (ls->next != stackStart) {
-        ls = ls->next;
+/* runs one pass over all rows or columns, the caller takes the first band */
+static void blur_pass(BlurPass* pass, gboolean vertical, int n_bands)
+{
+    BlurBand bands[MAX_BANDS];
+    int n = vertical ? pass->width : pass->height;
+    int i;
+
+    for (i = 0; i < n_bands; i++) {
+        bands[i].pass = pass;
+        bands[i].vertical = vertical;
+        bands[i].start = n * i / n_bands;
+        bands[i].end = n * (i + 1) / n_bands;
     }
-    ls->next = NULL;
-    g_slist_free_full(stackStart, (GDestroyNotify)blur_stack_free);
+
+    pass->pending = n_bands - 1;
+    for (i = 1; i < n_bands; i++)
+        g_thread_pool_push(get_pool(), &bands[i], NULL);
+
+    blur_band(&bands[0]);
+
+    g_mutex_lock(&pass->mutex);
+    while (pass->pending > 0)
+        g_cond_wait(&pass->cond, &pass->mutex);
+    g_mutex_unlock(&pass->mutex);
 }
 
+void stack_blur_surface(cairo_surface_t* surface, int radius)
+{
+    if (radius < 1) return;
+    radius = MIN(radius, MAX_RADIUS);
+
+    cairo_surface_flush(surface);
+
+    BlurPass pass;
+    pass.pixels = (uint8_t *)cairo_image_surface_get_data(surface);
+    pass.width = cairo_image_surface_get_width(surface);
+    pass.height = cairo_image_surface_get_height(surface);
+    pass.stride = cairo_image_surface_get_stride(surface);
+    pass.radius = radius;
+
+    if (!pass.pixels || pass.width < 1 || pass.height < 1) return;
+
+    int n_bands = 1;
+    if (pass.width * pass.height >= MIN_THREADED_PIXELS && get_pool())
+        n_bands = MIN(g_get_num_processors(), MAX_BANDS);
+
+    g_mutex_init(&pass.mutex);
+    g_cond_init(&pass.cond);
+
+    blur_pass(&pass, FALSE, n_bands);
+    blur_pass(&pass, TRUE, n_bands);
+
+    g_cond_clear(&pass.cond);
+    g_mutex_clear(&pass.mutex);
+
+    cairo_surface_mark_dirty(surface);
+}
+
+/* largest power of two the surface can be shrunk by without it showing:
+ * the blur must still span MIN_SCALED_RADIUS pixels of the small copy */
+static int get_downscale_factor(int radius, double scale)
+{
+    double limit = radius / (double)MIN_SCALED_RADIUS;
+    int factor = 1;
+
+    /* shown enlarged, the small copy would show sooner */
+    if (scale > 1.0)
+        limit /= scale;
 
+    while (factor * 2 <= limit)
+        factor *= 2;
+    return factor;
+}
+
+static void paint_scaled(cairo_surface_t* dest, cairo_surface_t* source,
+        double scale, cairo_filter_t filter)
+{
+    cairo_t* cr = cairo_create(dest);
+    cairo_scale(cr, scale, scale);
+    cairo_set_source_surface(cr, source, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), filter);
+    cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_PAD);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+}
+
+/**
+ * stack_blur_surface_scaled:
+ * @surface: an image surface
+ * @radius: blur radius in pixels of @surface
+ * @scale: the scale the result will be shown at
+ *
+ * Blurs a copy of @surface, shrunk by the largest power of two that
+ * leaves a radius of at least MIN_SCALED_RADIUS pixels (more when @scale
+ * enlarges it), then scales it back up with a bilinear filter.  For a
+ * radius of 64 that is 1/256th of the pixels.
+ *
+ * Return value: a new surface of the size and format of @surface
+ */
+cairo_surface_t* stack_blur_surface_scaled(cairo_surface_t* surface,
+        int radius, double scale)
+{
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    cairo_surface_t* result = cairo_image_surface_create(
+            cairo_image_surface_get_format(surface), width, height);
+
+    int factor = get_downscale_factor(radius, scale);
+    if (factor == 1) {
+        paint_scaled(result, surface, 1.0, CAIRO_FILTER_NEAREST);
+        stack_blur_surface(result, radius);
+        return result;
+    }
+
+    /* ARGB32 even for RGB24 sources: scaling may leave the unused alpha
+     * byte of RGB24 zero, and the vertical pass skips pixels with no alpha */
+    cairo_surface_t* small = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+            (width + factor - 1) / factor, (height + factor - 1) / factor);
+
+    paint_scaled(small, surface, 1.0 / factor, CAIRO_FILTER_GOOD);
+    stack_blur_surface(small, (radius + factor / 2) / factor);
+    paint_scaled(result, small, factor, CAIRO_FILTER_BILINEAR);
+
+    cairo_surface_destroy(small);
+    return result;
+}
@@ -0,0 +1,53 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*-  */
+
+/**
+ * Copyright (C) 2015 Deepin Technology Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ **/
+
+#include <math.h>
+#include "deepin-surface-damage.h"
+
+cairo_region_t* deepin_surface_damage_region(const XRectangle* rects, int n,
+        int x, int y, int width, int height)
+{
+    cairo_region_t* damage = cairo_region_create();
+    for (int i = 0; i < n; i++) {
+        cairo_rectangle_int_t r = {
+            rects[i].x - x, rects[i].y - y, rects[i].width, rects[i].height
+        };
+        cairo_region_union_rectangle(damage, &r);
+    }
+
+    cairo_rectangle_int_t bounds = {0, 0, width, height};
+    cairo_region_intersect_rectangle(damage, &bounds);
+    return damage;
+}
+
+cairo_region_t* deepin_surface_damage_scale(const cairo_region_t* dirty,
+        double scale, int width, int height, cairo_rectangle_int_t* extents)
+{
+    cairo_region_t* scaled = cairo_region_create();
+
+    /* grow each rect to whole pixels, the filter blends neighbours in */
+    int n = cairo_region_num_rectangles(dirty);
+    for (int i = 0; i < n; i++) {
+        cairo_rectangle_int_t r;
+        cairo_region_get_rectangle(dirty, i, &r);
+
+        int x1 = floor(r.x * scale), y1 = floor(r.y * scale);
+        int x2 = ceil((r.x + r.width) * scale);
+        int y2 = ceil((r.y + r.height) * scale);
+        cairo_rectangle_int_t s = { x1, y1, x2 - x1, y2 - y1 };
+        cairo_region_union_rectangle(scaled, &s);
+    }
+
+    cairo_rectangle_int_t bounds = {0, 0, width, height};
+    cairo_region_intersect_rectangle(scaled, &bounds);
+    cairo_region_get_extents(scaled, extents);
+    return scaled;
+}
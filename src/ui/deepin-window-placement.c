@@ -0,0 +1,724 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*-  */
+
+/**
+ * Copyright (C) 2015 Deepin Technology Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ **/
+
+/*
+ * Window placement for the workspace overview and the shadow workspaces.
+ *
+ * The natural placement keeps pushing overlapping windows apart.  Instead
+ * of testing every pair on every pass, the windows are kept sorted by
+ * their left edge (sweep and prune): a window can only overlap the ones
+ * after it that start before its right edge ends.  The sort is redone by
+ * insertion each pass, which is cheap since windows only move a little.
+ * Every loop has a budget, so a pathological set of windows costs a
+ * bounded amount of time and is simply left overlapping a bit.
+ */
+
+#include <config.h>
+#include <math.h>
+#include <string.h>
+#include <limits.h>
+#include <gdk/gdk.h>
+#include "deepin-window-placement.h"
+#ifndef DEEPIN_PLACEMENT_STANDALONE
+#include "deepin-message-hub.h"
+#endif
+
+#define GAPS 10
+#define ACCURACY 20
+
+/* budgets of the natural placement */
+#define MAX_TRANSLATIONS 100000
+#define MAX_PUSH_PASSES 1000
+#define MAX_GROW_PASSES 100
+
+static MetaRectangle rect_adjusted(MetaRectangle rect, int dx1, int dy1, int dx2, int dy2)
+{
+    return (MetaRectangle){rect.x + dx1, rect.y + dy1, rect.width + (-dx1 + dx2), rect.height + (-dy1 + dy2)};
+}
+
+static GdkPoint rect_center(MetaRectangle rect)
+{
+    return (GdkPoint){rect.x + rect.width / 2, rect.y + rect.height / 2};
+}
+
+static int squared_distance (GdkPoint a, GdkPoint b)
+{
+    int k1 = b.x - a.x;
+    int k2 = b.y - a.y;
+
+    return k1*k1 + k2*k2;
+}
+
+static void grid_placement(const MetaRectangle* windows, int n,
+        MetaRectangle area, gboolean closest, MetaRectangle* targets)
+{
+    int columns = (int)ceil (sqrt (n));
+    int rows = (int)ceil (n / (double)columns);
+
+    // Assign slots
+    int slot_width = area.width / columns;
+    int slot_height = area.height / rows;
+
+    // window in each slot, or -1
+    int* taken_slots = g_new(int, rows * columns);
+    for (int i = 0; i < rows * columns; i++)
+        taken_slots[i] = -1;
+
+    if (closest) {
+        // Assign each window to the closest available slot. a window
+        // pushed out of its slot looks for another one, which ends since
+        // every takeover brings a slot's occupant closer
+        GdkPoint* slot_centers = g_new(GdkPoint, rows * columns);
+        for (int x = 0; x < columns; x++) {
+            for (int y = 0; y < rows; y++) {
+                slot_centers[x + y * columns] = (GdkPoint){
+                    area.x + slot_width  * x + slot_width  / 2,
+                    area.y + slot_height * y + slot_height / 2
+                };
+            }
+        }
+
+        int* pending = g_new(int, n);
+        int n_pending = 0;
+        for (int i = n - 1; i >= 0; i--)
+            pending[n_pending++] = i;
+
+        int budget = n * n * 4;
+        while (n_pending > 0 && budget-- > 0) {
+            int window = pending[--n_pending];
+            GdkPoint pos = rect_center (windows[window]);
+
+            int slot_candidate = -1;
+            int slot_candidate_distance = INT_MAX;
+
+            for (int i = 0; i < n; i++) {
+                int dist = squared_distance (pos, slot_centers[i]);
+                if (dist >= slot_candidate_distance)
+                    continue;
+
+                // either nobody lives here, or we're better - takeover the slot if it's our best
+                int occupier = taken_slots[i];
+                if (occupier < 0 || dist < squared_distance (rect_center (windows[occupier]), slot_centers[i])) {
+                    slot_candidate = i;
+                    slot_candidate_distance = dist;
+                }
+            }
+
+            if (taken_slots[slot_candidate] >= 0)
+                pending[n_pending++] = taken_slots[slot_candidate];
+            taken_slots[slot_candidate] = window;
+        }
+
+        // out of budget, whoever is left takes the free slots
+        for (int i = 0; i < n && n_pending > 0; i++) {
+            if (taken_slots[i] < 0)
+                taken_slots[i] = pending[--n_pending];
+        }
+
+        g_free(pending);
+        g_free(slot_centers);
+
+    } else {
+        // Assign each window as the origin order.
+        for (int i = 0; i < n; i++)
+            taken_slots[i] = i;
+    }
+
+    // see how many windows we have on the last row
+    int left_over = n - columns * (rows - 1);
+
+    for (int slot = 0; slot < columns * rows; slot++) {
+        int window = taken_slots[slot];
+        // some slots might be empty
+        if (window < 0)
+            continue;
+
+        MetaRectangle rect = windows[window];
+
+        // Work out where the slot is
+        MetaRectangle target = {
+            area.x + (slot % columns) * slot_width,
+            area.y + (slot / columns) * slot_height,
+            slot_width,
+            slot_height
+        };
+        target = rect_adjusted (target, 10, 10, -10, -10);
+
+        float scale;
+        if (target.width / (double)rect.width < target.height / (double)rect.height) {
+            // Center vertically
+            scale = target.width / (float)rect.width;
+            target.y += (target.height - (int)(rect.height * scale)) / 2;
+            target.height = (int)floorf (rect.height * scale);
+        } else {
+            // Center horizontally
+            scale = target.height / (float)rect.height;
+            target.x += (target.width - (int)(rect.width * scale)) / 2;
+            target.width = (int)floorf (rect.width * scale);
+        }
+
+        // Don't scale the windows too much
+        if (scale > 1.0) {
+            scale = 1.0f;
+            target = (MetaRectangle){
+                rect_center (target).x - (int)floorf (rect.width * scale) / 2,
+                rect_center (target).y - (int)floorf (rect.height * scale) / 2,
+                (int)floorf (scale * rect.width),
+                (int)floorf (scale * rect.height)
+            };
+        }
+
+        // put the last row in the center, if necessary
+        if (left_over != columns && slot >= columns * (rows - 1))
+            target.x += (columns - left_over) * slot_width / 2;
+
+        targets[window] = target;
+    }
+
+    g_free(taken_slots);
+}
+
+/* rects sorted by their left edge */
+typedef struct _SweepList
+{
+    MetaRectangle* rects;
+    int* order; // indices into rects, by x
+    int* where; // position of each rect in order
+    int n;
+    int max_width;
+} SweepList;
+
+static void sweep_init(SweepList* sweep, MetaRectangle* rects, int n)
+{
+    sweep->rects = rects;
+    sweep->n = n;
+    sweep->max_width = 0;
+    sweep->order = g_new(int, n);
+    sweep->where = g_new(int, n);
+    for (int i = 0; i < n; i++) {
+        sweep->order[i] = i;
+        sweep->where[i] = i;
+    }
+}
+
+static void sweep_free(SweepList* sweep)
+{
+    g_free(sweep->order);
+    g_free(sweep->where);
+}
+
+// insertion sort, the order is nearly right already
+static void sweep_sort(SweepList* sweep)
+{
+    MetaRectangle* rects = sweep->rects;
+
+    sweep->max_width = 0;
+    for (int i = 0; i < sweep->n; i++) {
+        int index = sweep->order[i];
+        int j = i;
+        while (j > 0 && rects[sweep->order[j - 1]].x > rects[index].x) {
+            sweep->order[j] = sweep->order[j - 1];
+            sweep->where[sweep->order[j]] = j;
+            j--;
+        }
+        sweep->order[j] = index;
+        sweep->where[index] = j;
+        sweep->max_width = MAX(sweep->max_width, rects[index].width);
+    }
+}
+
+// moves rects[index], which just changed, back to its place in order
+static void sweep_update(SweepList* sweep, int index)
+{
+    MetaRectangle* rects = sweep->rects;
+    int* order = sweep->order;
+    int j = sweep->where[index];
+
+    while (j > 0 && rects[order[j - 1]].x > rects[index].x) {
+        order[j] = order[j - 1];
+        sweep->where[order[j]] = j;
+        j--;
+    }
+    while (j < sweep->n - 1 && rects[order[j + 1]].x < rects[index].x) {
+        order[j] = order[j + 1];
+        sweep->where[order[j]] = j;
+        j++;
+    }
+    order[j] = index;
+    sweep->where[index] = j;
+    sweep->max_width = MAX(sweep->max_width, rects[index].width);
+}
+
+// whether rect leaves border or overlaps any rect but skip
+static gboolean sweep_overlaps_any(SweepList* sweep, MetaRectangle rect,
+        int skip, MetaRectangle border)
+{
+    MetaRectangle* rects = sweep->rects;
+
+    if (!meta_rectangle_contains_rect(&border, &rect))
+        return TRUE;
+
+    // first rect that may reach into rect from the left
+    int lo = 0, hi = sweep->n;
+    int from = rect.x - sweep->max_width;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (rects[sweep->order[mid]].x <= from) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (int i = lo; i < sweep->n; i++) {
+        int index = sweep->order[i];
+        if (rects[index].x >= rect.x + rect.width)
+            break;
+        if (index != skip && meta_rectangle_overlap(&rects[index], &rect))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+// move rects i and j, which overlap, apart
+static void push_apart(MetaRectangle* rects, int i, int j, int direction,
+        MetaRectangle* bounds)
+{
+    MetaRectangle rect = rects[i];
+    MetaRectangle comp = rects[j];
+
+    // Determine pushing direction
+    GdkPoint i_center = rect_center (rect);
+    GdkPoint j_center = rect_center (comp);
+    GdkPoint diff = {j_center.x - i_center.x, j_center.y - i_center.y};
+
+    // Prevent dividing by zero and non-movement
+    if (diff.x == 0 && diff.y == 0)
+        diff.x = 1;
+
+    // Approximate a vector of between 10px and 20px in magnitude in the same direction
+    float length = sqrtf (diff.x * diff.x + diff.y * diff.y);
+    diff.x = (int)floorf (diff.x * ACCURACY / length);
+    diff.y = (int)floorf (diff.y * ACCURACY / length);
+    // Move both windows apart
+    rect.x += -diff.x;
+    rect.y += -diff.y;
+    comp.x += diff.x;
+    comp.y += diff.y;
+
+    // Try to keep the bounding rect the same aspect as the screen so that more
+    // screen real estate is utilised. We do this by splitting the screen into nine
+    // equal sections, if the window center is in any of the corner sections pull the
+    // window towards the outer corner. If it is in any of the other edge sections
+    // alternate between each corner on that edge. We don't want to determine it
+    // randomly as it will not produce consistant locations when using the filter.
+    // Only move one window so we don't cause large amounts of unnecessary zooming
+    // in some situations. We need to do this even when expanding later just in case
+    // all windows are the same size.
+    // (We are using an old bounding rect for this, hopefully it doesn't matter)
+    int x_section = (int)roundf ((rect.x - bounds->x) / (bounds->width / 3.0f));
+    int y_section = (int)roundf ((comp.y - bounds->y) / (bounds->height / 3.0f));
+
+    i_center = rect_center (rect);
+    diff.x = 0;
+    diff.y = 0;
+    if (x_section != 1 || y_section != 1) { // Remove this if you want the center to pull as well
+        if (x_section == 1)
+            x_section = (direction / 2 == 1 ? 2 : 0);
+        if (y_section == 1)
+            y_section = (direction % 2 == 1 ? 2 : 0);
+    }
+    if (x_section == 0 && y_section == 0) {
+        diff.x = bounds->x - i_center.x;
+        diff.y = bounds->y - i_center.y;
+    }
+    if (x_section == 2 && y_section == 0) {
+        diff.x = bounds->x + bounds->width - i_center.x;
+        diff.y = bounds->y - i_center.y;
+    }
+    if (x_section == 2 && y_section == 2) {
+        diff.x = bounds->x + bounds->width - i_center.x;
+        diff.y = bounds->y + bounds->height - i_center.y;
+    }
+    if (x_section == 0 && y_section == 2) {
+        diff.x = bounds->x - i_center.x;
+        diff.y = bounds->y + bounds->height - i_center.y;
+    }
+    if (diff.x != 0 || diff.y != 0) {
+        length = sqrtf (diff.x * diff.x + diff.y * diff.y);
+        diff.x *= (int)floorf (ACCURACY / length / 2.0f);
+        diff.y *= (int)floorf (ACCURACY / length / 2.0f);
+        rect.x += diff.x;
+        rect.y += diff.y;
+    }
+
+    // Update bounding rect
+    meta_rectangle_union(bounds, &rect, bounds);
+    meta_rectangle_union(bounds, &comp, bounds);
+
+    rects[i] = rect;
+    rects[j] = comp;
+}
+
+static void natural_placement(const MetaRectangle* windows, int n,
+        MetaRectangle area, MetaRectangle* targets)
+{
+    MetaRectangle bounds = {area.x, area.y, area.width, area.height};
+    MetaRectangle* rects = targets;
+    SweepList sweep;
+
+    for (int i = 0; i < n; i++) {
+        rects[i] = rect_adjusted(windows[i], -GAPS, -GAPS, GAPS, GAPS);
+        meta_rectangle_union(&bounds, &rects[i], &bounds);
+    }
+
+    sweep_init(&sweep, rects, n);
+
+    // only pairs that overlap on the x axis are looked at. rects moved
+    // during a pass may slip past each other, the next pass sorts again
+    // and catches that; a pass without overlaps is exact
+    int translations = 0;
+    int passes = 0;
+    gboolean overlap = FALSE;
+    do {
+        overlap = FALSE;
+        sweep_sort(&sweep);
+
+        for (int a = 0; a < n; a++) {
+            int i = sweep.order[a];
+            for (int b = a + 1; b < n; b++) {
+                int j = sweep.order[b];
+                if (rects[j].x >= rects[i].x + rects[i].width)
+                    break;
+                if (!meta_rectangle_overlap(&rects[i], &rects[j]))
+                    continue;
+
+                overlap = TRUE;
+                translations++;
+                // This is used when the window is on the edge of the screen to try to use as much screen real estate as possible.
+                push_apart(rects, i, j, i % 4, &bounds);
+            }
+        }
+    } while (overlap && ++passes < MAX_PUSH_PASSES && translations < MAX_TRANSLATIONS);
+
+    // Work out scaling by getting the most top-left and most bottom-right window coords.
+    float scale = fminf (fminf (area.width / (float)bounds.width,
+                area.height / (float)bounds.height), 1.0f);
+
+    // Make bounding rect fill the screen size for later steps
+    bounds.x = (int)floorf (bounds.x - (area.width - bounds.width * scale) / 2);
+    bounds.y = (int)floorf (bounds.y - (area.height - bounds.height * scale) / 2);
+    bounds.width = (int)floorf (area.width / scale);
+    bounds.height = (int)floorf (area.height / scale);
+
+    // Move all windows back onto the screen and set their scale
+    for (int index = 0; index < n; index++) {
+        MetaRectangle rect = rects[index];
+        rects[index] = (MetaRectangle){
+            (int)floorf ((rect.x - bounds.x) * scale + area.x),
+                (int)floorf ((rect.y - bounds.y) * scale + area.y),
+                (int)floorf (rect.width * scale),
+                (int)floorf (rect.height * scale)
+        };
+    }
+
+    // fill gaps by enlarging windows
+    gboolean moved = FALSE;
+    MetaRectangle border = area;
+    sweep_sort(&sweep);
+    passes = 0;
+    do {
+        moved = FALSE;
+
+        for (int index = 0; index < n; index++) {
+            MetaRectangle rect = rects[index];
+
+            // grow keeping the aspect, the clones are scaled by width
+            // alone and would spill over a rect taller than it is
+            int width_diff = ACCURACY;
+            int height_diff = (int)floorf ((rect.width + width_diff) /
+                        (float)rect.width * rect.height) - rect.height;
+            int x_diff = width_diff / 2;
+            int y_diff = height_diff / 2;
+
+            // top right, bottom right, bottom left, top left; each try
+            // grows from where the last one that fit left it
+            GdkPoint offsets[] = {
+                { x_diff, -y_diff - height_diff },
+                { x_diff, y_diff },
+                { -x_diff, y_diff },
+                { -x_diff, -y_diff - height_diff },
+            };
+
+            for (int k = 0; k < G_N_ELEMENTS(offsets); k++) {
+                MetaRectangle grown = {
+                    rect.x + offsets[k].x, rect.y + offsets[k].y,
+                    rect.width + width_diff, rect.height + height_diff
+                };
+                if (!sweep_overlaps_any(&sweep, grown, index, border)) {
+                    rect = grown;
+                    moved = TRUE;
+                }
+            }
+
+            rects[index] = rect;
+            sweep_update(&sweep, index);
+        }
+    } while (moved && ++passes < MAX_GROW_PASSES);
+
+    for (int index = 0; index < n; index++) {
+        MetaRectangle rect = rects[index];
+        MetaRectangle window_rect = windows[index];
+
+        rect = rect_adjusted(rect, GAPS, GAPS, -GAPS, -GAPS);
+        scale = rect.width / (float)window_rect.width;
+
+        if (scale > 2.0 || (scale > 1.0 && (window_rect.width > 300 || window_rect.height > 300))) {
+            scale = (window_rect.width > 300 || window_rect.height > 300) ? 1.0f : 2.0f;
+            rect = (MetaRectangle){rect_center (rect).x - (int)floorf (window_rect.width * scale) / 2,
+                rect_center (rect).y - (int)floorf (window_rect.height * scale) / 2,
+                (int)floorf (window_rect.width * scale),
+                (int)floorf (window_rect.height * scale)};
+        }
+
+        targets[index] = rect;
+    }
+
+    sweep_free(&sweep);
+}
+
+void deepin_window_placement_compute(DeepinPlacementMode mode,
+        const MetaRectangle* windows, int n, MetaRectangle area,
+        MetaRectangle* targets)
+{
+    if (n <= 0) return;
+
+    switch (mode) {
+        case DEEPIN_PLACEMENT_GRID:
+            grid_placement(windows, n, area, FALSE, targets);
+            break;
+        case DEEPIN_PLACEMENT_GRID_CLOSEST:
+            grid_placement(windows, n, area, TRUE, targets);
+            break;
+        case DEEPIN_PLACEMENT_NATURAL:
+            natural_placement(windows, n, area, targets);
+            break;
+    }
+}
+
+/* Layouts computed lately, so reopening the overview over the same
+ * windows needs no work.  The key holds everything the result depends
+ * on: mode, area and every window rect in order.  Any change of geometry
+ * gives another key, so entries never go wrong; they are only dropped to
+ * not keep layouts of windows that are gone. */
+#define LAYOUT_CACHE_SIZE 8
+
+typedef struct _CachedLayout
+{
+    GBytes* key;
+    MetaRectangle* targets;
+    int n;
+} CachedLayout;
+
+G_LOCK_DEFINE_STATIC(layout_cache);
+static GHashTable* layout_cache = NULL; // GBytes* -> CachedLayout*
+static GQueue layout_lru = G_QUEUE_INIT; // most recently used first
+
+static void cached_layout_free(CachedLayout* layout)
+{
+    g_bytes_unref(layout->key);
+    g_free(layout->targets);
+    g_slice_free(CachedLayout, layout);
+}
+
+static GBytes* layout_key_new(DeepinPlacementMode mode,
+        const MetaRectangle* windows, int n, MetaRectangle area)
+{
+    gsize header = sizeof(int) * 2 + sizeof(MetaRectangle);
+    gsize size = header + sizeof(MetaRectangle) * n;
+    guint8* data = g_malloc(size);
+
+    int params[2] = {mode, n};
+    memcpy(data, params, sizeof params);
+    memcpy(data + sizeof params, &area, sizeof area);
+    memcpy(data + header, windows, sizeof(MetaRectangle) * n);
+    return g_bytes_new_take(data, size);
+}
+
+// returns a copy of the layout for key, or NULL
+static MetaRectangle* layout_cache_lookup(GBytes* key)
+{
+    MetaRectangle* targets = NULL;
+
+    G_LOCK(layout_cache);
+    if (layout_cache) {
+        CachedLayout* layout = g_hash_table_lookup(layout_cache, key);
+        if (layout) {
+            g_queue_remove(&layout_lru, layout);
+            g_queue_push_head(&layout_lru, layout);
+            targets = g_memdup(layout->targets, sizeof(MetaRectangle) * layout->n);
+        }
+    }
+    G_UNLOCK(layout_cache);
+
+    return targets;
+}
+
+static void layout_cache_insert(GBytes* key, const MetaRectangle* targets, int n)
+{
+    G_LOCK(layout_cache);
+    if (layout_cache && !g_hash_table_contains(layout_cache, key)) {
+        CachedLayout* layout = g_slice_new0(CachedLayout);
+        layout->key = g_bytes_ref(key);
+        layout->targets = g_memdup(targets, sizeof(MetaRectangle) * n);
+        layout->n = n;
+        g_hash_table_insert(layout_cache, layout->key, layout);
+        g_queue_push_head(&layout_lru, layout);
+
+        while (g_queue_get_length(&layout_lru) > LAYOUT_CACHE_SIZE) {
+            CachedLayout* oldest = g_queue_pop_tail(&layout_lru);
+            g_hash_table_remove(layout_cache, oldest->key);
+            cached_layout_free(oldest);
+        }
+    }
+    G_UNLOCK(layout_cache);
+}
+
+/**
+ * deepin_window_placement_invalidate:
+ *
+ * Forgets the layouts cached by deepin_window_placement_compute_async(),
+ * for when windows come, go or get resized.
+ */
+void deepin_window_placement_invalidate(void)
+{
+    G_LOCK(layout_cache);
+    if (layout_cache) {
+        g_hash_table_remove_all(layout_cache);
+    }
+    g_queue_foreach(&layout_lru, (GFunc)cached_layout_free, NULL);
+    g_queue_clear(&layout_lru);
+    G_UNLOCK(layout_cache);
+}
+
+#ifndef DEEPIN_PLACEMENT_STANDALONE
+static void on_layouts_outdated(DeepinMessageHub* hub, MetaWindow* window,
+        gpointer data)
+{
+    deepin_window_placement_invalidate();
+}
+
+static void on_layout_window_damaged(DeepinMessageHub* hub, MetaWindow* window,
+        XRectangle* rects, int n, gpointer data)
+{
+    /* no rects means the window got resized, a content change alone
+     * doesn't move anything */
+    if (!rects || n == 0) deepin_window_placement_invalidate();
+}
+#endif
+
+static void watch_layout_changes(void)
+{
+#ifndef DEEPIN_PLACEMENT_STANDALONE
+    g_object_connect(G_OBJECT(deepin_message_hub_get()),
+            "signal::window-added", on_layouts_outdated, NULL,
+            "signal::window-removed", on_layouts_outdated, NULL,
+            "signal::window-damaged", on_layout_window_damaged, NULL,
+            NULL);
+#endif
+}
+
+/* made from the main thread, which also starts watching for windows
+ * that make cached layouts outdated, whether a view is open or not */
+static void layout_cache_ensure(void)
+{
+    gboolean created = FALSE;
+
+    G_LOCK(layout_cache);
+    if (!layout_cache) {
+        layout_cache = g_hash_table_new(g_bytes_hash, g_bytes_equal);
+        created = TRUE;
+    }
+    G_UNLOCK(layout_cache);
+
+    if (created) watch_layout_changes();
+}
+
+typedef struct _PlacementJob
+{
+    DeepinPlacementMode mode;
+    MetaRectangle* windows;
+    int n;
+    MetaRectangle area;
+    GBytes* key;
+} PlacementJob;
+
+static void placement_job_free(PlacementJob* job)
+{
+    g_free(job->windows);
+    g_bytes_unref(job->key);
+    g_slice_free(PlacementJob, job);
+}
+
+static void place_in_thread(GTask* task, gpointer source, gpointer data,
+        GCancellable* cancellable)
+{
+    PlacementJob* job = (PlacementJob*)data;
+    MetaRectangle* targets = g_new0(MetaRectangle, MAX(job->n, 1));
+
+    deepin_window_placement_compute(job->mode, job->windows, job->n,
+            job->area, targets);
+    layout_cache_insert(job->key, targets, job->n);
+    g_task_return_pointer(task, targets, g_free);
+}
+
+/**
+ * deepin_window_placement_compute_async:
+ *
+ * Like deepin_window_placement_compute(), in a thread.  windows is
+ * copied, so it may be freed as soon as this returns.  A layout already
+ * computed for the same windows and area is returned without a thread.
+ */
+void deepin_window_placement_compute_async(DeepinPlacementMode mode,
+        const MetaRectangle* windows, int n, MetaRectangle area,
+        GCancellable* cancellable, GAsyncReadyCallback callback,
+        gpointer user_data)
+{
+    n = MAX(n, 0);
+
+    layout_cache_ensure();
+
+    GBytes* key = layout_key_new(mode, windows, n, area);
+    GTask* task = g_task_new(NULL, cancellable, callback, user_data);
+
+    MetaRectangle* targets = layout_cache_lookup(key);
+    if (targets) {
+        g_bytes_unref(key);
+        g_task_return_pointer(task, targets, g_free);
+        g_object_unref(task);
+        return;
+    }
+
+    PlacementJob* job = g_slice_new0(PlacementJob);
+    job->mode = mode;
+    job->windows = g_memdup(windows, sizeof(MetaRectangle) * n);
+    job->n = n;
+    job->area = area;
+    job->key = key;
+
+    g_task_set_task_data(task, job, (GDestroyNotify)placement_job_free);
+    g_task_run_in_thread(task, place_in_thread);
+    g_object_unref(task);
+}
+
+MetaRectangle* deepin_window_placement_compute_finish(GAsyncResult* result,
+        GError** error)
+{
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
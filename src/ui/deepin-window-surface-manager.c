@@ -11,12 +11,18 @@
 
 #include <config.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include <util.h>
+#include <gio/gio.h>
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
 #include <cairo/cairo-xlib.h>
+#include <cairo/cairo-xlib-xrender.h>
 #include <X11/extensions/Xrender.h>
 #include <X11/extensions/Xcomposite.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcbext.h>
 
 #include "errors.h"
 #include "../core/frame-private.h"
@@ -26,13 +32,72 @@
 #include "compositor.h"
 #include "deepin-design.h"
 #include "deepin-window-surface-manager.h"
+#include "deepin-surface-damage.h"
 #include "deepin-message-hub.h"
 
 static DeepinWindowSurfaceManager* _the_manager = NULL;
 
 /*
- * MetaWindow -> surface list
- *   windows[i] is a GTree, key is scale, value is surface 
+ * Per window we keep an unscaled copy of its outer rect (ref) and copies
+ * at the scales asked for.  Damage only marks parts of them dirty, which
+ * are fetched again the next time the window is asked for, so a busy
+ * window costs what changed instead of a full grab.
+ *
+ * Scaled copies are scaled by the X server with RENDER and only the
+ * scaled pixels are read back, so a thumbnail of a 4K window never pulls
+ * the whole window over the wire.  ref is only grabbed when somebody wants
+ * the window unscaled, or as a fallback when the server can't scale.
+ *
+ * The async getter doesn't wait for the server either: the read back is
+ * a GetImage whose reply is picked up from the main loop (ServerFetch),
+ * so asking for thumbnails never stalls painting.
+ */
+typedef struct _ServerFetch ServerFetch;
+
+typedef struct _ScaledSurface
+{
+    cairo_surface_t* surface; /* NULL until the first fetch is in */
+    cairo_region_t* dirty; /* in ref coordinates */
+    ServerFetch* fetch; /* in flight, if any */
+} ScaledSurface;
+
+typedef struct _WindowSurfaces
+{
+    cairo_format_t format;
+    int width, height;     /* of the outer rect */
+    cairo_surface_t* ref;  /* NULL until grabbed */
+    cairo_region_t* dirty; /* parts of ref older than the window */
+    GTree* scaled;         /* scale -> ScaledSurface */
+    guint jobs;            /* scale jobs reading ref on a worker */
+    guint serial;          /* bumped whenever the window is damaged */
+    guint id;              /* tells fetches whether it is still the same */
+} WindowSurfaces;
+
+struct _ServerFetch
+{
+    xcb_connection_t* conn;
+    MetaWindow* window;    /* only compared, it may be gone */
+    guint ws_id;
+    double scale;
+    cairo_format_t format;
+    int width, height;     /* of the whole scale */
+    cairo_rectangle_int_t area; /* being read, in scaled coordinates */
+    cairo_region_t* clip;  /* what of area it brings up to date */
+    xcb_get_image_cookie_t cookie;
+    xcb_get_image_reply_t* reply;
+    gboolean done;
+    GList* tasks;          /* GTask waiting for it */
+};
+
+typedef struct _ScaleJob
+{
+    MetaWindow* window;
+    cairo_surface_t* ref;
+    double scale;
+} ScaleJob;
+
+/*
+ * MetaWindow -> WindowSurfaces
  */
 struct _DeepinWindowSurfaceManagerPrivate
 {
@@ -47,6 +112,13 @@ enum
 
 static guint signals[N_SIGNALS];
 
+static guint _last_serial = 0;
+
+static GQueue _fetches = G_QUEUE_INIT; /* ServerFetch, in request order */
+static GSource* _fetch_source = NULL;
+
+static void window_surfaces_free(WindowSurfaces* ws);
+
 G_DEFINE_TYPE (DeepinWindowSurfaceManager, deepin_window_surface_manager, G_TYPE_OBJECT);
 
 static void deepin_window_surface_manager_init (DeepinWindowSurfaceManager *self)
@@ -54,7 +126,7 @@ static void deepin_window_surface_manager_init (DeepinWindowSurfaceManager *self
 	self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, DEEPIN_TYPE_WINDOW_SURFACE_MANAGER, DeepinWindowSurfaceManagerPrivate);
 
     self->priv->windows = g_hash_table_new_full(g_direct_hash, g_direct_equal,
-            NULL, (GDestroyNotify)g_tree_unref);
+            NULL, (GDestroyNotify)window_surfaces_free);
 }
 
 static void deepin_window_surface_manager_finalize (GObject *object)
@@ -90,6 +162,45 @@ static gint scale_compare(gconstpointer a, gconstpointer b, gpointer data)
     return 0;
 }
 
+static void scaled_surface_free(ScaledSurface* ss)
+{
+    if (ss->surface) cairo_surface_destroy(ss->surface);
+    cairo_region_destroy(ss->dirty);
+    g_slice_free(ScaledSurface, ss);
+}
+
+static WindowSurfaces* window_surfaces_new(cairo_format_t format,
+        int width, int height)
+{
+    WindowSurfaces* ws = g_slice_new0(WindowSurfaces);
+    cairo_rectangle_int_t r = {0, 0, width, height};
+
+    ws->format = format;
+    ws->width = width;
+    ws->height = height;
+    ws->dirty = cairo_region_create_rectangle(&r);
+    ws->scaled = g_tree_new_full(scale_compare, NULL, g_free,
+            (GDestroyNotify)scaled_surface_free);
+    ws->serial = ++_last_serial;
+    ws->id = ws->serial;
+    return ws;
+}
+
+static void window_surfaces_free(WindowSurfaces* ws)
+{
+    if (ws->ref) cairo_surface_destroy(ws->ref);
+    cairo_region_destroy(ws->dirty);
+    g_tree_unref(ws->scaled);
+    g_slice_free(WindowSurfaces, ws);
+}
+
+static gboolean add_scaled_dirty(gpointer key, gpointer value, gpointer data)
+{
+    ScaledSurface* ss = (ScaledSurface*)value;
+    cairo_region_union(ss->dirty, (cairo_region_t*)data);
+    return FALSE;
+}
+
 static cairo_surface_t* get_window_surface_from_xlib(MetaWindow* window)
 {
     cairo_surface_t *surface;
@@ -117,101 +228,719 @@ static cairo_surface_t* get_window_surface_from_xlib(MetaWindow* window)
     return surface;
 }
 
-cairo_surface_t* deepin_window_surface_manager_get_surface(MetaWindow* window,
+static cairo_format_t get_window_format(MetaWindow* window)
+{
+    cairo_format_t format = CAIRO_FORMAT_RGB24;
+    if (window->depth == 32)
+        format = CAIRO_FORMAT_ARGB32;
+
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+    XRenderPictFormat *render_fmt;
+    render_fmt = XRenderFindVisualFormat(window->display->xdisplay,
+            window->xvisual);
+
+    if (render_fmt && render_fmt->type == PictTypeDirect 
+            && render_fmt->direct.alphaMask)
+        format = CAIRO_FORMAT_ARGB32;
+
+#endif
+    return format;
+}
+
+static cairo_surface_t* copy_surface(cairo_surface_t* surface)
+{
+    cairo_surface_t* ret = cairo_image_surface_create(
+            cairo_image_surface_get_format(surface),
+            cairo_image_surface_get_width(surface),
+            cairo_image_surface_get_height(surface));
+
+    cairo_t* cr = cairo_create(ret);
+    cairo_set_source_surface(cr, surface, 0, 0);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    return ret;
+}
+
+/* the window contents on the server, (dx, dy) is where its origin is
+ * in ref coordinates */
+static cairo_surface_t* get_window_source(MetaWindow* window, int* dx, int* dy)
+{
+    cairo_surface_t* source;
+    if (window->display->compositor) {
+        source = meta_compositor_get_window_surface(window->display->compositor, window);
+    } else {
+        source = get_window_surface_from_xlib(window);
+    }
+    if (!source) return NULL;
+
+    MetaRectangle r, r2;
+    meta_window_get_input_rect(window, &r);
+    meta_window_get_outer_rect(window, &r2);
+
+    *dx = r.x - r2.x;
+    *dy = r.y - r2.y;
+    return source;
+}
+
+/* bring the dirty parts of ref up to date with the window, grabbing it
+ * first if it never was */
+static gboolean refresh_ref(MetaWindow* window, WindowSurfaces* ws)
+{
+    if (!ws->ref) {
+        cairo_rectangle_int_t r = {0, 0, ws->width, ws->height};
+
+        ws->ref = cairo_image_surface_create(ws->format, ws->width, ws->height);
+        cairo_region_destroy(ws->dirty);
+        ws->dirty = cairo_region_create_rectangle(&r);
+    }
+
+    if (cairo_region_is_empty(ws->dirty)) return TRUE;
+
+    int dx, dy;
+    cairo_surface_t* source = get_window_source(window, &dx, &dy);
+    if (!source) return FALSE;
+
+    /* somebody is scaling the old contents on a worker, leave them be */
+    if (ws->jobs > 0) {
+        cairo_surface_t* ref = copy_surface(ws->ref);
+        cairo_surface_destroy(ws->ref);
+        ws->ref = ref;
+        ws->jobs = 0;
+    }
+
+    cairo_rectangle_int_t extents;
+    cairo_region_get_extents(ws->dirty, &extents);
+
+    meta_error_trap_push (window->display);
+
+    /* cairo reads back the whole of an xlib source, so the dirty part is
+     * copied to a scratch pixmap on the server first and only that crosses
+     * the wire */
+    cairo_surface_t* part = source;
+    int part_x = dx, part_y = dy;
+    if (extents.width < ws->width || extents.height < ws->height) {
+        part = cairo_surface_create_similar(source,
+                cairo_surface_get_content(source),
+                extents.width, extents.height);
+
+        cairo_t* cr = cairo_create(part);
+        cairo_set_source_surface(cr, source, dx - extents.x, dy - extents.y);
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+
+        part_x = extents.x;
+        part_y = extents.y;
+    }
+
+    cairo_t* cr = cairo_create(ws->ref);
+    gdk_cairo_region(cr, ws->dirty);
+    cairo_clip(cr);
+    cairo_set_source_surface(cr, part, part_x, part_y);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+
+    if (part != source) cairo_surface_destroy(part);
+    cairo_surface_destroy(source);
+
+    int error_code = meta_error_trap_pop_with_return (window->display, FALSE);
+    if (error_code != 0) {
+        meta_warning ("draw surface error %d\n", error_code);
+        return FALSE;
+    }
+
+    cairo_region_destroy(ws->dirty);
+    ws->dirty = cairo_region_create();
+    return TRUE;
+}
+
+static cairo_surface_t* scale_surface(cairo_surface_t* ref, double scale)
+{
+    double width = cairo_image_surface_get_width(ref) * scale;
+    double height = cairo_image_surface_get_height(ref) * scale;
+    cairo_surface_t* surface = cairo_image_surface_create(
+            cairo_image_surface_get_format(ref), width, height);
+    cairo_t* cr = cairo_create(surface);
+    cairo_scale(cr, scale, scale);
+    cairo_set_source_surface(cr, ref, 0, 0);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    return surface;
+}
+
+/* scale the window on the X server into a new pixmap holding just area of
+ * the result, area is in scaled coordinates.  None if the server can't */
+static Pixmap scale_to_pixmap(MetaWindow* window, cairo_format_t format,
+        double scale, cairo_rectangle_int_t* area,
+        XRenderPictFormat** pixmap_format)
+{
+    MetaDisplay* display = window->display;
+    Display* xdisplay = display->xdisplay;
+
+    if (!META_DISPLAY_HAS_RENDER(display)) return None;
+
+    int dx, dy;
+    cairo_surface_t* source = get_window_source(window, &dx, &dy);
+    if (!source) return None;
+
+    if (cairo_surface_get_type(source) != CAIRO_SURFACE_TYPE_XLIB) {
+        cairo_surface_destroy(source);
+        return None;
+    }
+
+    Drawable drawable = cairo_xlib_surface_get_drawable(source);
+    XRenderPictFormat* src_format = XRenderFindVisualFormat(xdisplay,
+            cairo_xlib_surface_get_visual(source));
+    XRenderPictFormat* dst_format = XRenderFindStandardFormat(xdisplay,
+            format == CAIRO_FORMAT_ARGB32 ? PictStandardARGB32 : PictStandardRGB24);
+    if (!src_format || !dst_format) {
+        cairo_surface_destroy(source);
+        return None;
+    }
+
+    Pixmap pixmap = XCreatePixmap(xdisplay, drawable,
+            area->width, area->height, dst_format->depth);
+    Picture src = XRenderCreatePicture(xdisplay, drawable, src_format, 0, NULL);
+    Picture dst = XRenderCreatePicture(xdisplay, pixmap, dst_format, 0, NULL);
+
+    /* takes scaled coordinates back to the source */
+    XTransform transform = {{
+        { XDoubleToFixed(1.0 / scale), 0, XDoubleToFixed(-dx) },
+        { 0, XDoubleToFixed(1.0 / scale), XDoubleToFixed(-dy) },
+        { 0, 0, XDoubleToFixed(1.0) }
+    }};
+    XRenderSetPictureTransform(xdisplay, src, &transform);
+    XRenderSetPictureFilter(xdisplay, src, FilterGood, NULL, 0);
+    XRenderComposite(xdisplay, PictOpSrc, src, None, dst,
+            area->x, area->y, 0, 0, 0, 0, area->width, area->height);
+
+    XRenderFreePicture(xdisplay, src);
+    XRenderFreePicture(xdisplay, dst);
+    cairo_surface_destroy(source);
+
+    if (pixmap_format) *pixmap_format = dst_format;
+    return pixmap;
+}
+
+/* scale the window on the X server and read back just area of the result,
+ * area is in scaled coordinates.  NULL if the server can't do it */
+static cairo_surface_t* scale_on_server(MetaWindow* window,
+        cairo_format_t format, double scale, cairo_rectangle_int_t* area)
+{
+    MetaDisplay* display = window->display;
+    Display* xdisplay = display->xdisplay;
+    XRenderPictFormat* dst_format;
+
+    meta_error_trap_push (display);
+
+    Pixmap pixmap = scale_to_pixmap(window, format, scale, area, &dst_format);
+    if (pixmap == None) {
+        meta_error_trap_pop (display, FALSE);
+        return NULL;
+    }
+
+    cairo_surface_t* scaled = cairo_xlib_surface_create_with_xrender_format(
+            xdisplay, pixmap, window->screen->xscreen, dst_format,
+            area->width, area->height);
+    cairo_surface_t* image = cairo_image_surface_create(format,
+            area->width, area->height);
+
+    cairo_t* cr = cairo_create(image);
+    cairo_set_source_surface(cr, scaled, 0, 0);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+
+    cairo_surface_destroy(scaled);
+    XFreePixmap(xdisplay, pixmap);
+
+    int error_code = meta_error_trap_pop_with_return (display, FALSE);
+    if (error_code != 0) {
+        meta_warning ("%s: scale error %d\n", __func__, error_code);
+        cairo_surface_destroy(image);
+        return NULL;
+    }
+
+    return image;
+}
+
+/* bring the dirty parts of a cached scale up to date with the window */
+static gboolean refresh_scaled(MetaWindow* window, WindowSurfaces* ws,
+        double scale, ScaledSurface* ss)
+{
+    if (cairo_region_is_empty(ss->dirty)) return TRUE;
+
+    cairo_rectangle_int_t area;
+    cairo_region_t* scaled = deepin_surface_damage_scale(ss->dirty, scale,
+            cairo_image_surface_get_width(ss->surface),
+            cairo_image_surface_get_height(ss->surface), &area);
+
+    cairo_t* cr = cairo_create(ss->surface);
+    gdk_cairo_region(cr, scaled);
+    cairo_clip(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_region_destroy(scaled);
+
+    cairo_surface_t* part = NULL;
+    if (area.width > 0 && area.height > 0) {
+        part = scale_on_server(window, ws->format, scale, &area);
+    }
+
+    if (part) {
+        cairo_set_source_surface(cr, part, area.x, area.y);
+        cairo_paint(cr);
+        cairo_surface_destroy(part);
+    } else {
+        if (!refresh_ref(window, ws)) {
+            cairo_destroy(cr);
+            return FALSE;
+        }
+        cairo_scale(cr, scale, scale);
+        cairo_set_source_surface(cr, ws->ref, 0, 0);
+        cairo_paint(cr);
+    }
+    cairo_destroy(cr);
+
+    cairo_region_destroy(ss->dirty);
+    ss->dirty = cairo_region_create();
+    return TRUE;
+}
+
+static ScaledSurface* cache_scaled(WindowSurfaces* ws, double scale,
+        cairo_surface_t* surface)
+{
+    ScaledSurface* ss = g_slice_new(ScaledSurface);
+    ss->surface = surface ? cairo_surface_reference(surface) : NULL;
+    ss->dirty = cairo_region_create();
+    ss->fetch = NULL;
+
+    double* s = g_new(double, 1);
+    *s = scale;
+    g_tree_insert(ws->scaled, s, ss);
+    return ss;
+}
+
+/* look up the window, dropping what was cached for another size */
+static WindowSurfaces* get_window_surfaces(MetaWindow* window)
+{
+    DeepinWindowSurfaceManager* self = deepin_window_surface_manager_get();
+
+    MetaRectangle r;
+    meta_window_get_outer_rect(window, &r);
+
+    WindowSurfaces* ws = (WindowSurfaces*)g_hash_table_lookup(self->priv->windows, window);
+    if (ws && (ws->width != r.width || ws->height != r.height)) {
+        g_hash_table_remove(self->priv->windows, window);
+        ws = NULL;
+    }
+
+    if (!ws) {
+        ws = window_surfaces_new(get_window_format(window), r.width, r.height);
+        g_hash_table_insert(self->priv->windows, window, ws);
+    }
+
+    return ws;
+}
+
+/* a new scale of window, scaled on the server when possible */
+static cairo_surface_t* get_new_scaled(MetaWindow* window, WindowSurfaces* ws,
         double scale)
+{
+    cairo_rectangle_int_t area = {
+        0, 0, (int)(ws->width * scale), (int)(ws->height * scale)
+    };
+    if (area.width <= 0 || area.height <= 0) return NULL;
+
+    cairo_surface_t* surface = scale_on_server(window, ws->format, scale, &area);
+    if (!surface && refresh_ref(window, ws)) {
+        surface = scale_surface(ws->ref, scale);
+    }
+    return surface;
+}
+
+static cairo_surface_t* image_from_reply(xcb_get_image_reply_t* reply,
+        cairo_format_t format, int width, int height)
+{
+    int length = xcb_get_image_data_length(reply);
+    if (length < width * height * 4) return NULL;
+
+    /* both are 32bpp, rows may be padded differently */
+    int src_stride = length / height;
+    const uint8_t* src = xcb_get_image_data(reply);
+
+    cairo_surface_t* image = cairo_image_surface_create(format, width, height);
+    int stride = cairo_image_surface_get_stride(image);
+    uint8_t* dst = cairo_image_surface_get_data(image);
+
+    for (int y = 0; y < height; y++) {
+        memcpy(dst + y * stride, src + y * src_stride, width * 4);
+    }
+    cairo_surface_mark_dirty(image);
+    return image;
+}
+
+/* the scale fetch was started for, NULL if it was dropped meanwhile */
+static ScaledSurface* fetch_target(ServerFetch* fetch, WindowSurfaces** ws)
 {
     DeepinWindowSurfaceManager* self = deepin_window_surface_manager_get();
 
-    GTree* t = (GTree*)g_hash_table_lookup(self->priv->windows, window);
-    if (!t) {
-        t = g_tree_new_full(scale_compare, NULL, g_free, 
-                (GDestroyNotify)cairo_surface_destroy);
-        g_hash_table_insert(self->priv->windows, window, t);
+    *ws = (WindowSurfaces*)g_hash_table_lookup(self->priv->windows, fetch->window);
+    if (!*ws || (*ws)->id != fetch->ws_id) return NULL;
+
+    ScaledSurface* ss = (ScaledSurface*)g_tree_lookup((*ws)->scaled, &fetch->scale);
+    return ss && ss->fetch == fetch ? ss : NULL;
+}
+
+/* put the reply into its scale and hand the result to whoever waits */
+static void finish_fetch(ServerFetch* fetch)
+{
+    DeepinWindowSurfaceManager* self = deepin_window_surface_manager_get();
+    cairo_surface_t* image = NULL;
+    cairo_surface_t* surface = NULL;
+
+    if (fetch->reply) {
+        image = image_from_reply(fetch->reply, fetch->format,
+                fetch->area.width, fetch->area.height);
     }
 
-    double* s = g_new(double, 1);
-    *s = 1.0;
-    cairo_surface_t* ref = (cairo_surface_t*)g_tree_lookup(t, s);
-    if (!ref) {
-        if (window->display->compositor) {
-            ref = meta_compositor_get_window_surface(window->display->compositor, window);
+    WindowSurfaces* ws;
+    ScaledSurface* ss = fetch_target(fetch, &ws);
+    if (ss) {
+        ss->fetch = NULL;
+
+        if (image) {
+            if (!ss->surface) {
+                ss->surface = cairo_image_surface_create(fetch->format,
+                        fetch->width, fetch->height);
+                meta_verbose("%s: new scale %f\n", __func__, fetch->scale);
+            }
+
+            cairo_t* cr = cairo_create(ss->surface);
+            gdk_cairo_region(cr, fetch->clip);
+            cairo_clip(cr);
+            cairo_set_source_surface(cr, image, fetch->area.x, fetch->area.y);
+            cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+            cairo_paint(cr);
+            cairo_destroy(cr);
+
+            surface = cairo_surface_reference(ss->surface);
         } else {
-            ref = get_window_surface_from_xlib(window);
+            g_hash_table_remove(self->priv->windows, fetch->window);
         }
-        if (!ref) {
-            g_free(s);
-            return NULL;
+
+    } else if (image && fetch->area.width == fetch->width
+            && fetch->area.height == fetch->height) {
+        /* dropped, but what came in is the whole of it still */
+        surface = cairo_surface_reference(image);
+    }
+
+    if (image) cairo_surface_destroy(image);
+
+    GList* tasks = fetch->tasks;
+    free(fetch->reply);
+    cairo_region_destroy(fetch->clip);
+    g_slice_free(ServerFetch, fetch);
+
+    for (GList* l = tasks; l; l = l->next) {
+        GTask* task = G_TASK(l->data);
+        if (surface) {
+            g_task_return_pointer(task, cairo_surface_reference(surface),
+                    (GDestroyNotify)cairo_surface_destroy);
+        } else {
+            g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "can not get scaled surface");
         }
+        g_object_unref(task);
+    }
+    g_list_free(tasks);
 
-        MetaRectangle r, r2;
-        meta_window_get_input_rect(window, &r);
-        meta_window_get_outer_rect(window, &r2);
+    if (surface) cairo_surface_destroy(surface);
+}
 
-        cairo_format_t format = CAIRO_FORMAT_RGB24;
-        if (window->depth == 32)
-            format = CAIRO_FORMAT_ARGB32;
+/* the server answers in request order, so only the oldest needs polling */
+static gboolean fetches_ready(void)
+{
+    ServerFetch* fetch = (ServerFetch*)g_queue_peek_head(&_fetches);
+    if (!fetch) return FALSE;
 
-#ifdef HAVE_COMPOSITE_EXTENSIONS
-        XRenderPictFormat *render_fmt;
-        render_fmt = XRenderFindVisualFormat(window->display->xdisplay,
-                window->xvisual);
+    if (!fetch->done) {
+        void* reply = NULL;
+        xcb_generic_error_t* error = NULL;
 
-        if (render_fmt && render_fmt->type == PictTypeDirect 
-                && render_fmt->direct.alphaMask)
-            format = CAIRO_FORMAT_ARGB32;
+        if (xcb_poll_for_reply(fetch->conn, fetch->cookie.sequence,
+                    &reply, &error)) {
+            if (error) {
+                meta_verbose("%s: error %d\n", __func__, error->error_code);
+                free(error);
+            }
+            fetch->reply = (xcb_get_image_reply_t*)reply;
+            fetch->done = TRUE;
+        }
+    }
+    return fetch->done;
+}
 
-#endif
+static gboolean fetches_prepare(GSource* source, gint* timeout)
+{
+    *timeout = -1;
+    return fetches_ready();
+}
 
-        cairo_surface_t* ret = cairo_image_surface_create(format, 
-                r2.width, r2.height);
+static gboolean fetches_check(GSource* source)
+{
+    return fetches_ready();
+}
 
-        meta_error_trap_push (window->display);
+static gboolean fetches_dispatch(GSource* source, GSourceFunc callback,
+        gpointer data)
+{
+    while (fetches_ready()) {
+        finish_fetch((ServerFetch*)g_queue_pop_head(&_fetches));
+    }
+    return TRUE;
+}
 
-        cairo_t* cr = cairo_create(ret);
-        cairo_set_source_surface(cr, ref, r.x - r2.x, r.y - r2.y);
-        cairo_paint(cr);
-        cairo_destroy(cr);
-        cairo_surface_destroy(ref);
+static GSourceFuncs fetches_funcs = {
+    fetches_prepare,
+    fetches_check,
+    fetches_dispatch,
+    NULL
+};
 
-        int error_code = meta_error_trap_pop_with_return (window->display, FALSE);
-        if (error_code != 0) {
-            meta_warning ("draw surface error %d\n", error_code);
-            g_free(s);
-            cairo_surface_destroy(ret);
-            return NULL;
+static void wait_for_fetch(ServerFetch* fetch)
+{
+    if (!fetch->done) {
+        fetch->reply = xcb_get_image_reply(fetch->conn, fetch->cookie, NULL);
+        fetch->done = TRUE;
+    }
+    g_queue_remove(&_fetches, fetch);
+    finish_fetch(fetch);
+}
 
-        } else {
-            ref = ret;
-            meta_verbose("%s: clip visible rect\n", window->desc);
-            g_tree_insert(t, s, ref);
+/* have the server scale the dirty parts of ss and send them back, without
+ * waiting for them.  FALSE if the server can't scale */
+static gboolean start_fetch(MetaWindow* window, WindowSurfaces* ws,
+        double scale, ScaledSurface* ss, GTask* task)
+{
+    MetaDisplay* display = window->display;
+    xcb_connection_t* conn = XGetXCBConnection(display->xdisplay);
+
+    /* the pixels are copied as they come */
+    guint8 order = G_BYTE_ORDER == G_LITTLE_ENDIAN ?
+        XCB_IMAGE_ORDER_LSB_FIRST : XCB_IMAGE_ORDER_MSB_FIRST;
+    if (xcb_get_setup(conn)->image_byte_order != order) return FALSE;
+
+    int width = (int)(ws->width * scale), height = (int)(ws->height * scale);
+    cairo_rectangle_int_t area;
+    cairo_region_t* clip = deepin_surface_damage_scale(ss->dirty, scale,
+            width, height, &area);
+    if (area.width <= 0 || area.height <= 0) {
+        cairo_region_destroy(clip);
+        return FALSE;
+    }
+
+    meta_error_trap_push (display);
+
+    Pixmap pixmap = scale_to_pixmap(window, ws->format, scale, &area, NULL);
+    if (pixmap == None) {
+        meta_error_trap_pop (display, FALSE);
+        cairo_region_destroy(clip);
+        return FALSE;
+    }
+
+    ServerFetch* fetch = g_slice_new0(ServerFetch);
+    fetch->conn = conn;
+    fetch->window = window;
+    fetch->ws_id = ws->id;
+    fetch->scale = scale;
+    fetch->format = ws->format;
+    fetch->width = width;
+    fetch->height = height;
+    fetch->area = area;
+    fetch->clip = clip;
+    /* requests are handled in order, the pixmap can go right away */
+    fetch->cookie = xcb_get_image(conn, XCB_IMAGE_FORMAT_Z_PIXMAP, pixmap,
+            0, 0, area.width, area.height, ~0);
+    fetch->tasks = g_list_prepend(NULL, task);
+    XFreePixmap(display->xdisplay, pixmap);
+
+    meta_error_trap_pop (display, FALSE);
+    xcb_flush(conn);
+
+    /* damage coming in from now on is for the next fetch */
+    cairo_region_destroy(ss->dirty);
+    ss->dirty = cairo_region_create();
+    ss->fetch = fetch;
+
+    if (!_fetch_source) {
+        _fetch_source = g_source_new(&fetches_funcs, sizeof(GSource));
+        g_source_set_priority(_fetch_source, G_PRIORITY_DEFAULT);
+        g_source_attach(_fetch_source, NULL);
+    }
+    g_queue_push_tail(&_fetches, fetch);
+    return TRUE;
+}
+
+cairo_surface_t* deepin_window_surface_manager_get_surface(MetaWindow* window,
+        double scale)
+{
+    DeepinWindowSurfaceManager* self = deepin_window_surface_manager_get();
+    WindowSurfaces* ws = get_window_surfaces(window);
+
+    if (scale == 1.0) {
+        if (!refresh_ref(window, ws)) {
+            g_hash_table_remove(self->priv->windows, window);
+            return NULL;
         }
-    } else {
-        g_free(s);
+        return ws->ref;
+    }
+
+    ScaledSurface* ss = (ScaledSurface*)g_tree_lookup(ws->scaled, &scale);
+    if (ss && ss->fetch) {
+        /* or it would land on top of what is read here */
+        wait_for_fetch(ss->fetch);
+        ws = get_window_surfaces(window);
+        ss = (ScaledSurface*)g_tree_lookup(ws->scaled, &scale);
     }
 
-    if (scale == 1.0) return ref;
+    if (ss) {
+        if (!refresh_scaled(window, ws, scale, ss)) {
+            g_hash_table_remove(self->priv->windows, window);
+            return NULL;
+        }
+        return ss->surface;
+    }
 
-    cairo_surface_t* surface = (cairo_surface_t*)g_tree_lookup(t, &scale);
+    cairo_surface_t* surface = get_new_scaled(window, ws, scale);
     if (!surface) {
-        double width = cairo_image_surface_get_width(ref) * scale;
-        double height = cairo_image_surface_get_height(ref) * scale;
-        surface = cairo_image_surface_create(cairo_image_surface_get_format(ref),
-                width, height);
-        cairo_t* cr = cairo_create(surface);
-        cairo_scale(cr, scale, scale);
-        cairo_set_source_surface(cr, ref, 0, 0);
-        cairo_paint(cr);
-        cairo_destroy(cr);
-
-        s = g_new(double, 1);
-        *s = scale;
-        g_tree_insert(t, s, surface);
-        meta_verbose("%s: (%s) new scale %f\n", __func__, window->desc, scale);
+        g_hash_table_remove(self->priv->windows, window);
+        return NULL;
     }
-    
+    cache_scaled(ws, scale, surface);
+    cairo_surface_destroy(surface);
+    meta_verbose("%s: (%s) new scale %f\n", __func__, window->desc, scale);
+
     return surface;
 }
 
+static void scale_job_free(ScaleJob* job)
+{
+    cairo_surface_destroy(job->ref);
+    g_slice_free(ScaleJob, job);
+}
+
+static void scale_in_thread(GTask* task, gpointer source, gpointer data,
+        GCancellable* cancellable)
+{
+    ScaleJob* job = (ScaleJob*)data;
+
+    g_task_return_pointer(task, scale_surface(job->ref, job->scale),
+            (GDestroyNotify)cairo_surface_destroy);
+}
+
+static void on_scale_done(GObject* source, GAsyncResult* res, gpointer data)
+{
+    DeepinWindowSurfaceManager* self = DEEPIN_WINDOW_SURFACE_MANAGER(source);
+    GTask* task = G_TASK(data);
+    ScaleJob* job = (ScaleJob*)g_task_get_task_data(G_TASK(res));
+    cairo_surface_t* surface = g_task_propagate_pointer(G_TASK(res), NULL);
+
+    /* only cache it if the window wasn't damaged meanwhile */
+    WindowSurfaces* ws = (WindowSurfaces*)g_hash_table_lookup(self->priv->windows,
+            job->window);
+    if (ws && ws->ref == job->ref) {
+        ws->jobs--;
+        /* damage that came in while scaling is still in ws->dirty */
+        ScaledSurface* ss = cache_scaled(ws, job->scale, surface);
+        cairo_region_union(ss->dirty, ws->dirty);
+        meta_verbose("%s: (%s) new scale %f\n", __func__, job->window->desc,
+                job->scale);
+    }
+
+    g_task_return_pointer(task, surface, (GDestroyNotify)cairo_surface_destroy);
+    g_object_unref(task);
+}
+
+/**
+ * deepin_window_surface_manager_get_surface_async:
+ *
+ * Scales are made by the X server, only what was damaged since the last
+ * time is fetched, and the result is picked up from the main loop once
+ * the server sends it.  When the server can't scale, the window is grabbed
+ * here and scaled on a worker thread.
+ */
+void deepin_window_surface_manager_get_surface_async(MetaWindow* window,
+        double scale, GCancellable* cancellable,
+        GAsyncReadyCallback callback, gpointer user_data)
+{
+    DeepinWindowSurfaceManager* self = deepin_window_surface_manager_get();
+    GTask* task = g_task_new(self, cancellable, callback, user_data);
+
+    WindowSurfaces* ws = get_window_surfaces(window);
+    cairo_surface_t* surface = NULL;
+
+    if (scale == 1.0) {
+        if (refresh_ref(window, ws)) surface = cairo_surface_reference(ws->ref);
+
+    } else {
+        ScaledSurface* ss = (ScaledSurface*)g_tree_lookup(ws->scaled, &scale);
+        if (ss && ss->fetch) {
+            ss->fetch->tasks = g_list_append(ss->fetch->tasks, task);
+            return;
+
+        } else if (ss) {
+            if (cairo_region_is_empty(ss->dirty)) {
+                surface = cairo_surface_reference(ss->surface);
+            } else if (start_fetch(window, ws, scale, ss, task)) {
+                return;
+            } else if (refresh_scaled(window, ws, scale, ss)) {
+                surface = cairo_surface_reference(ss->surface);
+            }
+
+        } else {
+            cairo_rectangle_int_t r = {0, 0, ws->width, ws->height};
+
+            ss = cache_scaled(ws, scale, NULL);
+            cairo_region_union_rectangle(ss->dirty, &r);
+            if (start_fetch(window, ws, scale, ss, task)) return;
+            g_tree_remove(ws->scaled, &scale);
+
+            if (refresh_ref(window, ws)) {
+                ScaleJob* job = g_slice_new(ScaleJob);
+                job->window = window;
+                job->ref = cairo_surface_reference(ws->ref);
+                job->scale = scale;
+                ws->jobs++;
+
+                GTask* scale_task = g_task_new(self, NULL, on_scale_done, task);
+                g_task_set_task_data(scale_task, job, (GDestroyNotify)scale_job_free);
+                g_task_run_in_thread(scale_task, scale_in_thread);
+                g_object_unref(scale_task);
+                return;
+            }
+        }
+    }
+
+    if (!surface) {
+        g_hash_table_remove(self->priv->windows, window);
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                "can not get surface of %s", window->desc);
+        g_object_unref(task);
+        return;
+    }
+
+    g_task_return_pointer(task, surface, (GDestroyNotify)cairo_surface_destroy);
+    g_object_unref(task);
+}
+
+cairo_surface_t* deepin_window_surface_manager_get_surface_finish(
+        GAsyncResult* result, GError** error)
+{
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
+
 cairo_surface_t* deepin_window_surface_manager_get_combined_surface(
         MetaWindow* win1, MetaWindow* win2, int x, int y, double scale)
 {
@@ -255,6 +984,21 @@ cairo_surface_t* deepin_window_surface_manager_get_combined3(
     return ret;
 }
 
+/**
+ * deepin_window_surface_manager_get_serial:
+ *
+ * Changes every time the window is damaged, resized or dropped, so a
+ * holder of a surface can tell whether asking again would give anything
+ * new.  0 means nothing is cached for the window.
+ */
+guint deepin_window_surface_manager_get_serial(MetaWindow* window)
+{
+    DeepinWindowSurfaceManager* self = deepin_window_surface_manager_get();
+
+    WindowSurfaces* ws = (WindowSurfaces*)g_hash_table_lookup(self->priv->windows, window);
+    return ws ? ws->serial : 0;
+}
+
 void deepin_window_surface_manager_remove_window(MetaWindow* window)
 {
     if (!window) return;
@@ -278,7 +1022,6 @@ void deepin_window_surface_manager_flush()
         MetaWindow* win = (MetaWindow*)t->data;
         g_hash_table_remove(priv->windows, win);
         g_signal_emit(self, signals[SIGNAL_SURFACE_INVALID], 0, win);
-        deepin_window_surface_manager_get_surface((MetaWindow*)t->data, 1.0);
     }
     g_list_free(l);
 }
@@ -289,10 +1032,41 @@ static void on_window_removed(DeepinMessageHub* hub, MetaWindow* window,
     deepin_window_surface_manager_remove_window(window);
 }
 
+/* only what is cached needs to know which parts changed */
+static gboolean on_wants_window_damage(DeepinMessageHub* hub,
+        MetaWindow* window, gpointer data)
+{
+    DeepinWindowSurfaceManager* self = deepin_window_surface_manager_get();
+    return g_hash_table_contains(self->priv->windows, window);
+}
+
 static void on_window_damaged(DeepinMessageHub* hub, MetaWindow* window, 
-        gpointer data)
+        XRectangle* rects, int n, gpointer data)
 {
-    deepin_window_surface_manager_remove_window(window);
+    DeepinWindowSurfaceManager* self = deepin_window_surface_manager_get();
+
+    WindowSurfaces* ws = (WindowSurfaces*)g_hash_table_lookup(self->priv->windows, window);
+    if (!ws) return;
+
+    /* no rects means the whole window, e.g it got resized */
+    if (!rects || n == 0) {
+        deepin_window_surface_manager_remove_window(window);
+        return;
+    }
+
+    MetaRectangle r;
+    meta_window_get_outer_rect(window, &r);
+
+    cairo_region_t* damage = deepin_surface_damage_region(rects, n,
+            r.x, r.y, ws->width, ws->height);
+
+    /* the scales are fetched from the server on their own, not from ref */
+    cairo_region_union(ws->dirty, damage);
+    g_tree_foreach(ws->scaled, add_scaled_dirty, damage);
+    cairo_region_destroy(damage);
+    ws->serial = ++_last_serial;
+
+    g_signal_emit(self, signals[SIGNAL_SURFACE_INVALID], 0, window);
 }
 
 DeepinWindowSurfaceManager* deepin_window_surface_manager_get(void)
@@ -304,6 +1078,7 @@ DeepinWindowSurfaceManager* deepin_window_surface_manager_get(void)
         g_object_connect(G_OBJECT(deepin_message_hub_get()), 
                 "signal::window-removed", on_window_removed, NULL,
                 "signal::window-damaged", on_window_damaged, NULL,
+                "signal::wants-window-damage", on_wants_window_damage, NULL,
                 NULL);
     }
     return _the_manager;
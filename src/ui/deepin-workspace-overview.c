@@ -30,6 +30,8 @@
 #include "deepin-window-surface-manager.h"
 #include "deepin-background-cache.h"
 #include "deepin-message-hub.h"
+#include "deepin-window-placement.h"
+#include "deepin-clone-model.h"
 
 #define SET_STATE(w, state)  \
     gtk_style_context_set_state(gtk_widget_get_style_context(GTK_WIDGET(w)), (state))
@@ -81,6 +83,9 @@ struct _DeepinWorkspaceOverviewPrivate
     MetaDeepinClonedWidget* window_need_focused;
 
     int dock_height;
+
+    GCancellable* placing; /* pending placements, if any */
+    int pending_places; /* monitors still being laid out */
 };
 
 typedef struct _ClonedPrivateInfo
@@ -160,201 +165,60 @@ static void place_window(DeepinWorkspaceOverview* self,
     meta_deepin_cloned_widget_set_size(clone, req.width, req.height);
 }
 
-static const int GAPS = 10;
-static const int MAX_TRANSLATIONS = 100000;
-static const int ACCURACY = 20;
-
-//some math utilities
-static gboolean rect_is_overlapping_any(MetaRectangle rect, MetaRectangle* rects, gint n, MetaRectangle border)
-{
-    if (!meta_rectangle_contains_rect(&border, &rect))
-        return TRUE;
-
-    for (int i = 0; i < n; i++) {
-        if (meta_rectangle_equal(&rects[i], &rect))
-            continue;
-
-        if (meta_rectangle_overlap(&rects[i], &rect))
-            return TRUE;
-    }
-
-    return FALSE;
-}
-
-static MetaRectangle rect_adjusted(MetaRectangle rect, int dx1, int dy1, int dx2, int dy2)
+typedef struct _PlaceRequest
 {
-    return (MetaRectangle){rect.x + dx1, rect.y + dy1, rect.width + (-dx1 + dx2), rect.height + (-dy1 + dy2)};
-}
+    DeepinWorkspaceOverview* self;
+    MonitorData* md;
+    GPtrArray* clones; // clones being placed, in the order of the rects
+} PlaceRequest;
 
-static GdkPoint rect_center(MetaRectangle rect)
+static void place_request_free(PlaceRequest* req)
 {
-    return (GdkPoint){rect.x + rect.width / 2, rect.y + rect.height / 2};
+    g_object_unref(req->self);
+    g_ptr_array_unref(req->clones);
+    g_slice_free(PlaceRequest, req);
 }
 
-static int squared_distance (GdkPoint a, GdkPoint b)
-{
-    int k1 = b.x - a.x;
-    int k2 = b.y - a.y;
-
-    return k1*k1 + k2*k2;
-}
-
-typedef struct _TilableWindow
-{
-    MetaRectangle rect;
-    MetaDeepinClonedWidget* id;
-} TilableWindow;
-
-static void grid_placement ( DeepinWorkspaceOverview* self, 
-        MonitorData* md, MetaRectangle area, gboolean closest)
+static gboolean has_clone(GPtrArray* clones, MetaDeepinClonedWidget* clone)
 {
-    DeepinWorkspaceOverviewPrivate* priv = self->priv;
-    GPtrArray* clones = md->clones;
-    if (!clones || clones->len == 0) return;
-
-    int window_count = clones->len;
-    int columns = (int)ceil (sqrt (window_count));
-    int rows = (int)ceil (window_count / (double)columns);
-
-    // Assign slots
-    int slot_width = area.width / columns;
-    int slot_height = area.height / rows;
-
-    GList* windows = NULL;
+    if (!clones) return FALSE;
     for (int i = 0; i < clones->len; i++) {
-        MetaDeepinClonedWidget* clone = g_ptr_array_index(clones, i);
-
-        TilableWindow* tw = g_new0(TilableWindow, 1);
-        tw->id = clone;
-
-        MetaWindow* win = meta_deepin_cloned_widget_get_window(clone);
-        meta_window_get_input_rect(win, &tw->rect);
-
-        windows = g_list_append(windows, tw);
+        if (g_ptr_array_index(clones, i) == clone) return TRUE;
     }
+    return FALSE;
+}
 
-    TilableWindow* taken_slots[rows * columns];
-    memset(taken_slots, 0, sizeof taken_slots);
-
-    if (closest) {
-        // Assign each window to the closest available slot.
-
-        // precalculate all slot centers
-        GdkPoint slot_centers[rows * columns];
-        memset(slot_centers, 0, sizeof slot_centers);
-
-        for (int x = 0; x < columns; x++) {
-            for (int y = 0; y < rows; y++) {
-                slot_centers[x + y * columns] = (GdkPoint){
-                    area.x + slot_width  * x + slot_width  / 2,
-                    area.y + slot_height * y + slot_height / 2
-                };
-            }
-        }
-
-        GList* tmplist = g_list_copy(windows);
-        while (g_list_length(tmplist) > 0) {
-            GList* link = g_list_nth(tmplist, 0);
-            TilableWindow* window = (TilableWindow*)link->data;
-            MetaRectangle rect = window->rect;
-
-            int slot_candidate = -1;
-            int slot_candidate_distance = INT_MAX;
-            GdkPoint pos = rect_center (rect);
-
-            // all slots
-            for (int i = 0; i < columns * rows; i++) {
-                if (i > window_count - 1)
-                    break;
-
-                int dist = squared_distance (pos, slot_centers[i]);
-
-                if (dist < slot_candidate_distance) {
-                    // window is interested in this slot
-                    TilableWindow* occupier = taken_slots[i];
-                    if (occupier == window)
-                        continue;
-
-                    if (occupier == NULL || dist < squared_distance (rect_center (occupier->rect), slot_centers[i])) {
-                        // either nobody lives here, or we're better - takeover the slot if it's our best
-                        slot_candidate = i;
-                        slot_candidate_distance = dist;
-                    }
-                }
-            }
-
-            if (slot_candidate == -1)
-                continue;
-
-            if (taken_slots[slot_candidate] != NULL)
-                tmplist = g_list_prepend(tmplist, taken_slots[slot_candidate]);
-
-            tmplist = g_list_remove_link(tmplist, link);
-            taken_slots[slot_candidate] = window;
-            g_list_free(link);
-        }
-        g_list_free(tmplist);
-
-    } else {
-        // Assign each window as the origin order.
-        for (int i = 0; i < clones->len; i++) {
-            GList* link = g_list_nth (windows, i);
-            taken_slots[i] = (TilableWindow*)link->data;
-        }
+static void on_places_calculated(GObject* source, GAsyncResult* res,
+        gpointer data)
+{
+    PlaceRequest* req = (PlaceRequest*)data;
+    DeepinWorkspaceOverviewPrivate* priv = req->self->priv;
+    GError* error = NULL;
+
+    MetaRectangle* targets = deepin_window_placement_compute_finish(res, &error);
+    if (!targets) {
+        // cancelled, a newer request is on the way
+        g_error_free(error);
+        place_request_free(req);
+        return;
     }
 
-    // see how many windows we have on the last row
-    int left_over = (int)window_count - columns * (rows - 1);
-
-    for (int slot = 0; slot < columns * rows; slot++) {
-        TilableWindow* window = taken_slots[slot];
-        // some slots might be empty
-        if (window == NULL)
-            continue;
-
-        MetaRectangle rect = window->rect;
-
-        // Work out where the slot is
-        MetaRectangle target = {
-            area.x + (slot % columns) * slot_width,
-            area.y + (slot / columns) * slot_height,
-            slot_width, 
-            slot_height
-        };
-        target = rect_adjusted (target, 10, 10, -10, -10);
-
-        float scale;
-        if (target.width / (double)rect.width < target.height / (double)rect.height) {
-            // Center vertically
-            scale = target.width / (float)rect.width;
-            target.y += (target.height - (int)(rect.height * scale)) / 2;
-            target.height = (int)floorf (rect.height * scale);
-        } else {
-            // Center horizontally
-            scale = target.height / (float)rect.height;
-            target.x += (target.width - (int)(rect.width * scale)) / 2;
-            target.width = (int)floorf (rect.width * scale);
+    if (!priv->disposed) {
+        for (int i = 0; i < req->clones->len; i++) {
+            MetaDeepinClonedWidget* clone = g_ptr_array_index(req->clones, i);
+            if (has_clone(req->md->clones, clone))
+                place_window(req->self, clone, targets[i]);
         }
 
-        // Don't scale the windows too much
-        if (scale > 1.0) {
-            scale = 1.0f;
-            target = (MetaRectangle){
-                rect_center (target).x - (int)floorf (rect.width * scale) / 2,
-                rect_center (target).y - (int)floorf (rect.height * scale) / 2,
-                (int)floorf (scale * rect.width), 
-                (int)floorf (scale * rect.height)
-            };
+        // ready once every monitor is laid out
+        if (--priv->pending_places == 0) {
+            g_clear_object(&priv->placing);
+            priv->ready = TRUE;
         }
-
-        // put the last row in the center, if necessary
-        if (left_over != columns && slot >= columns * (rows - 1))
-            target.x += (columns - left_over) * slot_width / 2;
-
-        place_window(self, window->id, target);
     }
 
-    g_list_free_full(windows, g_free);
+    g_free(targets);
+    place_request_free(req);
 }
 
 static int padding_top  = 12;
@@ -365,6 +229,13 @@ static void calculate_places(DeepinWorkspaceOverview* self)
 {
     DeepinWorkspaceOverviewPrivate* priv = self->priv;
 
+    if (priv->placing) {
+        g_cancellable_cancel(priv->placing);
+        g_clear_object(&priv->placing);
+    }
+    priv->placing = g_cancellable_new();
+    priv->pending_places = 0;
+
     for (int i = 0; i < priv->monitors->len; i++) {
         MonitorData* md = (MonitorData*)g_ptr_array_index(priv->monitors, i);
 
@@ -378,10 +249,32 @@ static void calculate_places(DeepinWorkspaceOverview* self)
 
             md->place_rect = area;
 
-            grid_placement(self, md, area, FALSE);
+            PlaceRequest* req = g_slice_new0(PlaceRequest);
+            req->self = g_object_ref(self);
+            req->md = md;
+            req->clones = g_ptr_array_new_with_free_func(g_object_unref);
+
+            MetaRectangle* rects = g_new(MetaRectangle, md->clones->len);
+            for (int j = 0; j < md->clones->len; j++) {
+                MetaDeepinClonedWidget* clone = g_ptr_array_index(md->clones, j);
+                MetaWindow* win = meta_deepin_cloned_widget_get_window(clone);
+
+                meta_window_get_input_rect(win, &rects[j]);
+                g_ptr_array_add(req->clones, g_object_ref(clone));
+            }
+
+            priv->pending_places++;
+            deepin_window_placement_compute_async(DEEPIN_PLACEMENT_GRID,
+                    rects, md->clones->len, area, priv->placing,
+                    on_places_calculated, req);
+            g_free(rects);
         }
     }
-    priv->ready = TRUE;
+
+    if (priv->pending_places == 0) {
+        g_clear_object(&priv->placing);
+        priv->ready = TRUE;
+    }
 }
 
 static gboolean on_idle(DeepinWorkspaceOverview* self)
@@ -411,7 +304,7 @@ static void on_window_removed(DeepinMessageHub* hub, MetaWindow* window,
             MetaDeepinClonedWidget* clone = g_ptr_array_index(md->clones, i);
             if (meta_deepin_cloned_widget_get_window(clone) == window) {
                 g_ptr_array_remove(md->clones, clone);
-                gtk_container_remove(GTK_CONTAINER(self), (GtkWidget*)clone);
+                deepin_clone_model_release(clone, self);
 
                 meta_verbose("%s remove clone for %s\n", __func__, window->desc);
 
@@ -438,6 +331,31 @@ static void deepin_workspace_overview_init (DeepinWorkspaceOverview *self)
     gtk_widget_set_has_window(GTK_WIDGET(self), FALSE);
 }
 
+static void deepin_workspace_overview_dispose (GObject *object)
+{
+    DeepinWorkspaceOverview* self = DEEPIN_WORKSPACE_OVERVIEW(object);
+    DeepinWorkspaceOverviewPrivate* priv = self->priv;
+
+    if (priv->placing) {
+        g_cancellable_cancel(priv->placing);
+        g_clear_object(&priv->placing);
+    }
+
+    for (int i = 0; priv->monitors && i < priv->monitors->len; i++) {
+        MonitorData* md = g_ptr_array_index(priv->monitors, i);
+        if (!md->clones) continue;
+
+        for (int j = 0; j < md->clones->len; j++) {
+            deepin_clone_model_release(
+                    (MetaDeepinClonedWidget*)g_ptr_array_index(md->clones, j),
+                    self);
+        }
+        g_ptr_array_set_size(md->clones, 0);
+    }
+
+    G_OBJECT_CLASS (deepin_workspace_overview_parent_class)->dispose (object);
+}
+
 static void deepin_workspace_overview_finalize (GObject *object)
 {
     DeepinWorkspaceOverview* self = DEEPIN_WORKSPACE_OVERVIEW(object);
@@ -677,6 +595,7 @@ static void deepin_workspace_overview_class_init (DeepinWorkspaceOverviewClass *
     widget_class->map = deepin_workspace_overview_map;
     widget_class->unmap = deepin_workspace_overview_unmap;
 
+    object_class->dispose = deepin_workspace_overview_dispose;
     object_class->finalize = deepin_workspace_overview_finalize;
 }
 
@@ -787,7 +706,7 @@ static gboolean on_close_button_clicked(GtkWidget* widget,
             MetaDeepinClonedWidget* clone = g_ptr_array_index(md->clones, i);
             if (clone == priv->hovered_clone) {
                 g_ptr_array_remove(md->clones, clone);
-                gtk_container_remove(GTK_CONTAINER(self), clone);
+                deepin_clone_model_release(clone, self);
                 meta_window_delete(meta_window, CurrentTime);
 
                 priv->hovered_clone = NULL;
@@ -888,7 +807,7 @@ static MetaDeepinClonedWidget* _clone_window(DeepinWorkspaceOverview* self,
         MetaWindow* window)
 {
     DeepinWorkspaceOverviewPrivate* priv = self->priv;
-    GtkWidget* widget = meta_deepin_cloned_widget_new(window, TRUE);
+    GtkWidget* widget = (GtkWidget*)deepin_clone_model_acquire(window, TRUE);
     gtk_widget_set_sensitive(widget, TRUE);
 
     ClonedPrivateInfo* info = clone_get_info(widget);
@@ -900,7 +819,7 @@ static MetaDeepinClonedWidget* _clone_window(DeepinWorkspaceOverview* self,
 
     MetaRectangle r;
     meta_window_get_outer_rect(window, &r);
-    meta_deepin_cloned_widget_set_size(
+    meta_deepin_cloned_widget_set_initial_size(
             META_DEEPIN_CLONED_WIDGET(widget), r.width, r.height);
     meta_deepin_cloned_widget_set_render_frame(
             META_DEEPIN_CLONED_WIDGET(widget), TRUE);
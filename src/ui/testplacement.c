@@ -0,0 +1,430 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Window placement test and benchmark */
+
+/**
+ * Copyright (C) 2015 Deepin Technology Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ **/
+
+/*
+ * Lays out random sets of windows in every mode and checks the targets
+ * stay inside the area and, where the layout settled, don't overlap, and
+ * that the async version gives the same layouts, cached or not.
+ * With --benchmark it times the natural placement against the all pairs
+ * version the overview used to have, on growing numbers of windows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "deepin-window-placement.h"
+
+#define GAPS 10
+#define ACCURACY 20
+#define MAX_TRANSLATIONS 100000
+
+typedef struct { int x, y; } Point;
+
+static MetaRectangle rect_adjusted(MetaRectangle rect, int dx1, int dy1, int dx2, int dy2)
+{
+    return (MetaRectangle){rect.x + dx1, rect.y + dy1, rect.width + (-dx1 + dx2), rect.height + (-dy1 + dy2)};
+}
+
+static Point rect_center(MetaRectangle rect)
+{
+    return (Point){rect.x + rect.width / 2, rect.y + rect.height / 2};
+}
+
+/* The natural placement of deepin-shadow-workspace.c as it was, only
+ * taking rects instead of clones, as the reference.  Its enlarge phase
+ * compared each rect against itself and never grew anything, that is
+ * kept too.
+ */
+static gboolean ref_overlapping_any(MetaRectangle rect, MetaRectangle* rects, gint n, MetaRectangle border)
+{
+    if (!meta_rectangle_contains_rect(&border, &rect))
+        return TRUE;
+
+    for (int i = 0; i < n; i++) {
+        if (meta_rectangle_equal(&rects[i], &rect))
+            continue;
+
+        if (meta_rectangle_overlap(&rects[i], &rect))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void reference_natural_placement(const MetaRectangle* windows, int n,
+        MetaRectangle area, MetaRectangle* targets)
+{
+    MetaRectangle bounds = {area.x, area.y, area.width, area.height};
+    MetaRectangle* rects = g_new(MetaRectangle, n);
+
+    for (int i = 0; i < n; i++) {
+        rects[i] = rect_adjusted(windows[i], -GAPS, -GAPS, GAPS, GAPS);
+        meta_rectangle_union(&bounds, &rects[i], &bounds);
+    }
+
+    int loop_counter = 0;
+    gboolean overlap = FALSE;
+    do {
+        overlap = FALSE;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                if (i == j)
+                    continue;
+
+                MetaRectangle rect = rects[i];
+                MetaRectangle comp = rects[j];
+
+                if (!meta_rectangle_overlap(&rect, &comp))
+                    continue;
+
+                loop_counter ++;
+                overlap = TRUE;
+
+                Point i_center = rect_center (rect);
+                Point j_center = rect_center (comp);
+                Point diff = {j_center.x - i_center.x, j_center.y - i_center.y};
+
+                if (diff.x == 0 && diff.y == 0)
+                    diff.x = 1;
+
+                float length = sqrtf (diff.x * diff.x + diff.y * diff.y);
+                diff.x = (int)floorf (diff.x * ACCURACY / length);
+                diff.y = (int)floorf (diff.y * ACCURACY / length);
+                rect.x += -diff.x;
+                rect.y += -diff.y;
+                comp.x += diff.x;
+                comp.y += diff.y;
+
+                int x_section = (int)roundf ((rect.x - bounds.x) / (bounds.width / 3.0f));
+                int y_section = (int)roundf ((comp.y - bounds.y) / (bounds.height / 3.0f));
+
+                i_center = rect_center (rect);
+                diff.x = 0;
+                diff.y = 0;
+                if (x_section != 1 || y_section != 1) {
+                    if (x_section == 1)
+                        x_section = ((i % 4) / 2 == 1 ? 2 : 0);
+                    if (y_section == 1)
+                        y_section = ((i % 4) % 2 == 1 ? 2 : 0);
+                }
+                if (x_section == 0 && y_section == 0) {
+                    diff.x = bounds.x - i_center.x;
+                    diff.y = bounds.y - i_center.y;
+                }
+                if (x_section == 2 && y_section == 0) {
+                    diff.x = bounds.x + bounds.width - i_center.x;
+                    diff.y = bounds.y - i_center.y;
+                }
+                if (x_section == 2 && y_section == 2) {
+                    diff.x = bounds.x + bounds.width - i_center.x;
+                    diff.y = bounds.y + bounds.height - i_center.y;
+                }
+                if (x_section == 0 && y_section == 2) {
+                    diff.x = bounds.x - i_center.x;
+                    diff.y = bounds.y + bounds.height - i_center.y;
+                }
+                if (diff.x != 0 || diff.y != 0) {
+                    length = sqrtf (diff.x * diff.x + diff.y * diff.y);
+                    diff.x *= (int)floorf (ACCURACY / length / 2.0f);
+                    diff.y *= (int)floorf (ACCURACY / length / 2.0f);
+                    rect.x += diff.x;
+                    rect.y += diff.y;
+                }
+
+                meta_rectangle_union(&bounds, &rect, &bounds);
+                meta_rectangle_union(&bounds, &comp, &bounds);
+
+                rects[i] = rect;
+                rects[j] = comp;
+            }
+        }
+    } while (overlap && loop_counter < MAX_TRANSLATIONS);
+
+    float scale = fminf (fminf (area.width / (float)bounds.width,
+                area.height / (float)bounds.height), 1.0f);
+
+    bounds.x = (int)floorf (bounds.x - (area.width - bounds.width * scale) / 2);
+    bounds.y = (int)floorf (bounds.y - (area.height - bounds.height * scale) / 2);
+    bounds.width = (int)floorf (area.width / scale);
+    bounds.height = (int)floorf (area.height / scale);
+
+    for (int index = 0; index < n; index++) {
+        MetaRectangle rect = rects[index];
+        rects[index] = (MetaRectangle){
+            (int)floorf ((rect.x - bounds.x) * scale + area.x),
+                (int)floorf ((rect.y - bounds.y) * scale + area.y),
+                (int)floorf (rect.width * scale),
+                (int)floorf (rect.height * scale)
+        };
+    }
+
+    gboolean moved = FALSE;
+    MetaRectangle border = area;
+    do {
+        moved = FALSE;
+
+        for (int index = 0; index < n; index++) {
+            MetaRectangle rect = rects[index];
+
+            int width_diff = ACCURACY;
+            int height_diff = (int)floorf ((((rect.width + width_diff) - rect.height) /
+                        (float)rect.width) * rect.height);
+            int x_diff = width_diff / 2;
+            int y_diff = height_diff / 2;
+            Point offsets[] = {
+                { x_diff, -y_diff - height_diff },
+                { x_diff, y_diff },
+                { -x_diff, y_diff },
+                { -x_diff, -y_diff - height_diff },
+            };
+
+            for (guint k = 0; k < G_N_ELEMENTS(offsets); k++) {
+                MetaRectangle old = rect;
+                rect = (MetaRectangle){ rect.x + offsets[k].x, rect.y + offsets[k].y,
+                    rect.width + width_diff, rect.height + width_diff };
+                if (ref_overlapping_any (rect, rects, n, border))
+                    rect = old;
+                else moved = TRUE;
+            }
+
+            rects[index] = rect;
+        }
+    } while (moved);
+
+    for (int index = 0; index < n; index++) {
+        MetaRectangle rect = rects[index];
+        MetaRectangle window_rect = windows[index];
+
+        rect = rect_adjusted(rect, GAPS, GAPS, -GAPS, -GAPS);
+        scale = rect.width / (float)window_rect.width;
+
+        if (scale > 2.0 || (scale > 1.0 && (window_rect.width > 300 || window_rect.height > 300))) {
+            scale = (window_rect.width > 300 || window_rect.height > 300) ? 1.0f : 2.0f;
+            rect = (MetaRectangle){rect_center (rect).x - (int)floorf (window_rect.width * scale) / 2,
+                rect_center (rect).y - (int)floorf (window_rect.height * scale) / 2,
+                (int)floorf (window_rect.width * scale),
+                (int)floorf (window_rect.height * scale)};
+        }
+
+        targets[index] = rect;
+    }
+
+    g_free(rects);
+}
+
+/* n windows scattered over a 1920x1080 screen, the way they pile up
+ * on a busy workspace */
+static MetaRectangle* random_windows(int n)
+{
+    MetaRectangle* windows = g_new(MetaRectangle, n);
+
+    for (int i = 0; i < n; i++) {
+        windows[i].width = g_random_int_range(150, 1400);
+        windows[i].height = g_random_int_range(100, 900);
+        windows[i].x = g_random_int_range(0, 1920 - windows[i].width);
+        windows[i].y = g_random_int_range(0, 1080 - windows[i].height);
+    }
+    return windows;
+}
+
+static const char* mode_names[] = { "grid", "grid-closest", "natural" };
+
+static gboolean check(DeepinPlacementMode mode, int n)
+{
+    MetaRectangle area = { 12, 12, 1896, 1056 };
+    MetaRectangle* windows = random_windows(n);
+    MetaRectangle* targets = g_new0(MetaRectangle, n);
+    gboolean ok = TRUE;
+
+    deepin_window_placement_compute(mode, windows, n, area, targets);
+
+    for (int i = 0; i < n && ok; i++) {
+        if (targets[i].width <= 0 || targets[i].height <= 0 ||
+                !meta_rectangle_contains_rect(&area, &targets[i])) {
+            printf("%s, %d windows: window %d placed at %d,%d %dx%d\n",
+                    mode_names[mode], n, i, targets[i].x, targets[i].y,
+                    targets[i].width, targets[i].height);
+            ok = FALSE;
+        }
+
+        for (int j = i + 1; j < n && ok; j++) {
+            if (meta_rectangle_overlap(&targets[i], &targets[j])) {
+                printf("%s, %d windows: windows %d and %d overlap\n",
+                        mode_names[mode], n, i, j);
+                ok = FALSE;
+            }
+        }
+    }
+
+    g_free(windows);
+    g_free(targets);
+    return ok;
+}
+
+static void test_correctness(void)
+{
+    static const int counts[] = { 1, 2, 3, 5, 8, 13, 24, 40 };
+    int failed = 0;
+
+    for (int mode = DEEPIN_PLACEMENT_GRID; mode <= DEEPIN_PLACEMENT_NATURAL; mode++) {
+        for (guint i = 0; i < G_N_ELEMENTS(counts); i++) {
+            for (int run = 0; run < 10; run++) {
+                if (!check(mode, counts[i])) failed++;
+            }
+        }
+    }
+
+    if (failed) {
+        printf("%d placement tests failed\n", failed);
+        exit(1);
+    }
+}
+
+typedef struct
+{
+    GMainLoop* loop;
+    MetaRectangle* targets;
+} AsyncResult;
+
+static void on_placed(GObject* source, GAsyncResult* res, gpointer data)
+{
+    AsyncResult* result = (AsyncResult*)data;
+
+    result->targets = deepin_window_placement_compute_finish(res, NULL);
+    g_main_loop_quit(result->loop);
+}
+
+static MetaRectangle* place_async(const MetaRectangle* windows, int n,
+        MetaRectangle area)
+{
+    AsyncResult result = { g_main_loop_new(NULL, FALSE), NULL };
+
+    deepin_window_placement_compute_async(DEEPIN_PLACEMENT_NATURAL,
+            windows, n, area, NULL, on_placed, &result);
+    g_main_loop_run(result.loop);
+    g_main_loop_unref(result.loop);
+    return result.targets;
+}
+
+static void test_async(void)
+{
+    MetaRectangle area = { 12, 12, 1896, 1056 };
+    const int n = 30;
+    MetaRectangle* windows = random_windows(n);
+    MetaRectangle* expected = g_new0(MetaRectangle, n);
+    int failed = 0;
+
+    deepin_window_placement_compute(DEEPIN_PLACEMENT_NATURAL, windows, n,
+            area, expected);
+
+    /* computed, then from the cache, then computed again */
+    for (int run = 0; run < 3; run++) {
+        if (run == 2)
+            deepin_window_placement_invalidate();
+
+        MetaRectangle* targets = place_async(windows, n, area);
+        if (!targets || memcmp(targets, expected, sizeof(MetaRectangle) * n) != 0) {
+            printf("async placement, run %d: layout differs\n", run);
+            failed++;
+        }
+        g_free(targets);
+    }
+
+    /* moving one window must not hit the old layout */
+    windows[0].x += 100;
+    deepin_window_placement_compute(DEEPIN_PLACEMENT_NATURAL, windows, n,
+            area, expected);
+    MetaRectangle* targets = place_async(windows, n, area);
+    if (!targets || memcmp(targets, expected, sizeof(MetaRectangle) * n) != 0) {
+        printf("async placement after a move: layout differs\n");
+        failed++;
+    }
+    g_free(targets);
+
+    g_free(windows);
+    g_free(expected);
+
+    if (failed) {
+        printf("%d async placement tests failed\n", failed);
+        exit(1);
+    }
+}
+
+static double time_placement(void (*place)(const MetaRectangle*, int,
+            MetaRectangle, MetaRectangle*),
+        const MetaRectangle* windows, int n)
+{
+    const int runs = 3;
+    MetaRectangle area = { 12, 12, 1896, 1056 };
+    MetaRectangle* targets = g_new0(MetaRectangle, n);
+    double best = G_MAXDOUBLE;
+
+    for (int i = 0; i < runs; i++) {
+        gint64 start = g_get_monotonic_time();
+        place(windows, n, area, targets);
+        best = MIN(best, (g_get_monotonic_time() - start) / 1000.0);
+    }
+
+    g_free(targets);
+    return best;
+}
+
+static void place_natural(const MetaRectangle* windows, int n,
+        MetaRectangle area, MetaRectangle* targets)
+{
+    deepin_window_placement_compute(DEEPIN_PLACEMENT_NATURAL, windows, n,
+            area, targets);
+}
+
+static void place_grid_closest(const MetaRectangle* windows, int n,
+        MetaRectangle area, MetaRectangle* targets)
+{
+    deepin_window_placement_compute(DEEPIN_PLACEMENT_GRID_CLOSEST, windows, n,
+            area, targets);
+}
+
+static void run_benchmark(void)
+{
+    static const int counts[] = { 10, 50, 100, 200 };
+
+    printf("%-8s %12s %12s %12s\n", "windows", "original", "natural",
+            "grid-closest");
+
+    for (guint i = 0; i < G_N_ELEMENTS(counts); i++) {
+        MetaRectangle* windows = random_windows(counts[i]);
+
+        printf("%-8d %10.1fms %10.1fms %10.1fms\n", counts[i],
+                time_placement(reference_natural_placement, windows, counts[i]),
+                time_placement(place_natural, windows, counts[i]),
+                time_placement(place_grid_closest, windows, counts[i]));
+
+        g_free(windows);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+        run_benchmark();
+        return 0;
+    }
+
+    test_correctness();
+    test_async();
+
+    printf("All tests passed.\n");
+    return 0;
+}
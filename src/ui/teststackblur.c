@@ -0,0 +1,545 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* StackBlur correctness test and benchmark */
+
+/**
+ * Copyright (C) 2015 Deepin Technology Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ **/
+
+/*
+ * Checks stack_blur_surface() against the GSList based kernel it replaced,
+ * which must give the same bytes, and stack_blur_surface_scaled() against
+ * the full blur, which it must come close to.  With --benchmark it times
+ * all three over 1080p and 4K surfaces instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <cairo.h>
+#include <glib.h>
+#include "deepin-stackblur.h"
+
+/* The original kernel, kept as it was, as the reference.
+ *
+ * Copyright (c) 2010 Mario Klingemann, see deepin-stackblur.c for the
+ * license.
+ */
+
+static unsigned ref_mul_table[] = {
+512,512,456,512,328,456,335,512,405,328,271,456,388,335,292,512,
+454,405,364,328,298,271,496,456,420,388,360,335,312,292,273,512,
+482,454,428,405,383,364,345,328,312,298,284,271,259,496,475,456,
+437,420,404,388,374,360,347,335,323,312,302,292,282,273,265,512,
+497,482,468,454,441,428,417,405,394,383,373,364,354,345,337,328,
+320,312,305,298,291,284,278,271,265,259,507,496,485,475,465,456,
+446,437,428,420,412,404,396,388,381,374,367,360,354,347,341,335,
+329,323,318,312,307,302,297,292,287,282,278,273,269,265,261,512,
+505,497,489,482,475,468,461,454,447,441,435,428,422,417,411,405,
+399,394,389,383,378,373,368,364,359,354,350,345,341,337,332,328,
+324,320,316,312,309,305,301,298,294,291,287,284,281,278,274,271,
+268,265,262,259,257,507,501,496,491,485,480,475,470,465,460,456,
+451,446,442,437,433,428,424,420,416,412,408,404,400,396,392,388,
+385,381,377,374,370,367,363,360,357,354,350,347,344,341,338,335,
+332,329,326,323,320,318,315,312,310,307,304,302,299,297,294,292,
+289,287,285,282,280,278,275,273,271,269,267,265,263,261,259};
+
+
+static unsigned ref_shg_table[] = {
+9, 11, 12, 13, 13, 14, 14, 15, 15, 15, 15, 16, 16, 16, 16, 17,
+17, 17, 17, 17, 17, 17, 18, 18, 18, 18, 18, 18, 18, 18, 18, 19,
+19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 20, 20, 20,
+20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 21,
+21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,
+21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 22, 22, 22, 22, 22, 22,
+22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 23,
+23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+23, 23, 23, 23, 23, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24 };
+
+
+typedef struct BlurData_
+{
+    int r, g, b, a;
+} BlurData;
+
+static GSList* blur_stack_new(GSList* l)
+{
+    BlurData* d = g_slice_new0(BlurData);
+    return g_slist_append(l, d);
+}
+
+static void blur_stack_free(BlurData* d)
+{
+    g_slice_free(BlurData, d);
+}
+
+static void reference_stack_blur(cairo_surface_t* surface, int radius)
+{
+    if (radius < 1) return;
+
+    uint8_t * pixels = (uint8_t *)cairo_image_surface_get_data(surface);
+    unsigned width = cairo_image_surface_get_width(surface),
+        height = cairo_image_surface_get_height(surface);
+
+    int x, y, i, p, yp, yi, yw, r_sum, g_sum, b_sum, a_sum,
+            r_out_sum, g_out_sum, b_out_sum, a_out_sum,
+            r_in_sum, g_in_sum, b_in_sum, a_in_sum,
+            pr, pg, pb, pa, rbs;
+
+    int div = radius + radius + 1;
+    int widthMinus1  = width - 1;
+    int heightMinus1 = height - 1;
+    int radiusPlus1  = radius + 1;
+    int sumFactor = radiusPlus1 * ( radiusPlus1 + 1 ) / 2;
+
+    GSList* stackStart = blur_stack_new(NULL);
+    GSList* stack = stackStart, *stackEnd = NULL;
+    for ( i = 1; i < div; i++ ) {
+        stack = blur_stack_new(stack);
+        if ( i == radiusPlus1 ) stackEnd = g_slist_last(stack);
+    }
+    g_assert(stack == stackStart);
+    stack = g_slist_last(stackStart);
+    g_assert(stack->next == NULL);
+    stack->next = stackStart; /* NOTE: make a circle */
+    GSList* stackIn = NULL;
+    GSList* stackOut = NULL;
+
+    yw = yi = 0;
+
+    unsigned mul_sum = ref_mul_table[radius];
+    unsigned shg_sum = ref_shg_table[radius];
+
+    for ( y = 0; y < height; y++ ) {
+        r_in_sum = g_in_sum = b_in_sum = a_in_sum = r_sum = g_sum = b_sum = a_sum = 0;
+
+        r_out_sum = radiusPlus1 * ( pr = pixels[yi] );
+        g_out_sum = radiusPlus1 * ( pg = pixels[yi+1] );
+        b_out_sum = radiusPlus1 * ( pb = pixels[yi+2] );
+        a_out_sum = radiusPlus1 * ( pa = pixels[yi+3] );
+
+        r_sum += sumFactor * pr;
+        g_sum += sumFactor * pg;
+        b_sum += sumFactor * pb;
+        a_sum += sumFactor * pa;
+
+        stack = stackStart;
+
+        for( i = 0; i < radiusPlus1; i++ ) {
+            BlurData* d = (BlurData*)stack->data;
+            d->r = pr;
+            d->g = pg;
+            d->b = pb;
+            d->a = pa;
+            stack = stack->next;
+        }
+
+        for( i = 1; i < radiusPlus1; i++ ) {
+            p = yi + (( widthMinus1 < i ? widthMinus1 : i ) << 2 );
+            BlurData* d = (BlurData*)stack->data;
+            r_sum += ( d->r = ( pr = pixels[p])) * ( rbs = radiusPlus1 - i );
+            g_sum += ( d->g = ( pg = pixels[p+1])) * rbs;
+            b_sum += ( d->b = ( pb = pixels[p+2])) * rbs;
+            a_sum += ( d->a = ( pa = pixels[p+3])) * rbs;
+
+            r_in_sum += pr;
+            g_in_sum += pg;
+            b_in_sum += pb;
+            a_in_sum += pa;
+
+            stack = stack->next;
+        }
+
+
+        stackIn = stackStart;
+        stackOut = stackEnd;
+        for ( x = 0; x < width; x++ ) {
+            pixels[yi]   = (r_sum * mul_sum) >> shg_sum;
+            pixels[yi+1] = (g_sum * mul_sum) >> shg_sum;
+            pixels[yi+2] = (b_sum * mul_sum) >> shg_sum;
+            /*pixels[yi+3] = (a_sum * mul_sum) >> shg_sum;*/
+
+            r_sum -= r_out_sum;
+            g_sum -= g_out_sum;
+            b_sum -= b_out_sum;
+            a_sum -= a_out_sum;
+
+            BlurData* d = (BlurData*)stackIn->data;
+            r_out_sum -= d->r;
+            g_out_sum -= d->g;
+            b_out_sum -= d->b;
+            a_out_sum -= d->a;
+
+            p =  ( yw + ( ( p = x + radius + 1 ) < widthMinus1 ? p : widthMinus1 ) ) << 2;
+
+            r_in_sum += ( d->r = pixels[p]);
+            g_in_sum += ( d->g = pixels[p+1]);
+            b_in_sum += ( d->b = pixels[p+2]);
+            a_in_sum += ( d->a = pixels[p+3]);
+
+            r_sum += r_in_sum;
+            g_sum += g_in_sum;
+            b_sum += b_in_sum;
+            a_sum += a_in_sum;
+
+            stackIn = stackIn->next;
+
+            d = (BlurData*)stackOut->data;
+            r_out_sum += ( pr = d->r );
+            g_out_sum += ( pg = d->g );
+            b_out_sum += ( pb = d->b );
+            a_out_sum += ( pa = d->a );
+
+            r_in_sum -= pr;
+            g_in_sum -= pg;
+            b_in_sum -= pb;
+            a_in_sum -= pa;
+
+            stackOut = stackOut->next;
+
+            yi += 4;
+        }
+        yw += width;
+    }
+
+
+    for ( x = 0; x < width; x++ )
+    {
+        g_in_sum = b_in_sum = a_in_sum = r_in_sum = g_sum = b_sum = a_sum = r_sum = 0;
+
+        yi = x << 2;
+        r_out_sum = radiusPlus1 * ( pr = pixels[yi]);
+        g_out_sum = radiusPlus1 * ( pg = pixels[yi+1]);
+        b_out_sum = radiusPlus1 * ( pb = pixels[yi+2]);
+        a_out_sum = radiusPlus1 * ( pa = pixels[yi+3]);
+
+        r_sum += sumFactor * pr;
+        g_sum += sumFactor * pg;
+        b_sum += sumFactor * pb;
+        a_sum += sumFactor * pa;
+
+        stack = stackStart;
+
+        for( i = 0; i < radiusPlus1; i++ ) {
+            BlurData* d = (BlurData*)stack->data;
+            d->r = pr;
+            d->g = pg;
+            d->b = pb;
+            d->a = pa;
+            stack = stack->next;
+        }
+
+        yp = width;
+
+        for( i = 1; i <= radius; i++ ) {
+            yi = ( yp + x ) << 2;
+
+            BlurData* d = (BlurData*)stack->data;
+            r_sum += ( d->r = ( pr = pixels[yi])) * ( rbs = radiusPlus1 - i );
+            g_sum += ( d->g = ( pg = pixels[yi+1])) * rbs;
+            b_sum += ( d->b = ( pb = pixels[yi+2])) * rbs;
+            a_sum += ( d->a = ( pa = pixels[yi+3])) * rbs;
+
+            r_in_sum += pr;
+            g_in_sum += pg;
+            b_in_sum += pb;
+            a_in_sum += pa;
+
+            stack = stack->next;
+
+            if( i < heightMinus1 ) {
+                yp += width;
+            }
+        }
+
+        yi = x;
+        stackIn = stackStart;
+        stackOut = stackEnd;
+        for ( y = 0; y < height; y++ ) {
+            p = yi << 2;
+            /*pixels[p+3] = pa = (a_sum * mul_sum) >> shg_sum;*/
+            if ( pa > 0 ) {
+                pa = 255 / pa;
+                pixels[p]   = ((r_sum * mul_sum) >> shg_sum ) * pa;
+                pixels[p+1] = ((g_sum * mul_sum) >> shg_sum ) * pa;
+                pixels[p+2] = ((b_sum * mul_sum) >> shg_sum ) * pa;
+            } else {
+                /*pixels[p] = pixels[p+1] = pixels[p+2] = 0;*/
+                /*pixels[p+3] = 0;*/
+            }
+
+            r_sum -= r_out_sum;
+            g_sum -= g_out_sum;
+            b_sum -= b_out_sum;
+            a_sum -= a_out_sum;
+
+            BlurData* d = (BlurData*)stackIn->data;
+            r_out_sum -= d->r;
+            g_out_sum -= d->g;
+            b_out_sum -= d->b;
+            a_out_sum -= d->a;
+
+            p = ( x + (( ( p = y + radiusPlus1) < heightMinus1 ? p : heightMinus1 ) * width )) << 2;
+
+            r_sum += ( r_in_sum += ( d->r = pixels[p]));
+            g_sum += ( g_in_sum += ( d->g = pixels[p+1]));
+            b_sum += ( b_in_sum += ( d->b = pixels[p+2]));
+            a_sum += ( a_in_sum += ( d->a = pixels[p+3]));
+
+            stackIn = stackIn->next;
+
+            d = (BlurData*)stackOut->data;
+            r_out_sum += ( pr = d->r );
+            g_out_sum += ( pg = d->g );
+            b_out_sum += ( pb = d->b );
+            a_out_sum += ( pa = d->a );
+
+            r_in_sum -= pr;
+            g_in_sum -= pg;
+            b_in_sum -= pb;
+            a_in_sum -= pa;
+
+            stackOut = stackOut->next;
+
+            yi += width;
+        }
+    }
+
+    /* free stack */
+    GSList* ls = stackEnd;
+    while (ls->next != stackStart) {
+        ls = ls->next;
+    }
+    ls->next = NULL;
+    g_slist_free_full(stackStart, (GDestroyNotify)blur_stack_free);
+}
+
+static cairo_surface_t* random_surface(int width, int height, gboolean opaque)
+{
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+            width, height);
+    uint8_t* data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width * 4; x++) {
+            /* keep some pixels fully transparent, they take another path */
+            if (x % 4 == 3) {
+                int v = opaque ? 255 : g_random_int_range(-64, 256);
+                data[y * stride + x] = v < 0 ? 0 : v;
+            } else
+                data[y * stride + x] = g_random_int_range(0, 256);
+        }
+    }
+    cairo_surface_mark_dirty(surface);
+    return surface;
+}
+
+static cairo_surface_t* copy_surface(cairo_surface_t* surface)
+{
+    int height = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    cairo_surface_t* copy = cairo_image_surface_create(
+            cairo_image_surface_get_format(surface),
+            cairo_image_surface_get_width(surface), height);
+
+    cairo_surface_flush(surface);
+    memcpy(cairo_image_surface_get_data(copy),
+            cairo_image_surface_get_data(surface), stride * height);
+    cairo_surface_mark_dirty(copy);
+    return copy;
+}
+
+static gboolean check(int width, int height, int radius, gboolean opaque)
+{
+    cairo_surface_t* expected = random_surface(width, height, opaque);
+    cairo_surface_t* actual = copy_surface(expected);
+    int stride = cairo_image_surface_get_stride(expected);
+    gboolean ok;
+
+    reference_stack_blur(expected, radius);
+    stack_blur_surface(actual, radius);
+
+    ok = memcmp(cairo_image_surface_get_data(expected),
+            cairo_image_surface_get_data(actual), stride * height) == 0;
+    if (!ok)
+        printf("%dx%d radius %d %s: output differs\n", width, height, radius,
+                opaque ? "opaque" : "translucent");
+
+    cairo_surface_destroy(expected);
+    cairo_surface_destroy(actual);
+    return ok;
+}
+
+static void test_correctness(void)
+{
+    /* the original reads past the end of single row surfaces */
+    static const int sizes[][2] = {
+        {1, 2}, {2, 2}, {3, 7}, {17, 5}, {64, 64}, {100, 37},
+        {300, 200}, {513, 300}, {640, 480},
+    };
+    static const int radii[] = { 1, 2, 3, 5, 8, 15, 30, 64, 120, 200, 254 };
+    int failed = 0;
+
+    for (guint i = 0; i < G_N_ELEMENTS(sizes); i++) {
+        for (guint j = 0; j < G_N_ELEMENTS(radii); j++) {
+            if (!check(sizes[i][0], sizes[i][1], radii[j], TRUE)) failed++;
+            if (!check(sizes[i][0], sizes[i][1], radii[j], FALSE)) failed++;
+        }
+    }
+
+    if (failed) {
+        printf("%d stack blur tests failed\n", failed);
+        exit(1);
+    }
+}
+
+/* mean difference per byte allowed between the downscaled and full blur */
+#define MAX_SCALED_ERROR 3.0
+
+/* rectangles of random colours, which unlike noise still show through
+ * a large blur */
+static cairo_surface_t* shapes_surface(int width, int height)
+{
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+            width, height);
+    cairo_t* cr = cairo_create(surface);
+
+    cairo_set_source_rgb(cr, g_random_double(), g_random_double(),
+            g_random_double());
+    cairo_paint(cr);
+
+    for (int i = 0; i < 12; i++) {
+        cairo_set_source_rgb(cr, g_random_double(), g_random_double(),
+                g_random_double());
+        cairo_rectangle(cr, g_random_int_range(0, width),
+                g_random_int_range(0, height),
+                g_random_int_range(1, width / 2 + 2),
+                g_random_int_range(1, height / 2 + 2));
+        cairo_fill(cr);
+    }
+
+    cairo_destroy(cr);
+    return surface;
+}
+
+static gboolean check_scaled(int width, int height, int radius, double scale)
+{
+    cairo_surface_t* expected = shapes_surface(width, height);
+    cairo_surface_t* actual = stack_blur_surface_scaled(expected, radius, scale);
+    int stride = cairo_image_surface_get_stride(expected);
+    uint8_t* e;
+    uint8_t* a;
+    double total = 0;
+    gboolean ok;
+
+    stack_blur_surface(expected, radius);
+    cairo_surface_flush(actual);
+    e = cairo_image_surface_get_data(expected);
+    a = cairo_image_surface_get_data(actual);
+
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width * 4; x++)
+            total += abs(e[y * stride + x] - a[y * stride + x]);
+
+    total /= width * height * 4;
+    ok = total <= MAX_SCALED_ERROR;
+    if (!ok)
+        printf("%dx%d radius %d scale %.2f: downscaled blur off by %.2f\n",
+                width, height, radius, scale, total);
+
+    cairo_surface_destroy(expected);
+    cairo_surface_destroy(actual);
+    return ok;
+}
+
+static void test_scaled(void)
+{
+    static const int sizes[][2] = { {64, 64}, {300, 200}, {513, 300} };
+    static const int radii[] = { 8, 15, 30, 64, 120 };
+    static const double scales[] = { 0.25, 1.0, 2.0 };
+    int failed = 0;
+
+    for (guint i = 0; i < G_N_ELEMENTS(sizes); i++)
+        for (guint j = 0; j < G_N_ELEMENTS(radii); j++)
+            for (guint k = 0; k < G_N_ELEMENTS(scales); k++)
+                if (!check_scaled(sizes[i][0], sizes[i][1], radii[j], scales[k]))
+                    failed++;
+
+    if (failed) {
+        printf("%d downscaled blur tests failed\n", failed);
+        exit(1);
+    }
+}
+
+static double time_blur(void (*blur)(cairo_surface_t*, int),
+        cairo_surface_t* surface, int radius)
+{
+    const int runs = 5;
+    double best = G_MAXDOUBLE;
+
+    for (int i = 0; i < runs; i++) {
+        cairo_surface_t* copy = copy_surface(surface);
+        gint64 start = g_get_monotonic_time();
+        blur(copy, radius);
+        best = MIN(best, (g_get_monotonic_time() - start) / 1000.0);
+        cairo_surface_destroy(copy);
+    }
+    return best;
+}
+
+static void blur_scaled(cairo_surface_t* surface, int radius)
+{
+    cairo_surface_destroy(stack_blur_surface_scaled(surface, radius, 1.0));
+}
+
+static void run_benchmark(void)
+{
+    static const int sizes[][2] = { {1920, 1080}, {3840, 2160} };
+    static const int radii[] = { 5, 20, 60, 150 };
+
+    printf("%-10s %6s %12s %12s %12s\n", "size", "radius", "original",
+            "current", "downscaled");
+
+    for (guint i = 0; i < G_N_ELEMENTS(sizes); i++) {
+        cairo_surface_t* surface = random_surface(sizes[i][0], sizes[i][1], TRUE);
+
+        for (guint j = 0; j < G_N_ELEMENTS(radii); j++) {
+            char size[32];
+            g_snprintf(size, sizeof size, "%dx%d", sizes[i][0], sizes[i][1]);
+            printf("%-10s %6d %10.1fms %10.1fms %10.1fms\n", size, radii[j],
+                    time_blur(reference_stack_blur, surface, radii[j]),
+                    time_blur(stack_blur_surface, surface, radii[j]),
+                    time_blur(blur_scaled, surface, radii[j]));
+        }
+
+        cairo_surface_destroy(surface);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+        run_benchmark();
+        return 0;
+    }
+
+    test_correctness();
+    test_scaled();
+
+    printf("All tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,141 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Window surface damage test */
+
+/**
+ * Copyright (C) 2015 Deepin Technology Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ **/
+
+/*
+ * Checks that damage to part of a window only makes that part of its
+ * cached copies stale: the region fetched again for a scaled copy covers
+ * every scaled pixel the damage touches and little more.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <glib.h>
+#include "deepin-surface-damage.h"
+
+#define WIN_X 50
+#define WIN_Y 50
+#define WIN_WIDTH 1000
+#define WIN_HEIGHT 800
+
+static int region_area(cairo_region_t* region)
+{
+    int area = 0;
+    int n = cairo_region_num_rectangles(region);
+    for (int i = 0; i < n; i++) {
+        cairo_rectangle_int_t r;
+        cairo_region_get_rectangle(region, i, &r);
+        area += r.width * r.height;
+    }
+    return area;
+}
+
+static void test_partial(void)
+{
+    XRectangle rect = { WIN_X + 100, WIN_Y + 200, 20, 10 };
+    cairo_region_t* dirty = deepin_surface_damage_region(&rect, 1,
+            WIN_X, WIN_Y, WIN_WIDTH, WIN_HEIGHT);
+
+    cairo_rectangle_int_t expected = { 100, 200, 20, 10 };
+    cairo_rectangle_int_t extents;
+    cairo_region_get_extents(dirty, &extents);
+    g_assert(extents.x == expected.x && extents.y == expected.y &&
+            extents.width == expected.width && extents.height == expected.height);
+
+    double scale = 0.25;
+    cairo_rectangle_int_t area;
+    cairo_region_t* scaled = deepin_surface_damage_scale(dirty, scale,
+            WIN_WIDTH * scale, WIN_HEIGHT * scale, &area);
+
+    /* 100..120 x 200..210 scaled is 25..30 x 50..52.5 */
+    g_assert(area.x == 25 && area.y == 50);
+    g_assert(area.width == 5 && area.height == 3);
+    g_assert(region_area(scaled) == 15);
+
+    cairo_region_destroy(scaled);
+    cairo_region_destroy(dirty);
+}
+
+static void test_clipped(void)
+{
+    XRectangle rects[] = {
+        { WIN_X - 30, WIN_Y - 30, 40, 40 },
+        { WIN_X + WIN_WIDTH - 5, WIN_Y + 10, 100, 10 },
+        { 0, WIN_Y + WIN_HEIGHT + 10, 3000, 20 },
+    };
+    cairo_region_t* dirty = deepin_surface_damage_region(rects,
+            G_N_ELEMENTS(rects), WIN_X, WIN_Y, WIN_WIDTH, WIN_HEIGHT);
+
+    g_assert(region_area(dirty) == 10 * 10 + 5 * 10);
+
+    cairo_rectangle_int_t area;
+    cairo_region_t* scaled = deepin_surface_damage_scale(dirty, 0.3,
+            WIN_WIDTH * 0.3, WIN_HEIGHT * 0.3, &area);
+    g_assert(area.x >= 0 && area.y >= 0);
+    g_assert(area.x + area.width <= (int)(WIN_WIDTH * 0.3));
+    g_assert(area.y + area.height <= (int)(WIN_HEIGHT * 0.3));
+
+    cairo_region_destroy(scaled);
+    cairo_region_destroy(dirty);
+}
+
+/* every scaled pixel that samples a damaged pixel is fetched again, and
+ * the fetch stays far from the whole window for small damage */
+static void test_random(void)
+{
+    for (int iter = 0; iter < 200; iter++) {
+        int n = g_random_int_range(1, 4);
+        XRectangle rects[4];
+        for (int i = 0; i < n; i++) {
+            rects[i].x = WIN_X + g_random_int_range(0, WIN_WIDTH - 40);
+            rects[i].y = WIN_Y + g_random_int_range(0, WIN_HEIGHT - 40);
+            rects[i].width = g_random_int_range(1, 40);
+            rects[i].height = g_random_int_range(1, 40);
+        }
+
+        double scale = g_random_double_range(0.1, 1.0);
+        int width = WIN_WIDTH * scale, height = WIN_HEIGHT * scale;
+
+        cairo_region_t* dirty = deepin_surface_damage_region(rects, n,
+                WIN_X, WIN_Y, WIN_WIDTH, WIN_HEIGHT);
+        cairo_rectangle_int_t area;
+        cairo_region_t* scaled = deepin_surface_damage_scale(dirty, scale,
+                width, height, &area);
+
+        for (int i = 0; i < n; i++) {
+            int x0 = rects[i].x - WIN_X, y0 = rects[i].y - WIN_Y;
+            for (int y = y0; y < y0 + rects[i].height; y++) {
+                for (int x = x0; x < x0 + rects[i].width; x++) {
+                    int sx = floor(x * scale), sy = floor(y * scale);
+                    if (sx >= width || sy >= height) continue;
+                    g_assert(cairo_region_contains_point(scaled, sx, sy));
+                }
+            }
+        }
+
+        g_assert(region_area(scaled) < width * height / 4);
+
+        cairo_region_destroy(scaled);
+        cairo_region_destroy(dirty);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    test_partial();
+    test_clipped();
+    test_random();
+
+    printf("All tests passed.\n");
+    return 0;
+}